@@ -18,6 +18,7 @@
 #include "common.h"
 
 #include <stdlib.h>
+#include <stdarg.h>
 #include <string.h>
 #include <ctype.h>
 #include <errno.h>
@@ -70,15 +71,98 @@ static unsigned int zrqinit_buffer_n;
 static char kermit_autostart_buffer[32];
 static unsigned int kermit_autostart_buffer_n;
 
-/* Quicklearn buffer */
-static wchar_t quicklearn_buffer[32];
+/*
+ * Quicklearn: the remote text since the last waitfor() is kept in
+ * quicklearn_buffer, and indexed as it arrives by a suffix automaton.  The
+ * suffixes of the whole text that occur nowhere else in it are exactly
+ * those longer than the suffix link of the last state, so the shortest
+ * waitfor() string that cannot match early is known without scanning.
+ */
+
+/* How much remote text a waitfor() is chosen from */
+#define QUICKLEARN_WINDOW       4096
+
+/* Prefer at least this much of the prompt line in a waitfor() */
+#define QUICKLEARN_WAITFOR_MIN  8
+
+/* The longest waitfor() string */
+#define QUICKLEARN_WAITFOR_MAX  80
+
+/* The longest sendkeys() string */
+#define QUICKLEARN_SEND_MAX     256
+
+/* stdio buffer size for the quicklearn script file */
+#define QUICKLEARN_FILE_BUFFER_SIZE     16384
+
+/**
+ * One state of the quicklearn suffix automaton.
+ */
+struct quicklearn_state {
+    /* The longest string reaching this state */
+    int length;
+
+    /* The suffix link */
+    int link;
+
+    /* The first outgoing edge, or -1 */
+    int edges;
+};
+
+/**
+ * One transition of the quicklearn suffix automaton.
+ */
+struct quicklearn_edge {
+    wchar_t ch;
+    int target;
+
+    /* The next edge out of the same state, or -1 */
+    int next;
+};
+
+/* Quicklearn buffers */
+static wchar_t * quicklearn_buffer = NULL;
 static int quicklearn_buffer_n;
-static unsigned char quicklearn_send_buffer[32];
+static int quicklearn_line_n;
+static unsigned char quicklearn_send_buffer[QUICKLEARN_SEND_MAX];
 static int quicklearn_send_buffer_n;
 
+/* The suffix automaton over quicklearn_buffer */
+static struct quicklearn_state * quicklearn_states = NULL;
+static int quicklearn_states_n;
+static struct quicklearn_edge * quicklearn_edges = NULL;
+static int quicklearn_edges_n;
+static int quicklearn_last;
+
 /* The file to save the quicklearn script to */
 static FILE * quicklearn_file = NULL;
 
+/* Flush the capture file after this many unflushed bytes */
+#define CAPTURE_FLUSH_BYTES     65536
+
+/* stdio buffer size for the capture and session log files */
+#define CAPTURE_BUFFER_SIZE     65536
+
+/* The full path to the capture file, without segment number or suffix */
+static char * capture_filename = NULL;
+
+/* The current capture segment, 0 for the first file */
+static int capture_segment = 0;
+
+/* When true, capture_file is a pipe to gzip or zstd */
+static Q_BOOL capture_pipe = Q_FALSE;
+
+/* Bytes written to the current capture segment */
+static unsigned long capture_bytes = 0;
+
+/* Bytes written to the capture file since the last fflush() */
+static unsigned long capture_unflushed = 0;
+
+/* Start a new capture segment after this many bytes, 0 means never */
+static unsigned long capture_rotate_size = 0;
+
+/* When true, the session log has been written since the last fflush() */
+static Q_BOOL logging_unflushed = Q_FALSE;
+
 /**
  * A flag to indicate a data flood on the console.  We need to not permit
  * download protocol autostarts during a flood.
@@ -118,15 +202,277 @@ void setup_doorway_handling() {
     Xfree(option, __FILE__, __LINE__);
 }
 
+/**
+ * Write the capture file header for a new capture or a new rotated
+ * segment.
+ */
+static void capture_write_header() {
+    char time_string[TIME_STRING_LENGTH];
+    time_t current_time;
+
+    time(&current_time);
+    strftime(time_string, sizeof(time_string),
+             _("Capture Generated %a, %d %b %Y %H:%M:%S %z"),
+             localtime(&current_time));
+
+    if (q_status.capture_type == Q_CAPTURE_TYPE_HTML) {
+        /*
+         * HTML
+         */
+        fprintf(q_status.capture_file, "<html>\n\n");
+        fprintf(q_status.capture_file,
+                "<!-- * - * Qodem " Q_VERSION
+                " %s BEGIN * - * --> \n\n", time_string);
+        fprintf(q_status.capture_file,
+                "<body bgcolor=\"black\">\n<pre {font-family: 'Courier New', monospace;}><code><font %s>",
+                color_to_html(q_current_color));
+    } else {
+        fprintf(q_status.capture_file,
+                "* - * Qodem " Q_VERSION " %s BEGIN * - *\n\n",
+                time_string);
+    }
+}
+
+/**
+ * Write the capture file footer when capture stops or a segment is
+ * rotated.
+ */
+static void capture_write_footer() {
+    char time_string[TIME_STRING_LENGTH];
+    time_t current_time;
+
+    time(&current_time);
+    strftime(time_string, sizeof(time_string),
+             _("Capture Generated %a, %d %b %Y %H:%M:%S %z"),
+             localtime(&current_time));
+
+    if (q_status.capture_type == Q_CAPTURE_TYPE_HTML) {
+        /*
+         * HTML
+         */
+        fprintf(q_status.capture_file, "</code></pre></font>\n</body>\n");
+        fprintf(q_status.capture_file,
+                "\n<!-- * - * Qodem " Q_VERSION " %s END * - * -->\n",
+                time_string);
+        fprintf(q_status.capture_file, "\n</html>\n");
+    } else {
+        fprintf(q_status.capture_file,
+                "\n* - * Qodem " Q_VERSION " %s END * - *\n", time_string);
+    }
+}
+
+/**
+ * Open the current capture segment: capture_filename, plus ".N" for the
+ * Nth rotated segment, plus ".gz" or ".zst" if compressing.
+ *
+ * @return the open file or pipe, or NULL on error
+ */
+static FILE * capture_open_segment() {
+    char * segment_filename;
+    char * command;
+    const char * suffix = "";
+    const char * compressor = NULL;
+    FILE * file;
+    int i;
+    int j;
+
+    if (strcasecmp(get_option(Q_OPTION_CAPTURE_COMPRESS), "gzip") == 0) {
+        compressor = "gzip -c";
+        suffix = ".gz";
+    } else if (strcasecmp(get_option(Q_OPTION_CAPTURE_COMPRESS),
+            "zstd") == 0) {
+        compressor = "zstd -q -c";
+        suffix = ".zst";
+    }
+
+    segment_filename = (char *) Xmalloc(strlen(capture_filename) + 32,
+                                        __FILE__, __LINE__);
+    if (capture_segment == 0) {
+        sprintf(segment_filename, "%s%s", capture_filename, suffix);
+    } else {
+        sprintf(segment_filename, "%s.%d%s", capture_filename,
+                capture_segment, suffix);
+    }
+
+    capture_bytes = 0;
+    capture_unflushed = 0;
+    capture_pipe = Q_FALSE;
+
+#ifndef Q_PDCURSES_WIN32
+    if (compressor != NULL) {
+        /*
+         * Compress in a child process.  Both gzip and zstd streams can be
+         * concatenated, so it is fine to append to an existing file.
+         */
+        command = (char *) Xmalloc(strlen(compressor) +
+                                   strlen(segment_filename) * 4 + 16,
+                                   __FILE__, __LINE__);
+        j = sprintf(command, "%s >> '", compressor);
+        for (i = 0; segment_filename[i] != 0; i++) {
+            if (segment_filename[i] == '\'') {
+                command[j++] = '\'';
+                command[j++] = '\\';
+                command[j++] = '\'';
+            }
+            command[j++] = segment_filename[i];
+        }
+        command[j++] = '\'';
+        command[j] = 0;
+        file = popen(command, "w");
+        Xfree(command, __FILE__, __LINE__);
+        if (file != NULL) {
+            capture_pipe = Q_TRUE;
+        }
+    } else {
+#endif
+        file = fopen(segment_filename, "a");
+        if (file != NULL) {
+            fseek(file, 0, SEEK_END);
+            capture_bytes = ftell(file);
+        }
+#ifndef Q_PDCURSES_WIN32
+    }
+#endif
+
+    if (file != NULL) {
+        setvbuf(file, NULL, _IOFBF, CAPTURE_BUFFER_SIZE);
+    }
+    Xfree(segment_filename, __FILE__, __LINE__);
+    return file;
+}
+
+/**
+ * Close the current capture segment.
+ */
+static void capture_close_segment() {
+#ifndef Q_PDCURSES_WIN32
+    if (capture_pipe == Q_TRUE) {
+        pclose(q_status.capture_file);
+    } else {
+        fclose(q_status.capture_file);
+    }
+#else
+    fclose(q_status.capture_file);
+#endif
+    q_status.capture_file = NULL;
+}
+
+/**
+ * Note bytes written to the capture file, flushing it or starting a new
+ * segment as needed.
+ *
+ * @param n the number of bytes just written
+ */
+static void capture_account(const int n) {
+    FILE * file;
+
+    if (n <= 0) {
+        return;
+    }
+    capture_bytes += n;
+    capture_unflushed += n;
+    if (capture_unflushed >= CAPTURE_FLUSH_BYTES) {
+        fflush(q_status.capture_file);
+        capture_unflushed = 0;
+    }
+
+    if ((capture_rotate_size > 0) && (capture_bytes >= capture_rotate_size)) {
+        /*
+         * Rotate to the next segment
+         */
+        capture_write_footer();
+        capture_close_segment();
+        capture_segment++;
+        file = capture_open_segment();
+        if (file == NULL) {
+            q_status.capture = Q_FALSE;
+            qlog(_("Capture close: unable to open next segment: %s\n"),
+                 strerror(errno));
+            Xfree(capture_filename, __FILE__, __LINE__);
+            capture_filename = NULL;
+            return;
+        }
+        q_status.capture_file = file;
+        capture_write_header();
+        qlog(_("Capture rotated to segment %d\n"), capture_segment);
+    }
+}
+
+/**
+ * Write raw bytes to the capture file.
+ *
+ * @param data the bytes to write
+ * @param n the number of bytes in data
+ */
+void capture_write(const unsigned char * data, const int n) {
+    if ((q_status.capture == Q_FALSE) || (n <= 0)) {
+        return;
+    }
+    fwrite(data, 1, n, q_status.capture_file);
+    capture_account(n);
+}
+
+/**
+ * Write a formatted string to the capture file.
+ *
+ * @param format the format string
+ */
+void capture_printf(const char * format, ...) {
+    va_list arglist;
+    int rc;
+
+    if (q_status.capture == Q_FALSE) {
+        return;
+    }
+    va_start(arglist, format);
+    rc = vfprintf(q_status.capture_file, format, arglist);
+    va_end(arglist);
+    capture_account(rc);
+}
+
+/**
+ * Flush the capture and session log files if they have unwritten data and
+ * it has been at least a second since the last flush.  This is called
+ * once per pass through the main loop.
+ */
+void flush_capture_and_log() {
+    time_t now;
+
+    if (((q_status.capture == Q_FALSE) || (capture_unflushed == 0)) &&
+        ((q_status.logging == Q_FALSE) || (logging_unflushed == Q_FALSE))
+    ) {
+        return;
+    }
+
+    time(&now);
+    if (q_status.capture_flush_time == now) {
+        return;
+    }
+    if ((q_status.capture == Q_TRUE) && (capture_unflushed > 0)) {
+        fflush(q_status.capture_file);
+        capture_unflushed = 0;
+    }
+    if ((q_status.logging == Q_TRUE) && (logging_unflushed == Q_TRUE)) {
+        fflush(q_status.logging_file);
+        logging_unflushed = Q_FALSE;
+    }
+    q_status.capture_flush_time = now;
+}
+
+/**
+ * Note that the session log has unflushed data.  qlog() calls this rather
+ * than flushing after every line.
+ */
+void logging_written() {
+    logging_unflushed = Q_TRUE;
+}
+
 /**
  * Begin capturing the session to file.
  *
  * @param filename the file to save data to
  */
 void start_capture(const char * filename) {
-    char * new_filename;
-    char time_string[TIME_STRING_LENGTH];
-    time_t current_time;
     char notify_message[DIALOG_MESSAGE_SIZE];
 
     if (q_status.read_only == Q_TRUE) {
@@ -134,46 +480,34 @@ void start_capture(const char * filename) {
         return;
     }
 
-    if ((filename != NULL) && (q_status.capture == Q_FALSE)) {
-        q_status.capture_file = open_workingdir_file(filename, &new_filename);
+    if ((filename != NULL) && (strlen(filename) > 0) &&
+        (q_status.capture == Q_FALSE)
+    ) {
+        if (filename[0] != '/') {
+            /* Relative path, prefix working directory */
+            capture_filename = Xstrdup(get_workingdir_filename(filename),
+                __FILE__, __LINE__);
+        } else {
+            capture_filename = Xstrdup(filename, __FILE__, __LINE__);
+        }
+        capture_segment = 0;
+        capture_rotate_size =
+            strtoul(get_option(Q_OPTION_CAPTURE_ROTATE_SIZE), NULL, 10) * 1024;
+
+        q_status.capture_file = capture_open_segment();
         if (q_status.capture_file == NULL) {
             snprintf(notify_message, sizeof(notify_message),
                      _("Error opening file \"%s\" for writing: %s"),
-                     new_filename, strerror(errno));
+                     capture_filename, strerror(errno));
             notify_form(notify_message, 0);
             q_cursor_on();
+            Xfree(capture_filename, __FILE__, __LINE__);
+            capture_filename = NULL;
         } else {
             qlog(_("Capture open to file '%s'\n"), filename);
-            time(&current_time);
-
-            if (q_status.capture_type == Q_CAPTURE_TYPE_HTML) {
-                /*
-                 * HTML
-                 */
-                strftime(time_string, sizeof(time_string),
-                         _("Capture Generated %a, %d %b %Y %H:%M:%S %z"),
-                         localtime(&current_time));
-                fprintf(q_status.capture_file, "<html>\n\n");
-                fprintf(q_status.capture_file,
-                        "<!-- * - * Qodem " Q_VERSION
-                        " %s BEGIN * - * --> \n\n", time_string);
-                fprintf(q_status.capture_file,
-                        "<body bgcolor=\"black\">\n<pre {font-family: 'Courier New', monospace;}><code><font %s>",
-                        color_to_html(q_current_color));
-            } else {
-                strftime(time_string, sizeof(time_string),
-                         _("Capture Generated %a, %d %b %Y %H:%M:%S %z"),
-                         localtime(&current_time));
-                fprintf(q_status.capture_file,
-                        "* - * Qodem " Q_VERSION " %s BEGIN * - *\n\n",
-                        time_string);
-            }
-
+            capture_write_header();
             q_status.capture = Q_TRUE;
         }
-        if (new_filename != filename) {
-            Xfree(new_filename, __FILE__, __LINE__);
-        }
     }
 }
 
@@ -181,36 +515,14 @@ void start_capture(const char * filename) {
  * Stop capturing and close the capture file.
  */
 void stop_capture() {
-    char time_string[TIME_STRING_LENGTH];
-    time_t current_time;
-
     if (q_status.capture == Q_FALSE) {
         return;
     }
 
-    time(&current_time);
-
-    if (q_status.capture_type == Q_CAPTURE_TYPE_HTML) {
-        /*
-         * HTML
-         */
-        fprintf(q_status.capture_file, "</code></pre></font>\n</body>\n");
-        strftime(time_string, sizeof(time_string),
-                 _("Capture Generated %a, %d %b %Y %H:%M:%S %z"),
-                 localtime(&current_time));
-        fprintf(q_status.capture_file,
-                "\n<!-- * - * Qodem " Q_VERSION " %s END * - * -->\n",
-                time_string);
-        fprintf(q_status.capture_file, "\n</html>\n");
-    } else {
-        strftime(time_string, sizeof(time_string),
-                 _("Capture Generated %a, %d %b %Y %H:%M:%S %z"),
-                 localtime(&current_time));
-        fprintf(q_status.capture_file,
-                "\n* - * Qodem " Q_VERSION " %s END * - *\n", time_string);
-    }
-
-    fclose(q_status.capture_file);
+    capture_write_footer();
+    capture_close_segment();
+    Xfree(capture_filename, __FILE__, __LINE__);
+    capture_filename = NULL;
     q_status.capture = Q_FALSE;
     qlog(_("Capture close\n"));
 }
@@ -240,6 +552,7 @@ void start_logging(const char * filename) {
             notify_form(notify_message, 0);
             q_cursor_on();
         } else {
+            setvbuf(q_status.logging_file, NULL, _IOFBF, CAPTURE_BUFFER_SIZE);
             time(&current_time);
             strftime(time_string, sizeof(time_string),
                      _("Log Generated %a, %d %b %Y %H:%M:%S %z"),
@@ -274,6 +587,7 @@ void stop_logging() {
             time_string);
     fclose(q_status.logging_file);
     q_status.logging = Q_FALSE;
+    logging_unflushed = Q_FALSE;
 }
 
 
@@ -406,6 +720,164 @@ static Q_BOOL check_kermit_autostart(unsigned char from_modem) {
     return Q_FALSE;
 }
 
+/**
+ * Find a transition in the quicklearn suffix automaton.
+ *
+ * @param state the state to leave
+ * @param ch the character
+ * @return the target state, or -1 if there is no transition
+ */
+static int quicklearn_next_state(const int state, const wchar_t ch) {
+    int i;
+
+    for (i = quicklearn_states[state].edges; i != -1;
+         i = quicklearn_edges[i].next) {
+        if (quicklearn_edges[i].ch == ch) {
+            return quicklearn_edges[i].target;
+        }
+    }
+    return -1;
+}
+
+/**
+ * Set a transition in the quicklearn suffix automaton, adding it if
+ * needed.
+ *
+ * @param state the state to leave
+ * @param ch the character
+ * @param target the state to go to
+ */
+static void quicklearn_set_edge(const int state, const wchar_t ch,
+                                const int target) {
+    int i;
+
+    for (i = quicklearn_states[state].edges; i != -1;
+         i = quicklearn_edges[i].next) {
+        if (quicklearn_edges[i].ch == ch) {
+            quicklearn_edges[i].target = target;
+            return;
+        }
+    }
+    i = quicklearn_edges_n;
+    quicklearn_edges_n++;
+    quicklearn_edges[i].ch = ch;
+    quicklearn_edges[i].target = target;
+    quicklearn_edges[i].next = quicklearn_states[state].edges;
+    quicklearn_states[state].edges = i;
+}
+
+/**
+ * Add a state to the quicklearn suffix automaton.
+ *
+ * @param length the longest string reaching the state
+ * @return the new state
+ */
+static int quicklearn_new_state(const int length) {
+    int state = quicklearn_states_n;
+
+    quicklearn_states_n++;
+    quicklearn_states[state].length = length;
+    quicklearn_states[state].link = -1;
+    quicklearn_states[state].edges = -1;
+    return state;
+}
+
+/**
+ * Extend the quicklearn suffix automaton by one character at the end of
+ * quicklearn_buffer.
+ *
+ * @param ch the character
+ */
+static void quicklearn_extend(const wchar_t ch) {
+    int state;
+    int p;
+    int q;
+    int clone;
+    int i;
+
+    state = quicklearn_new_state(quicklearn_states[quicklearn_last].length +
+                                 1);
+    p = quicklearn_last;
+    while ((p != -1) && (quicklearn_next_state(p, ch) == -1)) {
+        quicklearn_set_edge(p, ch, state);
+        p = quicklearn_states[p].link;
+    }
+    if (p == -1) {
+        quicklearn_states[state].link = 0;
+    } else {
+        q = quicklearn_next_state(p, ch);
+        if (quicklearn_states[p].length + 1 == quicklearn_states[q].length) {
+            quicklearn_states[state].link = q;
+        } else {
+            clone = quicklearn_new_state(quicklearn_states[p].length + 1);
+            quicklearn_states[clone].link = quicklearn_states[q].link;
+            for (i = quicklearn_states[q].edges; i != -1;
+                 i = quicklearn_edges[i].next) {
+                quicklearn_set_edge(clone, quicklearn_edges[i].ch,
+                                    quicklearn_edges[i].target);
+            }
+            while ((p != -1) && (quicklearn_next_state(p, ch) == q)) {
+                quicklearn_set_edge(p, ch, clone);
+                p = quicklearn_states[p].link;
+            }
+            quicklearn_states[q].link = clone;
+            quicklearn_states[state].link = clone;
+        }
+    }
+    quicklearn_last = state;
+}
+
+/**
+ * Rebuild the quicklearn suffix automaton over quicklearn_buffer.
+ */
+static void quicklearn_reindex() {
+    int i;
+
+    quicklearn_states_n = 0;
+    quicklearn_edges_n = 0;
+    quicklearn_last = quicklearn_new_state(0);
+    for (i = 0; i < quicklearn_buffer_n; i++) {
+        quicklearn_extend(quicklearn_buffer[i]);
+    }
+}
+
+/**
+ * Append a character to the quicklearn script line being built, escaped
+ * for a Perl double-quoted string.
+ *
+ * @param line the line being built
+ * @param line_n the length of line.  This is advanced past the character.
+ * @param ch the character
+ * @param utf8 if true, encode characters above 0x7F to UTF-8, otherwise
+ * write them as-is
+ */
+static void quicklearn_escape(char * line, int * line_n, const wchar_t ch,
+                              const Q_BOOL utf8) {
+
+    if (ch == 0x0D) {
+        *line_n += sprintf(line + *line_n, "\\r");
+    } else if (ch == 0x0A) {
+        *line_n += sprintf(line + *line_n, "\\n");
+    } else if (ch < 0x20) {
+        /*
+         * Other control character
+         */
+        *line_n += sprintf(line + *line_n, "\\x%02x", (unsigned int) ch);
+    } else if ((ch == '@') || (ch == '$') || (ch == '"') || (ch == '\\')) {
+        /*
+         * Perl - escape out @, $, ", and \
+         */
+        line[*line_n] = '\\';
+        line[*line_n + 1] = (char) ch;
+        *line_n += 2;
+    } else if ((ch < 0x80) || (utf8 == Q_FALSE)) {
+        line[*line_n] = (char) ch;
+        *line_n += 1;
+    } else {
+        *line_n += utf8_encode(ch, line + *line_n);
+    }
+}
+
 /**
  * Begin saving prompts and responses to a Perl language script file.
  *
@@ -434,6 +906,8 @@ void start_quicklearn(const char * filename) {
             notify_form(notify_message, 0);
             q_cursor_on();
         } else {
+            setvbuf(quicklearn_file, NULL, _IOFBF,
+                    QUICKLEARN_FILE_BUFFER_SIZE);
             time(&current_time);
             strftime(time_string, sizeof(time_string),
                      _("QuickLearn Script Generated %a, %d %b %Y %H:%M:%S %z"),
@@ -530,8 +1004,18 @@ void start_quicklearn(const char * filename) {
             /*
              * Reset quicklearn buffers
              */
+            quicklearn_buffer = (wchar_t *) Xmalloc(sizeof(wchar_t) *
+                QUICKLEARN_WINDOW, __FILE__, __LINE__);
+            quicklearn_states = (struct quicklearn_state *)
+                Xmalloc(sizeof(struct quicklearn_state) * 2 *
+                        QUICKLEARN_WINDOW, __FILE__, __LINE__);
+            quicklearn_edges = (struct quicklearn_edge *)
+                Xmalloc(sizeof(struct quicklearn_edge) * 3 *
+                        QUICKLEARN_WINDOW, __FILE__, __LINE__);
             quicklearn_buffer_n = 0;
+            quicklearn_line_n = 0;
             quicklearn_send_buffer_n = 0;
+            quicklearn_reindex();
 
             /*
              * Turn off other incompatible features
@@ -566,6 +1050,13 @@ void stop_quicklearn() {
     quicklearn_file = NULL;
     q_status.quicklearn = Q_FALSE;
 
+    Xfree(quicklearn_buffer, __FILE__, __LINE__);
+    quicklearn_buffer = NULL;
+    Xfree(quicklearn_states, __FILE__, __LINE__);
+    quicklearn_states = NULL;
+    Xfree(quicklearn_edges, __FILE__, __LINE__);
+    quicklearn_edges = NULL;
+
     qlog(_("QuickLearn finished.\n"));
 }
 
@@ -574,70 +1065,60 @@ void stop_quicklearn() {
  * command.
  */
 static void quicklearn_save_sendto() {
+    char line[QUICKLEARN_SEND_MAX * 4 + 16];
+    int line_n;
     int i;
+
     assert(quicklearn_file != NULL);
 
-    fprintf(quicklearn_file, "sendkeys(\"");
+    line_n = sprintf(line, "sendkeys(\"");
     for (i = 0; i < quicklearn_send_buffer_n; i++) {
-        if (quicklearn_send_buffer[i] == 0x0D) {
-            /*
-             * CR
-             */
-            fprintf(quicklearn_file, "\\r");
-        } else if (quicklearn_send_buffer[i] == 0x0A) {
-            /*
-             * NL - should be rare to send out
-             */
-            fprintf(quicklearn_file, "\\x0A");
-        } else if (quicklearn_send_buffer[i] < 0x20) {
-            /*
-             * Other control character
-             */
-            fprintf(quicklearn_file, "\\x%02x", quicklearn_send_buffer[i]);
-        } else if (quicklearn_send_buffer[i] == '@') {
-            /*
-             * Perl - escape out @
-             */
-            fprintf(quicklearn_file, "\\@");
-        } else if (quicklearn_send_buffer[i] == '$') {
-            /*
-             * Perl - escape out $
-             */
-            fprintf(quicklearn_file, "\\$");
-        } else {
-            fprintf(quicklearn_file, "%c", quicklearn_send_buffer[i]);
-        }
+        quicklearn_escape(line, &line_n, quicklearn_send_buffer[i], Q_FALSE);
     }
-    fprintf(quicklearn_file, "\");\n");
+    line_n += sprintf(line + line_n, "\");\n");
+    fwrite(line, 1, line_n, quicklearn_file);
     quicklearn_send_buffer_n = 0;
 }
 
 /**
- * Save the quicklearn receive buffer to the quicklearn file as a waitfor
- * command.
+ * Save the end of the quicklearn receive buffer to the quicklearn file as a
+ * waitfor command.  The string is the shortest ending that does not appear
+ * earlier in the buffer, widened to cover some of the prompt line.
  */
 static void quicklearn_save_waitfor() {
+    char line[QUICKLEARN_WAITFOR_MAX * 4 + 16];
+    int line_n;
+    int length;
     int i;
+
     assert(quicklearn_file != NULL);
 
-    fprintf(quicklearn_file, "waitfor(\"");
-    for (i = 0; i < quicklearn_buffer_n; i++) {
-        if (quicklearn_buffer[i] == '@') {
-            /*
-             * Perl - escape out @
-             */
-            fprintf(quicklearn_file, "\\@");
-        } else if (quicklearn_buffer[i] == '$') {
-            /*
-             * Perl - escape out $
-             */
-            fprintf(quicklearn_file, "\\$");
-        } else {
-            fprintf(quicklearn_file, "%lc", (wint_t) quicklearn_buffer[i]);
+    length = quicklearn_states[quicklearn_states[quicklearn_last].link].length
+        + 1;
+    if (quicklearn_line_n > length) {
+        if (quicklearn_line_n < QUICKLEARN_WAITFOR_MIN) {
+            length = quicklearn_line_n;
+        } else if (length < QUICKLEARN_WAITFOR_MIN) {
+            length = QUICKLEARN_WAITFOR_MIN;
         }
     }
-    fprintf(quicklearn_file, "\");\n");
+    if (length > QUICKLEARN_WAITFOR_MAX) {
+        length = QUICKLEARN_WAITFOR_MAX;
+    }
+
+    line_n = sprintf(line, "waitfor(\"");
+    for (i = quicklearn_buffer_n - length; i < quicklearn_buffer_n; i++) {
+        quicklearn_escape(line, &line_n, quicklearn_buffer[i], Q_TRUE);
+    }
+    line_n += sprintf(line + line_n, "\");\n");
+    fwrite(line, 1, line_n, quicklearn_file);
+
+    /*
+     * The script's next waitfor() starts reading after this point
+     */
     quicklearn_buffer_n = 0;
+    quicklearn_line_n = 0;
+    quicklearn_reindex();
 }
 
 /**
@@ -653,24 +1134,29 @@ void quicklearn_print_character(const wchar_t ch) {
         if (quicklearn_send_buffer_n > 0) {
             quicklearn_save_sendto();
         }
+        quicklearn_line_n = 0;
+    } else {
+        quicklearn_line_n++;
+    }
+
+    if (quicklearn_buffer_n == QUICKLEARN_WINDOW) {
         /*
-         * Clear on newline
+         * Keep the newer half.  A waitfor() chosen after this is only
+         * unique within the retained text.
          */
-        quicklearn_buffer_n = 0;
-        return;
+        memmove(quicklearn_buffer,
+                quicklearn_buffer + QUICKLEARN_WINDOW / 2,
+                sizeof(wchar_t) * (QUICKLEARN_WINDOW / 2));
+        quicklearn_buffer_n = QUICKLEARN_WINDOW / 2;
+        quicklearn_reindex();
     }
+
     /*
      * Append
      */
-    if (quicklearn_buffer_n == 32) {
-        wmemmove(quicklearn_buffer, quicklearn_buffer + 1,
-                 (quicklearn_buffer_n - 1));
-        quicklearn_buffer[quicklearn_buffer_n - 1] = ch;
-        return;
-    } else {
-        quicklearn_buffer_n++;
-        quicklearn_buffer[quicklearn_buffer_n - 1] = ch;
-    }
+    quicklearn_buffer[quicklearn_buffer_n] = ch;
+    quicklearn_buffer_n++;
+    quicklearn_extend(ch);
 }
 
 /**
@@ -691,25 +1177,15 @@ void quicklearn_send_byte(const unsigned char ch) {
     /*
      * Append
      */
-    if (quicklearn_send_buffer_n == 32) {
-        memmove(quicklearn_send_buffer, quicklearn_send_buffer + 1,
-                (quicklearn_send_buffer_n - 1));
-        quicklearn_send_buffer[quicklearn_send_buffer_n - 1] = ch;
-    } else {
-        quicklearn_send_buffer_n++;
-        quicklearn_send_buffer[quicklearn_send_buffer_n - 1] = ch;
+    if (quicklearn_send_buffer_n == QUICKLEARN_SEND_MAX) {
+        quicklearn_save_sendto();
     }
+    quicklearn_send_buffer[quicklearn_send_buffer_n] = ch;
+    quicklearn_send_buffer_n++;
 
     if ((ch == '\r') || (ch == '\n')) {
         quicklearn_save_sendto();
-
-        /*
-         * Clear waitfor on newline output
-         */
-        quicklearn_buffer_n = 0;
-        return;
     }
-
 }
 
 /**
@@ -880,8 +1356,8 @@ void console_keyboard_handler(int keystroke, int flags) {
     /*
      * Special case: If the keystroke is Shift-Ins or Ctrl-Ins, "paste"
      * whatever might be in the system clipboard (by way of
-     * post_keystroke()'ing each byte).  We honor this regardless of doorway
-     * mode.
+     * post_keystroke()'ing each byte in one batch).  We honor this
+     * regardless of doorway mode.
      */
     if (q_key_code_yes(keystroke) &&
         ((keystroke == Q_KEY_IC) || (keystroke == Q_KEY_SIC)) &&
@@ -904,6 +1380,7 @@ void console_keyboard_handler(int keystroke, int flags) {
             if (q_status.bracketed_paste_mode == Q_TRUE) {
                 bracketed_paste_on();
             }
+            post_keystroke_batch_begin();
             last_utf8_state = utf8_state;
             for (i = 0; i < clipboard_length; i++) {
                 utf8_decode(&utf8_state, &utf8_char,
@@ -938,6 +1415,7 @@ void console_keyboard_handler(int keystroke, int flags) {
                     post_keystroke((wchar_t) utf8_char, KEY_FLAG_UNICODE);
                 }
             }
+            post_keystroke_batch_end();
             PDC_freeclipboard(clipboard_contents);
             clipboard_contents = NULL;
             if (q_status.bracketed_paste_mode == Q_TRUE) {
@@ -2215,6 +2693,20 @@ void console_keyboard_handler(int keystroke, int flags) {
     }
 }
 
+/**
+ * Write untranslated bytes from the remote side to a raw capture.
+ *
+ * @param buffer the bytes from the remote side
+ * @param n the number of bytes in buffer
+ */
+static void capture_raw(const unsigned char * buffer, const int n) {
+    if ((q_status.capture == Q_TRUE) &&
+        (q_status.capture_type == Q_CAPTURE_TYPE_RAW)
+    ) {
+        capture_write(buffer, n);
+    }
+}
+
 /**
  * Process raw bytes from the remote side through the emulation layer,
  * handling zmodem/kermit autostart, translation tables, etc.
@@ -2227,6 +2719,7 @@ void console_keyboard_handler(int keystroke, int flags) {
 void console_process_incoming_data(unsigned char * buffer, const int n,
                                    int * remaining) {
     int i;
+    unsigned char ch;
     wchar_t emulated_char;
     Q_EMULATION_STATUS emulation_rc;
 
@@ -2251,34 +2744,18 @@ void console_process_incoming_data(unsigned char * buffer, const int n,
             }
         }
 
-        /*
-         * Capture
-         */
-        if (q_status.capture == Q_TRUE) {
-            if (q_status.capture_type == Q_CAPTURE_TYPE_RAW) {
-                /*
-                 * Raw
-                 */
-                fprintf(q_status.capture_file, "%c", buffer[i]);
-                if (q_status.capture_flush_time < time(NULL)) {
-                    fflush(q_status.capture_file);
-                    q_status.capture_flush_time = time(NULL);
-                }
-            }
-        }
-
         /*
          * Run received characters through the 8-bit input translation table
          * before doing anything else.  This can break UTF-8 decoding,
          * Zmodem/Kermit autostart, and more.
          */
-        buffer[i] = translate_8bit_in(buffer[i]);
+        ch = translate_8bit_in(buffer[i]);
 
         /*
          * Strip 8th bit processing
          */
         if (q_status.strip_8th_bit == Q_TRUE) {
-            buffer[i] &= 0x7F;
+            ch &= 0x7F;
         }
 
         /*
@@ -2289,7 +2766,7 @@ void console_process_incoming_data(unsigned char * buffer, const int n,
             /*
              * Check for Zmodem autostart
              */
-            if (check_zmodem_autostart(buffer[i]) == Q_TRUE) {
+            if (check_zmodem_autostart(ch) == Q_TRUE) {
                 if (q_download_location == NULL) {
                     q_download_location =
                         save_form(_("Download Directory"),
@@ -2311,13 +2788,14 @@ void console_process_incoming_data(unsigned char * buffer, const int n,
                 /*
                  * Get out of here
                  */
+                capture_raw(buffer, i + 1);
                 return;
             }
 
             /*
              * Check for Kermit autostart
              */
-            if (check_kermit_autostart(buffer[i]) == Q_TRUE) {
+            if (check_kermit_autostart(ch) == Q_TRUE) {
                 if (q_download_location == NULL) {
                     q_download_location =
                         save_form(_("Download Directory"),
@@ -2339,6 +2817,7 @@ void console_process_incoming_data(unsigned char * buffer, const int n,
                 /*
                  * Get out of here
                  */
+                capture_raw(buffer, i + 1);
                 return;
             }
 
@@ -2347,7 +2826,7 @@ void console_process_incoming_data(unsigned char * buffer, const int n,
         /*
          * Normal character -- pass it through emulator
          */
-        emulation_rc = terminal_emulator(buffer[i], &emulated_char);
+        emulation_rc = terminal_emulator(ch, &emulated_char);
         *remaining -= 1;
 
         DLOG(("terminal_emulator() (outside) RC %d char '%lc' 0x%x\n",
@@ -2396,6 +2875,11 @@ void console_process_incoming_data(unsigned char * buffer, const int n,
 
     } /* for (i = 0; i < n; i++) */
 
+    /*
+     * Capture everything that was consumed in one write
+     */
+    capture_raw(buffer, i);
+
     q_screen_dirty = Q_TRUE;
     if (q_status.split_screen == Q_TRUE) {
         q_split_screen_dirty = Q_TRUE;
@@ -121,6 +121,34 @@ extern void start_capture(const char * filename);
  */
 extern void stop_capture();
 
+/**
+ * Write raw bytes to the capture file.
+ *
+ * @param data the bytes to write
+ * @param n the number of bytes in data
+ */
+extern void capture_write(const unsigned char * data, const int n);
+
+/**
+ * Write a formatted string to the capture file.
+ *
+ * @param format the format string
+ */
+extern void capture_printf(const char * format, ...);
+
+/**
+ * Flush the capture and session log files if they have unwritten data and
+ * it has been at least a second since the last flush.  This is called
+ * once per pass through the main loop.
+ */
+extern void flush_capture_and_log();
+
+/**
+ * Note that the session log has unflushed data.  qlog() calls this rather
+ * than flushing after every line.
+ */
+extern void logging_written();
+
 /**
  * Begin logging major events for the session to file.
  *
@@ -707,7 +707,7 @@ void set_raw_termios(const int tty_fd) {
  */
 static void setup_dial_screen() {
     time(&q_dialer_cycle_start_time);
-    q_dialer_cycle_time = atoi(get_option(Q_OPTION_DIAL_CONNECT_TIME));
+    q_dialer_cycle_time = get_option_int(Q_OPTION_DIAL_CONNECT_TIME);
     q_dialer_attempts++;
     q_dial_state = Q_DIAL_DIALING;
 
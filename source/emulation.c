@@ -1098,7 +1098,7 @@ void reset_emulation() {
      * Reset bracketed paste mode to global flag.
      */
     q_status.bracketed_paste_mode = Q_FALSE;
-    if (strcasecmp(get_option(Q_OPTION_BRACKETED_PASTE), "true") == 0) {
+    if (get_option_bool(Q_OPTION_BRACKETED_PASTE) == Q_TRUE) {
         q_status.bracketed_paste_mode = Q_TRUE;
     }
 
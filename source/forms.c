@@ -32,6 +32,10 @@
 #endif
 #include <fnmatch.h>
 #include <assert.h>
+#ifdef __linux
+#  include <sys/inotify.h>
+#  include <unistd.h>
+#endif
 #include "console.h"
 #include "qodem.h"
 #include "options.h"
@@ -49,6 +53,17 @@ static char file_mode_string_buffer[11];
 #define BATCH_ENTRY_FILES_N             20
 #define BATCH_ENTRY_FILENAME_LENGTH     30
 
+/* Number of directory listings kept by read_directory() */
+#define DIRECTORY_CACHE_N               4
+
+#ifdef __linux
+/* The inotify events that change a directory listing */
+#define DIRECTORY_CACHE_EVENTS  (IN_CREATE | IN_DELETE | IN_MOVED_FROM | \
+                                 IN_MOVED_TO | IN_MODIFY | IN_ATTRIB | \
+                                 IN_CLOSE_WRITE | IN_DELETE_SELF | \
+                                 IN_MOVE_SELF)
+#endif
+
 /*
  * GNU uses FNM_FILE_NAME instead of FNM_PATHNAME.  I prefer that too.
  */
@@ -1447,17 +1462,447 @@ char * file_mode_string(mode_t mode) {
 }
 
 /**
- * Swap two entries in a file_info array.
+ * A cached directory listing.  The entries are kept sorted with
+ * directories first, then by name, so view_directory() and the host mode
+ * file listing can display them without re-reading or re-sorting the
+ * directory.
+ */
+struct directory_cache {
+    /**
+     * The directory name, or NULL if this slot is unused.
+     */
+    char * path;
+
+    /**
+     * The directory mtime when it was last read.
+     */
+    time_t mtime;
+
+    /**
+     * The files, sorted.  Directories are entries[0..dirs_n-1], files are
+     * entries[dirs_n..entries_n-1].
+     */
+    struct file_info ** entries;
+    int entries_n;
+    int entries_max;
+    int dirs_n;
+
+    /**
+     * Value of directory_cache_clock at the last lookup, used to pick which
+     * slot to evict.
+     */
+    unsigned long last_used;
+
+#ifdef __linux
+    /**
+     * inotify descriptor watching path, or -1.
+     */
+    int inotify_fd;
+#endif
+};
+
+/* The directories most recently read by read_directory(). */
+static struct directory_cache directory_caches[DIRECTORY_CACHE_N];
+static unsigned long directory_cache_clock = 0;
+
+/**
+ * Comparison function for qsort(): directories first, then by name.
+ *
+ * @param arg1 the first struct file_info **
+ * @param arg2 the second struct file_info **
+ * @return less than, equal to, or greater than zero
+ */
+static int compare_file_info(const void * arg1, const void * arg2) {
+    const struct file_info * a = *((const struct file_info **) arg1);
+    const struct file_info * b = *((const struct file_info **) arg2);
+
+    if (S_ISDIR(a->fstats.st_mode) && !S_ISDIR(b->fstats.st_mode)) {
+        return -1;
+    }
+    if (!S_ISDIR(a->fstats.st_mode) && S_ISDIR(b->fstats.st_mode)) {
+        return 1;
+    }
+    return strcmp(a->name, b->name);
+}
+
+/**
+ * Find the position for a name in a sorted range of a directory cache.
+ *
+ * @param cache the cache
+ * @param begin the first index of the range
+ * @param end one past the last index of the range
+ * @param name the filename to look for
+ * @param found set to true if name is at the returned index
+ * @return the index of name, or the index where it should be inserted
+ */
+static int directory_cache_search(const struct directory_cache * cache,
+                                  int begin, int end, const char * name,
+                                  Q_BOOL * found) {
+    int middle;
+    int rc;
+
+    *found = Q_FALSE;
+    while (begin < end) {
+        middle = begin + (end - begin) / 2;
+        rc = strcmp(cache->entries[middle]->name, name);
+        if (rc == 0) {
+            *found = Q_TRUE;
+            return middle;
+        }
+        if (rc < 0) {
+            begin = middle + 1;
+        } else {
+            end = middle;
+        }
+    }
+    return begin;
+}
+
+/**
+ * Read the stats for one file in a cached directory.
+ *
+ * @param cache the cache
+ * @param name the filename
+ * @param fstats the stats buffer
+ * @return the return value from stat() / lstat()
+ */
+static int directory_cache_stat(const struct directory_cache * cache,
+                                const char * name, struct stat * fstats) {
+#ifdef Q_PDCURSES_WIN32
+    const char pathsep = '\\';
+#else
+    const char pathsep = '/';
+#endif
+    char * full_filename;
+    int rc;
+
+    full_filename = (char *) Xmalloc(strlen(cache->path) + strlen(name) + 2,
+                                     __FILE__, __LINE__);
+    sprintf(full_filename, "%s%c%s", cache->path, pathsep, name);
+#ifdef Q_PDCURSES_WIN32
+    rc = stat(full_filename, fstats);
+#else
+    rc = lstat(full_filename, fstats);
+#endif
+    if (rc < 0) {
+        memset(fstats, 0, sizeof(struct stat));
+    }
+    Xfree(full_filename, __FILE__, __LINE__);
+    return rc;
+}
+
+/**
+ * Add a file to the end of a directory cache's entries.  The caller needs
+ * to place it in sorted order.
+ *
+ * @param cache the cache
+ * @param name the filename
+ * @param fstats the file stats
+ */
+static void directory_cache_append(struct directory_cache * cache,
+                                   const char * name,
+                                   const struct stat * fstats) {
+    struct file_info * entry;
+
+    if (cache->entries_n == cache->entries_max) {
+        cache->entries_max *= 2;
+        cache->entries = (struct file_info **) Xrealloc(cache->entries,
+            sizeof(struct file_info *) * cache->entries_max,
+            __FILE__, __LINE__);
+    }
+    entry = (struct file_info *) Xmalloc(sizeof(struct file_info), __FILE__,
+                                         __LINE__);
+    entry->name = Xstrdup(name, __FILE__, __LINE__);
+    memcpy(&entry->fstats, fstats, sizeof(struct stat));
+    cache->entries[cache->entries_n] = entry;
+    cache->entries_n++;
+}
+
+/**
+ * Release everything in a directory cache slot.
+ *
+ * @param cache the cache
+ */
+static void directory_cache_free(struct directory_cache * cache) {
+    int i;
+
+    for (i = 0; i < cache->entries_n; i++) {
+        Xfree(cache->entries[i]->name, __FILE__, __LINE__);
+        Xfree(cache->entries[i], __FILE__, __LINE__);
+    }
+    if (cache->entries != NULL) {
+        Xfree(cache->entries, __FILE__, __LINE__);
+    }
+    if (cache->path != NULL) {
+        Xfree(cache->path, __FILE__, __LINE__);
+    }
+#ifdef __linux
+    if (cache->inotify_fd != -1) {
+        close(cache->inotify_fd);
+    }
+#endif
+    memset(cache, 0, sizeof(struct directory_cache));
+#ifdef __linux
+    cache->inotify_fd = -1;
+#endif
+}
+
+/**
+ * Read an entire directory into a cache slot.
+ *
+ * @param cache the cache, with path already set
+ * @return true if the directory could be read
+ */
+static Q_BOOL directory_cache_load(struct directory_cache * cache) {
+    DIR * directory = NULL;
+    struct dirent * dir_entry;
+    struct stat fstats;
+    int i;
+
+    for (i = 0; i < cache->entries_n; i++) {
+        Xfree(cache->entries[i]->name, __FILE__, __LINE__);
+        Xfree(cache->entries[i], __FILE__, __LINE__);
+    }
+    cache->entries_n = 0;
+    cache->dirs_n = 0;
+    if (cache->entries == NULL) {
+        cache->entries_max = 64;
+        cache->entries = (struct file_info **) Xmalloc(
+            sizeof(struct file_info *) * cache->entries_max,
+            __FILE__, __LINE__);
+    }
+
+    if (stat(cache->path, &fstats) == 0) {
+        cache->mtime = fstats.st_mtime;
+    }
+
+    directory = opendir(cache->path);
+    if (directory == NULL) {
+        return Q_FALSE;
+    }
+    for (dir_entry = readdir(directory); dir_entry != NULL;
+         dir_entry = readdir(directory)) {
+
+        if (directory_cache_stat(cache, dir_entry->d_name, &fstats) < 0) {
+            fprintf(stderr, "Can't stat %s: %s\n", dir_entry->d_name,
+                    strerror(errno));
+        }
+        directory_cache_append(cache, dir_entry->d_name, &fstats);
+        if (S_ISDIR(fstats.st_mode)) {
+            cache->dirs_n++;
+        }
+    }
+    closedir(directory);
+
+    /*
+     * Sort by filename, but put directories before files
+     */
+    qsort(cache->entries, cache->entries_n, sizeof(struct file_info *),
+          compare_file_info);
+
+    return Q_TRUE;
+}
+
+/**
+ * Bring one file in a directory cache up to date: remove its old entry and
+ * insert a new one in sorted position if it still exists.
+ *
+ * @param cache the cache
+ * @param name the filename that changed
+ */
+static void directory_cache_update(struct directory_cache * cache,
+                                   const char * name) {
+    struct file_info * entry;
+    struct stat fstats;
+    Q_BOOL found;
+    int i;
+
+    /*
+     * Remove the old entry, wherever it is
+     */
+    i = directory_cache_search(cache, 0, cache->dirs_n, name, &found);
+    if (found == Q_FALSE) {
+        i = directory_cache_search(cache, cache->dirs_n, cache->entries_n,
+                                   name, &found);
+    }
+    if (found == Q_TRUE) {
+        entry = cache->entries[i];
+        if (S_ISDIR(entry->fstats.st_mode)) {
+            cache->dirs_n--;
+        }
+        memmove(cache->entries + i, cache->entries + i + 1,
+                sizeof(struct file_info *) * (cache->entries_n - i - 1));
+        cache->entries_n--;
+        Xfree(entry->name, __FILE__, __LINE__);
+        Xfree(entry, __FILE__, __LINE__);
+    }
+
+    if (directory_cache_stat(cache, name, &fstats) < 0) {
+        /*
+         * File is gone
+         */
+        return;
+    }
+
+    /*
+     * Insert the new entry
+     */
+    directory_cache_append(cache, name, &fstats);
+    entry = cache->entries[cache->entries_n - 1];
+    if (S_ISDIR(fstats.st_mode)) {
+        i = directory_cache_search(cache, 0, cache->dirs_n, name, &found);
+        cache->dirs_n++;
+    } else {
+        i = directory_cache_search(cache, cache->dirs_n,
+                                   cache->entries_n - 1, name, &found);
+    }
+    memmove(cache->entries + i + 1, cache->entries + i,
+            sizeof(struct file_info *) * (cache->entries_n - i - 1));
+    cache->entries[i] = entry;
+}
+
+/**
+ * Check a directory cache against the filesystem, updating only the
+ * entries that changed if inotify is available.
  *
- * @pararm file_list the array
- * @param i the first entry index
- * @param j the second entry index
+ * @param cache the cache
+ * @return true if the cache is now current
  */
-static void swap_file_info(struct file_info * file_list, int i, int j) {
-    struct file_info temp;
-    memcpy(&temp, &file_list[i], sizeof(struct file_info));
-    memcpy(&file_list[i], &file_list[j], sizeof(struct file_info));
-    memcpy(&file_list[j], &temp, sizeof(struct file_info));
+static Q_BOOL directory_cache_refresh(struct directory_cache * cache) {
+    struct stat fstats;
+#ifdef __linux
+    char buffer[4096]
+        __attribute__ ((aligned(__alignof__(struct inotify_event))));
+    struct inotify_event * event;
+    ssize_t rc;
+    char * p;
+
+    if (cache->inotify_fd != -1) {
+        for (;;) {
+            rc = read(cache->inotify_fd, buffer, sizeof(buffer));
+            if (rc <= 0) {
+                /*
+                 * EAGAIN: no more changes
+                 */
+                return Q_TRUE;
+            }
+            for (p = buffer; p < buffer + rc;
+                 p += sizeof(struct inotify_event) + event->len) {
+
+                event = (struct inotify_event *) p;
+                if (event->mask & (IN_Q_OVERFLOW | IN_IGNORED |
+                        IN_DELETE_SELF | IN_MOVE_SELF)) {
+                    /*
+                     * Lost track, read it all again
+                     */
+                    close(cache->inotify_fd);
+                    cache->inotify_fd = inotify_init1(IN_NONBLOCK |
+                                                      IN_CLOEXEC);
+                    if (cache->inotify_fd != -1) {
+                        if (inotify_add_watch(cache->inotify_fd,
+                                cache->path, DIRECTORY_CACHE_EVENTS) < 0) {
+                            close(cache->inotify_fd);
+                            cache->inotify_fd = -1;
+                        }
+                    }
+                    return directory_cache_load(cache);
+                }
+                if (event->len > 0) {
+                    directory_cache_update(cache, event->name);
+                }
+            }
+        }
+    }
+#endif
+
+    /*
+     * No change notification, so fall back to the directory mtime.
+     */
+    if (stat(cache->path, &fstats) < 0) {
+        return Q_FALSE;
+    }
+    if (fstats.st_mtime != cache->mtime) {
+        return directory_cache_load(cache);
+    }
+    return Q_TRUE;
+}
+
+/**
+ * Read the contents of a directory, sorted with directories first and then
+ * by name.  The most recently used directories are cached and only the
+ * changes are re-read on the next call.
+ *
+ * @param path the directory name
+ * @param files_n the number of entries returned
+ * @return the entries, or NULL if the directory could not be read.  The
+ * returned array belongs to the cache and is valid until the next call to
+ * read_directory().
+ */
+struct file_info ** read_directory(const char * path, int * files_n) {
+    struct directory_cache * cache = NULL;
+    int i;
+
+    directory_cache_clock++;
+    *files_n = 0;
+
+    for (i = 0; i < DIRECTORY_CACHE_N; i++) {
+        if ((directory_caches[i].path != NULL) &&
+            (strcmp(directory_caches[i].path, path) == 0)
+        ) {
+            cache = &directory_caches[i];
+            if (directory_cache_refresh(cache) == Q_FALSE) {
+                directory_cache_free(cache);
+                return NULL;
+            }
+            break;
+        }
+    }
+
+    if (cache == NULL) {
+        /*
+         * Evict the least recently used directory
+         */
+        cache = &directory_caches[0];
+        for (i = 0; i < DIRECTORY_CACHE_N; i++) {
+            if (directory_caches[i].path == NULL) {
+                cache = &directory_caches[i];
+#ifdef __linux
+                cache->inotify_fd = -1;
+#endif
+                break;
+            }
+            if (directory_caches[i].last_used < cache->last_used) {
+                cache = &directory_caches[i];
+            }
+        }
+        if (cache->path != NULL) {
+            directory_cache_free(cache);
+        }
+        cache->path = Xstrdup(path, __FILE__, __LINE__);
+
+#ifdef __linux
+        /*
+         * Start watching before the read so that no change is missed.
+         */
+        cache->inotify_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+        if (cache->inotify_fd != -1) {
+            if (inotify_add_watch(cache->inotify_fd, path,
+                    DIRECTORY_CACHE_EVENTS) < 0) {
+                close(cache->inotify_fd);
+                cache->inotify_fd = -1;
+            }
+        }
+#endif
+
+        if (directory_cache_load(cache) == Q_FALSE) {
+            directory_cache_free(cache);
+            return NULL;
+        }
+    }
+
+    cache->last_used = directory_cache_clock;
+    *files_n = cache->entries_n;
+    return cache->entries;
 }
 
 /**
@@ -1544,21 +1989,19 @@ struct file_info * view_directory(const char * initial_directory,
     const char pathsep = '/';
 #endif
 
-    DIR * directory = NULL;
-    struct dirent * dir_entry;
     char * current_directory_name;
     int files_n = 0;
     int page_size;
     char * full_filename;
     struct file_info * return_file_info;
-    struct stat fstats;
+    struct stat selected_fstats;
 
     /*
-     * Deliberate: NULL to the first call to realloc() means malloc()
+     * The entries to display.  These point into the read_directory() cache.
      */
-    struct file_info * file_list = NULL;
-    int file_list_idx;
-    int swaps;
+    struct file_info ** file_list = NULL;
+    struct file_info ** directory_list;
+    int directory_list_n;
     Q_BOOL reload;
     Q_BOOL skip_hidden = Q_TRUE;
 
@@ -1596,9 +2039,6 @@ struct file_info * view_directory(const char * initial_directory,
          * Cleanup file_list if I reload
          */
         if (file_list != NULL) {
-            for (i = 0; i < files_n; i++) {
-                Xfree(file_list[i].name, __FILE__, __LINE__);
-            }
             Xfree(file_list, __FILE__, __LINE__);
             file_list = NULL;
         }
@@ -1606,9 +2046,9 @@ struct file_info * view_directory(const char * initial_directory,
         /*
          * Read directory
          */
-        assert(directory == NULL);
-        directory = opendir(current_directory_name);
-        if (directory == NULL) {
+        directory_list = read_directory(current_directory_name,
+                                        &directory_list_n);
+        if (directory_list == NULL) {
             snprintf(selection_buffer, sizeof(selection_buffer),
                      _("Error opening directory %s: %s"),
                      current_directory_name, strerror(errno));
@@ -1617,49 +2057,21 @@ struct file_info * view_directory(const char * initial_directory,
             return NULL;
         }
         files_n = 0;
+        file_list = (struct file_info **) Xmalloc(sizeof(struct file_info *) *
+                                                  (directory_list_n + 1),
+                                                  __FILE__, __LINE__);
 
-        dir_entry = readdir(directory);
-        while (dir_entry != NULL) {
-            char * full_filename;
-
-            /*
-             * Get the full filename
-             */
-            full_filename =
-                (char *) Xmalloc(strlen(dir_entry->d_name) +
-                                 strlen(current_directory_name) + 2, __FILE__,
-                                 __LINE__);
-            memset(full_filename, 0,
-                   strlen(dir_entry->d_name) + strlen(current_directory_name) +
-                   2);
-            memcpy(full_filename, current_directory_name,
-                   strlen(current_directory_name));
-            full_filename[strlen(current_directory_name)] = pathsep;
-            memcpy(full_filename + strlen(current_directory_name) + 1,
-                   dir_entry->d_name, strlen(dir_entry->d_name));
-            full_filename[strlen(dir_entry->d_name) +
-                          strlen(current_directory_name) + 1] = '\0';
-
-            /*
-             * Get the file stats
-             */
-#ifdef Q_PDCURSES_WIN32
-            if (stat(full_filename, &fstats) < 0) {
-#else
-            if (lstat(full_filename, &fstats) < 0) {
-#endif
-                fprintf(stderr, "Can't stat %s: %s\n", full_filename,
-                        strerror(errno));
-            }
-
+        /*
+         * read_directory() already sorted by filename with directories
+         * before files, so just pick out the ones to display.
+         */
+        for (i = 0; i < directory_list_n; i++) {
             /*
              * Skip over files that don't meet the filter
              */
-            if (match_by_filename(dir_entry->d_name, &fstats, filter) ==
-                Q_FALSE) {
-                dir_entry = readdir(directory);
-                Xfree(full_filename, __FILE__, __LINE__);
-                full_filename = NULL;
+            if (match_by_filename(directory_list[i]->name,
+                                  &directory_list[i]->fstats,
+                                  filter) == Q_FALSE) {
                 continue;
             }
 
@@ -1667,112 +2079,16 @@ struct file_info * view_directory(const char * initial_directory,
              * Skip over hidden files
              */
             if (skip_hidden == Q_TRUE) {
-                if (dir_entry->d_name[0] == '.') {
-                    if ((strcmp(dir_entry->d_name, ".") != 0)
-                        && (strcmp(dir_entry->d_name, "..") != 0)) {
-                        dir_entry = readdir(directory);
-                        Xfree(full_filename, __FILE__, __LINE__);
-                        full_filename = NULL;
+                if (directory_list[i]->name[0] == '.') {
+                    if ((strcmp(directory_list[i]->name, ".") != 0)
+                        && (strcmp(directory_list[i]->name, "..") != 0)) {
                         continue;
                     }
                 }
             }
 
-            /*
-             * Save this filename
-             */
-            file_list =
-                (struct file_info *) Xrealloc(file_list,
-                                              sizeof(struct file_info) *
-                                              (files_n + 1), __FILE__,
-                                              __LINE__);
-            memset(&file_list[files_n], 0, sizeof(struct file_info));
-            file_list[files_n].name =
-                Xstrdup(dir_entry->d_name, __FILE__, __LINE__);
-
-            /*
-             * Save the file stats
-             */
-            memcpy(&file_list[files_n].fstats, &fstats, sizeof(struct stat));
-
-            /*
-             * Increment file_list size
-             */
+            file_list[files_n] = directory_list[i];
             files_n++;
-
-            /*
-             * Get next entry
-             */
-            dir_entry = readdir(directory);
-            Xfree(full_filename, __FILE__, __LINE__);
-            full_filename = NULL;
-        }
-        assert(directory != NULL);
-        closedir(directory);
-        directory = NULL;
-
-        /*
-         * Sort by filename, but put directories before files
-         */
-        swaps = 1;
-        while (swaps > 0) {
-            swaps = 0;
-            for (file_list_idx = 0; file_list_idx < files_n - 1;
-                 file_list_idx++) {
-
-                if (!S_ISDIR(file_list[file_list_idx].fstats.st_mode) &&
-                    S_ISDIR(file_list[file_list_idx + 1].fstats.st_mode)
-                ) {
-                    /*
-                     * Swap
-                     */
-                    swap_file_info(file_list, file_list_idx, file_list_idx + 1);
-                    swaps++;
-                    file_list_idx -= 2;
-                    if (file_list_idx < 0) {
-                        file_list_idx = 0;
-                    }
-                    continue;
-                }
-                if (S_ISDIR(file_list[file_list_idx].fstats.st_mode) &&
-                    S_ISDIR(file_list[file_list_idx + 1].fstats.st_mode)
-                ) {
-                    if (strcmp
-                        (file_list[file_list_idx].name,
-                         file_list[file_list_idx + 1].name) > 0) {
-                        /*
-                         * Swap
-                         */
-                        swap_file_info(file_list, file_list_idx,
-                                       file_list_idx + 1);
-                        swaps++;
-                        file_list_idx -= 2;
-                        if (file_list_idx < 0) {
-                            file_list_idx = 0;
-                        }
-                    }
-                    continue;
-                }
-                if (!S_ISDIR(file_list[file_list_idx].fstats.st_mode) &&
-                    !S_ISDIR(file_list[file_list_idx + 1].fstats.st_mode)
-                ) {
-                    if (strcmp
-                        (file_list[file_list_idx].name,
-                         file_list[file_list_idx + 1].name) > 0) {
-                        /*
-                         * Swap
-                         */
-                        swap_file_info(file_list, file_list_idx,
-                                       file_list_idx + 1);
-                        swaps++;
-                        file_list_idx -= 2;
-                        if (file_list_idx < 0) {
-                            file_list_idx = 0;
-                        }
-                    }
-                    continue;
-                }
-            }
         }
 
         /*
@@ -1827,9 +2143,6 @@ struct file_info * view_directory(const char * initial_directory,
              * No leak
              */
             if (file_list != NULL) {
-                for (i = 0; i < files_n; i++) {
-                    Xfree(file_list[i].name, __FILE__, __LINE__);
-                }
                 Xfree(file_list, __FILE__, __LINE__);
                 file_list = NULL;
             }
@@ -1873,7 +2186,7 @@ struct file_info * view_directory(const char * initial_directory,
             for (i = 0; (i < page_size) && (i + page_offset < files_n); i++) {
 
                 snprintf(selection_buffer, sizeof(selection_buffer), " %s",
-                         file_list[page_offset + i].name);
+                         file_list[page_offset + i]->name);
 
                 /*
                  * Name
@@ -1890,7 +2203,7 @@ struct file_info * view_directory(const char * initial_directory,
                 /*
                  * Size or <dir>
                  */
-                if (S_ISDIR(file_list[page_offset + i].fstats.st_mode)) {
+                if (S_ISDIR(file_list[page_offset + i]->fstats.st_mode)) {
                     /*
                      * Directory
                      */
@@ -1903,7 +2216,7 @@ struct file_info * view_directory(const char * initial_directory,
                     snprintf(selection_buffer + strlen(selection_buffer),
                              sizeof(selection_buffer), "%12lu",
                              (unsigned long) file_list[page_offset +
-                                                       i].fstats.st_size);
+                                                       i]->fstats.st_size);
                 }
 
                 /*
@@ -1911,7 +2224,7 @@ struct file_info * view_directory(const char * initial_directory,
                  */
                 strftime(selection_buffer + strlen(selection_buffer),
                          sizeof(selection_buffer), "  %d/%b/%Y %H:%M:%S",
-                         localtime(&file_list[page_offset + i].fstats.
+                         localtime(&file_list[page_offset + i]->fstats.
                                    st_mtime));
 
                 /*
@@ -1919,7 +2232,7 @@ struct file_info * view_directory(const char * initial_directory,
                  */
                 snprintf(selection_buffer + strlen(selection_buffer),
                          sizeof(selection_buffer), " %s",
-                         file_mode_string(file_list[page_offset + i].fstats.
+                         file_mode_string(file_list[page_offset + i]->fstats.
                                           st_mode));
 
                 if (strlen(selection_buffer) < window_length - 3) {
@@ -2015,9 +2328,6 @@ struct file_info * view_directory(const char * initial_directory,
                  * No leak
                  */
                 if (file_list != NULL) {
-                    for (i = 0; i < files_n; i++) {
-                        Xfree(file_list[i].name, __FILE__, __LINE__);
-                    }
                     Xfree(file_list, __FILE__, __LINE__);
                     file_list = NULL;
                 }
@@ -2085,13 +2395,13 @@ struct file_info * view_directory(const char * initial_directory,
 
             case Q_KEY_ENTER:
 
-                if (strcmp(file_list[selected_field].name, ".") == 0) {
+                if (strcmp(file_list[selected_field]->name, ".") == 0) {
                     /*
                      * Special case: '.'
                      */
                     full_filename =
                         Xstrdup(current_directory_name, __FILE__, __LINE__);
-                } else if (strcmp(file_list[selected_field].name, "..") == 0) {
+                } else if (strcmp(file_list[selected_field]->name, "..") == 0) {
                     /*
                      * Special case: '..'
                      */
@@ -2114,53 +2424,54 @@ struct file_info * view_directory(const char * initial_directory,
                          */
                         full_filename =
                             (char *)
-                            Xmalloc(strlen(file_list[selected_field].name) + 2,
+                            Xmalloc(strlen(file_list[selected_field]->name) + 2,
                                     __FILE__, __LINE__);
                         memset(full_filename, 0,
-                               strlen(file_list[selected_field].name) + 2);
+                               strlen(file_list[selected_field]->name) + 2);
                         full_filename[0] = pathsep;
                         memcpy(full_filename + 1,
-                               file_list[selected_field].name,
-                               strlen(file_list[selected_field].name));
-                        full_filename[strlen(file_list[selected_field].name) +
+                               file_list[selected_field]->name,
+                               strlen(file_list[selected_field]->name));
+                        full_filename[strlen(file_list[selected_field]->name) +
                                       1] = '\0';
 
                     } else {
 
                         full_filename =
                             (char *)
-                            Xmalloc(strlen(file_list[selected_field].name) +
+                            Xmalloc(strlen(file_list[selected_field]->name) +
                                     strlen(current_directory_name) + 2,
                                     __FILE__, __LINE__);
                         memset(full_filename, 0,
-                               strlen(file_list[selected_field].name) +
+                               strlen(file_list[selected_field]->name) +
                                strlen(current_directory_name) + 2);
                         memcpy(full_filename, current_directory_name,
                                strlen(current_directory_name));
                         full_filename[strlen(current_directory_name)] = pathsep;
                         memcpy(full_filename + strlen(current_directory_name) +
-                               1, file_list[selected_field].name,
-                               strlen(file_list[selected_field].name));
-                        full_filename[strlen(file_list[selected_field].name) +
+                               1, file_list[selected_field]->name,
+                               strlen(file_list[selected_field]->name));
+                        full_filename[strlen(file_list[selected_field]->name) +
                                       strlen(current_directory_name) + 1] =
                             '\0';
 
                     }
                 }
 
+                memcpy(&selected_fstats, &file_list[selected_field]->fstats,
+                       sizeof(struct stat));
 #ifndef Q_PDCURSES_WIN32
-                if (S_ISLNK(file_list[selected_field].fstats.st_mode)) {
+                if (S_ISLNK(selected_fstats.st_mode)) {
                     /*
                      * Follow symlink to underlying file or directory
                      */
-                    if (stat(full_filename, &file_list[selected_field].fstats) <
-                        0) {
+                    if (stat(full_filename, &selected_fstats) < 0) {
                         goto exit_view_directory;
                     }
                 }
 #endif
 
-                if (S_ISDIR(file_list[selected_field].fstats.st_mode)) {
+                if (S_ISDIR(selected_fstats.st_mode)) {
                     /*
                      * Switch directory
                      */
@@ -2209,8 +2520,8 @@ exit_view_directory:
                         (struct file_info *) Xmalloc(sizeof(struct file_info),
                                                      __FILE__, __LINE__);
                     memset(return_file_info, 0, sizeof(struct file_info));
-                    memcpy(return_file_info, &file_list[selected_field],
-                           sizeof(struct file_info));
+                    memcpy(&return_file_info->fstats, &selected_fstats,
+                           sizeof(struct stat));
                     return_file_info->name = full_filename;
 
                     /*
@@ -2238,9 +2549,6 @@ exit_view_directory:
                      * No leak
                      */
                     if (file_list != NULL) {
-                        for (i = 0; i < files_n; i++) {
-                            Xfree(file_list[i].name, __FILE__, __LINE__);
-                        }
                         Xfree(file_list, __FILE__, __LINE__);
                         file_list = NULL;
                     }
@@ -2270,24 +2578,24 @@ exit_view_directory:
                             i = 0;
                             continue;
                         }
-                        if ((strcmp(file_list[i].name, ".") == 0)
-                            || (strcmp(file_list[i].name, "..") == 0)) {
+                        if ((strcmp(file_list[i]->name, ".") == 0)
+                            || (strcmp(file_list[i]->name, "..") == 0)) {
                             /*
                              * Don't look at '.' or '..'
                              */
                             i++;
                             continue;
                         }
-                        if (tolower(file_list[i].name[0]) ==
+                        if (tolower(file_list[i]->name[0]) ==
                             tolower(keystroke & 0x7F)) {
                             /*
                              * Found match on first character
                              */
                             break;
                         }
-                        if (strlen(file_list[i].name) >= 2) {
-                            if ((file_list[i].name[0] == '.')
-                                && (tolower(file_list[i].name[1]) ==
+                        if (strlen(file_list[i]->name) >= 2) {
+                            if ((file_list[i]->name[0] == '.')
+                                && (tolower(file_list[i]->name[1]) ==
                                     tolower(keystroke & 0x7F))) {
                                 /*
                                  * Found match on first character past dot
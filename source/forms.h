@@ -155,6 +155,19 @@ extern struct file_info * view_directory(const char * initial_directory,
 extern struct file_info * batch_entry_window(const char * initial_directory,
                                              const Q_BOOL upload);
 
+/**
+ * Read the contents of a directory, sorted with directories first and then
+ * by name.  The most recently used directories are cached and only the
+ * changes are re-read on the next call.
+ *
+ * @param path the directory name
+ * @param files_n the number of entries returned
+ * @return the entries, or NULL if the directory could not be read.  The
+ * returned array belongs to the cache and is valid until the next call to
+ * read_directory().
+ */
+extern struct file_info ** read_directory(const char * path, int * files_n);
+
 /**
  * Convert a mode value into a displayable string similar to the first column
  * of the ls long format (-l).  Note that the string returned is a single
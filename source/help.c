@@ -90,11 +90,47 @@ struct help_topic {
     struct help_link ** links;
     int links_n;
     struct help_topic * next;
+    struct help_topic * hash_next;
 };
 
 /* The global list of help topics. */
 static struct help_topic * TOPICS = NULL;
 
+/* Topics hashed by key for find_topic(). */
+#define HELP_TOPIC_HASH_SIZE 128
+static struct help_topic * topics_hash[HELP_TOPIC_HASH_SIZE];
+
+/* Whether or not setup_help() has run. */
+static Q_BOOL help_loaded = Q_FALSE;
+
+/**
+ * Hash a topic key.
+ *
+ * @param key the topic key
+ * @return the bucket in topics_hash
+ */
+static unsigned int topic_key_hash(const char * key) {
+    unsigned int hash = 5381;
+    for (; *key != 0; key++) {
+        hash = (hash * 33) ^ (unsigned char) *key;
+    }
+    return hash % HELP_TOPIC_HASH_SIZE;
+}
+
+/**
+ * Set a topic's key and add it to topics_hash.
+ *
+ * @param topic the topic
+ * @param key the topic key.  This is not copied.
+ */
+static void set_topic_key(struct help_topic * topic, char * key) {
+    unsigned int bucket = topic_key_hash(key);
+
+    topic->key = key;
+    topic->hash_next = topics_hash[bucket];
+    topics_hash[bucket] = topic;
+}
+
 /**
  * Find a topic in the list.
  *
@@ -102,14 +138,14 @@ static struct help_topic * TOPICS = NULL;
  * @return the help_topic entry
  */
 static struct help_topic * find_topic(const char * key) {
-    struct help_topic *topic = TOPICS;
+    struct help_topic *topic = topics_hash[topic_key_hash(key)];
     DLOG(("find_topic: look for %s\n", key));
     while (topic != NULL) {
         if (strcmp(topic->key, key) == 0) {
             DLOG(("find_topic: found %ls\n", topic->title));
             return topic;
         }
-        topic = topic->next;
+        topic = topic->hash_next;
     }
 
     DLOG(("find_topic: NOT FOUND\n"));
@@ -478,6 +514,19 @@ static void build_options_topic() {
 
 }
 
+/**
+ * qsort() comparison function for help links, by topic key.
+ *
+ * @param a pointer to the first help_link pointer
+ * @param b pointer to the second help_link pointer
+ * @return the strcmp() of the topic keys
+ */
+static int compare_help_links(const void * a, const void * b) {
+    const struct help_link * link_a = *((const struct help_link **) a);
+    const struct help_link * link_b = *((const struct help_link **) b);
+    return strcmp(link_a->topic_key, link_b->topic_key);
+}
+
 /**
  * Generate a help index based on the existing topics and links.
  */
@@ -555,22 +604,8 @@ static void build_help_index() {
      * Now I have an array of link pointers.  Sort and uniq it.
      */
 
-    /*
-     * In-place bubble sort
-     */
-    for (i = 0; i < index_links_n; i++) {
-        for (j = i; j < index_links_n; j++) {
-            link = index_links[i];
-            link2 = index_links[j];
-            if (strcmp(link->topic_key, link2->topic_key) > 0) {
-                /*
-                 * Swap
-                 */
-                index_links[i] = link2;
-                index_links[j] = link;
-            }
-        }
-    }
+    qsort(index_links, index_links_n, sizeof(struct help_link *),
+          compare_help_links);
 
     DLOG(("HELP INDEX SORTED:\n"));
     for (i = 0; i < index_links_n; i++) {
@@ -582,20 +617,16 @@ static void build_help_index() {
     /*
      * In-place uniq
      */
-    for (i = 0; i < index_links_n - 1; i++) {
-        link = index_links[i];
-        link2 = index_links[i + 1];
-        if (strcmp(link->topic_key, link2->topic_key) == 0) {
-            /*
-             * Toss link2
-             */
-            memmove(&index_links[i], &index_links[i + 1],
-                    sizeof(struct help_link *) * (index_links_n - i - 1));
-            index_links_n--;
-            if (i >= 0) {
-                i--;
+    if (index_links_n > 0) {
+        j = 1;
+        for (i = 1; i < index_links_n; i++) {
+            if (strcmp(index_links[i]->topic_key,
+                       index_links[j - 1]->topic_key) != 0) {
+                index_links[j] = index_links[i];
+                j++;
             }
         }
+        index_links_n = j;
     }
 
     DLOG(("HELP INDEX UNIQ:\n"));
@@ -608,7 +639,7 @@ static void build_help_index() {
      * Finally, build the index topic itself.
      */
     topic_index = new_topic();
-    topic_index->key = HELP_INDEX_KEY;
+    set_topic_key(topic_index, HELP_INDEX_KEY);
     topic_index->title = L"Index";
     line_number = 0;
 
@@ -636,7 +667,8 @@ static void build_help_index() {
 }
 
 /**
- * Parse raw_help_text into data structures to feed help_handler().
+ * Parse raw_help_text into data structures to feed help_handler().  This
+ * only does work the first time it is called.
  */
 void setup_help() {
 
@@ -665,6 +697,11 @@ void setup_help() {
     int rc;
     unsigned int i;
 
+    if (help_loaded == Q_TRUE) {
+        return;
+    }
+    help_loaded = Q_TRUE;
+
     DLOG(("HELP: setup_help()\n"));
 
     /*
@@ -770,7 +807,7 @@ void setup_help() {
                 memset(title_wcs, 0, sizeof(title_wcs));
                 convert_unicode(title, title_wcs);
                 topic = new_topic();
-                topic->key = Xstrdup(key, __FILE__, __LINE__);
+                set_topic_key(topic, Xstrdup(key, __FILE__, __LINE__));
                 topic->title = Xwcsdup(title_wcs, __FILE__, __LINE__);
 
 
@@ -1472,6 +1509,11 @@ reload:
  * @param help_screen the screen to start with
  */
 void launch_help(Q_HELP_SCREEN help_screen) {
+    /*
+     * The help text is only parsed the first time it is needed.
+     */
+    setup_help();
+
     switch (help_screen) {
     case Q_HELP_PHONEBOOK:
         help_handler(HELP_PHONEBOOK_KEY);
@@ -1643,7 +1685,9 @@ char * raw_help_text = \
 "characters after emulation processing; \"html\" saves in HTML format\n"
 "with Unicode entities and color attributes after emulation processing;\n"
 "\"ask\" will bring up a dialog to select which format to use every time\n"
-"the scrollback is saved.\n"
+"the scrollback is saved.  @BOLD{F} finds text and @BOLD{A} finds it again;\n"
+"searches are case-insensitive.  On systems other than Windows, a search\n"
+"string written as /pattern/ is a POSIX extended regular expression.\n"
 "\n"
 "@BOLD{Alt-H} Hangup/Close\n"
 "This hangs up the modem (drops DTR) or closes the remote connection\n"
@@ -2243,9 +2287,10 @@ char * raw_help_text = \
 " mouse API.  Mouse clicks however do work.\n"
 "\n"
 "@TOPIC{REFERENCE_03_SCRIPT,Reference - Script Support}\n"
-"Qodem does not have its own scripting language.  Instead, any\n"
-"program that reads and writes to the standard input and output can\n"
-"be run as a Qodem script:\n"
+"Qodem has only a very small scripting language of its own, for\n"
+"simple logon scripts (see below).  Beyond that, any program that\n"
+"reads and writes to the standard input and output can be run as a\n"
+"Qodem script:\n"
 "\n"
 "  * Characters sent from the remote connection are visible to the\n"
 "    script in its standard input.\n"
@@ -2308,6 +2353,31 @@ char * raw_help_text = \
 "my_script.pl and with its first command-line argument ($ARGV[0] in\n"
 "Perl) set to \"arg1\".\n"
 "\n"
+"Scripts whose filename ends in \".qsc\" are run by Qodem itself rather\n"
+"than as a separate program.  They watch the remote data directly, so\n"
+"they are lighter and faster than an external script for the usual\n"
+"wait-and-reply logon.  Each line holds one command; lines starting\n"
+"with \"#\" are comments:\n"
+"\n"
+"    send \"text\"                       Send text to the remote side\n"
+"    waitfor \"text\" [seconds [label]]  Wait for text from the remote\n"
+"    regex \"pattern\" [seconds [label]] Wait for a POSIX extended regex\n"
+"    pause seconds                     Wait a while\n"
+"    print \"text\"                      Show text in the script messages\n"
+"    label name                        Mark a place for goto\n"
+"    goto name                         Continue at label name\n"
+"    exit [code]                       Stop with exit code (default 0)\n"
+"\n"
+"Text may use \\r, \\n, \\t, \\e, \\\\, \\\", and \\xHH escapes.  A wait\n"
+"that times out continues at its label, or stops the script with exit\n"
+"code 1 if it has no label.  A wait with no timeout waits forever.\n"
+"For example:\n"
+"\n"
+"    waitfor \"login: \" 30\n"
+"    send \"me\\r\"\n"
+"    waitfor \"assword: \" 10\n"
+"    send \"secret\\r\"\n"
+"\n"
 "@TOPIC{REFERENCE_04_TRANSLATE,Reference - Translate Tables}\n"
 "Qodem has a slightly different method for translating bytes and\n"
 "Unicode code points than Qmodem's @BOLD{Alt-A} Translate Table function.\n"
@@ -2795,6 +2865,10 @@ char * raw_help_text = \
 "@BOLD{--geometry} COLSxROWS\n"
 "    Request text window size COLS x ROWS.\n"
 "\n"
+"@BOLD{--profile-startup}\n"
+"    When Qodem exits, report to standard error how long each subsystem\n"
+"    took to initialize at startup.\n"
+"\n"
 "@BOLD{--dial} N\n"
 "    Immediately open a connection to the phone book entry number N.  The\n"
 "    first phone book entry has n=1.\n"
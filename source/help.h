@@ -52,8 +52,9 @@ typedef enum {
 /* Functions -------------------------------------------------------------- */
 
 /**
- * This must be called to initialize the help screens from the long raw help
- * text string.
+ * Initialize the help screens from the long raw help text string.
+ * launch_help() calls this on first use, so it need not be called at
+ * startup.
  */
 extern void setup_help();
 
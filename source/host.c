@@ -31,6 +31,11 @@
 #include <assert.h>
 #include <stdlib.h>
 #include <errno.h>
+#include <fcntl.h>
+#ifndef Q_PDCURSES_WIN32
+#  include <sys/mman.h>
+#  include <unistd.h>
+#endif
 #if defined(Q_PDCURSES_WIN32) && !defined(__BORLANDC__)
 #  include <windows.h>
 #  include <shlwapi.h>
@@ -56,6 +61,14 @@ static const char * DLOGNAME = NULL;
 /* The file in ~/qodem/hosts that stores user-generated messages. */
 #define MESSAGE_FILENAME "messages.txt"
 
+/* The file in ~/qodem/hosts that indexes MESSAGE_FILENAME. */
+#define MESSAGE_INDEX_FILENAME "messages.idx"
+
+#define MESSAGE_INDEX_MAGIC             0x58444951      /* "QIDX" */
+#define MESSAGE_INDEX_VERSION           1
+#define MESSAGE_INDEX_NAME_LENGTH       32
+#define MESSAGE_FLAG_DELETED            0x01
+
 /**
  * The available host mode functions.
  */
@@ -142,6 +155,7 @@ static void upload_file_ymodem();
 static void upload_file_zmodem();
 static void upload_file_kermit();
 static void enter_message_finish_menu();
+static void compact_message_base();
 
 /**
  * The state transition table
@@ -248,9 +262,58 @@ static wchar_t * msg_to = NULL;
 static wchar_t ** msg_body = NULL;
 static int msg_body_n = 0;
 
-/* The messages list supporting the read messages function. */
-static wchar_t *** all_messages = NULL;
-static int all_messages_n = 0;
+/**
+ * One message in the messages file index.  The index file is a
+ * message_index_header followed by one of these per message, in the same
+ * order as the messages file.  Deleting a message sets
+ * MESSAGE_FLAG_DELETED; the text is removed by compact_message_base().
+ */
+struct message_index_entry {
+    /**
+     * Offset in the messages file of the line after the "." separator.
+     */
+    uint32_t offset;
+
+    /**
+     * Number of bytes in the message, up to the next "." separator.
+     */
+    uint32_t length;
+
+    /**
+     * MESSAGE_FLAG_* bits.
+     */
+    uint32_t flags;
+
+    /**
+     * The From: field, UTF-8, null-terminated.
+     */
+    char from[MESSAGE_INDEX_NAME_LENGTH];
+
+    /**
+     * The To: field, UTF-8, null-terminated.
+     */
+    char to[MESSAGE_INDEX_NAME_LENGTH];
+};
+
+/**
+ * The index file header.
+ */
+struct message_index_header {
+    uint32_t magic;
+    uint32_t version;
+};
+
+/* The message base supporting the read messages function. */
+static Q_BOOL message_base_open = Q_FALSE;
+static char * message_text = NULL;
+static size_t message_text_length = 0;
+static struct message_index_entry * message_index = NULL;
+static int message_index_n = 0;
+static int message_index_max = 0;
+
+/* Maps message number to message_index slot, skipping deleted messages. */
+static int * live_messages = NULL;
+static int live_messages_n = 0;
 static int current_message = 0;
 
 /**
@@ -378,6 +441,7 @@ static void reset_host() {
  * @param count the number of bytes in buffer
  */
 static void host_write(char * buffer, int count) {
+    unsigned char ch;
     int i;
     if (host_online == Q_TRUE) {
         qodem_write(q_child_tty_fd, buffer, count, Q_TRUE);
@@ -393,12 +457,8 @@ static void host_write(char * buffer, int count) {
                  * Raw - use the translation map here because it will match
                  * what went out on the wire.
                  */
-                fprintf(q_status.capture_file, "%c",
-                    translate_8bit_out(buffer[i]));
-                if (q_status.capture_flush_time < time(NULL)) {
-                    fflush(q_status.capture_file);
-                    q_status.capture_flush_time = time(NULL);
-                }
+                ch = translate_8bit_out(buffer[i]);
+                capture_write(&ch, 1);
             }
         }
 
@@ -464,6 +524,13 @@ void host_start(Q_HOST_TYPE type, const char * port) {
     case Q_HOST_TYPE_TELNETD:
 #ifdef Q_SSH_CRYPTLIB
     case Q_HOST_TYPE_SSHD:
+        if (type == Q_HOST_TYPE_SSHD) {
+            /*
+             * Make the server key now if it is missing, rather than while
+             * the first caller is waiting on the handshake.
+             */
+            ssh_create_server_key();
+        }
 #endif
 
 #ifdef Q_UPNP
@@ -624,6 +691,11 @@ static void host_stop() {
 
     host_online = Q_FALSE;
     q_host_active = Q_FALSE;
+
+    /*
+     * Now that no one is reading messages, purge the deleted ones.
+     */
+    compact_message_base();
 }
 
 /**
@@ -943,230 +1015,558 @@ static void kill_message() {
     main_menu();
 }
 
-/* Save a message to the message file */
-static void save_message() {
-    FILE * file;
+/**
+ * Build the full path to a file in the host directory.
+ *
+ * @param name the filename, e.g. MESSAGE_FILENAME
+ * @return a newly-allocated string containing the full path
+ */
+static char * host_dir_filename(const char * name) {
     char * filename;
-    char notify_message[DIALOG_MESSAGE_SIZE];
-    int i;
+    const char * host_dir = get_option(Q_OPTION_HOST_DIR);
 
-    filename = (char *) Xmalloc(strlen(MESSAGE_FILENAME) +
-                                strlen(get_option(Q_OPTION_HOST_DIR)) + 2,
+    filename = (char *) Xmalloc(strlen(name) + strlen(host_dir) + 2,
                                 __FILE__, __LINE__);
-    memset(filename, 0,
-           strlen(MESSAGE_FILENAME) + strlen(get_option(Q_OPTION_HOST_DIR)) +
-           2);
-    strncpy(filename, get_option(Q_OPTION_HOST_DIR),
-            strlen(get_option(Q_OPTION_HOST_DIR)));
-    filename[strlen(filename)] = '/';
-    strncpy(filename + strlen(filename), MESSAGE_FILENAME,
-            strlen(MESSAGE_FILENAME));
+    sprintf(filename, "%s/%s", host_dir, name);
+    return filename;
+}
 
-    /*
-     * Append to file
-     */
-    file = fopen(filename, "a");
-    if (file == NULL) {
-        snprintf(notify_message, sizeof(notify_message),
-                 _("Error opening file \"%s\" for writing: %s"),
-                 filename, strerror(errno));
-        host_write(notify_message, strlen(notify_message));
-        return;
+/**
+ * Copy a message header field (From: or To:) into a fixed-width index
+ * field, truncating on a UTF-8 character boundary.
+ *
+ * @param field the index field to fill
+ * @param value the start of the value in the message text
+ * @param length the number of bytes in value
+ */
+static void set_index_name(char * field, const char * value, size_t length) {
+    while ((length > 0) && q_isspace(value[length - 1])) {
+        length--;
+    }
+    if (length > MESSAGE_INDEX_NAME_LENGTH - 1) {
+        length = MESSAGE_INDEX_NAME_LENGTH - 1;
+        while ((length > 0) && ((value[length] & 0xC0) == 0x80)) {
+            length--;
+        }
     }
+    memset(field, 0, MESSAGE_INDEX_NAME_LENGTH);
+    memcpy(field, value, length);
+}
 
-    /*
-     * Emit message to file
-     */
-    /*
-     * Single period is the message separator since it cannot be entered in
-     * the line editor.
-     */
-    fprintf(file, ".\n");
-    fprintf(file, "From: %ls\n", msg_from);
-    fprintf(file, "To:   %ls\n", msg_to);
-    fprintf(file, "----------------------------------------\n");
-    for (i = 0; i < msg_body_n; i++) {
-        fprintf(file, "%ls\n", msg_body[i]);
+/**
+ * Append one entry to the in-memory message index.
+ *
+ * @param entry the entry to append
+ */
+static void append_index_entry(const struct message_index_entry * entry) {
+    if (message_index_n == message_index_max) {
+        if (message_index_max == 0) {
+            message_index_max = 64;
+        } else {
+            message_index_max *= 2;
+        }
+        message_index = (struct message_index_entry *)
+            Xrealloc(message_index,
+                     sizeof(struct message_index_entry) * message_index_max,
+                     __FILE__, __LINE__);
     }
-    fprintf(file, "----------------------------------------\n");
+    message_index[message_index_n] = *entry;
+    message_index_n++;
+}
 
-    /*
-     * All done
-     */
-    fclose(file);
+/**
+ * Scan a region of the messages file for messages and append them to the
+ * in-memory index.  This is only needed when the index is missing or was
+ * not updated by the last writer (e.g. messages.txt was edited by hand).
+ *
+ * @param text the messages file contents
+ * @param start the offset to begin scanning at.  This must be the beginning
+ * of a line.
+ * @param end the offset to stop scanning at
+ */
+static void scan_messages(const char * text, size_t start, size_t end) {
+    struct message_index_entry entry;
+    Q_BOOL in_message = Q_FALSE;
+    const char * line;
+    const char * eol;
+    const char * begin;
+    size_t line_length;
+    size_t pos = start;
+
+    memset(&entry, 0, sizeof(entry));
+
+    while (pos < end) {
+        line = text + pos;
+        eol = memchr(line, '\n', end - pos);
+        if (eol == NULL) {
+            eol = text + end;
+        }
+        line_length = eol - line;
 
-    /*
-     * No leak
-     */
-    Xfree(filename, __FILE__, __LINE__);
+        begin = line;
+        while ((line_length > 0) && q_isspace(begin[line_length - 1])) {
+            line_length--;
+        }
+        while ((line_length > 0) && q_isspace(*begin)) {
+            begin++;
+            line_length--;
+        }
 
-    /*
-     * Reset message state
-     */
-    kill_message();
+        if ((line_length == 1) && (*begin == '.')) {
+            /*
+             * Single period is the message separator.
+             */
+            if (in_message == Q_TRUE) {
+                entry.length = (uint32_t) (line - text) - entry.offset;
+                append_index_entry(&entry);
+                memset(&entry, 0, sizeof(entry));
+            }
+            in_message = Q_TRUE;
+            entry.offset = (uint32_t) (eol - text);
+            if (entry.offset < end) {
+                entry.offset++;
+            }
+        } else if (in_message == Q_TRUE) {
+            if ((line_length >= 5) && (strncmp(begin, "From:", 5) == 0)
+                && (entry.from[0] == 0)
+            ) {
+                begin += 5;
+                line_length -= 5;
+                while ((line_length > 0) && q_isspace(*begin)) {
+                    begin++;
+                    line_length--;
+                }
+                set_index_name(entry.from, begin, line_length);
+            } else if ((line_length >= 3) && (strncmp(begin, "To:", 3) == 0)
+                && (entry.to[0] == 0)
+            ) {
+                begin += 3;
+                line_length -= 3;
+                while ((line_length > 0) && q_isspace(*begin)) {
+                    begin++;
+                    line_length--;
+                }
+                set_index_name(entry.to, begin, line_length);
+            }
+        }
 
-    /*
-     * Re-display the main menu
-     */
-    main_menu();
+        pos = (eol - text);
+        if (pos < end) {
+            pos++;
+        }
+    }
+
+    if (in_message == Q_TRUE) {
+        entry.length = (uint32_t) end - entry.offset;
+        append_index_entry(&entry);
+    }
 }
 
-/* Clear messages from memory */
-static void clear_all_messages() {
-    int message_i;
-    int line_i;
-    wchar_t ** message;
-    wchar_t * line;
-    if (all_messages != NULL) {
-        assert(all_messages_n > 0);
-        for (message_i = 0; message_i < all_messages_n; message_i++) {
-            message = all_messages[message_i];
-            line_i = 0;
-            line = message[line_i];
-            while (line != NULL) {
-                Xfree(line, __FILE__, __LINE__);
-                line_i++;
-                line = message[line_i];
+/**
+ * Load the message index from disk.  If it is missing or does not match
+ * the messages file, it is rebuilt (or extended) by scanning the messages
+ * file.
+ *
+ * @param text the messages file contents
+ * @param text_length the number of bytes in text
+ */
+static void load_message_index(const char * text, const size_t text_length) {
+    struct message_index_header header;
+    struct message_index_entry entry;
+    char * filename;
+    FILE * file;
+    size_t indexed_length = 0;
+    int old_message_index_n;
+    Q_BOOL rebuild = Q_FALSE;
+    int i;
+
+    filename = host_dir_filename(MESSAGE_INDEX_FILENAME);
+    file = fopen(filename, "rb");
+    if (file != NULL) {
+        if ((fread(&header, sizeof(header), 1, file) == 1) &&
+            (header.magic == MESSAGE_INDEX_MAGIC) &&
+            (header.version == MESSAGE_INDEX_VERSION)
+        ) {
+            while (fread(&entry, sizeof(entry), 1, file) == 1) {
+                append_index_entry(&entry);
             }
-            Xfree(message, __FILE__, __LINE__);
-            message_i++;
         }
+        fclose(file);
+    }
+
+    /*
+     * Every entry must lie inside the messages file, in order.  An index
+     * left over from another messages file (or a damaged one) is rebuilt
+     * rather than trusted.
+     */
+    for (i = 0; i < message_index_n; i++) {
+        if ((message_index[i].offset > text_length) ||
+            (message_index[i].length > text_length - message_index[i].offset)
+            || ((i > 0) && (message_index[i].offset <
+                    message_index[i - 1].offset + message_index[i - 1].length))
+        ) {
+            DLOG(("load_message_index(): entry %d is bad, rebuilding\n", i));
+            message_index_n = 0;
+            rebuild = Q_TRUE;
+            break;
+        }
+    }
+
+    if (message_index_n > 0) {
+        indexed_length = message_index[message_index_n - 1].offset +
+            message_index[message_index_n - 1].length;
+    }
+    if ((indexed_length == text_length) && (rebuild == Q_FALSE)) {
+        /*
+         * The index is current.
+         */
+        Xfree(filename, __FILE__, __LINE__);
+        return;
+    }
+
+    DLOG(("load_message_index(): index covers %lu bytes, file has %lu\n",
+            (unsigned long) indexed_length, (unsigned long) text_length));
 
-        Xfree(all_messages, __FILE__, __LINE__);
-        all_messages = NULL;
-        all_messages_n = 0;
+    old_message_index_n = message_index_n;
+    if ((indexed_length > text_length) ||
+        ((indexed_length > 0) && (text[indexed_length - 1] != '\n'))
+    ) {
+        /*
+         * The messages file was changed underneath us, start over.
+         */
+        message_index_n = 0;
+        old_message_index_n = 0;
+        indexed_length = 0;
     }
+    scan_messages(text, indexed_length, text_length);
+
+    if (q_status.read_only == Q_TRUE) {
+        Xfree(filename, __FILE__, __LINE__);
+        return;
+    }
+
+    /*
+     * Save the new entries
+     */
+    if (old_message_index_n == 0) {
+        file = fopen(filename, "wb");
+        if (file != NULL) {
+            header.magic = MESSAGE_INDEX_MAGIC;
+            header.version = MESSAGE_INDEX_VERSION;
+            fwrite(&header, sizeof(header), 1, file);
+        }
+    } else {
+        file = fopen(filename, "ab");
+    }
+    if (file != NULL) {
+        for (i = old_message_index_n; i < message_index_n; i++) {
+            fwrite(&message_index[i], sizeof(struct message_index_entry), 1,
+                file);
+        }
+        fclose(file);
+    }
+    Xfree(filename, __FILE__, __LINE__);
 }
 
-/* Load all messages into memory */
-static void read_all_messages() {
-    FILE * file;
+/**
+ * Open the message base: map the messages file into memory and load its
+ * index.  After this, message_text[message_index[live_messages[n]].offset]
+ * is the beginning of message n.
+ */
+static void open_message_base() {
     char * filename;
     char notify_message[DIALOG_MESSAGE_SIZE];
-    char * begin;
-    wchar_t ** message = NULL;
-    int message_n = 0;
-    wchar_t line_wchar[Q_MAX_LINE_LENGTH];
-    char line[Q_MAX_LINE_LENGTH];
-
-    filename = (char *) Xmalloc(strlen(MESSAGE_FILENAME) +
-                                strlen(get_option(Q_OPTION_HOST_DIR)) + 2,
-                                __FILE__, __LINE__);
-    memset(filename, 0,
-           strlen(MESSAGE_FILENAME) + strlen(get_option(Q_OPTION_HOST_DIR)) +
-           2);
-    strncpy(filename, get_option(Q_OPTION_HOST_DIR),
-            strlen(get_option(Q_OPTION_HOST_DIR)));
-    filename[strlen(filename)] = '/';
-    strncpy(filename + strlen(filename), MESSAGE_FILENAME,
-            strlen(MESSAGE_FILENAME));
+    struct stat fstats;
+    int fd;
+    int i;
 
-    /*
-     * Read from file
-     */
-    if (file_exists(filename) == Q_FALSE) {
+    if (message_base_open == Q_TRUE) {
+        return;
+    }
+    message_base_open = Q_TRUE;
+
+    filename = host_dir_filename(MESSAGE_FILENAME);
+    if ((stat(filename, &fstats) < 0) || (fstats.st_size == 0)) {
         /*
-         * File isn't present, bail out
+         * File isn't present, no messages.  Any index left behind describes
+         * text that is gone, so drop it before save_message() appends to
+         * it.
          */
+        Xfree(filename, __FILE__, __LINE__);
+        if (q_status.read_only == Q_FALSE) {
+            filename = host_dir_filename(MESSAGE_INDEX_FILENAME);
+            unlink(filename);
+            Xfree(filename, __FILE__, __LINE__);
+        }
         return;
     }
 
-    file = fopen(filename, "r");
-    if (file == NULL) {
+#ifdef Q_PDCURSES_WIN32
+    fd = open(filename, O_RDONLY | O_BINARY);
+#else
+    fd = open(filename, O_RDONLY);
+#endif
+    if (fd < 0) {
         snprintf(notify_message, sizeof(notify_message),
                  _("Error opening file \"%s\" for reading: %s"),
                  filename, strerror(errno));
         host_write(notify_message, strlen(notify_message));
+        Xfree(filename, __FILE__, __LINE__);
         return;
     }
+    message_text_length = fstats.st_size;
 
-    while (!feof(file)) {
-        if (fgets(line, sizeof(line), file) == NULL) {
-            /*
-             * This will cause the outer while's feof() check to fail and
-             * smoothly exit the while loop.
-             */
-            continue;
-        }
-        begin = line;
+#ifdef Q_PDCURSES_WIN32
+    message_text = (char *) Xmalloc(message_text_length, __FILE__, __LINE__);
+    if (read(fd, message_text, message_text_length) !=
+        (int) message_text_length) {
+        Xfree(message_text, __FILE__, __LINE__);
+        message_text = NULL;
+    }
+#else
+    message_text = (char *) mmap(NULL, message_text_length, PROT_READ,
+                                 MAP_SHARED, fd, 0);
+    if (message_text == MAP_FAILED) {
+        message_text = NULL;
+    }
+#endif
+    close(fd);
 
-        while ((strlen(line) > 0) && q_isspace(line[strlen(line) - 1])) {
-            /*
-             * Trim trailing whitespace
-             */
-            line[strlen(line) - 1] = '\0';
-        }
-        while (q_isspace(*begin)) {
-            /*
-             * Trim leading whitespace
-             */
-            begin++;
+    if (message_text == NULL) {
+        snprintf(notify_message, sizeof(notify_message),
+                 _("Error reading file \"%s\": %s"),
+                 filename, strerror(errno));
+        host_write(notify_message, strlen(notify_message));
+        message_text_length = 0;
+        Xfree(filename, __FILE__, __LINE__);
+        return;
+    }
+    Xfree(filename, __FILE__, __LINE__);
+
+    load_message_index(message_text, message_text_length);
+
+    /*
+     * Map message numbers to index entries, skipping deleted messages.
+     */
+    if (message_index_n > 0) {
+        live_messages = (int *) Xmalloc(sizeof(int) * message_index_n,
+                                        __FILE__, __LINE__);
+    }
+    for (i = 0; i < message_index_n; i++) {
+        if ((message_index[i].flags & MESSAGE_FLAG_DELETED) == 0) {
+            live_messages[live_messages_n] = i;
+            live_messages_n++;
         }
+    }
+}
 
-        /*
-         * Convert from UTF-8
-         */
-        memset(line_wchar, 0, sizeof(line_wchar));
-        mbstowcs(line_wchar, begin, strlen(begin) + 1);
+/**
+ * Release the message base.
+ */
+static void close_message_base() {
+    if (message_text != NULL) {
+#ifdef Q_PDCURSES_WIN32
+        Xfree(message_text, __FILE__, __LINE__);
+#else
+        munmap(message_text, message_text_length);
+#endif
+        message_text = NULL;
+        message_text_length = 0;
+    }
+    if (message_index != NULL) {
+        Xfree(message_index, __FILE__, __LINE__);
+        message_index = NULL;
+        message_index_n = 0;
+        message_index_max = 0;
+    }
+    if (live_messages != NULL) {
+        Xfree(live_messages, __FILE__, __LINE__);
+        live_messages = NULL;
+        live_messages_n = 0;
+    }
+    message_base_open = Q_FALSE;
+}
+
+/**
+ * Remove deleted messages from the messages file and rebuild the index.
+ * This is called when host mode ends, so that deleting a message while
+ * online only needs to flip a flag in the index.
+ */
+static void compact_message_base() {
+    char * filename;
+    char * index_filename;
+    char * new_filename;
+    char * new_index_filename;
+    struct message_index_header header;
+    struct message_index_entry entry;
+    FILE * file;
+    FILE * index_file;
+    uint32_t offset = 0;
+    int i;
+
+    if (q_status.read_only == Q_TRUE) {
+        return;
+    }
 
+    close_message_base();
+    open_message_base();
+    if (live_messages_n == message_index_n) {
         /*
-         * See if this is '.'
+         * Nothing to remove
          */
-        if (wcscmp(line_wchar, L".") == 0) {
-            /*
-             * New message
-             */
-            all_messages = (wchar_t ***) Xrealloc(all_messages,
-                                                  sizeof(wchar_t **) *
-                                                  (all_messages_n + 1),
-                                                  __FILE__, __LINE__);
-            all_messages_n++;
-
-            if (message != NULL) {
-                message = (wchar_t **) Xrealloc(message,
-                                                sizeof(wchar_t *) * (message_n +
-                                                                     1),
-                                                __FILE__, __LINE__);
-                message[message_n] = NULL;
-                all_messages[all_messages_n - 2] = message;
-                message = NULL;
-                message_n = 0;
-            }
-            continue;
+        close_message_base();
+        return;
+    }
+
+    DLOG(("compact_message_base(): %d messages, %d deleted\n",
+            message_index_n, message_index_n - live_messages_n));
+
+    filename = host_dir_filename(MESSAGE_FILENAME);
+    index_filename = host_dir_filename(MESSAGE_INDEX_FILENAME);
+    new_filename = host_dir_filename(MESSAGE_FILENAME ".new");
+    new_index_filename = host_dir_filename(MESSAGE_INDEX_FILENAME ".new");
+
+    file = fopen(new_filename, "wb");
+    index_file = fopen(new_index_filename, "wb");
+    if ((file == NULL) || (index_file == NULL)) {
+        if (file != NULL) {
+            fclose(file);
+            unlink(new_filename);
+        }
+        if (index_file != NULL) {
+            fclose(index_file);
+            unlink(new_index_filename);
         }
+        goto compact_message_base_done;
+    }
 
-        /*
-         * Append this line to message
-         */
-        message =
-            (wchar_t **) Xrealloc(message, sizeof(wchar_t *) * (message_n + 1),
-                                  __FILE__, __LINE__);
-        message[message_n] = Xwcsdup(line_wchar, __FILE__, __LINE__);
-        message_n++;
+    header.magic = MESSAGE_INDEX_MAGIC;
+    header.version = MESSAGE_INDEX_VERSION;
+    fwrite(&header, sizeof(header), 1, index_file);
+
+    for (i = 0; i < live_messages_n; i++) {
+        entry = message_index[live_messages[i]];
+        fwrite(".\n", 2, 1, file);
+        fwrite(message_text + entry.offset, entry.length, 1, file);
+        entry.offset = offset + 2;
+        offset += entry.length + 2;
+        fwrite(&entry, sizeof(entry), 1, index_file);
     }
+    fclose(file);
+    fclose(index_file);
+
+    close_message_base();
+    rename(new_filename, filename);
+    rename(new_index_filename, index_filename);
+
+compact_message_base_done:
+    close_message_base();
+    Xfree(filename, __FILE__, __LINE__);
+    Xfree(index_filename, __FILE__, __LINE__);
+    Xfree(new_filename, __FILE__, __LINE__);
+    Xfree(new_index_filename, __FILE__, __LINE__);
+}
+
+/* Save a message to the message file */
+static void save_message() {
+    FILE * file;
+    char * filename;
+    char notify_message[DIALOG_MESSAGE_SIZE];
+    struct message_index_entry entry;
+    char name[MESSAGE_INDEX_NAME_LENGTH * 4];
+    long offset;
+    int i;
 
     /*
-     * Append last message
+     * Bring the index up to date with the messages file before appending
+     * to both of them.
      */
-    if (message != NULL) {
-        message =
-            (wchar_t **) Xrealloc(message, sizeof(wchar_t *) * (message_n + 1),
-                                  __FILE__, __LINE__);
-        message[message_n] = NULL;
-        all_messages[all_messages_n - 1] = message;
-        message = NULL;
-        message_n = 0;
+    close_message_base();
+    open_message_base();
+
+    filename = host_dir_filename(MESSAGE_FILENAME);
+
+    /*
+     * Append to file
+     */
+    file = fopen(filename, "a");
+    if (file == NULL) {
+        snprintf(notify_message, sizeof(notify_message),
+                 _("Error opening file \"%s\" for writing: %s"),
+                 filename, strerror(errno));
+        host_write(notify_message, strlen(notify_message));
+        Xfree(filename, __FILE__, __LINE__);
+        return;
     }
+    fseek(file, 0, SEEK_END);
+    offset = ftell(file);
+
+    /*
+     * Emit message to file
+     */
+    /*
+     * Single period is the message separator since it cannot be entered in
+     * the line editor.
+     */
+    fprintf(file, ".\n");
+    memset(&entry, 0, sizeof(entry));
+    entry.offset = (uint32_t) ftell(file);
+    fprintf(file, "From: %ls\n", msg_from);
+    fprintf(file, "To:   %ls\n", msg_to);
+    fprintf(file, "----------------------------------------\n");
+    for (i = 0; i < msg_body_n; i++) {
+        fprintf(file, "%ls\n", msg_body[i]);
+    }
+    fprintf(file, "----------------------------------------\n");
+    entry.length = (uint32_t) (ftell(file) - entry.offset);
 
     /*
      * All done
      */
     fclose(file);
+    Xfree(filename, __FILE__, __LINE__);
 
     /*
-     * No leak
+     * Append to index, but only if it was already current.  Otherwise the
+     * next open_message_base() will rebuild it.
      */
-    Xfree(filename, __FILE__, __LINE__);
+    if ((message_index_n == 0) ||
+        (message_index[message_index_n - 1].offset +
+            message_index[message_index_n - 1].length == offset)
+    ) {
+        memset(name, 0, sizeof(name));
+        wcstombs(name, msg_from, sizeof(name) - 1);
+        set_index_name(entry.from, name, strlen(name));
+        memset(name, 0, sizeof(name));
+        wcstombs(name, msg_to, sizeof(name) - 1);
+        set_index_name(entry.to, name, strlen(name));
+
+        filename = host_dir_filename(MESSAGE_INDEX_FILENAME);
+        file = fopen(filename, "ab");
+        if (file != NULL) {
+            fseek(file, 0, SEEK_END);
+            if (ftell(file) == 0) {
+                struct message_index_header header;
+                header.magic = MESSAGE_INDEX_MAGIC;
+                header.version = MESSAGE_INDEX_VERSION;
+                fwrite(&header, sizeof(header), 1, file);
+            }
+            fwrite(&entry, sizeof(entry), 1, file);
+            fclose(file);
+        }
+        Xfree(filename, __FILE__, __LINE__);
+    }
+    close_message_base();
+
+    /*
+     * Reset message state
+     */
+    kill_message();
+
+    /*
+     * Re-display the main menu
+     */
+    main_menu();
 }
 
 /* Switch to previous message */
@@ -1182,7 +1582,7 @@ static void previous_message() {
 
 /* Switch to next message */
 static void next_message() {
-    if (current_message < all_messages_n - 1) {
+    if (current_message < live_messages_n - 1) {
         current_message++;
     }
     /*
@@ -1191,105 +1591,46 @@ static void next_message() {
     read_messages_menu();
 }
 
-/* Update the entire messages file */
-static void save_all_messages() {
-    int message_i;
-    int line_i;
-    wchar_t ** message;
-    wchar_t * line;
-    FILE * file;
+/* Remove the current message */
+static void kill_read_message() {
     char * filename;
-    char notify_message[DIALOG_MESSAGE_SIZE];
-
-    filename = (char *) Xmalloc(strlen(MESSAGE_FILENAME) +
-                                strlen(get_option(Q_OPTION_HOST_DIR)) + 2,
-                                __FILE__, __LINE__);
-    memset(filename, 0,
-           strlen(MESSAGE_FILENAME) + strlen(get_option(Q_OPTION_HOST_DIR)) +
-           2);
-    strncpy(filename, get_option(Q_OPTION_HOST_DIR),
-            strlen(get_option(Q_OPTION_HOST_DIR)));
-    filename[strlen(filename)] = '/';
-    strncpy(filename + strlen(filename), MESSAGE_FILENAME,
-            strlen(MESSAGE_FILENAME));
+    FILE * file;
+    int slot;
 
-    /*
-     * Overwrite file
-     */
-    file = fopen(filename, "w");
-    if (file == NULL) {
-        snprintf(notify_message, sizeof(notify_message),
-                 _("Error opening file \"%s\" for writing: %s"),
-                 filename, strerror(errno));
-        host_write(notify_message, strlen(notify_message));
+    if (live_messages_n == 0) {
+        read_messages_menu();
         return;
     }
 
-    if (all_messages != NULL) {
-        assert(all_messages_n > 0);
-        for (message_i = 0; message_i < all_messages_n; message_i++) {
-            /*
-             * Single period is the message separator since it cannot be
-             * entered in the line editor.
-             */
-            fprintf(file, ".\n");
-            message = all_messages[message_i];
-            line_i = 0;
-            line = message[line_i];
-            while (line != NULL) {
-                fprintf(file, "%ls\n", line);
-                line_i++;
-                line = message[line_i];
-            }
-            message_i++;
-        }
-    }
-
     /*
-     * All done
+     * Mark the message deleted in the index.  compact_message_base() will
+     * remove it from the messages file later.
      */
-    fclose(file);
-
-    /*
-     * No leak
-     */
-    Xfree(filename, __FILE__, __LINE__);
-}
-
-/* Remove the current message */
-static void kill_read_message() {
-    wchar_t * line;
-    int line_i;
-    wchar_t ** message;
-
-    message = all_messages[current_message];
-    memmove(all_messages + current_message,
-            all_messages + current_message + 1,
-            all_messages_n - current_message - 1);
-    all_messages_n--;
-    if (current_message == all_messages_n) {
+    slot = live_messages[current_message];
+    message_index[slot].flags |= MESSAGE_FLAG_DELETED;
+    memmove(live_messages + current_message,
+            live_messages + current_message + 1,
+            sizeof(int) * (live_messages_n - current_message - 1));
+    live_messages_n--;
+    if ((current_message == live_messages_n) && (current_message > 0)) {
         current_message--;
     }
 
-    line_i = 0;
-    line = message[line_i];
-    while (line != NULL) {
-        Xfree(line, __FILE__, __LINE__);
-        line_i++;
-        line = message[line_i];
-    }
-    Xfree(message, __FILE__, __LINE__);
-
-    if (all_messages_n == 0) {
-        Xfree(all_messages, __FILE__, __LINE__);
-        all_messages = NULL;
+    if (q_status.read_only == Q_FALSE) {
+        filename = host_dir_filename(MESSAGE_INDEX_FILENAME);
+        file = fopen(filename, "r+b");
+        if (file != NULL) {
+            if (fseek(file, sizeof(struct message_index_header) +
+                    sizeof(struct message_index_entry) * slot,
+                    SEEK_SET) == 0) {
+                fwrite(&message_index[slot],
+                       sizeof(struct message_index_entry), 1, file);
+            }
+            fclose(file);
+        }
+        Xfree(filename, __FILE__, __LINE__);
     }
 
-    /*
-     * Update messages file
-     */
-    save_all_messages();
-
     /*
      * Re-display the read message menu
      */
@@ -1299,34 +1640,47 @@ static void kill_read_message() {
 /* Display one message to the console */
 static void display_message(const int n) {
     char buffer[Q_MAX_LINE_LENGTH];
-    int line_i;
-    wchar_t ** message;
-    wchar_t * line;
-    if (all_messages_n == 0) {
+    struct message_index_entry * entry;
+    char * line;
+    char * eol;
+    char * end;
+    size_t line_length;
+
+    if (live_messages_n == 0) {
         do_menu("No messages." EOL);
         return;
     }
 
-    assert(all_messages != NULL);
-    assert(all_messages_n > 0);
-    assert(n < all_messages_n);
+    assert(message_text != NULL);
+    assert(n < live_messages_n);
 
-    message = all_messages[n];
+    entry = &message_index[live_messages[n]];
 
     /*
      * Print message #
      */
     sprintf(buffer, _("Message #%d of %d%s"), current_message + 1,
-            all_messages_n, EOL);
+            live_messages_n, EOL);
     host_write(buffer, strlen(buffer));
 
-    line_i = 0;
-    line = message[line_i];
-    while (line != NULL) {
-        sprintf(buffer, "%ls%s", line, EOL);
-        host_write(buffer, strlen(buffer));
-        line_i++;
-        line = message[line_i];
+    line = message_text + entry->offset;
+    end = line + entry->length;
+    while (line < end) {
+        eol = memchr(line, '\n', end - line);
+        if (eol == NULL) {
+            eol = end;
+        }
+        line_length = eol - line;
+        while ((line_length > 0) && q_isspace(line[line_length - 1])) {
+            line_length--;
+        }
+        while ((line_length > 0) && q_isspace(*line)) {
+            line++;
+            line_length--;
+        }
+        host_write(line, line_length);
+        do_menu(EOL);
+        line = eol + 1;
     }
 }
 
@@ -1341,18 +1695,16 @@ static void view_current_message() {
 
 /* Read the saved messages */
 static void read_messages_menu() {
-    if (all_messages == NULL) {
-        read_all_messages();
-    }
+    open_message_base();
 
-    if ((current_message >= all_messages_n) && (all_messages_n > 0)
+    if ((current_message >= live_messages_n) && (live_messages_n > 0)
         ) {
         do_menu(EOL
             "A message was deleted, displaying last message." EOL);
         /*
          * Truncate to the last message
          */
-        current_message = all_messages_n - 1;
+        current_message = live_messages_n - 1;
     }
 
     do_menu(EOL);
@@ -1364,17 +1716,18 @@ static void read_messages_menu() {
 
 /* List files excluding '.', '..', and the messages file */
 static void list_files() {
-    DIR * directory = NULL;
-    struct dirent * dir_entry;
+    struct file_info ** file_list;
+    int files_n;
     char buffer[COMMAND_LINE_SIZE];
     struct stat fstats;
     int total = 0;
+    int i;
 
     /*
      * Read directory
      */
-    directory = opendir(get_option(Q_OPTION_HOST_DIR));
-    if (directory == NULL) {
+    file_list = read_directory(get_option(Q_OPTION_HOST_DIR), &files_n);
+    if (file_list == NULL) {
         sprintf(buffer, _("Unable to display files in %s%s"),
                 get_option(Q_OPTION_HOST_DIR), EOL);
         host_write(buffer, strlen(buffer));
@@ -1383,57 +1736,46 @@ static void list_files() {
     sprintf(buffer, _("%sFiles in host directory:%s"), EOL, EOL);
     host_write(buffer, strlen(buffer));
 
-    dir_entry = readdir(directory);
-    while (dir_entry != NULL) {
-        char * full_filename;
-
-        /*
-         * Get the full filename
-         */
-        full_filename = (char *) Xmalloc(strlen(dir_entry->d_name) +
-                                         strlen(get_option(Q_OPTION_HOST_DIR)) +
-                                         2, __FILE__, __LINE__);
-        memset(full_filename, 0,
-               strlen(dir_entry->d_name) +
-               strlen(get_option(Q_OPTION_HOST_DIR)) + 2);
-        memcpy(full_filename, get_option(Q_OPTION_HOST_DIR),
-               strlen(get_option(Q_OPTION_HOST_DIR)));
-        full_filename[strlen(get_option(Q_OPTION_HOST_DIR))] = '/';
-        memcpy(full_filename + strlen(get_option(Q_OPTION_HOST_DIR)) + 1,
-               dir_entry->d_name, strlen(dir_entry->d_name));
-        full_filename[strlen(dir_entry->d_name) +
-                      strlen(get_option(Q_OPTION_HOST_DIR)) + 1] = '\0';
-
+    for (i = 0; i < files_n; i++) {
         /*
          * Skip '.', '..', and hidden files
          */
-        if (dir_entry->d_name[0] == '.') {
-            dir_entry = readdir(directory);
-            Xfree(full_filename, __FILE__, __LINE__);
-            full_filename = NULL;
+        if (file_list[i]->name[0] == '.') {
             continue;
         }
 
         /*
          * Skip the messages file
          */
-        if (strcmp(dir_entry->d_name, MESSAGE_FILENAME) == 0) {
-            dir_entry = readdir(directory);
-            Xfree(full_filename, __FILE__, __LINE__);
-            full_filename = NULL;
+        if ((strcmp(file_list[i]->name, MESSAGE_FILENAME) == 0) ||
+            (strcmp(file_list[i]->name, MESSAGE_INDEX_FILENAME) == 0)
+        ) {
             continue;
         }
 
         total++;
 
         /*
-         * Get the file stats
+         * Get the file stats.  read_directory() does not follow symlinks.
          */
-        if (stat(full_filename, &fstats) < 0) {
-            sprintf(buffer, _("Can't stat %s: %s%s"),
-                    full_filename, strerror(errno), EOL);
-            host_write(buffer, strlen(buffer));
+        memcpy(&fstats, &file_list[i]->fstats, sizeof(struct stat));
+#ifndef Q_PDCURSES_WIN32
+        if (S_ISLNK(fstats.st_mode)) {
+            char * host_dir = get_option(Q_OPTION_HOST_DIR);
+            char * full_filename;
+
+            full_filename = (char *) Xmalloc(strlen(file_list[i]->name) +
+                                             strlen(host_dir) + 2,
+                                             __FILE__, __LINE__);
+            sprintf(full_filename, "%s/%s", host_dir, file_list[i]->name);
+            if (stat(full_filename, &fstats) < 0) {
+                sprintf(buffer, _("Can't stat %s: %s%s"),
+                        full_filename, strerror(errno), EOL);
+                host_write(buffer, strlen(buffer));
+            }
+            Xfree(full_filename, __FILE__, __LINE__);
         }
+#endif
 
         /*
          * Print the file information
@@ -1447,13 +1789,13 @@ static void list_files() {
              * Name + Directory
              */
             snprintf(buffer, sizeof(buffer), _(" %-30s        <dir>"),
-                     dir_entry->d_name);
+                     file_list[i]->name);
         } else {
             /*
              * Name + File size
              */
             snprintf(buffer, sizeof(buffer), " %-30s %12lu",
-                     dir_entry->d_name, (unsigned long) fstats.st_size);
+                     file_list[i]->name, (unsigned long) fstats.st_size);
         }
 
         /*
@@ -1477,17 +1819,7 @@ static void list_files() {
          * Emit
          */
         host_write(buffer, strlen(buffer));
-
-        /*
-         * Get next entry
-         */
-        dir_entry = readdir(directory);
-        Xfree(full_filename, __FILE__, __LINE__);
-        full_filename = NULL;
     }
-    assert(directory != NULL);
-    closedir(directory);
-    directory = NULL;
 
     if (total == 0) {
         /*
@@ -2128,7 +2460,7 @@ static void main_menu() {
     /*
      * Reset read messages state
      */
-    clear_all_messages();
+    close_message_base();
     current_message = 0;
 }
 
@@ -2661,24 +2993,20 @@ void host_process_data(unsigned char * input, const unsigned int input_n,
                  */
                 input[i] = translate_8bit_in(input[i]);
 
-                /*
-                 * Capture
-                 */
-                if (q_status.capture == Q_TRUE) {
-                    if (q_status.capture_type == Q_CAPTURE_TYPE_RAW) {
-                        /*
-                         * Raw
-                         */
-                        fprintf(q_status.capture_file, "%c", input[i]);
-                        if (q_status.capture_flush_time < time(NULL)) {
-                            fflush(q_status.capture_file);
-                            q_status.capture_flush_time = time(NULL);
-                        }
-                    }
-                }
-
                 state_machine_keyboard_handler(input[i]);
             }
+
+            /*
+             * Capture
+             */
+            if (q_status.capture == Q_TRUE) {
+                if (q_status.capture_type == Q_CAPTURE_TYPE_RAW) {
+                    /*
+                     * Raw
+                     */
+                    capture_write(input, input_n);
+                }
+            }
         }
         *remaining = 0;
         return;
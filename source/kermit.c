@@ -47,6 +47,7 @@
 #include <string.h>
 #include <stdlib.h>
 #include <ctype.h>
+#include <stdint.h>
 #ifdef _MSC_VER
 #  include <sys/utime.h>
 #else
@@ -76,6 +77,21 @@ static const char * DLOGNAME = NULL;
  */
 #define KERMIT_BLOCK_SIZE 1024
 
+/*
+ * The largest extended-length packet that can be expressed in MAXLX1 and
+ * MAXLX2 (94 * 95 + 94).  Used on reliable network and pipe connections.
+ */
+#define KERMIT_MAX_LONG_PACKET 9024
+
+/* Long packet limit for serial and modem connections */
+#define KERMIT_SERIAL_LONG_PACKET 1024
+
+/* Largest sliding window permitted by sequence numbers modulo 64 */
+#define KERMIT_MAX_WINDOW 31
+
+/* Window size offered on serial and modem connections */
+#define KERMIT_SERIAL_WINDOW 8
+
 /* Data types ----------------------------------------------- */
 
 /**
@@ -430,53 +446,339 @@ struct kermit_packet {
 static struct kermit_packet input_packet;
 static struct kermit_packet output_packet;
 
-/* Input buffer used to collect a complete packet before processing it */
-static unsigned char packet_buffer[KERMIT_BLOCK_SIZE * 2];
+/*
+ * Input buffer used to collect a complete packet before processing it.  It
+ * holds two packets of max_long_packet length.
+ */
+static unsigned char * packet_buffer = NULL;
+static unsigned int packet_buffer_max;
 static int packet_buffer_n;
 
 /*
- * Full duplex sliding windows support.  EVERY transfer operates with a
- * window size of 1.  If windowing is negotiated, the window size may get
- * bigger.
+ * File data read ahead for the next DATA packet.
+ */
+static unsigned char file_buffer[KERMIT_MAX_LONG_PACKET];
+
+/*
+ * The longest packet and widest window we will offer for this transfer,
+ * chosen by set_transport_limits().
+ */
+static unsigned int max_long_packet = KERMIT_SERIAL_LONG_PACKET;
+static unsigned int max_window = KERMIT_SERIAL_WINDOW;
+
+/*
+ * If true, the connection is reliable enough to offer streaming.
+ */
+static Q_BOOL reliable_transport = Q_FALSE;
+
+/*
+ * SEQ is modulo 64, so a window can be indexed directly by SEQ with a
+ * fixed 64-slot array.  The negotiated window (WINDO_in/WINDO_out) is
+ * always smaller than this.
  */
-static unsigned int input_window_begin;
-static unsigned int input_window_i;
-static unsigned int input_window_n;
-static unsigned int output_window_begin;
-static unsigned int output_window_i;
-static unsigned int output_window_n;
+#define KERMIT_SEQ_N 64
 
 /**
  * Windowing needs to be able to re-transmit previously encoded packets.
  * This structure contains everything it needs to do so.
  */
 struct kermit_packet_serial {
-    /* SEQ */
-    unsigned int seq;
-
     /*
      * # of times this packet has been sent
      */
     unsigned int try_count;
 
-    /* Packet was sent/received OK */
-    Q_BOOL acked;
-
     /* From packet_types[] */
     PACKET_TYPE type;
 
-    /* The raw packet data */
+    /*
+     * The raw packet data.  This points into the window arena, or to
+     * overflow for payloads bigger than the arena stride.
+     */
     unsigned char * data;
     unsigned int data_n;
+
+    /* Private buffer for oversized payloads, kept for reuse */
+    unsigned char * overflow;
+    unsigned int overflow_max;
 };
-static struct kermit_packet_serial * input_window = NULL;
-static struct kermit_packet_serial * output_window = NULL;
+
+/**
+ * Full duplex sliding windows support.  EVERY transfer operates with a
+ * window size of 1.  If windowing is negotiated, the window size may get
+ * bigger.
+ *
+ * The window holds the SEQs begin through begin + n - 1 (modulo 64).  Each
+ * SEQ owns slots[SEQ] and a stride-sized piece of the arena, so lookups
+ * by SEQ never search and packets are never individually malloc'd.
+ */
+struct kermit_window {
+    /* Packets indexed by SEQ */
+    struct kermit_packet_serial slots[KERMIT_SEQ_N];
+
+    /* Bit SEQ is set if the packet with that SEQ was sent/received OK */
+    uint64_t acked;
+
+    /* The SEQ of the oldest packet in the window */
+    unsigned int begin;
+
+    /* The number of packets in the window */
+    unsigned int n;
+
+    /* KERMIT_SEQ_N * stride bytes of packet payload storage */
+    unsigned char * arena;
+    unsigned int stride;
+};
+static struct kermit_window input_window;
+static struct kermit_window output_window;
+
+/**
+ * Index of the lowest set bit, from "Using de Bruijn Sequences to Index a
+ * 1 in a Computer Word" by Leiserson, Prokop, and Randall.
+ */
+static const unsigned char debruijn_bit_index[64] = {
+     0,  1, 48,  2, 57, 49, 28,  3, 61, 58, 50, 42, 38, 29, 17,  4,
+    62, 55, 59, 36, 53, 51, 43, 22, 45, 39, 33, 30, 24, 18, 12,  5,
+    63, 47, 56, 27, 60, 41, 37, 16, 54, 35, 52, 21, 44, 32, 23, 11,
+    46, 26, 40, 15, 34, 20, 31, 10, 25, 14, 19,  9, 13,  8,  7,  6
+};
+
+/**
+ * Find the lowest set bit in a word.
+ *
+ * @param bits a non-zero word
+ * @return the bit number, 0-63
+ */
+static int lowest_bit(const uint64_t bits) {
+    assert(bits != 0);
+    return debruijn_bit_index[((bits & (~bits + 1)) *
+            ((uint64_t) 0x03F79D71B4CB0A89ULL)) >> 58];
+}
+
+/**
+ * Rotate a SEQ bitmap right, so that bit seq becomes bit 0.
+ *
+ * @param bits the bitmap
+ * @param seq the SEQ to move to bit 0
+ * @return the rotated bitmap
+ */
+static uint64_t rotate_seq_bits(const uint64_t bits, const unsigned int seq) {
+    if (seq == 0) {
+        return bits;
+    }
+    return (bits >> seq) | (bits << (KERMIT_SEQ_N - seq));
+}
+
+/**
+ * Get the bitmap of SEQs covered by a window.
+ *
+ * @param window the window
+ * @return a bitmap with bits begin through begin + n - 1 set
+ */
+static uint64_t window_mask(const struct kermit_window * window) {
+    uint64_t mask;
+
+    if (window->n == 0) {
+        return 0;
+    }
+    assert(window->n < KERMIT_SEQ_N);
+    mask = (((uint64_t) 1) << window->n) - 1;
+    return rotate_seq_bits(mask, (KERMIT_SEQ_N - window->begin) %
+        KERMIT_SEQ_N);
+}
+
+/**
+ * Get the SEQ one past the newest packet in a window.
+ *
+ * @param window the window
+ * @return the SEQ the next appended packet should have
+ */
+static unsigned int window_end(const struct kermit_window * window) {
+    return (window->begin + window->n) % KERMIT_SEQ_N;
+}
+
+/**
+ * Get the SEQ of the newest packet in a window.
+ *
+ * @param window the window, which must not be empty
+ * @return the SEQ
+ */
+static unsigned int window_last(const struct kermit_window * window) {
+    assert(window->n > 0);
+    return (window->begin + window->n - 1) % KERMIT_SEQ_N;
+}
+
+/**
+ * See if a SEQ is in a window.
+ *
+ * @param window the window
+ * @param seq the SEQ
+ * @return true if the window has a slot for seq
+ */
+static Q_BOOL window_contains(const struct kermit_window * window,
+                              const unsigned int seq) {
+
+    if (((seq + KERMIT_SEQ_N - window->begin) % KERMIT_SEQ_N) < window->n) {
+        return Q_TRUE;
+    }
+    return Q_FALSE;
+}
+
+/**
+ * See if the packet with a SEQ has been ACK'd.
+ *
+ * @param window the window
+ * @param seq the SEQ
+ * @return true if it was sent/received OK
+ */
+static Q_BOOL window_acked(const struct kermit_window * window,
+                           const unsigned int seq) {
+
+    if ((window->acked & (((uint64_t) 1) << seq)) != 0) {
+        return Q_TRUE;
+    }
+    return Q_FALSE;
+}
+
+/**
+ * Mark the packet with a SEQ as ACK'd or not.
+ *
+ * @param window the window
+ * @param seq the SEQ
+ * @param acked if true, the packet was sent/received OK
+ */
+static void window_set_acked(struct kermit_window * window,
+                             const unsigned int seq, const Q_BOOL acked) {
+
+    if (acked == Q_TRUE) {
+        window->acked |= (((uint64_t) 1) << seq);
+    } else {
+        window->acked &= ~(((uint64_t) 1) << seq);
+    }
+}
+
+/**
+ * Find the oldest packet in a window that has not been ACK'd.
+ *
+ * @param window the window
+ * @return the SEQ, or -1 if every packet in the window is ACK'd
+ */
+static int window_first_nak(const struct kermit_window * window) {
+    uint64_t naks;
+
+    naks = ~window->acked & window_mask(window);
+    if (naks == 0) {
+        return -1;
+    }
+    return (window->begin +
+        lowest_bit(rotate_seq_bits(naks, window->begin))) % KERMIT_SEQ_N;
+}
+
+/**
+ * Empty a window.
+ *
+ * @param window the window
+ */
+static void window_reset(struct kermit_window * window) {
+    window->begin = 0;
+    window->n = 0;
+    window->acked = 0;
+}
+
+/**
+ * Set up a window's arena for a new transfer, releasing any buffers from
+ * the last transfer.
+ *
+ * @param window the window
+ * @param stride the number of bytes of payload to reserve for each SEQ
+ */
+static void window_setup(struct kermit_window * window,
+                         const unsigned int stride) {
+    int i;
+
+    for (i = 0; i < KERMIT_SEQ_N; i++) {
+        if (window->slots[i].overflow != NULL) {
+            Xfree(window->slots[i].overflow, __FILE__, __LINE__);
+        }
+    }
+    if (window->arena != NULL) {
+        Xfree(window->arena, __FILE__, __LINE__);
+    }
+    memset(window, 0, sizeof(struct kermit_window));
+    window->stride = stride;
+    window->arena = (unsigned char *) Xmalloc(KERMIT_SEQ_N * stride,
+                                              __FILE__, __LINE__);
+}
+
+/**
+ * Copy a packet's bytes into its window slot.
+ *
+ * @param window the window
+ * @param seq the packet SEQ
+ * @param type the packet type
+ * @param data the bytes to save
+ * @param data_n the number of bytes in data
+ */
+static void window_store(struct kermit_window * window,
+                         const unsigned int seq, const PACKET_TYPE type,
+                         const unsigned char * data,
+                         const unsigned int data_n) {
+
+    struct kermit_packet_serial * slot = &window->slots[seq];
+
+    if (data_n <= window->stride) {
+        slot->data = window->arena + (seq * window->stride);
+    } else {
+        if (data_n > slot->overflow_max) {
+            slot->overflow = (unsigned char *) Xrealloc(slot->overflow,
+                data_n, __FILE__, __LINE__);
+            slot->overflow_max = data_n;
+        }
+        slot->data = slot->overflow;
+    }
+    if (data_n > 0) {
+        memcpy(slot->data, data, data_n);
+    }
+    slot->data_n = data_n;
+    slot->type = type;
+}
+
+/**
+ * Add a SEQ to the end of a window.
+ *
+ * @param window the window
+ * @param seq the packet SEQ
+ * @param acked if true, the packet was sent/received OK
+ */
+static void window_append(struct kermit_window * window,
+                          const unsigned int seq, const Q_BOOL acked) {
+
+    if (window->n == 0) {
+        window->begin = seq;
+    }
+    assert(seq == window_end(window));
+    window->n++;
+    window_set_acked(window, seq, acked);
+}
+
+/**
+ * Remove the oldest packet from a window.
+ *
+ * @param window the window
+ */
+static void window_pop(struct kermit_window * window) {
+    assert(window->n > 0);
+    window->slots[window->begin].data_n = 0;
+    window->begin = (window->begin + 1) % KERMIT_SEQ_N;
+    window->n--;
+}
 
 /* Forward references needed by various functions */
 static void send_file_header();
 static void error_packet(const char * message);
 static Q_BOOL window_next_packet_seq(const int seq);
 static Q_BOOL window_save_all();
+static void window_roll_off();
 static void ack_packet_param(char * param, int param_n);
 
 /**
@@ -531,6 +833,33 @@ static char * packet_type_description(int type) {
 /* Defaults --------------------------------------------------------------- */
 /* ------------------------------------------------------------------------ */
 
+/**
+ * Pick the packet length, window size, and streaming limits for the
+ * current connection.  Network connections and local pipes are error-free
+ * (TCP or the pty already takes care of that), so they get streaming and
+ * the maximum packet length.  Serial ports and modems get 1k packets and a
+ * modest window.
+ */
+static void set_transport_limits() {
+    reliable_transport = Q_TRUE;
+
+    if (Q_SERIAL_OPEN || (q_status.dial_method == Q_DIAL_METHOD_MODEM)) {
+        reliable_transport = Q_FALSE;
+    }
+
+    if (reliable_transport == Q_TRUE) {
+        max_long_packet = KERMIT_MAX_LONG_PACKET;
+        max_window = KERMIT_MAX_WINDOW;
+    } else {
+        max_long_packet = KERMIT_SERIAL_LONG_PACKET;
+        max_window = KERMIT_SERIAL_WINDOW;
+    }
+
+    DLOG(("set_transport_limits(): reliable %s long packet %d window %d\n",
+            (reliable_transport == Q_TRUE ? "true" : "false"),
+            max_long_packet, max_window));
+}
+
 /**
  * Set the session parameters we normally go in with.
  *
@@ -565,11 +894,11 @@ static void set_default_session_parameters(struct session_parameters * parms) {
      * 0x04 - Can do sliding windows
      */
     parms->CAPAS = 0x10 | 0x08 | 0x04;
-    parms->WINDO = 30;
+    parms->WINDO = max_window;
     parms->WINDO_in = 1;
     parms->WINDO_out = 1;
-    parms->MAXLX1 = KERMIT_BLOCK_SIZE / 95;
-    parms->MAXLX2 = KERMIT_BLOCK_SIZE % 95;
+    parms->MAXLX1 = max_long_packet / 95;
+    parms->MAXLX2 = max_long_packet % 95;
     parms->attributes = Q_TRUE;
     parms->windowing = Q_TRUE;
     if (q_status.kermit_long_packets == Q_TRUE) {
@@ -578,7 +907,9 @@ static void set_default_session_parameters(struct session_parameters * parms) {
     } else {
         parms->long_packets = Q_FALSE;
     }
-    if (q_status.kermit_streaming == Q_TRUE) {
+    if ((q_status.kermit_streaming == Q_TRUE) &&
+        (reliable_transport == Q_TRUE)
+    ) {
         parms->streaming = Q_TRUE;
         parms->WHATAMI = 0x28;  /* Can do streaming */
     } else {
@@ -805,7 +1136,7 @@ static Q_BOOL setup_for_next_file() {
     char * basename_arg;
     int i;
     int rc;
-    char ch;
+    unsigned char sniff_buffer[1024];
 
     /*
      * Reset our dynamic variables
@@ -857,7 +1188,7 @@ static Q_BOOL setup_for_next_file() {
      * Open the file
      */
     if ((status.file_stream =
-         fopen(upload_file_list[upload_file_list_i].name, "rb")) == NULL) {
+         open_upload_file(upload_file_list, upload_file_list_i)) == NULL) {
         DLOG(("ERROR: Unable to open file %s: %s (%d)\n",
                 upload_file_list[upload_file_list_i].name,
                 strerror(errno), errno));
@@ -880,36 +1211,27 @@ static Q_BOOL setup_for_next_file() {
         DLOG(("setup_for_next_file() check for binary file\n"));
 
         /*
-         * Seek to the beginning
+         * Look at the first 1k in one read
          */
         fseek(status.file_stream, 0, SEEK_SET);
-
-        for (i = 0; i < 1024; i++) {
-            rc = fread(&ch, 1, 1, status.file_stream);
-            if (rc < 0) {
-                /*
-                 * Uh-oh
-                 */
-                status.state = ABORT;
-                set_transfer_stats_last_message(_("DISK I/O ERROR"));
-                stop_file_transfer(Q_TRANSFER_STATE_ABORT);
-                error_packet("Disk I/O error");
-                return Q_FALSE;
-            } else if ((rc < 1) || (rc == 0)) {
-                /*
-                 * Last byte
-                 */
-                break;
-            } else {
-                /*
-                 * Read 1 byte successfully
-                 */
-            }
-            if ((ch & 0x80) != 0) {
+        rc = fread(sniff_buffer, 1, sizeof(sniff_buffer), status.file_stream);
+        if (ferror(status.file_stream)) {
+            /*
+             * Uh-oh
+             */
+            status.state = ABORT;
+            set_transfer_stats_last_message(_("DISK I/O ERROR"));
+            stop_file_transfer(Q_TRANSFER_STATE_ABORT);
+            error_packet("Disk I/O error");
+            return Q_FALSE;
+        }
+        for (i = 0; i < rc; i++) {
+            if ((sniff_buffer[i] & 0x80) != 0) {
                 /*
                  * Binary file
                  */
                 status.text_mode = Q_FALSE;
+                break;
             }
         }
 
@@ -1346,6 +1668,277 @@ static unsigned char kermit_ctl(unsigned char b) {
     return (b ^ 0x40);
 }
 
+/**
+ * Character classes for decode_class[].
+ */
+#define DECODE_PLAIN    0
+#define DECODE_QCTL     1
+#define DECODE_QBIN     2
+#define DECODE_REPT     3
+
+/**
+ * The prefixed form of one raw byte: up to QBIN + QCTL + character.
+ */
+struct kermit_encode_entry {
+    unsigned char n;
+    unsigned char bytes[3];
+};
+
+/**
+ * The encoded form of every byte value for the current prefix characters.
+ */
+static struct kermit_encode_entry encode_table[256];
+
+/**
+ * The role of every received byte value: plain data, or one of the QCTL /
+ * QBIN / REPT prefixes.
+ */
+static unsigned char decode_class[256];
+
+/**
+ * The value of every byte when it follows a QCTL prefix.
+ */
+static unsigned char decode_unctl[256];
+
+/**
+ * The prefix characters the tables were built for.
+ */
+static Q_BOOL prefix_tables_valid = Q_FALSE;
+static unsigned char prefix_tables_local_QCTL;
+static unsigned char prefix_tables_remote_QCTL;
+static unsigned char prefix_tables_QBIN;
+static unsigned char prefix_tables_REPT;
+
+/**
+ * Rebuild the encode and decode tables if the negotiated prefix characters
+ * have changed since they were last built.
+ */
+static void check_prefix_tables() {
+    unsigned int i;
+    unsigned char ch;
+    unsigned char ch7bit;
+    unsigned char output_ch;
+    Q_BOOL need_qbin;
+    Q_BOOL need_qctl;
+    Q_BOOL ch_is_ctl;
+    struct kermit_encode_entry * entry;
+
+    if ((prefix_tables_valid == Q_TRUE) &&
+        (prefix_tables_local_QCTL == local_parms.QCTL) &&
+        (prefix_tables_remote_QCTL == remote_parms.QCTL) &&
+        (prefix_tables_QBIN == session_parms.QBIN) &&
+        (prefix_tables_REPT == session_parms.REPT)
+    ) {
+        return;
+    }
+
+    DLOG(("check_prefix_tables() QCTL '%c' '%c' QBIN '%c' REPT '%c'\n",
+            local_parms.QCTL, remote_parms.QCTL, session_parms.QBIN,
+            session_parms.REPT));
+
+    for (i = 0; i < 256; i++) {
+        ch = (unsigned char) i;
+        ch7bit = ch & 0x7F;
+        need_qbin = Q_FALSE;
+        need_qctl = Q_FALSE;
+        ch_is_ctl = Q_FALSE;
+        output_ch = ch;
+
+        if ((session_parms.QBIN != ' ') && ((ch & 0x80) != 0)) {
+            need_qbin = Q_TRUE;
+        }
+        if ((session_parms.REPT != ' ') && (ch7bit == session_parms.REPT)) {
+            /*
+             * Quoted REPT character
+             */
+            need_qctl = Q_TRUE;
+        } else if ((session_parms.QBIN != ' ') &&
+            (ch7bit == session_parms.QBIN)) {
+            /*
+             * Quoted QBIN character
+             */
+            need_qctl = Q_TRUE;
+        } else if (ch7bit == local_parms.QCTL) {
+            /*
+             * Quoted QCTL character
+             */
+            need_qctl = Q_TRUE;
+        } else if ((ch7bit < 0x20) || (ch7bit == 0x7F)) {
+            /*
+             * ctrl character
+             */
+            need_qctl = Q_TRUE;
+            ch_is_ctl = Q_TRUE;
+        }
+
+        entry = &encode_table[i];
+        entry->n = 0;
+        if (need_qbin == Q_TRUE) {
+            entry->bytes[entry->n] = session_parms.QBIN;
+            entry->n++;
+            output_ch = ch7bit;
+        }
+        if (need_qctl == Q_TRUE) {
+            entry->bytes[entry->n] = local_parms.QCTL;
+            entry->n++;
+        }
+        if (ch_is_ctl == Q_TRUE) {
+            /*
+             * Either 7-bit or 8-bit control character
+             */
+            entry->bytes[entry->n] = kermit_ctl(output_ch);
+        } else {
+            entry->bytes[entry->n] = output_ch;
+        }
+        entry->n++;
+
+        /*
+         * Control prefix can quote anything, so make sure to UN-ctl only for
+         * control characters.
+         */
+        if (((kermit_ctl(ch) & 0x7F) < 0x20) ||
+            ((kermit_ctl(ch) & 0x7F) == 0x7F)
+        ) {
+            decode_unctl[i] = kermit_ctl(ch);
+        } else {
+            decode_unctl[i] = ch;
+        }
+        decode_class[i] = DECODE_PLAIN;
+    }
+
+    /*
+     * Same precedence as the receiver checks them: REPT, then QCTL, then
+     * QBIN.
+     */
+    if (session_parms.QBIN != ' ') {
+        decode_class[session_parms.QBIN] = DECODE_QBIN;
+    }
+    decode_class[remote_parms.QCTL] = DECODE_QCTL;
+    if (session_parms.REPT != ' ') {
+        decode_class[session_parms.REPT] = DECODE_REPT;
+    }
+
+    prefix_tables_local_QCTL = local_parms.QCTL;
+    prefix_tables_remote_QCTL = remote_parms.QCTL;
+    prefix_tables_QBIN = session_parms.QBIN;
+    prefix_tables_REPT = session_parms.REPT;
+    prefix_tables_valid = Q_TRUE;
+}
+
+/**
+ * Count how many bytes at the front of a buffer are equal to ch, comparing
+ * a machine word at a time.
+ *
+ * @param buffer the bytes to scan
+ * @param buffer_n the number of bytes in buffer
+ * @param ch the byte value to look for
+ * @return the length of the run of ch at the beginning of buffer
+ */
+static unsigned int kermit_run_length(const unsigned char * buffer,
+                                      const unsigned int buffer_n,
+                                      const unsigned char ch) {
+
+    uint64_t pattern = 0x0101010101010101ULL * ch;
+    uint64_t word;
+    unsigned int n = 0;
+
+    while (n + sizeof(word) <= buffer_n) {
+        memcpy(&word, buffer + n, sizeof(word));
+        if (word != pattern) {
+            break;
+        }
+        n += sizeof(word);
+    }
+    while ((n < buffer_n) && (buffer[n] == ch)) {
+        n++;
+    }
+    return n;
+}
+
+/**
+ * Append a block of decoded bytes to the output buffer, growing it if
+ * needed.
+ *
+ * @param input the decoded bytes
+ * @param input_n the number of bytes in input
+ * @param strip_cr if true, drop CR's from input
+ * @param output the output buffer
+ * @param output_n the number of bytes already in output, will be updated
+ * @param output_max the size of the output buffer, will be updated
+ */
+static void decode_append(const unsigned char * input,
+                          const unsigned int input_n, const Q_BOOL strip_cr,
+                          unsigned char ** output, unsigned int * output_n,
+                          unsigned int * output_max) {
+
+    unsigned int i;
+
+    if (*output_n + input_n > *output_max) {
+        /*
+         * Grow the output buffer to handle what we've got.
+         */
+        while (*output_n + input_n > *output_max) {
+            *output_max *= 2;
+        }
+        *output = (unsigned char *) Xrealloc(*output, *output_max,
+                                             __FILE__, __LINE__);
+        DLOG(("decode_data_field() resize output_max to %d\n",
+                *output_max));
+    }
+
+    if (strip_cr == Q_FALSE) {
+        memcpy(*output + *output_n, input, input_n);
+        *output_n += input_n;
+        return;
+    }
+    for (i = 0; i < input_n; i++) {
+        if (input[i] != C_CR) {
+            (*output)[*output_n] = input[i];
+            (*output_n)++;
+        }
+    }
+}
+
+/**
+ * Append repeat_count copies of a decoded byte to the output buffer,
+ * growing it if needed.
+ *
+ * @param ch the decoded byte
+ * @param repeat_count the number of copies
+ * @param strip_cr if true, drop ch if it is a CR
+ * @param output the output buffer
+ * @param output_n the number of bytes already in output, will be updated
+ * @param output_max the size of the output buffer, will be updated
+ */
+static void decode_repeat(const unsigned char ch,
+                          const unsigned int repeat_count,
+                          const Q_BOOL strip_cr, unsigned char ** output,
+                          unsigned int * output_n,
+                          unsigned int * output_max) {
+
+    if ((strip_cr == Q_TRUE) && (ch == C_CR)) {
+        /*
+         * Strip CR's
+         */
+        return;
+    }
+
+    if (*output_n + repeat_count > *output_max) {
+        /*
+         * Grow the output buffer to handle what we've got.
+         */
+        while (*output_n + repeat_count > *output_max) {
+            *output_max *= 2;
+        }
+        *output = (unsigned char *) Xrealloc(*output, *output_max,
+                                             __FILE__, __LINE__);
+        DLOG(("decode_data_field() resize output_max to %d\n",
+                *output_max));
+    }
+    memset(*output + *output_n, ch, repeat_count);
+    *output_n += repeat_count;
+}
+
 /**
  * Decode the data payload of a packet into raw 8-bit bytes.  Note that this
  * will dynamically reallocate the output buffer if needed (i.e. run-length
@@ -1366,14 +1959,15 @@ static Q_BOOL decode_data_field(PACKET_TYPE type, unsigned char * input,
 
     unsigned int i;
     unsigned int begin;
+    unsigned int run;
     unsigned int data_n = 0;
     unsigned char ch;
+    unsigned char ch_class;
     Q_BOOL prefix_ctrl = Q_FALSE;
     Q_BOOL prefix_8bit = Q_FALSE;
     Q_BOOL prefix_rept = Q_FALSE;
+    Q_BOOL strip_cr = Q_FALSE;
     unsigned int repeat_count = 1;
-    unsigned char output_ch = 0;
-    Q_BOOL do_output_ch = Q_FALSE;
 
     DLOG(("decode_data_field() %d %s input_n %d output_max %d\n", type,
             packet_type_chars[type].description, input_n, *output_max));
@@ -1385,116 +1979,69 @@ static Q_BOOL decode_data_field(PACKET_TYPE type, unsigned char * input,
              */
             open_receive_file();
         }
+        if (status.text_mode == Q_TRUE) {
+            strip_cr = Q_TRUE;
+        }
     }
 
-    for (begin = 0; begin < input_n; begin++) {
+    check_prefix_tables();
 
+    if (((input_packet.seq == 0) &&
+            ((type == P_KACK) || (type == P_KSINIT))) ||
+        (type == P_KATTRIBUTES)
+    ) {
         /*
-         * Output a previously-escaped character
+         * Special case: do not do any prefix handling for the Send-Init or
+         * its corresponding ACK packet, or for the Attributes packet.
          */
-        if (do_output_ch == Q_TRUE) {
-            for (i = 0; i < repeat_count; i++) {
-                if ((type == P_KDATA) &&
-                    (status.state == KM_RDW) &&
-                    (status.text_mode == Q_TRUE) &&
-                    (output_ch == C_CR)
-                ) {
-                    /*
-                     * Strip CR's
-                     */
-                } else {
-                    if (data_n == *output_max) {
-                        /*
-                         * Grow the output buffer to handle what we've got.
-                         */
-                        *output_max *= 2;
-                        *output = (unsigned char *) Xrealloc(*output,
-                                                             *output_max,
-                                                             __FILE__,
-                                                             __LINE__);
-                        DLOG(("decode_data_field() resize output_max to %d\n",
-                                *output_max));
-                    }
-                    (*output)[data_n] = output_ch;
-                    data_n++;
-                }
-            }
-            repeat_count = 1;
-            do_output_ch = Q_FALSE;
-        }
+        DLOG(("SEND-INIT / ATTRIBUTES --> %d bytes\n", input_n));
+        decode_append(input, input_n, Q_FALSE, output, &data_n, output_max);
+        goto decode_done;
+    }
+
+    for (begin = 0; begin < input_n; begin++) {
 
         /*
          * Pull next character from input
          */
         ch = input[begin];
+        ch_class = decode_class[ch];
 
-        if ((input_packet.seq == 0) &&
-            ((type == P_KACK) || (type == P_KSINIT))
+        if ((ch_class == DECODE_PLAIN) &&
+            (prefix_ctrl == Q_FALSE) &&
+            (prefix_8bit == Q_FALSE) &&
+            (prefix_rept == Q_FALSE) &&
+            (repeat_count == 1)
         ) {
             /*
-             * Special case: do not do any prefix handling for the Send-Init
-             * or its corresponding ACK packet.
+             * Common case: a run of unprefixed characters, copy it in one
+             * block.
              */
-            DLOG(("SEND-INIT --> ch '%c' %02x\n", ch, ch));
-
-            if (data_n == *output_max) {
-                /*
-                 * Grow the output buffer to handle what we've got.
-                 */
-                *output_max *= 2;
-                *output = (unsigned char *) Xrealloc(*output,
-                                                     *output_max,
-                                                     __FILE__, __LINE__);
-
-                DLOG(("decode_data_field() resize output_max to %d\n",
-                        *output_max));
+            run = 1;
+            while ((begin + run < input_n) &&
+                   (decode_class[input[begin + run]] == DECODE_PLAIN)
+            ) {
+                run++;
             }
-            (*output)[data_n] = ch;
-            data_n++;
+            decode_append(input + begin, run, strip_cr, output, &data_n,
+                          output_max);
+            begin += run - 1;
             continue;
         }
 
-        if (type == P_KATTRIBUTES) {
-            /*
-             * Special case: do not do any prefix handling for the Attributes
-             * packet.
-             */
-            DLOG(("ATTRIBUTES --> ch '%c' %02x\n", ch, ch));
-            if (data_n == *output_max) {
-                /*
-                 * Grow the output buffer to handle what we've got.
-                 */
-                *output_max *= 2;
-                *output = (unsigned char *) Xrealloc(*output,
-                                                     *output_max,
-                                                     __FILE__, __LINE__);
-                DLOG(("decode_data_field() resize output_max to %d\n",
-                        *output_max));
-            }
-            (*output)[data_n] = ch;
-            data_n++;
-            continue;
-        }
 #ifdef DEBUG_KERMIT_VERBOSE
         DLOG(("decode_data_field() ch '%c' %02x ctrl %d 8bit %d repeat %d repeat_count %d\n",
                 ch, ch, prefix_ctrl, prefix_8bit, prefix_rept, repeat_count));
 #endif /* DEBUG_KERMIT_VERBOSE */
 
-        if ((session_parms.REPT != ' ') && (ch == session_parms.REPT)) {
+        if (ch_class == DECODE_REPT) {
             if ((prefix_ctrl == Q_TRUE) && (prefix_8bit == Q_TRUE)) {
                 /*
                  * Escaped 8-bit REPT
                  */
-                output_ch = session_parms.REPT | 0x80;
-                do_output_ch = Q_TRUE;
-
-#ifdef DEBUG_KERMIT_VERBOSE
-                DLOG((" - escaped 8-bit REPT -\n"));
-                DLOG(("    '%c' %02x --> ch '%c' %02x\n",
-                        input[begin], input[begin],
-                        session_parms.REPT | 0x80, session_parms.REPT | 0x80));
-#endif /* DEBUG_KERMIT_VERBOSE */
-
+                decode_repeat(session_parms.REPT | 0x80, repeat_count,
+                              strip_cr, output, &data_n, output_max);
+                repeat_count = 1;
                 prefix_ctrl = Q_FALSE;
                 prefix_8bit = Q_FALSE;
                 prefix_rept = Q_FALSE;
@@ -1505,16 +2052,9 @@ static Q_BOOL decode_data_field(PACKET_TYPE type, unsigned char * input,
                 /*
                  * Escaped REPT
                  */
-                output_ch = session_parms.REPT;
-                do_output_ch = Q_TRUE;
-
-#ifdef DEBUG_KERMIT_VERBOSE
-                DLOG((" - escaped REPT -\n"));
-                DLOG(("    '%c' %02x --> ch '%c' %02x\n",
-                        input[begin], input[begin],
-                        session_parms.REPT, session_parms.REPT));
-#endif /* DEBUG_KERMIT_VERBOSE */
-
+                decode_repeat(session_parms.REPT, repeat_count,
+                              strip_cr, output, &data_n, output_max);
+                repeat_count = 1;
                 prefix_ctrl = Q_FALSE;
                 prefix_rept = Q_FALSE;
                 continue;
@@ -1522,9 +2062,6 @@ static Q_BOOL decode_data_field(PACKET_TYPE type, unsigned char * input,
 
             if (prefix_rept == Q_TRUE) {
                 repeat_count = kermit_unchar(session_parms.REPT);
-#ifdef DEBUG_KERMIT_VERBOSE
-                DLOG((" - REPT count %d \n", repeat_count));
-#endif /* DEBUG_KERMIT_VERBOSE */
                 prefix_rept = Q_FALSE;
                 continue;
             }
@@ -1533,7 +2070,6 @@ static Q_BOOL decode_data_field(PACKET_TYPE type, unsigned char * input,
              * Flip rept bit
              */
             prefix_rept = Q_TRUE;
-            do_output_ch = Q_FALSE;
             continue;
         }
 
@@ -1546,22 +2082,14 @@ static Q_BOOL decode_data_field(PACKET_TYPE type, unsigned char * input,
             continue;
         }
 
-        if (ch == remote_parms.QCTL) {
+        if (ch_class == DECODE_QCTL) {
             if ((prefix_8bit == Q_TRUE) && (prefix_ctrl == Q_TRUE)) {
-
                 /*
                  * 8-bit QCTL
                  */
-                output_ch = remote_parms.QCTL | 0x80;
-                do_output_ch = Q_TRUE;
-
-#ifdef DEBUG_KERMIT_VERBOSE
-                DLOG((" - 8-bit QCTL -\n"));
-                DLOG(("    '%c' %02x --> ch '%c' %02x\n",
-                        input[begin], input[begin],
-                        remote_parms.QCTL | 0x80, remote_parms.QCTL | 0x80));
-#endif /* DEBUG_KERMIT_VERBOSE */
-
+                decode_repeat(remote_parms.QCTL | 0x80, repeat_count,
+                              strip_cr, output, &data_n, output_max);
+                repeat_count = 1;
                 prefix_ctrl = Q_FALSE;
                 prefix_8bit = Q_FALSE;
                 continue;
@@ -1571,30 +2099,22 @@ static Q_BOOL decode_data_field(PACKET_TYPE type, unsigned char * input,
                 /*
                  * Escaped QCTL
                  */
-                output_ch = remote_parms.QCTL;
-                do_output_ch = Q_TRUE;
-
-#ifdef DEBUG_KERMIT_VERBOSE
-                DLOG((" - escaped QCTL -\n"));
-                DLOG(("    '%c' %02x --> ch '%c' %02x\n",
-                        input[begin], input[begin],
-                        remote_parms.QCTL, remote_parms.QCTL));
-#endif /* DEBUG_KERMIT_VERBOSE */
-
+                decode_repeat(remote_parms.QCTL, repeat_count,
+                              strip_cr, output, &data_n, output_max);
+                repeat_count = 1;
                 prefix_ctrl = Q_FALSE;
                 continue;
             }
+
             /*
              * Flip ctrl bit
              */
             prefix_ctrl = Q_TRUE;
-            do_output_ch = Q_FALSE;
             continue;
         }
 
-        if ((session_parms.QBIN != ' ') && (ch == session_parms.QBIN)) {
+        if (ch_class == DECODE_QBIN) {
             if ((prefix_8bit == Q_TRUE) && (prefix_ctrl == Q_FALSE)) {
-
                 /*
                  * This is an error
                  */
@@ -1608,15 +2128,9 @@ static Q_BOOL decode_data_field(PACKET_TYPE type, unsigned char * input,
                 /*
                  * 8-bit QBIN
                  */
-                output_ch = session_parms.QBIN | 0x80;
-                do_output_ch = Q_TRUE;
-
-#ifdef DEBUG_KERMIT_VERBOSE
-                DLOG((" - 8bit QBIN -\n"));
-                DLOG(("    '%c' %02x --> ch '%c' %02x\n",
-                        input[begin], input[begin],
-                        session_parms.QBIN | 0x80, session_parms.QBIN | 0x80));
-#endif /* DEBUG_KERMIT_VERBOSE */
+                decode_repeat(session_parms.QBIN | 0x80, repeat_count,
+                              strip_cr, output, &data_n, output_max);
+                repeat_count = 1;
                 prefix_ctrl = Q_FALSE;
                 prefix_8bit = Q_FALSE;
                 continue;
@@ -1626,16 +2140,9 @@ static Q_BOOL decode_data_field(PACKET_TYPE type, unsigned char * input,
                 /*
                  * Escaped QBIN
                  */
-                output_ch = session_parms.QBIN;
-                do_output_ch = Q_TRUE;
-
-#ifdef DEBUG_KERMIT_VERBOSE
-                DLOG((" - escaped QBIN -\n"));
-                DLOG(("    '%c' %02x --> ch '%c' %02x\n",
-                        input[begin], input[begin],
-                        session_parms.QBIN, session_parms.QBIN));
-#endif /* DEBUG_KERMIT_VERBOSE */
-
+                decode_repeat(session_parms.QBIN, repeat_count,
+                              strip_cr, output, &data_n, output_max);
+                repeat_count = 1;
                 prefix_ctrl = Q_FALSE;
                 continue;
             }
@@ -1644,7 +2151,6 @@ static Q_BOOL decode_data_field(PACKET_TYPE type, unsigned char * input,
              * Flip 8bit bit
              */
             prefix_8bit = Q_TRUE;
-            do_output_ch = Q_FALSE;
             continue;
         }
 
@@ -1652,15 +2158,7 @@ static Q_BOOL decode_data_field(PACKET_TYPE type, unsigned char * input,
          * Regular character
          */
         if (prefix_ctrl == Q_TRUE) {
-            /*
-             * Control prefix can quote anything, so make sure to UN-ctl only
-             * for control characters.
-             */
-            if (((kermit_ctl(ch) & 0x7F) < 0x20) ||
-                ((kermit_ctl(ch) & 0x7F) == 0x7F)
-            ) {
-                ch = kermit_ctl(ch);
-            }
+            ch = decode_unctl[ch];
             prefix_ctrl = Q_FALSE;
         }
         if (prefix_8bit == Q_TRUE) {
@@ -1672,65 +2170,13 @@ static Q_BOOL decode_data_field(PACKET_TYPE type, unsigned char * input,
                 input[begin], input[begin], ch, ch));
 #endif /* DEBUG_KERMIT_VERBOSE */
 
-        for (i = 0; i < repeat_count; i++) {
-            if ((type == P_KDATA) &&
-                (status.state == KM_RDW) &&
-                (status.text_mode == Q_TRUE) &&
-                (ch == C_CR)
-            ) {
-                /*
-                 * Strip CR's
-                 */
-            } else {
-                if (data_n == *output_max) {
-                    /*
-                     * Grow the output buffer to handle what we've got.
-                     */
-                    *output_max *= 2;
-                    *output = (unsigned char *) Xrealloc(*output,
-                                                         *output_max,
-                                                         __FILE__, __LINE__);
-                    DLOG(("decode_data_field() resize output_max to %d\n",
-                            *output_max));
-                }
-                (*output)[data_n] = ch;
-                data_n++;
-            }
-        }
+        decode_repeat(ch, repeat_count, strip_cr, output, &data_n,
+                      output_max);
         repeat_count = 1;
 
     } /* for (begin = 0; begin < input_n; begin++) */
 
-    /*
-     * Output a previously-escaped character (boundary case)
-     */
-    if (do_output_ch == Q_TRUE) {
-        for (i = 0; i < repeat_count; i++) {
-            if ((type == P_KDATA) &&
-                (status.state == KM_RDW) &&
-                (status.text_mode == Q_TRUE) &&
-                (output_ch == C_CR)
-            ) {
-                /*
-                 * Strip CR's
-                 */
-            } else {
-                if (data_n == *output_max) {
-                    /*
-                     * Grow the output buffer to handle what we've got.
-                     */
-                    *output_max *= 2;
-                    *output = (unsigned char *) Xrealloc(*output,
-                                                         *output_max,
-                                                         __FILE__, __LINE__);
-                    DLOG(("decode_data_field() resize output_max to %d\n",
-                            *output_max));
-                }
-                (*output)[data_n] = output_ch;
-                data_n++;
-            }
-        }
-    }
+decode_done:
 
     /*
      * Save final result
@@ -1763,20 +2209,16 @@ static int encode_one_byte(unsigned char ch, unsigned int repeat_count,
 
     unsigned int i;
     int data_n = 0;
-    unsigned char ch7bit;
-    Q_BOOL need_qbin;
-    Q_BOOL need_qctl;
-    Q_BOOL ch_is_ctl;
-    unsigned char output_ch;
+    struct kermit_encode_entry * entry = &encode_table[ch];
 
     /*
      * Use the RLE encoding for repeat count, but only if there are at least
      * three occurrences OR if this a space byte and we are using the 'B'
      * checksum type.
      */
-    if ((repeat_count > 3) ||
-        ((status.check_type == 12) && (ch == ' '))) {
-
+    if ((session_parms.REPT != ' ') &&
+        ((repeat_count > 3) || ((status.check_type == 12) && (ch == ' ')))
+    ) {
         output[data_n] = session_parms.REPT;
         data_n++;
         output[data_n] = kermit_tochar((unsigned char) repeat_count);
@@ -1784,65 +2226,35 @@ static int encode_one_byte(unsigned char ch, unsigned int repeat_count,
         repeat_count = 1;
     }
 
-    for (i = 0; i < repeat_count; i++) {
-        ch7bit = ch & 0x7F;
-        need_qbin = Q_FALSE;
-        need_qctl = Q_FALSE;
-        ch_is_ctl = Q_FALSE;
-        output_ch = ch;
-
-        if ((session_parms.QBIN != ' ') && ((ch & 0x80) != 0)) {
-            need_qbin = Q_TRUE;
-        }
-        if ((session_parms.REPT != ' ') && (ch7bit == session_parms.REPT)) {
-            /*
-             * Quoted REPT character
-             */
-            need_qctl = Q_TRUE;
-        } else if ((session_parms.QBIN != ' ') &&
-            (ch7bit == session_parms.QBIN)) {
-            /*
-             * Quoted QBIN character
-             */
-            need_qctl = Q_TRUE;
-        } else if (ch7bit == local_parms.QCTL) {
-            /*
-             * Quoted QCTL character
-             */
-            need_qctl = Q_TRUE;
-        } else if ((ch7bit < 0x20) || (ch7bit == 0x7F)) {
-            /*
-             * ctrl character
-             */
-            need_qctl = Q_TRUE;
-            ch_is_ctl = Q_TRUE;
-        }
-        if (need_qbin == Q_TRUE) {
-            output[data_n] = session_parms.QBIN;
-            data_n++;
-            output_ch = ch7bit;
-        }
-        if (need_qctl == Q_TRUE) {
-            output[data_n] = local_parms.QCTL;
-            data_n++;
-        }
-        if (ch_is_ctl == Q_TRUE) {
-            /*
-             * Either 7-bit or 8-bit control character
-             */
-            output[data_n] = kermit_ctl(output_ch);
-            data_n++;
-        } else {
-            /*
-             * Regular character
-             */
-            output[data_n] = output_ch;
-            data_n++;
-        }
+    for (i = 0; i < repeat_count; i++) {
+        memcpy(output + data_n, entry->bytes, entry->n);
+        data_n += entry->n;
     }
 
     return data_n;
 }
+
+/**
+ * Compute how many bytes encode_one_byte() will produce for a run.
+ *
+ * @param ch the raw byte
+ * @param repeat_count the number of consecutive occurrences of b
+ * @return the number of bytes encode_one_byte() would add to output
+ */
+static unsigned int encoded_length(unsigned char ch,
+                                   unsigned int repeat_count) {
+
+    if (repeat_count == 0) {
+        return 0;
+    }
+    if ((session_parms.REPT != ' ') &&
+        ((repeat_count > 3) || ((status.check_type == 12) && (ch == ' ')))
+    ) {
+        return 2 + encode_table[ch].n;
+    }
+    return repeat_count * encode_table[ch].n;
+}
+
 /**
  * Encode the data payload for a packet.
  *
@@ -1858,7 +2270,7 @@ static Q_BOOL encode_data_field(PACKET_TYPE type, unsigned char * input,
                                 unsigned int * output_n) {
 
     unsigned int i;
-    int rc;
+    unsigned int run;
     unsigned int begin = 0;
     unsigned int data_n = 0;
     unsigned char ch;
@@ -1866,7 +2278,11 @@ static Q_BOOL encode_data_field(PACKET_TYPE type, unsigned char * input,
     int repeat_count = 0;
     Q_BOOL first = Q_TRUE;
     Q_BOOL crlf = Q_FALSE;
+    Q_BOOL from_file = Q_FALSE;
     unsigned int data_max;
+    unsigned int run_max;
+    unsigned char * source = input;
+    unsigned int source_n = input_n;
 
     DLOG(("encode_data_field() %d %s %d\n", type,
             packet_type_chars[type].description, input_n));
@@ -1879,6 +2295,25 @@ static Q_BOOL encode_data_field(PACKET_TYPE type, unsigned char * input,
          */
         fseek(status.file_stream, status.file_position, SEEK_SET);
         status.outstanding_bytes = 0;
+
+        /*
+         * File data is read in blocks into file_buffer.
+         */
+        from_file = Q_TRUE;
+        source = file_buffer;
+        source_n = 0;
+    }
+
+    check_prefix_tables();
+
+    /*
+     * Without RLE a run is just its bytes written out, so don't collect
+     * runs at all.
+     */
+    if (session_parms.REPT == ' ') {
+        run_max = 1;
+    } else {
+        run_max = 94;
     }
 
     for (;;) {
@@ -1897,7 +2332,10 @@ static Q_BOOL encode_data_field(PACKET_TYPE type, unsigned char * input,
             data_max = session_parms.MAXL;
         }
 
-        if (data_n >= data_max - 5) {
+        /*
+         * The pending run is not in output yet, count it too.
+         */
+        if (data_n + encoded_length(last_ch, repeat_count) >= data_max - 5) {
             /*
              * No more room in destination
              */
@@ -1909,7 +2347,8 @@ static Q_BOOL encode_data_field(PACKET_TYPE type, unsigned char * input,
          * the LF -> CRLF conversion.
          */
         if ((status.text_mode == Q_TRUE) &&
-            (data_n >= session_parms.MAXL - 5 - 2)
+            (data_n + encoded_length(last_ch, repeat_count) >=
+                data_max - 5 - 2)
         ) {
             /*
              * No more room in destination
@@ -1922,9 +2361,18 @@ static Q_BOOL encode_data_field(PACKET_TYPE type, unsigned char * input,
             ch = C_LF;
         } else {
 
-            if ((type == P_KDATA) && (status.state == KM_SDW)) {
-                rc = fread(&ch, 1, 1, status.file_stream);
-                if (rc < 0) {
+            if ((from_file == Q_TRUE) && (begin == source_n)) {
+                /*
+                 * Refill file_buffer.  Bytes read past the end of this
+                 * packet are discarded: the next packet seeks to
+                 * file_position again.
+                 */
+                source_n = fread(file_buffer, 1,
+                                 (data_max < sizeof(file_buffer) ?
+                                     data_max : sizeof(file_buffer)),
+                                 status.file_stream);
+                begin = 0;
+                if ((source_n == 0) && (ferror(status.file_stream) != 0)) {
                     /*
                      * Uh-oh
                      */
@@ -1933,28 +2381,24 @@ static Q_BOOL encode_data_field(PACKET_TYPE type, unsigned char * input,
                     stop_file_transfer(Q_TRANSFER_STATE_ABORT);
                     error_packet("Disk I/O error");
                     return Q_FALSE;
-                } else if ((rc < 1) || (rc == 0)) {
+                }
+            }
+            if (begin == source_n) {
+                if (from_file == Q_TRUE) {
                     /*
                      * Last packet
                      */
                     DLOG(("      - EOF -\n"));
-                    break;
                 } else {
-                    /*
-                     * Read 1 byte successfully
-                     */
-                }
-            } else {
-                if (begin == input_n) {
                     DLOG(("      - end of input, break -\n"));
-                    /*
-                     * No more characters to read
-                     */
-                    break;
                 }
-                ch = input[begin];
-                begin++;
+                /*
+                 * No more characters to read
+                 */
+                break;
             }
+            ch = source[begin];
+            begin++;
             status.outstanding_bytes++;
         }
 
@@ -2011,8 +2455,22 @@ static Q_BOOL encode_data_field(PACKET_TYPE type, unsigned char * input,
         /*
          * Normal case: do repeat count and prefixing
          */
-        if ((last_ch == ch) && (repeat_count < 94)) {
+        if ((last_ch == ch) && (repeat_count < run_max)) {
             repeat_count++;
+
+            if ((status.text_mode == Q_FALSE) && (repeat_count < run_max)) {
+                /*
+                 * Binary data: take the rest of this run in one step.
+                 */
+                run = kermit_run_length(source + begin,
+                                        (source_n - begin <
+                                            run_max - repeat_count ?
+                                            source_n - begin :
+                                            run_max - repeat_count), ch);
+                begin += run;
+                repeat_count += run;
+                status.outstanding_bytes += run;
+            }
         } else {
 #ifdef DEBUG_KERMIT_VERBOSE
             DLOG(( "   encode ch '%c' %02x repeat %d\n",
@@ -2048,6 +2506,15 @@ static Q_BOOL encode_data_field(PACKET_TYPE type, unsigned char * input,
         data_n += encode_one_byte(C_LF, 1, output + data_n);
     }
 
+    if ((from_file == Q_TRUE) && (begin < source_n)) {
+        /*
+         * The read-ahead may have hit the end of the file before this packet
+         * used all of it.  send_file_data() checks feof(), so clear it: the
+         * next packet seeks back to file_position anyway.
+         */
+        clearerr(status.file_stream);
+    }
+
     /*
      * Save output bytes
      */
@@ -2388,9 +2855,9 @@ static Q_BOOL process_send_init() {
             parms.MAXLX1 = 500 / 95;
             parms.MAXLX2 = 500 % 95;
         }
-        if (((parms.MAXLX1 * 95) + parms.MAXLX2) > KERMIT_BLOCK_SIZE) {
-            parms.MAXLX1 = KERMIT_BLOCK_SIZE / 95;
-            parms.MAXLX2 = KERMIT_BLOCK_SIZE % 95;
+        if (((parms.MAXLX1 * 95) + parms.MAXLX2) > max_long_packet) {
+            parms.MAXLX1 = max_long_packet / 95;
+            parms.MAXLX2 = max_long_packet % 95;
         }
     }
 
@@ -3392,6 +3859,18 @@ static void negotiate_send_init() {
     } else {
         session_parms.long_packets = Q_FALSE;
     }
+    /*
+     * MAXLX1/MAXLX2 - Use the minimum value
+     */
+    if ((local_parms.MAXLX1 * 95 + local_parms.MAXLX2) <
+        (remote_parms.MAXLX1 * 95 + remote_parms.MAXLX2)
+    ) {
+        session_parms.MAXLX1 = local_parms.MAXLX1;
+        session_parms.MAXLX2 = local_parms.MAXLX2;
+    } else {
+        session_parms.MAXLX1 = remote_parms.MAXLX1;
+        session_parms.MAXLX2 = remote_parms.MAXLX2;
+    }
     /*
      * Streaming - if in agreement, use theirs
      */
@@ -3436,32 +3915,11 @@ static void negotiate_send_init() {
             if (local_parms.windowing == Q_TRUE) {
                 session_parms.CAPAS |= 0x04;
                 /*
-                 * Allocate the two windows
+                 * Reset the two windows.  Their slots were allocated in
+                 * kermit_start().
                  */
-                assert(input_window != NULL);
-                input_window =
-                    (struct kermit_packet_serial *) Xrealloc(input_window,
-                        session_parms.WINDO_in *
-                            sizeof(struct kermit_packet_serial),
-                        __FILE__, __LINE__);
-                memset(input_window, 0,
-                       session_parms.WINDO_in *
-                       sizeof(struct kermit_packet_serial));
-                assert(output_window != NULL);
-                output_window =
-                    (struct kermit_packet_serial *) Xrealloc(output_window,
-                        session_parms.WINDO_out *
-                            sizeof(struct kermit_packet_serial),
-                        __FILE__, __LINE__);
-                memset(output_window, 0,
-                       session_parms.WINDO_out *
-                       sizeof(struct kermit_packet_serial));
-                /*
-                 * Reset input_window
-                 */
-                input_window_n = 0;
-                input_window_i = 0;
-                input_window_begin = 0;
+                window_reset(&input_window);
+                window_reset(&output_window);
             }
         }
         /*
@@ -3598,46 +4056,22 @@ static void ack_file_packet() {
  * Generate a NAK packet.
  */
 static void nak_packet() {
-    int i;
     int seq = input_packet.seq;
-    Q_BOOL found_right_nak = Q_FALSE;
-    int seq_end_i;
 
     /*
      * Only the receiver can NAK
      */
     assert(status.sending == Q_FALSE);
 
-    if (input_window_n > 0) {
-        i = input_window_begin;
-        do {
-            if (input_window[i].acked == Q_FALSE) {
-                /*
-                 * NAK the oldest un-ACK'd packet
-                 */
-                seq = input_window[i].seq;
-                found_right_nak = Q_TRUE;
-                break;
-            }
-            /*
-             * This must be at the end of the loop.
-             */
-            i++;
-            i %= session_parms.WINDO_in;
-        } while (i != input_window_i);
-
-        if (found_right_nak == Q_FALSE) {
-            /*
-             * Did not find anything to NAK within the window, so NAK the
-             * next expected packet.
-             */
-            seq_end_i = input_window_i - 1;
-            if (seq_end_i < 0) {
-                seq_end_i = input_window_n - 1;
-            }
-            seq = input_window[seq_end_i].seq + 1;
+    if (input_window.n > 0) {
+        /*
+         * NAK the oldest un-ACK'd packet.  If everything within the window
+         * is ACK'd, NAK the next expected packet.
+         */
+        seq = window_first_nak(&input_window);
+        if (seq == -1) {
+            seq = window_end(&input_window);
         }
-
     } else {
 
         /*
@@ -3679,8 +4113,8 @@ static void nak_packet() {
             return;
         }
 
-        if ((input_window_n == session_parms.WINDO_in) &&
-            (input_window[input_window_begin].acked == Q_FALSE)
+        if ((input_window.n == session_parms.WINDO_in) &&
+            (window_acked(&input_window, input_window.begin) == Q_FALSE)
         ) {
             /*
              * The window cannot grow, make this a NOP
@@ -3689,45 +4123,23 @@ static void nak_packet() {
             output_packet.parsed_ok = Q_FALSE;
             return;
         }
-        DLOG(("nak_packet() adding to window slot %d with SEQ %u\n",
-                input_window_i, input_packet.seq));
+        DLOG(("nak_packet() adding to window with SEQ %u\n",
+                input_packet.seq));
 
         assert(session_parms.WINDO_in > 0);
 
         /*
          * Roll off the bottom if needed
          */
-        if ((input_window[input_window_begin].acked == Q_TRUE) &&
-            (input_window_n == session_parms.WINDO_in)) {
-
-            if (input_window[input_window_begin].type == P_KDATA) {
-                DLOG(("nak_packet() write %d bytes to file\n",
-                        input_window[input_window_begin].data_n));
+        if ((input_window.n == session_parms.WINDO_in) &&
+            (window_acked(&input_window, input_window.begin) == Q_TRUE)
+        ) {
+            window_roll_off();
 
-                fwrite(input_window[input_window_begin].data, 1,
-                       input_window[input_window_begin].data_n,
-                       status.file_stream);
-                status.file_position += input_window[input_window_begin].data_n;
-                q_transfer_stats.bytes_transfer = status.file_position;
-                stats_increment_blocks();
-            }
-            Xfree(input_window[input_window_begin].data, __FILE__, __LINE__);
-            input_window[input_window_begin].data = NULL;
-            input_window_begin++;
-            input_window_begin %= session_parms.WINDO_in;
-            input_window_n--;
-
-            input_window[input_window_i].type = input_packet.type;
-            input_window[input_window_i].seq = input_packet.seq;
-            input_window[input_window_i].try_count = 1;
-            input_window[input_window_i].acked = Q_FALSE;
-
-            assert(input_window[input_window_i].data == NULL);
-            input_window[input_window_i].data_n = 0;
-
-            input_window_i++;
-            input_window_i %= session_parms.WINDO_in;
-            input_window_n++;
+            window_store(&input_window, input_packet.seq, input_packet.type,
+                         NULL, 0);
+            input_window.slots[input_packet.seq].try_count = 1;
+            window_append(&input_window, input_packet.seq, Q_FALSE);
         } else {
             /*
              * We just sent the NAK for this one, so don't add another.
@@ -3950,7 +4362,7 @@ static Q_BOOL decode_input_bytes(unsigned char * input,
          * Sanity check the length field
          */
         if (input_packet.length >
-            session_parms.MAXLX1 * 95 + session_parms.MAXLX2) {
+            local_parms.MAXLX1 * 95 + local_parms.MAXLX2) {
             /*
              * Bad length field.  Tell the other side to re-send
              */
@@ -5190,7 +5602,7 @@ static Q_BOOL send_SDW() {
             status.skip_file = Q_TRUE;
         }
 
-        if ((session_parms.windowing == Q_TRUE) && (output_window != NULL)) {
+        if (session_parms.windowing == Q_TRUE) {
             /*
              * We are windowing, and received an ACK.  Just send the next
              * out, whatever it is.  If we're at EOF, send_SD_next_packet()
@@ -5264,8 +5676,7 @@ static Q_BOOL send_SZ() {
         input_packet.parsed_ok = Q_FALSE;
 
         if ((session_parms.windowing == Q_TRUE) &&
-            (output_window != NULL) &&
-            (output_window_n > 0)
+            (output_window.n > 0)
         ) {
             /*
              * We're waiting on another ACK somewhere down the line.
@@ -5435,6 +5846,25 @@ static Q_BOOL kermit_send() {
 /* ------------------------------------------------------------------------ */
 /* ------------------------------------------------------------------------ */
 
+/**
+ * Remove the oldest packet from the input window, writing it to file if it
+ * is file data.
+ */
+static void window_roll_off() {
+    struct kermit_packet_serial * slot;
+
+    slot = &input_window.slots[input_window.begin];
+    if ((slot->type == P_KDATA) && (status.file_stream != NULL)) {
+        DLOG(("window_roll_off() write %d bytes to file\n", slot->data_n));
+
+        fwrite(slot->data, 1, slot->data_n, status.file_stream);
+        status.file_position += slot->data_n;
+        q_transfer_stats.bytes_transfer = status.file_position;
+        stats_increment_blocks();
+    }
+    window_pop(&input_window);
+}
+
 /**
  * This function implements Case 1 of the logic on p. 55 of "The Kermit
  * Protocol".
@@ -5442,32 +5872,20 @@ static Q_BOOL kermit_send() {
  * @return true if the sequence is 1 past the window
  */
 static Q_BOOL window_next_packet_seq(const int seq) {
-    int seq_end_i;
-    int seq_end;
 
     DLOG(("window_next_packet_seq() check SEQ %d\n", seq));
 
     /*
      * If the window is empty, this is easy
      */
-    if (input_window_n == 0) {
+    if (input_window.n == 0) {
         return Q_TRUE;
     }
 
-    /*
-     * Get the SEQs at the beginning and ending of the window
-     */
-    seq_end_i = input_window_i - 1;
-    if (seq_end_i < 0) {
-        seq_end_i = session_parms.WINDO_in - 1;
-    }
-    seq_end = input_window[seq_end_i].seq;
-
-    DLOG(("window_next_packet_seq() seq_end %d seq_end_i %d input_window_begin %d input_window_i %d input_window_n %d\n",
-            seq_end, seq_end_i, input_window_begin, input_window_i,
-            input_window_n));
+    DLOG(("window_next_packet_seq() input_window begin %d n %d\n",
+            input_window.begin, input_window.n));
 
-    if (seq == (seq_end + 1) % 64) {
+    if (seq == window_end(&input_window)) {
 
         DLOG(("window_next_packet_seq() TRUE Case 1\n"));
 
@@ -5484,120 +5902,83 @@ static Q_BOOL window_next_packet_seq(const int seq) {
 }
 
 /**
- * Find the slot in the input window that either matches input_packet's
- * SEQ (where it should go) or is the next slot to append data to.
+ * Find the slot in the input window for input_packet.
  *
  * This function implements the logic on p. 55 of "The Kermit Protocol".
  *
- * @return the slot, or -1 if the packet should be ignored
+ * @param append set to true if input_packet is the next packet in sequence
+ * and should be appended to the window
+ * @return true if input_packet should be saved to slot input_packet.seq,
+ * false if it should be ignored
  */
-static int find_input_slot() {
-    int i;
-    int seq_end_i;
-    int seq_end;
-    int seq_end_ws;
-    Q_BOOL lost_packet = Q_FALSE;
+static Q_BOOL find_input_slot(Q_BOOL * append) {
+    unsigned int seq_end;
+    unsigned int distance;
+    unsigned int lost_max;
+    int seq;
 
     assert(input_packet.parsed_ok == Q_TRUE);
 
-    DLOG(("find_input_slot() SEQ %d input_window_n %d\n", input_packet.seq,
-            input_window_n));
+    DLOG(("find_input_slot() SEQ %d input_window begin %d n %d\n",
+            input_packet.seq, input_window.begin, input_window.n));
 
-    /*
-     * If the window is empty, this is easy
-     */
-    if (input_window_n == 0) {
-        return input_window_i;
-    }
+    *append = Q_FALSE;
 
     /*
-     * Get the SEQs at the ending of the window
+     * If the window is empty, this is easy
      */
-    seq_end_i = input_window_i - 1;
-    if (seq_end_i < 0) {
-        seq_end_i = session_parms.WINDO_in - 1;
+    if (input_window.n == 0) {
+        *append = Q_TRUE;
+        return Q_TRUE;
     }
-    seq_end = input_window[seq_end_i].seq;
-    seq_end_ws = (seq_end + session_parms.WINDO_in) % 64;
-
-    DLOG(("find_input_slot() seq_end %d seq_end_i %d seq_end_ws %d input_window_begin %d input_window_i %d input_window_n %d\n",
-            seq_end, seq_end_i, seq_end_ws, input_window_begin, input_window_i,
-            input_window_n));
-
-    if (input_packet.seq == (seq_end + 1) % 64) {
-        /*
-         * Case 1: The usual case.
-         */
 
-        /*
-         * If input_window_begin is a file data packet, write it to disk.
-         */
-        if ((input_window[input_window_begin].type == P_KDATA) &&
-            (input_window[input_window_begin].acked == Q_TRUE)
-        ) {
-            DLOG(("find_input_slot() write %d bytes to file\n",
-                    input_window[input_window_begin].data_n));
+    seq_end = window_last(&input_window);
+    distance = (input_packet.seq + KERMIT_SEQ_N - seq_end) % KERMIT_SEQ_N;
 
-            fwrite(input_window[input_window_begin].data, 1,
-                   input_window[input_window_begin].data_n, status.file_stream);
-            status.file_position += input_window[input_window_begin].data_n;
-            q_transfer_stats.bytes_transfer = status.file_position;
-            stats_increment_blocks();
-        }
+    if (distance == 1) {
         /*
-         * Roll off the back of the input window
+         * Case 1: The usual case.  Roll off the back of the input window
+         * if it is full.
          */
-        if ((input_window[input_window_begin].acked == Q_TRUE) &&
-            (input_window_n == session_parms.WINDO_in)) {
-            Xfree(input_window[input_window_begin].data, __FILE__, __LINE__);
-            input_window[input_window_begin].data = NULL;
-            input_window_begin++;
-            input_window_begin %= session_parms.WINDO_in;
-            input_window_n--;
+        if (input_window.n == session_parms.WINDO_in) {
+            if (window_acked(&input_window, input_window.begin) == Q_FALSE) {
+                /*
+                 * The oldest packet is still missing, there is no room
+                 * for this one.
+                 */
+                DLOG(("find_input_slot() Case 1 FULL - STALL\n"));
+                return Q_FALSE;
+            }
+            window_roll_off();
         }
-        DLOG(("find_input_slot() Case 1 %d\n", input_window_i));
+        DLOG(("find_input_slot() Case 1\n"));
 
-        return input_window_i;
+        *append = Q_TRUE;
+        return Q_TRUE;
     }
 
     /*
      * Case 2: A packet was lost.  We need to look for the range (seq_end +
-     * 2) to (seq_end + WINDO_in).  Due to modulo 64, there are a few
-     * different cases that match this.
+     * 2) to (seq_end + WINDO_in).  Without windowing, any gap at all means
+     * a lost packet.
      */
-    if ((seq_end_ws > seq_end + 2) &&
-        ((seq_end + 2) <= input_packet.seq) &&
-        (input_packet.seq <= seq_end_ws)
-    ) {
-        /*
-         * Case 2: lost packet.  seq_end and seq_end_ws are not modulo'd.
-         */
-        lost_packet = Q_TRUE;
-    }
-    if ((seq_end_ws < seq_end + 2) &&
-        ((input_packet.seq >= (seq_end + 2)) ||
-            (input_packet.seq <= seq_end_ws))
-    ) {
-        /*
-         * Case 2: lost packet.  seq_end_ws is modulo'd so it is less than
-         * seq_end.
-         */
-        lost_packet = Q_TRUE;
+    if (session_parms.windowing == Q_TRUE) {
+        lost_max = session_parms.WINDO_in;
+    } else {
+        lost_max = KERMIT_SEQ_N - 1;
     }
-    if (lost_packet == Q_TRUE) {
+    if ((distance >= 2) && (distance <= lost_max)) {
         /*
          * We lost a packet along the way somewhere.  NAK the next one we
          * want.
          */
-        seq_end++;
-        seq_end %= 64;
+        DLOG(("find_input_slot() Case 2: looking for %d\n",
+                (seq_end + 1) % KERMIT_SEQ_N));
 
-        DLOG(("find_input_slot() Case 2: looking for %d\n", seq_end));
-
-        i = input_packet.seq;
-        input_packet.seq = seq_end;
+        seq = input_packet.seq;
+        input_packet.seq = (seq_end + 1) % KERMIT_SEQ_N;
         nak_packet();
-        input_packet.seq = i;
+        input_packet.seq = seq;
 
         /*
          * Let's go ahead and save everything we have currently, make gaps,
@@ -5606,75 +5987,47 @@ static int find_input_slot() {
         window_save_all();
 
         /*
-         * Recompute seq_end et al
+         * nak_packet() might have appended the NAK'd SEQ, so start from
+         * the current end of the window.
          */
-        seq_end_i = input_window_i - 1;
-        if (seq_end_i < 0) {
-            seq_end_i = session_parms.WINDO_in - 1;
-        }
-        seq_end = input_window[seq_end_i].seq;
-        seq_end_ws = (seq_end + session_parms.WINDO_in) % 64;
-        seq_end++;
-        seq_end %= 64;
-
+        seq_end = window_end(&input_window);
         while ((seq_end != input_packet.seq) &&
-               (input_window_n < session_parms.WINDO_in)
+               (input_window.n < session_parms.WINDO_in)
         ) {
-            input_window[input_window_i].seq = seq_end;
-            input_window[input_window_i].acked = Q_FALSE;
-            assert(input_window[input_window_i].data == NULL);
-            input_window[input_window_i].data_n = 0;
-            input_window_i++;
-            input_window_i %= session_parms.WINDO_in;
-            input_window_n++;
+            window_store(&input_window, seq_end, P_KDATA, NULL, 0);
+            input_window.slots[seq_end].try_count = 0;
+            window_append(&input_window, seq_end, Q_FALSE);
             seq_end++;
-            seq_end %= 64;
+            seq_end %= KERMIT_SEQ_N;
         }
         /*
          * At this point input_window contains NAKs up to the current good
          * packet, or it's full.
          */
-        if (input_window_n < session_parms.WINDO_in) {
+        if (input_window.n < session_parms.WINDO_in) {
             /*
              * Save the current packet
              */
-            input_window[input_window_i].seq = input_packet.seq;
-            input_window[input_window_i].type = input_packet.type;
-            input_window[input_window_i].acked = Q_TRUE;
-            assert(input_window[input_window_i].data == NULL);
-            input_window[input_window_i].data_n = input_packet.data_n;
-            input_window[input_window_i].data =
-                (unsigned char *) Xmalloc(input_packet.data_n, __FILE__,
-                                          __LINE__);
-            memcpy(input_window[input_window_i].data, input_packet.data,
-                   input_packet.data_n);
-            input_window_i++;
-            input_window_i %= session_parms.WINDO_in;
-            input_window_n++;
+            window_store(&input_window, input_packet.seq, input_packet.type,
+                         input_packet.data, input_packet.data_n);
+            window_append(&input_window, input_packet.seq, Q_TRUE);
         }
-        return -1;
+        return Q_FALSE;
     }
 
     /*
      * Case 3: A bad packet got retransmitted and is finally here.  Save it.
      */
-    if (input_window_n > 0) {
-        i = input_window_begin;
-        do {
-            if (input_window[i].seq == input_packet.seq) {
-                DLOG(("find_input_slot() Case 3 %d\n", i));
-                return i;
-            }
-            i++;
-            i %= session_parms.WINDO_in;
-        } while (i != input_window_i);
+    if (window_contains(&input_window, input_packet.seq) == Q_TRUE) {
+        DLOG(("find_input_slot() Case 3\n"));
+        return Q_TRUE;
     }
 
     /*
      * Case 4: A packet outside the sliding window: ignore it.
      */
     DLOG(("find_input_slot() Case 4 -1\n"));
-    return -1;
+    return Q_FALSE;
 }
 
 /**
@@ -5683,22 +6036,10 @@ static int find_input_slot() {
  * @return the slot, or -1 if it is outside the window.
  */
 static int find_output_slot() {
-    int i;
-
     assert(input_packet.parsed_ok == Q_TRUE);
-    if (output_window_n > 1) {
-        i = output_window_begin;
-        do {
-            if (output_window[i].seq == input_packet.seq) {
-                return i;
-            }
-            i++;
-            i %= session_parms.WINDO_out;
-        } while (i != output_window_i);
-    } else if (output_window_n == 1) {
-        if (output_window[output_window_begin].seq == input_packet.seq) {
-            return output_window_begin;
-        }
+
+    if (window_contains(&output_window, input_packet.seq) == Q_TRUE) {
+        return input_packet.seq;
     }
 
     /*
@@ -5757,19 +6098,7 @@ static void check_for_repeat(unsigned char * output, unsigned int * output_n,
             (input_packet.type == P_KNAK)
         ) {
             DLOG(("check_for_repeat() NAK(n+1)\n"));
-            if (output_window_n > 0) {
-                i = output_window_begin;
-                do {
-                    assert(output_window[i].data != NULL);
-                    Xfree(output_window[i].data, __FILE__, __LINE__);
-                    output_window[i].data = NULL;
-                    i++;
-                    i %= session_parms.WINDO_out;
-                    output_window_n--;
-                } while (i != output_window_i);
-            }
-            output_window_i = 0;
-            output_window_begin = 0;
+            window_reset(&output_window);
 
             input_packet.type = P_KACK;
             input_packet.seq = status.sequence_number % 64;
@@ -5778,6 +6107,31 @@ static void check_for_repeat(unsigned char * output, unsigned int * output_n,
         }
     }
 
+    if ((i == -1) && (status.sending == Q_FALSE) &&
+        (session_parms.windowing == Q_TRUE) &&
+        (input_packet.type == P_KDATA) &&
+        (input_window.n > 0)
+    ) {
+        /*
+         * DATA from the previous window: our ACK was lost and the sender is
+         * retrying it.  ACK it again so it can advance its window.
+         */
+        unsigned int behind = (input_window.begin + KERMIT_SEQ_N -
+                               input_packet.seq) % KERMIT_SEQ_N;
+        if ((behind > 0) && (behind <= session_parms.WINDO_in)) {
+            DLOG(("check_for_repeat() re-ACK previous window SEQ %u\n",
+                    input_packet.seq));
+            output_packet.parsed_ok = Q_TRUE;
+            output_packet.type = P_KACK;
+            output_packet.seq = input_packet.seq;
+            output_packet.data_n = 0;
+            encode_output_packet(output + *output_n, output_n,
+                                 output_max - *output_n);
+            input_packet.parsed_ok = Q_FALSE;
+            return;
+        }
+    }
+
     if (i != -1) {
         if (status.sending == Q_FALSE) {
             /*
@@ -5785,7 +6139,6 @@ static void check_for_repeat(unsigned char * output, unsigned int * output_n,
              * Re-send what we sent last time in response.
              */
             resend = Q_TRUE;
-            assert(output_window[i].seq == input_packet.seq);
         } else {
             /*
              * We're sending and the receiver has responded to something:
@@ -5799,7 +6152,7 @@ static void check_for_repeat(unsigned char * output, unsigned int * output_n,
             switch (input_packet.type) {
             case P_KACK:
                 DLOG(("check_for_repeat() ACK slot %d\n", i));
-                output_window[i].acked = Q_TRUE;
+                window_set_acked(&output_window, i, Q_TRUE);
                 break;
             case P_KNAK:
                 /*
@@ -5818,16 +6171,13 @@ static void check_for_repeat(unsigned char * output, unsigned int * output_n,
     } /* if (i != -1) */
 
     if (resend == Q_TRUE) {
-        DLOG(("check_for_repeat() RESEND SEQ %u in slot %d: %s\n",
-                input_packet.seq, i,
-                packet_type_description(output_window[i].type)));
-
-        assert(output_window[i].seq == input_packet.seq);
+        DLOG(("check_for_repeat() RESEND SEQ %u: %s\n", input_packet.seq,
+                packet_type_description(output_window.slots[i].type)));
 
         memcpy(output + *output_n,
-               output_window[i].data, output_window[i].data_n);
-        output_window[i].try_count++;
-        *output_n += output_window[i].data_n;
+               output_window.slots[i].data, output_window.slots[i].data_n);
+        output_window.slots[i].try_count++;
+        *output_n += output_window.slots[i].data_n;
 
         /*
          * Do not handle this NAK packet again.
@@ -5835,9 +6185,9 @@ static void check_for_repeat(unsigned char * output, unsigned int * output_n,
         input_packet.parsed_ok = Q_FALSE;
     }
     if (sequence_error == Q_TRUE) {
-        DLOG(("check_for_repeat() PACKET SEQUENCE ERROR SEQ %u in slot %d: %s\n",
-                input_packet.seq, i,
-                packet_type_description(output_window[i].type)));
+        DLOG(("check_for_repeat() PACKET SEQUENCE ERROR SEQ %u: %s\n",
+                input_packet.seq,
+                packet_type_description(output_window.slots[i].type)));
 
         /*
          * Receiver isn't Kermit compliant, abort.
@@ -5854,41 +6204,25 @@ static void check_for_repeat(unsigned char * output, unsigned int * output_n,
  * Display the packets in the sliding windows.
  */
 static void debug_sliding_windows() {
-    int i;
-    DLOG(("%%%%%% INPUT WINDOW: %d slots %%%%%%\n", input_window_n));
+    unsigned int i;
+    unsigned int seq;
 
-    if (input_window_n > 0) {
-        i = input_window_begin;
-        do {
-            DLOG(("    SLOT %02d SEQ %02d %s %s\n",
-                    i, input_window[i].seq,
-                    (input_window[i].acked == Q_TRUE ? "ACK" : "NAK"),
-                    packet_type_description(input_window[i].type)));
+    DLOG(("%%%%%% INPUT WINDOW: %d slots %%%%%%\n", input_window.n));
 
-            /*
-             * This MUST be at the end of the loop.
-             */
-            i++;
-            i %= session_parms.WINDO_in;
-        } while (i != input_window_i);
+    for (i = 0; i < input_window.n; i++) {
+        seq = (input_window.begin + i) % KERMIT_SEQ_N;
+        DLOG(("    SEQ %02d %s %s\n", seq,
+                (window_acked(&input_window, seq) == Q_TRUE ? "ACK" : "NAK"),
+                packet_type_description(input_window.slots[seq].type)));
     }
 
-    DLOG(("%%%%%% OUTPUT WINDOW: %d slots %%%%%%\n", output_window_n));
+    DLOG(("%%%%%% OUTPUT WINDOW: %d slots %%%%%%\n", output_window.n));
 
-    if (output_window_n > 0) {
-        i = output_window_begin;
-        do {
-            DLOG(("    SLOT %02d SEQ %02d %s %s\n",
-                    i, output_window[i].seq,
-                    (output_window[i].acked == Q_TRUE ? "ACKed" : "NAK"),
-                    packet_type_description(output_window[i].type)));
-
-            /*
-             * This MUST be at the end of the loop.
-             */
-            i++;
-            i %= session_parms.WINDO_out;
-        } while ((i != output_window_i) && (output_window_n > 1));
+    for (i = 0; i < output_window.n; i++) {
+        seq = (output_window.begin + i) % KERMIT_SEQ_N;
+        DLOG(("    SEQ %02d %s %s\n", seq,
+                (window_acked(&output_window, seq) == Q_TRUE ? "ACKed" : "NAK"),
+                packet_type_description(output_window.slots[seq].type)));
     }
 
 }
@@ -5897,10 +6231,10 @@ static void debug_sliding_windows() {
  * Save the current packet to the input window.
  */
 static void save_input_packet() {
-    int i;
+    Q_BOOL append;
 
-    DLOG(("save_input_packet(): begin %d i %d n %d WINDOW_in %d SEQ %d sequence_number %lu\n",
-            input_window_begin, input_window_i, input_window_n,
+    DLOG(("save_input_packet(): begin %d n %d WINDOW_in %d SEQ %d sequence_number %lu\n",
+            input_window.begin, input_window.n,
             session_parms.WINDO_in, input_packet.seq,
             status.sequence_number % 64));
 
@@ -5924,61 +6258,87 @@ static void save_input_packet() {
     /*
      * Save to the input window slot
      */
-    i = find_input_slot();
-    if (i == -1) {
+    if (find_input_slot(&append) == Q_FALSE) {
         /*
          * Ignore this packet.
          */
         DLOG(("save_input_packet(): IGNORE PACKET\n"));
         input_packet.parsed_ok = Q_FALSE;
     } else {
-        if (input_window[i].data != NULL) {
-            Xfree(input_window[i].data, __FILE__, __LINE__);
-        }
-        input_window[i].data =
-            (unsigned char *) Xmalloc(input_packet.data_n, __FILE__, __LINE__);
-        memcpy(input_window[i].data, input_packet.data, input_packet.data_n);
-        input_window[i].data_n = input_packet.data_n;
-        input_window[i].seq = input_packet.seq;
-        input_window[i].type = input_packet.type;
-        input_window[i].acked = Q_TRUE;
-        input_window[i].try_count = 0;
+        window_store(&input_window, input_packet.seq, input_packet.type,
+                     input_packet.data, input_packet.data_n);
+        input_window.slots[input_packet.seq].try_count = 0;
 
-        DLOG(("save_input_packet(): saved %d bytes to input_window slot %d (%d total before this)\n",
-                input_window[i].data_n, i, input_window_n));
+        DLOG(("save_input_packet(): saved %d bytes to input_window SEQ %d (%d total before this)\n",
+                input_packet.data_n, input_packet.seq, input_window.n));
 
         /*
-         * Sanity check: if we're full, begin and i are the same.
+         * If we're appending, grow the window by 1 and increment sequence
+         * number.
          */
-        if (input_window_n == session_parms.WINDO_in) {
-            assert(input_window_i == input_window_begin);
+        if (append == Q_TRUE) {
+            assert(input_window.n < session_parms.WINDO_in);
+            window_append(&input_window, input_packet.seq, Q_TRUE);
+            status.sequence_number++;
+        } else {
+            window_set_acked(&input_window, input_packet.seq, Q_TRUE);
         }
+    }
+    DLOG(("save_input_packet(): CURRENT SEQ %lu %lu input_window begin %d n %d\n",
+            status.sequence_number % 64, status.sequence_number,
+            input_window.begin, input_window.n));
+
+    debug_sliding_windows();
+}
+
+/**
+ * Save the packet just encoded to output to the output window.
+ *
+ * @param data the encoded packet bytes
+ * @param data_n the number of bytes in data
+ */
+static void save_output_packet(const unsigned char * data,
+                               const unsigned int data_n) {
+
+    unsigned int seq = output_packet.seq;
+
+    if (status.sending == Q_TRUE) {
+        assert(output_window.n < session_parms.WINDO_out);
+    }
+    window_store(&output_window, seq, output_packet.type, data, data_n);
+    output_window.slots[seq].try_count = 1;
 
+    DLOG(("KERMIT: saved %d bytes to output_window SEQ %d (%d total before this)\n",
+            data_n, seq, output_window.n));
+
+    if ((status.sending == Q_TRUE) &&
+        (session_parms.streaming == Q_FALSE)
+    ) {
         /*
-         * If we're appending, grow the window by 1.  If receiving, increment
-         * sequence number.
+         * Rotate the output window.
          */
-        if (i == input_window_i) {
-            if (input_window_n < session_parms.WINDO_in) {
-                input_window_n++;
-                input_window_i++;
-                input_window_i %= session_parms.WINDO_in;
-            } else {
-                /*
-                 * Sanity check on circular buffer.
-                 */
-                assert(i == input_window_begin);
-            }
-            if (status.sending == Q_FALSE) {
-                status.sequence_number++;
+        if (window_contains(&output_window, seq) == Q_TRUE) {
+            /*
+             * Re-generated packet, replace it in place.
+             */
+            window_set_acked(&output_window, seq, Q_FALSE);
+        } else {
+            if ((output_window.n > 0) &&
+                (seq != window_end(&output_window))
+            ) {
+                DLOG(("KERMIT: output_window restart at SEQ %d\n", seq));
+                window_reset(&output_window);
             }
+            window_append(&output_window, seq, Q_FALSE);
         }
+    } else {
+        /*
+         * Receiving (or streaming) case: hang onto the last one sent
+         * packet.
+         */
+        window_reset(&output_window);
+        window_append(&output_window, seq, Q_TRUE);
     }
-    DLOG(("save_input_packet(): CURRENT SEQ %lu %lu input_window_begin %d input_window_i %d input_window_n %d\n",
-            status.sequence_number % 64, status.sequence_number,
-            input_window_begin, input_window_i, input_window_n));
-
-    debug_sliding_windows();
 }
 
 /**
@@ -5994,28 +6354,14 @@ static void handle_timeout(unsigned char * output, unsigned int * output_n,
                            const unsigned int output_max) {
 
     int i;
-    Q_BOOL found_nak = Q_FALSE;
 
     if (status.sending == Q_FALSE) {
-        if (input_window_n > 0) {
-            i = input_window_begin;
-            do {
-                if (input_window[i].acked == Q_FALSE) {
-                    found_nak = Q_TRUE;
-                    break;
-                }
-                i++;
-                i %= session_parms.WINDO_in;
-            } while (i != input_window_i);
-            if (found_nak == Q_TRUE) {
-                input_packet.seq = input_window[i].seq;
+        if (input_window.n > 0) {
+            i = window_first_nak(&input_window);
+            if (i != -1) {
+                input_packet.seq = i;
             } else {
-                i = input_window_i;
-                i--;
-                if (i < 0) {
-                    i = session_parms.WINDO_in;
-                }
-                input_packet.seq = input_window[i].seq;
+                input_packet.seq = window_last(&input_window);
             }
         } else {
             input_packet.seq = status.sequence_number;
@@ -6023,21 +6369,14 @@ static void handle_timeout(unsigned char * output, unsigned int * output_n,
         nak_packet();
     } else {
         if (session_parms.windowing == Q_TRUE) {
-            if (output_window_n > 0) {
-                i = output_window_begin;
-                do {
-                    if (output_window[i].acked == Q_FALSE) {
-                        found_nak = Q_TRUE;
-                        break;
-                    }
-                    i++;
-                    i %= session_parms.WINDO_out;
-                } while (i != output_window_i);
-                if (found_nak == Q_TRUE) {
+            if (output_window.n > 0) {
+                i = window_first_nak(&output_window);
+                if (i != -1) {
                     memcpy(output + *output_n,
-                           output_window[i].data, output_window[i].data_n);
-                    output_window[i].try_count++;
-                    *output_n += output_window[i].data_n;
+                           output_window.slots[i].data,
+                           output_window.slots[i].data_n);
+                    output_window.slots[i].try_count++;
+                    *output_n += output_window.slots[i].data_n;
                 } else {
                     /*
                      * This should be a bug
@@ -6056,8 +6395,8 @@ static void handle_timeout(unsigned char * output, unsigned int * output_n,
  * @return true if every packet in the window has been ACK'd and saved
  */
 static Q_BOOL window_save_all() {
-    while (input_window_n > 0) {
-        if (input_window[input_window_begin].acked == Q_FALSE) {
+    while (input_window.n > 0) {
+        if (window_acked(&input_window, input_window.begin) == Q_FALSE) {
             /*
              * Oops, still have a NAK in here somewhere
              */
@@ -6065,26 +6404,10 @@ static Q_BOOL window_save_all() {
         }
 
         /*
-         * If input_window_begin is a file data packet, write it to disk.
-         */
-        if (input_window[input_window_begin].type == P_KDATA) {
-            DLOG(("window_save_all() write %d bytes to file\n",
-                    input_window[input_window_begin].data_n));
-
-            fwrite(input_window[input_window_begin].data, 1,
-                   input_window[input_window_begin].data_n, status.file_stream);
-            status.file_position += input_window[input_window_begin].data_n;
-            q_transfer_stats.bytes_transfer = status.file_position;
-            stats_increment_blocks();
-        }
-        /*
-         * Roll off the back of the input window
+         * Roll off the back of the input window, writing file data to
+         * disk.
          */
-        Xfree(input_window[input_window_begin].data, __FILE__, __LINE__);
-        input_window[input_window_begin].data = NULL;
-        input_window_begin++;
-        input_window_begin %= session_parms.WINDO_in;
-        input_window_n--;
+        window_roll_off();
     }
 
     /*
@@ -6104,17 +6427,13 @@ static void move_windows() {
          * the window is empty or we have an un-ACK'd packet at the
          * beginning.
          */
-        while ((output_window_n > 0) &&
-               (output_window[output_window_begin].acked == Q_TRUE)) {
-
-            output_window_n--;
-            Xfree(output_window[output_window_begin].data, __FILE__, __LINE__);
-            output_window[output_window_begin].data = NULL;
-            output_window_begin++;
-            output_window_begin %= session_parms.WINDO_out;
+        while ((output_window.n > 0) &&
+               (window_acked(&output_window, output_window.begin) == Q_TRUE)
+        ) {
+            window_pop(&output_window);
         }
-        DLOG(("move_windows(): output_window resize down to %d, next slot %d\n",
-                output_window_n, output_window_i));
+        DLOG(("move_windows(): output_window resize down to %d, begin %d\n",
+                output_window.n, output_window.begin));
     }
 }
 
@@ -6155,7 +6474,7 @@ void kermit(unsigned char * input, unsigned int input_n,
     assert(input != NULL);
     assert(output != NULL);
     assert(*output_n >= 0);
-    assert(output_max > (KERMIT_BLOCK_SIZE * 2));
+    assert(output_max > KERMIT_MAX_LONG_PACKET + 128);
 
     /*
      * Stop if we are done
@@ -6236,7 +6555,7 @@ void kermit(unsigned char * input, unsigned int input_n,
     /*
      * Make sure we can store at least one more packet in output window.
      */
-    if ((output_window_n == session_parms.WINDO_out) &&
+    if ((output_window.n == session_parms.WINDO_out) &&
         (status.sending == Q_TRUE) &&
         (input_n == 0) &&
         (packet_buffer_n < 5) &&
@@ -6267,7 +6586,7 @@ void kermit(unsigned char * input, unsigned int input_n,
         /*
          * Make sure we can store at least one more packet in output window.
          */
-        if ((output_window_n == session_parms.WINDO_out) &&
+        if ((output_window.n == session_parms.WINDO_out) &&
             (status.sending == Q_TRUE) &&
             (input_n == 0) &&
             (had_some_input == Q_FALSE) &&
@@ -6314,18 +6633,18 @@ void kermit(unsigned char * input, unsigned int input_n,
         /*
          * Add input_n to packet_buffer
          */
-        if (input_n > sizeof(packet_buffer) - packet_buffer_n) {
+        if (input_n > packet_buffer_max - packet_buffer_n) {
 
-            DLOG(("KERMIT: copy %ld input bytes to packet_buffer\n",
-                    sizeof(packet_buffer) - packet_buffer_n));
+            DLOG(("KERMIT: copy %d input bytes to packet_buffer\n",
+                    packet_buffer_max - packet_buffer_n));
 
             memcpy(packet_buffer + packet_buffer_n,
-                   input, sizeof(packet_buffer) - packet_buffer_n);
+                   input, packet_buffer_max - packet_buffer_n);
             memmove(input,
-                    input + sizeof(packet_buffer) - packet_buffer_n,
-                    input_n - (sizeof(packet_buffer) - packet_buffer_n));
-            input_n -= (sizeof(packet_buffer) - packet_buffer_n);
-            packet_buffer_n = sizeof(packet_buffer);
+                    input + packet_buffer_max - packet_buffer_n,
+                    input_n - (packet_buffer_max - packet_buffer_n));
+            input_n -= (packet_buffer_max - packet_buffer_n);
+            packet_buffer_n = packet_buffer_max;
 
         } else {
             DLOG(("KERMIT: copy %d input bytes to packet_buffer\n", input_n));
@@ -6359,6 +6678,14 @@ void kermit(unsigned char * input, unsigned int input_n,
             }
         }
 
+        /*
+         * A good packet means the link is alive again: only consecutive
+         * timeouts count towards timeout_max.
+         */
+        if (input_packet.parsed_ok == Q_TRUE) {
+            status.timeout_count = 0;
+        }
+
         /*
          * See if this is a repeat packet
          */
@@ -6377,7 +6704,7 @@ void kermit(unsigned char * input, unsigned int input_n,
         /*
          * Make sure we can store at least one more packet in output window.
          */
-        if ((output_window_n == session_parms.WINDO_out) &&
+        if ((output_window.n == session_parms.WINDO_out) &&
             (status.sending == Q_TRUE) &&
             (session_parms.streaming == Q_FALSE)
         ) {
@@ -6424,44 +6751,8 @@ void kermit(unsigned char * input, unsigned int input_n,
          * is NOT a NAK.
          */
         if ((output_n_start != *output_n) && (output_packet.type != P_KNAK)) {
-            if (status.sending == Q_TRUE) {
-                assert(output_window_n < session_parms.WINDO_out);
-            }
-            if (output_window[output_window_i].data != NULL) {
-                Xfree(output_window[output_window_i].data, __FILE__, __LINE__);
-            }
-            output_window[output_window_i].data =
-                (unsigned char *) Xmalloc(*output_n - output_n_start, __FILE__,
-                                          __LINE__);
-            memcpy(output_window[output_window_i].data, output + output_n_start,
-                   *output_n - output_n_start);
-            output_window[output_window_i].data_n = *output_n - output_n_start;
-            output_window[output_window_i].seq = output_packet.seq;
-            output_window[output_window_i].type = output_packet.type;
-            output_window[output_window_i].acked = Q_FALSE;
-            output_window[output_window_i].try_count = 1;
-
-            DLOG(("KERMIT: saved %d bytes to output_window slot %d (%d total before this)\n",
-                    *output_n - output_n_start, output_window_i,
-                    output_window_n));
-
-            if ((status.sending == Q_TRUE) &&
-                (session_parms.streaming == Q_FALSE)
-            ) {
-                /*
-                 * Rotate the output window.
-                 */
-                output_window_n++;
-                output_window_i++;
-                output_window_i %= session_parms.WINDO_out;
-            } else {
-                /*
-                 * Receiving (or streaming) case: hang onto the last one sent
-                 * packet.
-                 */
-                output_window[output_window_i].acked = Q_TRUE;
-                output_window_n = 1;
-            }
+            save_output_packet(output + output_n_start,
+                               *output_n - output_n_start);
         }
 
         if ((input_n == 0) && (had_some_input == Q_FALSE)) {
@@ -6603,57 +6894,12 @@ Q_BOOL kermit_start(struct file_info * file_list, const char *pathname,
 #endif
 
     /*
-     * Sliding windows support
+     * Sliding windows support.  The window arenas are sized for the
+     * packet limits picked by set_transport_limits(), called below.
      */
-    if (input_window != NULL) {
-        if (input_window_n > 0) {
-            i = input_window_begin;
-            do {
-                Xfree(input_window[i].data, __FILE__, __LINE__);
-                input_window[i].data = NULL;
-
-                /*
-                 * This must be at the end of the loop.
-                 */
-                i++;
-                i %= session_parms.WINDO_in;
-            } while (i != input_window_i);
-            Xfree(input_window, __FILE__, __LINE__);
-            input_window = NULL;
-        }
-        input_window = NULL;
-    }
-    if (output_window != NULL) {
-        if (output_window_n > 0) {
-            i = output_window_begin;
-            do {
-                i %= session_parms.WINDO_out;
-                Xfree(output_window[i].data, __FILE__, __LINE__);
-                output_window[i].data = NULL;
-            } while (i != output_window_i);
-            Xfree(output_window, __FILE__, __LINE__);
-            output_window = NULL;
-        }
-        output_window = NULL;
-    }
-    input_window_begin = 0;
-    input_window_i = 0;
-    input_window_n = 0;
-    output_window_begin = 0;
-    output_window_i = 0;
-    output_window_n = 0;
-    assert(input_window == NULL);
-    assert(output_window == NULL);
-    input_window =
-        (struct kermit_packet_serial *) Xmalloc(
-            1 * sizeof(struct kermit_packet_serial),
-            __FILE__, __LINE__);
-    memset(input_window, 0, 1 * sizeof(struct kermit_packet_serial));
-    output_window =
-        (struct kermit_packet_serial *) Xmalloc(
-            1 * sizeof(struct kermit_packet_serial),
-            __FILE__, __LINE__);
-    memset(output_window, 0, 1 * sizeof(struct kermit_packet_serial));
+    set_transport_limits();
+    window_setup(&input_window, max_long_packet);
+    window_setup(&output_window, max_long_packet + 128);
 
     /*
      * Clear the last message
@@ -6661,8 +6907,15 @@ Q_BOOL kermit_start(struct file_info * file_list, const char *pathname,
     set_transfer_stats_last_message("");
 
     /*
-     * Clear the packet buffer
+     * Size the packet buffers for the longest packet this connection will
+     * offer.
      */
+    if (packet_buffer != NULL) {
+        Xfree(packet_buffer, __FILE__, __LINE__);
+    }
+    packet_buffer_max = (max_long_packet + 32) * 2;
+    packet_buffer = (unsigned char *) Xmalloc(packet_buffer_max, __FILE__,
+                                              __LINE__);
     packet_buffer_n = 0;
 
     /*
@@ -6680,8 +6933,8 @@ Q_BOOL kermit_start(struct file_info * file_list, const char *pathname,
     }
     memset(&input_packet, 0, sizeof(input_packet));
     memset(&output_packet, 0, sizeof(output_packet));
-    input_packet.data_max = KERMIT_BLOCK_SIZE;
-    output_packet.data_max = KERMIT_BLOCK_SIZE;
+    input_packet.data_max = max_long_packet;
+    output_packet.data_max = max_long_packet;
     input_packet.data =
         (unsigned char *) Xmalloc(input_packet.data_max, __FILE__, __LINE__);
     output_packet.data =
@@ -953,101 +953,92 @@ static wchar_t * bound_keyboard_keystroke(const int keystroke,
 }
 
 /**
- * Convert all instances of a control character in macro_output_buffer from
- * hat notation (^A, ..., ^_) to a true control character.  Due to the fact
- * ^@ is NUL and terminates a string, we do not support ^@ in a keyboard
- * macro.
+ * Append a string to macro_output_buffer, truncating at
+ * KEYBOARD_MACRO_SIZE.
  *
- * @param ch a letter between 'A' and '_'
+ * @param out the current length of macro_output_buffer
+ * @param text the string to append
+ * @return the new length of macro_output_buffer
  */
-static void substitute_ctrl_char(unsigned char ch) {
-    wchar_t ch_string[3];
-    wchar_t ch_char[2];
-    wchar_t * substituted_string;
-    assert(toupper(ch) >= 'A');
-    assert(toupper(ch) <= '_');
-
-    ch_string[0] = '^';
-    ch_string[1] = ch;
-    ch_string[2] = 0;
-    ch_char[0] = toupper(ch) - 0x40;
-    ch_char[1] = 0;
-    substituted_string =
-        substitute_wcs(macro_output_buffer, ch_string, ch_char);
-    wcsncpy(macro_output_buffer, substituted_string, KEYBOARD_MACRO_SIZE);
-    Xfree(substituted_string, __FILE__, __LINE__);
+static int append_macro_output(int out, const wchar_t * text) {
+    for (; (*text != 0) && (out < KEYBOARD_MACRO_SIZE - 1); text++) {
+        macro_output_buffer[out] = *text;
+        out++;
+    }
+    return out;
 }
 
 /**
  * Convert a macro string from "$PASSWORD^M" to "mypassword\r".
  * Sets *macro_string to macro_output_buffer.
  *
+ * Control characters may be written in hat notation (^A, ..., ^_, either
+ * case), and "^^" is a literal "^".  Due to the fact ^@ is NUL and
+ * terminates a string, we do not support ^@ in a keyboard macro.
+ * $USERNAME and $PASSWORD are replaced by the current connection's values,
+ * and are not themselves scanned for hat notation.
+ *
  * @param macro_string set to point to the converted string
  */
 static void postprocess_keyboard_macro(wchar_t ** macro_string) {
-    wchar_t * substituted_string;
-    unsigned char control_ch;
+    const wchar_t * in;
+    wchar_t ch;
+    int out = 0;
     int i;
 
     assert(macro_string != NULL);
     assert(*macro_string != NULL);
 
-    wmemset(macro_output_buffer, 0, KEYBOARD_MACRO_SIZE);
-    wmemcpy(macro_output_buffer, *macro_string, wcslen(*macro_string) + 1);
-
-    /*
-     * Process all control (hat) characters.  This works, but is awkward:
-     *
-     * First we turn "^^" into something unusual so that sequences like
-     * "^^Hello" will be seen as "^Hello" rather than "^<Ctrl-H>ello".
-     *
-     * Then we perform all the substitutions for control characters, and
-     * lowercase/uppercase are both allowed.
-     *
-     * Finally we put that "something unusual" back into "^" (the original
-     * substitution for "^^").
-     */
-    substituted_string = substitute_wcs(macro_output_buffer, L"^^", L"@|@#@|@");
-    wcsncpy(macro_output_buffer, substituted_string, KEYBOARD_MACRO_SIZE);
-    Xfree(substituted_string, __FILE__, __LINE__);
-    for (control_ch = 'A'; control_ch <= '_'; control_ch++) {
-        substitute_ctrl_char(control_ch);
-        if ((control_ch >= 'A') && (control_ch <= 'Z')) {
-            substitute_ctrl_char((unsigned char) tolower(control_ch));
-        }
-    }
-    substituted_string = substitute_wcs(macro_output_buffer, L"@|@#@|@", L"^");
-    wcsncpy(macro_output_buffer, substituted_string, KEYBOARD_MACRO_SIZE);
-    Xfree(substituted_string, __FILE__, __LINE__);
-
     /*
-     * $USERNAME
+     * This is a single pass over the macro with no allocation, so that
+     * bound keys are cheap even under heavy key repeat.
      */
-    if (q_status.current_username != NULL) {
-        substituted_string =
-            substitute_wcs(macro_output_buffer, L"$USERNAME",
-                           q_status.current_username);
-        wcsncpy(macro_output_buffer, substituted_string, KEYBOARD_MACRO_SIZE);
-        Xfree(substituted_string, __FILE__, __LINE__);
-    }
-
-    /*
-     * $PASSWORD
-     */
-    if (q_status.current_password != NULL) {
-        substituted_string =
-            substitute_wcs(macro_output_buffer, L"$PASSWORD",
-                           q_status.current_password);
-        wcsncpy(macro_output_buffer, substituted_string, KEYBOARD_MACRO_SIZE);
-        Xfree(substituted_string, __FILE__, __LINE__);
+    in = *macro_string;
+    while ((*in != 0) && (out < KEYBOARD_MACRO_SIZE - 1)) {
+        if (*in == '^') {
+            ch = in[1];
+            if (ch == '^') {
+                macro_output_buffer[out++] = '^';
+                in += 2;
+                continue;
+            }
+            if ((ch >= 'A') && (ch <= '_')) {
+                macro_output_buffer[out++] = ch - 0x40;
+                in += 2;
+                continue;
+            }
+            if ((ch >= 'a') && (ch <= 'z')) {
+                macro_output_buffer[out++] = ch - 0x60;
+                in += 2;
+                continue;
+            }
+        } else if (*in == '$') {
+            if ((q_status.current_username != NULL) &&
+                (wcsncmp(in, L"$USERNAME", 9) == 0)
+            ) {
+                out = append_macro_output(out, q_status.current_username);
+                in += 9;
+                continue;
+            }
+            if ((q_status.current_password != NULL) &&
+                (wcsncmp(in, L"$PASSWORD", 9) == 0)
+            ) {
+                out = append_macro_output(out, q_status.current_password);
+                in += 9;
+                continue;
+            }
+        }
+        macro_output_buffer[out++] = *in;
+        in++;
     }
+    macro_output_buffer[out] = 0;
 
     /*
      * ...and we are not quite done!  PETSCII maps uppercase and lowercase in
      * reverse from ASCII, so perform that flip here.
      */
     if (q_status.emulation == Q_EMUL_PETSCII) {
-        for (i = 0; i < wcslen(macro_output_buffer); i++) {
+        for (i = 0; i < out; i++) {
             if ((macro_output_buffer[i] > 0x20) &&
                 (macro_output_buffer[i] < 0x7F)
             ) {
@@ -1074,6 +1065,42 @@ static void encode_utf8_char(const wchar_t ch) {
     return;
 }
 
+/*
+ * When true, post_keystroke() leaves its output in the buffered write
+ * buffer instead of sending it immediately.  Used to paste many keystrokes
+ * in a few large writes.
+ */
+static Q_BOOL keystroke_batch = Q_FALSE;
+
+/**
+ * Send the output of post_keystroke() to the wire, unless a batch is in
+ * progress and has not yet filled a transfer buffer.
+ */
+static void post_keystroke_flush() {
+    if ((keystroke_batch == Q_FALSE) ||
+        (qodem_buffered_write_pending() >= Q_TRANSFER_BUFFER_SIZE)
+    ) {
+        qodem_buffered_write_flush(q_child_tty_fd);
+    }
+}
+
+/**
+ * Begin a batch of post_keystroke() calls, such as a clipboard paste.
+ * Output is accumulated and written in large pieces until
+ * post_keystroke_batch_end() is called.
+ */
+void post_keystroke_batch_begin() {
+    keystroke_batch = Q_TRUE;
+}
+
+/**
+ * End a batch of post_keystroke() calls and send whatever remains.
+ */
+void post_keystroke_batch_end() {
+    keystroke_batch = Q_FALSE;
+    qodem_buffered_write_flush(q_child_tty_fd);
+}
+
 /**
  * Send a local keystroke to the remote side.
  *
@@ -1201,7 +1228,7 @@ void post_keystroke(const int keystroke, const int flags) {
         /*
          * Done
          */
-        qodem_buffered_write_flush(q_child_tty_fd);
+        post_keystroke_flush();
         return;
 
     } /* if (!q_key_code_yes(keystroke2) || ((flags & KEY_FLAG_UNICODE) != 0)) */
@@ -1429,7 +1456,7 @@ void post_keystroke(const int keystroke, const int flags) {
     /*
      * Send it out to the wire.
      */
-    qodem_buffered_write_flush(q_child_tty_fd);
+    post_keystroke_flush();
 }
 
 /**
@@ -47,6 +47,18 @@ extern void initialize_keyboard();
  */
 extern void post_keystroke(const int keystroke, const int flags);
 
+/**
+ * Begin a batch of post_keystroke() calls, such as a clipboard paste.
+ * Output is accumulated and written in large pieces until
+ * post_keystroke_batch_end() is called.
+ */
+extern void post_keystroke_batch_begin();
+
+/**
+ * End a batch of post_keystroke() calls and send whatever remains.
+ */
+extern void post_keystroke_batch_end();
+
 /**
  * Keyboard handler for the Alt-J function key editor screen.
  *
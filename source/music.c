@@ -71,6 +71,11 @@ static const char * DLOGNAME = NULL;
  */
 static float frequency_table[7][12];
 
+/**
+ * When true, music_init() has run.
+ */
+static Q_BOOL music_initialized = Q_FALSE;
+
 #ifdef Q_SOUND_SDL
 
 /**
@@ -117,12 +122,18 @@ static void sdl_callback(void * userdata, Uint8 * output, int output_max) {
 #endif /* Q_SOUND_SDL */
 
 /**
- * This must be called to initialize the sound system.
+ * Initialize the sound system.  This is called the first time music is
+ * played, so that startup does not pay for SDL when no music is heard.
  */
 void music_init() {
     int i, j;
     float current_tone;
 
+    if (music_initialized == Q_TRUE) {
+        return;
+    }
+    music_initialized = Q_TRUE;
+
     DLOG(("music_init()\n"));
 
     /*
@@ -196,6 +207,10 @@ void music_init() {
 void music_teardown() {
     DLOG(("music_teardown()\n"));
 
+    if (music_initialized == Q_FALSE) {
+        return;
+    }
+
 #ifdef Q_SOUND_SDL
     SDL_PauseAudio(1);
 
@@ -228,6 +243,7 @@ void play_music(const struct q_music_struct * music,
     if (q_status.sound == Q_FALSE) {
         return;
     }
+    music_init();
 
     time(&now);
     if (now - ban_time < 5) {
@@ -569,6 +585,7 @@ void play_ansi_music(const unsigned char * buffer, const int buffer_n,
     if (q_status.sound == Q_FALSE) {
         return;
     }
+    music_init();
 
     memset(&music, 0, sizeof(music));
     p = &music;
@@ -52,7 +52,8 @@ struct q_music_struct {
 /* Functions -------------------------------------------------------------- */
 
 /**
- * This must be called to initialize the sound system.
+ * Initialize the sound system.  play_music() and play_ansi_music() call this
+ * on first use; calling it again does nothing.
  */
 extern void music_init();
 
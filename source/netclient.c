@@ -104,6 +104,7 @@
 #include <string.h>
 #include <stdlib.h>
 #include <errno.h>
+#include <sys/stat.h>
 
 #ifdef Q_PDCURSES_WIN32
 #  if defined(__BORLANDC__) || defined(_MSC_VER)
@@ -3872,21 +3873,78 @@ struct known_host_entry {
     int fingerprint_n;
 
     /**
-     * The next entry in the list.
+     * The next entry in the list, in file order.
      */
     struct known_host_entry * next;
+
+    /**
+     * The next entry in the same hash bucket.
+     */
+    struct known_host_entry * hash_next;
 };
 
+/**
+ * Number of hash buckets in the known_hosts index.
+ */
+#define KNOWN_HOSTS_HASH_SIZE 256
+
+/**
+ * All known_hosts entries in file order.  The file is read once into this
+ * list and the hash index, and read again only if it changes on disk.
+ */
+static struct known_host_entry * known_hosts = NULL;
+
+/**
+ * The last entry in known_hosts, where new entries are appended.
+ */
+static struct known_host_entry * known_hosts_tail = NULL;
+
+/**
+ * The known_hosts entries hashed by host and port.
+ */
+static struct known_host_entry * known_hosts_hash[KNOWN_HOSTS_HASH_SIZE];
+
+/**
+ * The file known_hosts was loaded from, or NULL if it has not been loaded.
+ */
+static char * known_hosts_filename = NULL;
+
+/**
+ * The modification time and size of known_hosts_filename when we last read
+ * or wrote it.
+ */
+static time_t known_hosts_mtime = 0;
+static off_t known_hosts_size = 0;
+
 /**
  * Flag to indicate some more data MIGHT be ready to read.
  */
 static Q_BOOL maybe_readable = Q_FALSE;
 
 /**
- * Flag to indicate some more data MIGHT be ready to read.  This can happen
- * if the last call to ssh_read() resulted in a length of 0 or EAGAIN.  The
- * socket will not be readable to select(), but another call to ssh_read()
- * could read some data.
+ * The size of the decrypted data buffer between cryptlib and ssh_read().
+ */
+#define SSH_READ_BUFFER_SIZE 65536
+
+/**
+ * Decrypted data popped from cryptlib that ssh_read() has not returned yet.
+ * cryptlib is drained into this in one go, so that when it is empty the
+ * socket's readability is the whole story again.
+ */
+static unsigned char ssh_read_buffer[SSH_READ_BUFFER_SIZE];
+static int ssh_read_buffer_start = 0;
+static int ssh_read_buffer_n = 0;
+
+/**
+ * If true, ssh_write() has pushed data that still needs cryptFlushData().
+ */
+static Q_BOOL ssh_write_pending = Q_FALSE;
+
+/**
+ * Flag to indicate some more data MIGHT be ready to read.  This is true
+ * when ssh_read() has decrypted data buffered, or when cryptlib may still
+ * be holding some.  The socket will not be readable to select(), but
+ * another call to ssh_read() will return data.
  *
  * @return true if there might be data to read from the ssh session
  */
@@ -3924,11 +3982,136 @@ static void sha1_to_string(const char * sha1, char * dest, const int n) {
 }
 
 /**
- * Load all entries from the known_hosts file.
+ * Hash a host and port for the known_hosts index.
+ *
+ * @param host the host's DNS name or IP address
+ * @param port the host's port
+ * @return the hash bucket
+ */
+static int known_host_hash(const char * host, const char * port) {
+    unsigned int hash = 5381;
+
+    while (*host != 0) {
+        hash = (hash * 33) ^ (unsigned char) *host;
+        host++;
+    }
+    hash = (hash * 33) ^ ':';
+    while (*port != 0) {
+        hash = (hash * 33) ^ (unsigned char) *port;
+        port++;
+    }
+    return hash % KNOWN_HOSTS_HASH_SIZE;
+}
+
+/**
+ * Find an entry in the known_hosts index.
  *
- * @param known_hosts the list of known_host_entry's to create
+ * @param host the host's DNS name or IP address
+ * @param port the host's port
+ * @return the entry, or NULL if there is none
+ */
+static struct known_host_entry * find_knownhost(const char * host,
+                                                const char * port) {
+
+    struct known_host_entry * entry;
+
+    for (entry = known_hosts_hash[known_host_hash(host, port)];
+         entry != NULL; entry = entry->hash_next) {
+
+        if ((strcmp(entry->host, host) == 0) &&
+            (strcmp(entry->port, port) == 0)
+        ) {
+            return entry;
+        }
+    }
+    return NULL;
+}
+
+/**
+ * Add an entry to the known_hosts index.  If the host is already there its
+ * fingerprint is replaced, so that later lines in the file win.
+ *
+ * @param host the host's DNS name or IP address
+ * @param port the host's port
+ * @param fingerprint the host fingerprint as a raw byte array
+ * @param fingerprint_n the number of bytes in fingerprint
+ * @return the new or updated entry
+ */
+static struct known_host_entry * add_knownhost(const char * host,
+                                               const char * port,
+                                               const char * fingerprint,
+                                               const int fingerprint_n) {
+
+    struct known_host_entry * entry;
+    int bucket;
+
+    entry = find_knownhost(host, port);
+    if (entry == NULL) {
+        entry = (struct known_host_entry *)
+            Xmalloc(sizeof(struct known_host_entry), __FILE__, __LINE__);
+        memset(entry, 0, sizeof(struct known_host_entry));
+        entry->host = Xstrdup(host, __FILE__, __LINE__);
+        entry->port = Xstrdup(port, __FILE__, __LINE__);
+
+        bucket = known_host_hash(host, port);
+        entry->hash_next = known_hosts_hash[bucket];
+        known_hosts_hash[bucket] = entry;
+
+        if (known_hosts_tail == NULL) {
+            known_hosts = entry;
+        } else {
+            known_hosts_tail->next = entry;
+        }
+        known_hosts_tail = entry;
+    }
+    memcpy(entry->fingerprint, fingerprint, fingerprint_n);
+    entry->fingerprint_n = fingerprint_n;
+    return entry;
+}
+
+/**
+ * Free all entries in the known_hosts index.
+ */
+static void free_knownhosts() {
+    struct known_host_entry * next = NULL;
+
+    DLOG(("free_knownhosts()\n"));
+
+    while (known_hosts != NULL) {
+        next = known_hosts->next;
+        Xfree(known_hosts->host, __FILE__, __LINE__);
+        Xfree(known_hosts->port, __FILE__, __LINE__);
+        Xfree(known_hosts, __FILE__, __LINE__);
+        known_hosts = next;
+    }
+    known_hosts_tail = NULL;
+    memset(known_hosts_hash, 0, sizeof(known_hosts_hash));
+    if (known_hosts_filename != NULL) {
+        Xfree(known_hosts_filename, __FILE__, __LINE__);
+        known_hosts_filename = NULL;
+    }
+}
+
+/**
+ * Remember the modification time and size of the known_hosts file, so that
+ * a change by someone else can be seen later.
  */
-static void load_knownhosts(struct known_host_entry ** known_hosts) {
+static void stat_knownhosts() {
+    struct stat fstats;
+
+    if (stat(known_hosts_filename, &fstats) == 0) {
+        known_hosts_mtime = fstats.st_mtime;
+        known_hosts_size = fstats.st_size;
+    } else {
+        known_hosts_mtime = 0;
+        known_hosts_size = 0;
+    }
+}
+
+/**
+ * Load all entries from the known_hosts file into the index.
+ */
+static void load_knownhosts() {
     char * filename;
     FILE * file;
     char * begin;
@@ -3941,8 +4124,10 @@ static void load_knownhosts(struct known_host_entry ** known_hosts) {
      */
     char line[PHONEBOOK_LINE_SIZE];
     char buffer[PHONEBOOK_LINE_SIZE];
-    struct known_host_entry * old_entry;
-    struct known_host_entry * new_entry;
+    char host[PHONEBOOK_LINE_SIZE];
+    char port[PHONEBOOK_LINE_SIZE];
+    char fingerprint[CRYPT_MAX_HASHSIZE + 1];
+    int fingerprint_n;
 
     enum SCAN_STATES {
         SCAN_STATE_NONE,        /* Between entries */
@@ -3954,7 +4139,11 @@ static void load_knownhosts(struct known_host_entry ** known_hosts) {
 
     DLOG(("load_knownhosts()\n"));
 
+    free_knownhosts();
     filename = get_option(Q_OPTION_SSH_KNOWNHOSTS);
+    known_hosts_filename = Xstrdup(filename, __FILE__, __LINE__);
+    stat_knownhosts();
+
     file = fopen(filename, "r");
     if (file == NULL) {
         /* Error, just quietly bail out. */
@@ -3962,8 +4151,8 @@ static void load_knownhosts(struct known_host_entry ** known_hosts) {
         return;
     }
 
-    old_entry = NULL;
-    new_entry = NULL;
+    memset(host, 0, sizeof(host));
+    memset(port, 0, sizeof(port));
     scan_state = SCAN_STATE_NONE;
     while (!feof(file)) {
 
@@ -4002,19 +4191,8 @@ static void load_knownhosts(struct known_host_entry ** known_hosts) {
                  * Beginning of an entry found
                  */
                 scan_state = SCAN_STATE_ENTRY;
-                new_entry = (struct known_host_entry *)
-                    Xmalloc(sizeof(struct known_host_entry),
-                    __FILE__, __LINE__);
-                memset(new_entry, 0, sizeof(struct known_host_entry));
-                if (*known_hosts == NULL) {
-                    *known_hosts = new_entry;
-                } else {
-                    old_entry->next = new_entry;
-                }
-                /*
-                 * Save entry
-                 */
-                old_entry = new_entry;
+                memset(host, 0, sizeof(host));
+                memset(port, 0, sizeof(port));
                 continue;
             }
         } /* if (scan_state == SCAN_STATE_NONE) */
@@ -4055,33 +4233,36 @@ static void load_knownhosts(struct known_host_entry ** known_hosts) {
                 /*
                  * HOST
                  */
-                new_entry->host = Xstrdup(begin, __FILE__, __LINE__);
+                snprintf(host, sizeof(host), "%s", begin);
             } else if (strncmp(buffer, "port", strlen("port")) == 0) {
                 /*
                  * PORT
                  */
-                new_entry->port = Xstrdup(begin, __FILE__, __LINE__);
+                snprintf(port, sizeof(port), "%s", begin);
             } else if (strncmp(buffer, "fingerprint",
                                strlen("fingerprint")) == 0) {
                 /*
                  * FINGERPRINT
                  */
-                new_entry->fingerprint_n = strlen(begin) / 4;
-                for (i = 0; i < new_entry->fingerprint_n; i++) {
+                fingerprint_n = strlen(begin) / 4;
+                if (fingerprint_n > CRYPT_MAX_HASHSIZE) {
+                    fingerprint_n = CRYPT_MAX_HASHSIZE;
+                }
+                for (i = 0; i < fingerprint_n; i++) {
                     ch = tolower(begin[i * 4 + 2]);
                     if ((ch >= '0') && (ch <= '9')) {
                         ch = ch - '0';
                     } else if ((ch >= 'a') && (ch <= 'f')) {
                         ch = ch - 'a' + 10;
                     }
-                    new_entry->fingerprint[i] = ch * 16;
+                    fingerprint[i] = ch * 16;
                     ch = tolower(begin[i * 4 + 3]);
                     if ((ch >= '0') && (ch <= '9')) {
                         ch = ch - '0';
                     } else if ((ch >= 'a') && (ch <= 'f')) {
                         ch = ch - 'a' + 10;
                     }
-                    new_entry->fingerprint[i] += ch;
+                    fingerprint[i] += ch;
                 }
 
                 /*
@@ -4092,40 +4273,87 @@ static void load_knownhosts(struct known_host_entry ** known_hosts) {
                  * There are no more supported options, switch state.
                  */
                 scan_state = SCAN_STATE_NONE;
-                DLOG(("Read known_hosts entry:\n", new_entry->host));
-                DLOG(("    host %s\n", new_entry->host));
-                DLOG(("    port %s\n", new_entry->port));
-                DLOG(("    fingerprint (%d) ", new_entry->fingerprint_n));
-                for (i = 0; i < new_entry->fingerprint_n; i++) {
-                    DLOG2(("\\x%02x", (new_entry->fingerprint[i] & 0xFF)));
+                DLOG(("Read known_hosts entry:\n"));
+                DLOG(("    host %s\n", host));
+                DLOG(("    port %s\n", port));
+                DLOG(("    fingerprint (%d) ", fingerprint_n));
+                for (i = 0; i < fingerprint_n; i++) {
+                    DLOG2(("\\x%02x", (fingerprint[i] & 0xFF)));
                 }
                 DLOG2(("\n"));
+
+                if ((strlen(host) > 0) && (strlen(port) > 0)) {
+                    add_knownhost(host, port, fingerprint, fingerprint_n);
+                }
             }
 
         } /* if (scan_state == SCAN_STATE_ENTRY) */
 
     } /* while (!feof(file)) */
 
+    fclose(file);
+}
+
+/**
+ * Make sure the known_hosts index is current: load it on first use, and
+ * again if the option points somewhere else or the file was changed by
+ * another program.
+ */
+static void use_knownhosts() {
+    char * filename = get_option(Q_OPTION_SSH_KNOWNHOSTS);
+    struct stat fstats;
+
+    if (known_hosts_filename != NULL) {
+        if (strcmp(known_hosts_filename, filename) == 0) {
+            if (stat(filename, &fstats) != 0) {
+                fstats.st_mtime = 0;
+                fstats.st_size = 0;
+            }
+            if ((fstats.st_mtime == known_hosts_mtime) &&
+                (fstats.st_size == known_hosts_size)
+            ) {
+                /* Still current */
+                return;
+            }
+        }
+    }
+    load_knownhosts();
 }
 
 /**
- * Save all entries in a known_hosts list to the known_hosts file.
+ * Write one known_hosts entry.
  *
- * @param known_hosts the list of known_host_entry's to save
+ * @param file the known_hosts file
+ * @param entry the entry to write
+ */
+static void write_knownhost_entry(FILE * file,
+                                  const struct known_host_entry * entry) {
+    int i;
+
+    fprintf(file, "[entry]\n");
+    fprintf(file, "host=%s\n", entry->host);
+    fprintf(file, "port=%s\n", entry->port);
+    fprintf(file, "fingerprint=");
+    for (i = 0; i < entry->fingerprint_n; i++) {
+        fprintf(file, "\\x%02x", (entry->fingerprint[i] & 0xFF));
+    }
+    fprintf(file, "\n\n");
+}
+
+/**
+ * Rewrite the known_hosts file from the index.
  */
-static void save_knownhosts(struct known_host_entry * known_hosts) {
+static void save_knownhosts() {
     FILE * file;
-    char * filename;
     struct known_host_entry * entry;
-    int i;
 
     DLOG(("save_knownhosts()\n"));
 
-    filename = get_option(Q_OPTION_SSH_KNOWNHOSTS);
-    file = fopen(filename, "w");
+    file = fopen(known_hosts_filename, "w");
     if (file == NULL) {
         /* Error, just quietly bail out. */
-        DLOG(("Can't open %s for writing: %s\n", filename, strerror(errno)));
+        DLOG(("Can't open %s for writing: %s\n", known_hosts_filename,
+                strerror(errno)));
         return;
     }
 
@@ -4133,33 +4361,38 @@ static void save_knownhosts(struct known_host_entry * known_hosts) {
     fprintf(file, "#\n");
 
     for (entry = known_hosts; entry != NULL; entry = entry->next) {
-        fprintf(file, "[entry]\n");
-        fprintf(file, "host=%s\n", entry->host);
-        fprintf(file, "port=%s\n", entry->port);
-        fprintf(file, "fingerprint=");
-        for (i = 0; i < entry->fingerprint_n; i++) {
-            fprintf(file, "\\x%02x", (entry->fingerprint[i] & 0xFF));
-        }
-        fprintf(file, "\n\n");
+        write_knownhost_entry(file, entry);
     }
     fclose(file);
+    stat_knownhosts();
 }
 
 /**
- * Free all entries in a known_hosts list.
+ * Append one entry to the end of the known_hosts file, leaving the rest of
+ * it alone.
  *
- * @param known_hosts the list of known_host_entry's to free
+ * @param entry the entry to append
  */
-static void free_knownhosts(struct known_host_entry * known_hosts) {
-    struct known_host_entry * next = NULL;
+static void append_knownhost(const struct known_host_entry * entry) {
+    FILE * file;
 
-    DLOG(("free_knownhosts()\n"));
+    DLOG(("append_knownhost()\n"));
 
-    while (known_hosts != NULL) {
-        next = known_hosts->next;
-        Xfree(known_hosts, __FILE__, __LINE__);
-        known_hosts = next;
+    file = fopen(known_hosts_filename, "a");
+    if (file == NULL) {
+        /* Error, just quietly bail out. */
+        DLOG(("Can't open %s for appending: %s\n", known_hosts_filename,
+                strerror(errno)));
+        return;
     }
+
+    if (known_hosts_size == 0) {
+        fprintf(file, "# Qodem Known Hosts File\n");
+        fprintf(file, "#\n");
+    }
+    write_knownhost_entry(file, entry);
+    fclose(file);
+    stat_knownhosts();
 }
 
 /**
@@ -4174,38 +4407,28 @@ static void free_knownhosts(struct known_host_entry * known_hosts) {
 static Q_BOOL get_knownhost_entry(const char * host, const char * port,
                                   char * fingerprint, int * fingerprint_n) {
 
-    struct known_host_entry * known_hosts = NULL;
+    struct known_host_entry * entry;
     int i;
 
     DLOG(("get_knownhost_entry()\n"));
 
-    load_knownhosts(&known_hosts);
+    use_knownhosts();
 
-    while (known_hosts != NULL) {
-        DLOG(("Scan known_hosts entry:\n", known_hosts->host));
-        DLOG(("    host '%s'\n", known_hosts->host));
-        DLOG(("    port '%s'\n", known_hosts->port));
-        if ((strcmp(known_hosts->host, host) == 0) &&
-            (strcmp(known_hosts->port, port) == 0)
-        ) {
-            /* Found a match, return it */
-            DLOG(("-- MATCH --\n"));
-            DLOG(("    fingerprint (%d) ", known_hosts->fingerprint_n));
-            for (i = 0; i < known_hosts->fingerprint_n; i++) {
-                DLOG2(("\\x%02x", (known_hosts->fingerprint[i] & 0xFF)));
-            }
-            DLOG2(("\n"));
+    entry = find_knownhost(host, port);
+    if (entry == NULL) {
+        return Q_FALSE;
+    }
 
-            memcpy(fingerprint, known_hosts->fingerprint,
-                known_hosts->fingerprint_n);
-            *fingerprint_n = known_hosts->fingerprint_n;
-            return Q_TRUE;
-        }
-        known_hosts = known_hosts->next;
+    DLOG(("-- MATCH --\n"));
+    DLOG(("    fingerprint (%d) ", entry->fingerprint_n));
+    for (i = 0; i < entry->fingerprint_n; i++) {
+        DLOG2(("\\x%02x", (entry->fingerprint[i] & 0xFF)));
     }
+    DLOG2(("\n"));
 
-    free_knownhosts(known_hosts);
-    return Q_FALSE;
+    memcpy(fingerprint, entry->fingerprint, entry->fingerprint_n);
+    *fingerprint_n = entry->fingerprint_n;
+    return Q_TRUE;
 }
 
 /**
@@ -4220,22 +4443,10 @@ static void create_knownhost_entry(const char * host, const char * port,
                                    char * fingerprint,
                                    const int fingerprint_n) {
 
-    struct known_host_entry * known_hosts = NULL;
-    struct known_host_entry * entry = NULL;
-
     DLOG(("create_knownhost_entry()\n"));
 
-    load_knownhosts(&known_hosts);
-    entry = (struct known_host_entry *) Xmalloc(sizeof(struct known_host_entry),
-                                                __FILE__, __LINE__);
-    memset(entry, 0, sizeof(struct known_host_entry));
-    entry->host = (char *) host;
-    entry->port = (char *) port;
-    memcpy(entry->fingerprint, fingerprint, fingerprint_n);
-    entry->fingerprint_n = fingerprint_n;
-    entry->next = known_hosts;
-    save_knownhosts(entry);
-    free_knownhosts(entry);
+    use_knownhosts();
+    append_knownhost(add_knownhost(host, port, fingerprint, fingerprint_n));
 }
 
 /**
@@ -4246,45 +4457,58 @@ static void create_knownhost_entry(const char * host, const char * port,
  */
 static void delete_knownhost_entry(const char * host, const char * port) {
 
-    struct known_host_entry * head = NULL;
+    struct known_host_entry * entry = NULL;
     struct known_host_entry * p = NULL;
     struct known_host_entry * q = NULL;
-    load_knownhosts(&head);
-    p = head;
+    int bucket;
 
     DLOG(("delete_knownhost_entry()\n"));
 
-    while (p != NULL) {
-        DLOG(("Scan known_hosts entry:\n", p->host));
-        DLOG(("    host '%s'\n", p->host));
-        DLOG(("    port '%s'\n", p->port));
-        if ((strcmp(p->host, host) == 0) &&
-            (strcmp(p->port, port) == 0)
-        ) {
-            /* Found a match, delete it */
-            DLOG(("-- MATCH --\n"));
-            if (q != NULL) {
-                /*
-                 * Deleting in the middle or the end.  Remove p from the
-                 * linked list.
-                 */
-                q->next = p->next;
-            } else {
-                /* Deleting at the head.  Just point the head to next. */
-                head = p->next;
-            }
-            Xfree(p, __FILE__, __LINE__);
-            save_knownhosts(head);
-            free_knownhosts(head);
-            return;
+    use_knownhosts();
+    entry = find_knownhost(host, port);
+    if (entry == NULL) {
+        /* No match found, do nothing. */
+        DLOG(("delete_knownhost_entry() : no match found for host %s port %s\n",
+                host, port));
+        return;
+    }
+
+    /*
+     * Unlink from the hash bucket.
+     */
+    bucket = known_host_hash(host, port);
+    if (known_hosts_hash[bucket] == entry) {
+        known_hosts_hash[bucket] = entry->hash_next;
+    } else {
+        for (p = known_hosts_hash[bucket]; p->hash_next != entry;
+             p = p->hash_next) {
         }
+        p->hash_next = entry->hash_next;
+    }
+
+    /*
+     * Unlink from the file order list.
+     */
+    for (p = known_hosts; p != entry; p = p->next) {
         q = p;
-        p = p->next;
     }
-    /* No match found, do nothing. */
-    DLOG(("delete_knownhost_entry() : no match found for host %s port %s\n",
-            host, port));
+    if (q != NULL) {
+        q->next = entry->next;
+    } else {
+        known_hosts = entry->next;
+    }
+    if (known_hosts_tail == entry) {
+        known_hosts_tail = q;
+    }
+
+    Xfree(entry->host, __FILE__, __LINE__);
+    Xfree(entry->port, __FILE__, __LINE__);
+    Xfree(entry, __FILE__, __LINE__);
 
+    /*
+     * Removing a line needs a full rewrite.
+     */
+    save_knownhosts();
 }
 
 /**
@@ -4312,6 +4536,54 @@ static void emit_crypto_error(int status, CRYPT_HANDLE object) {
     }
 }
 
+/**
+ * Send everything ssh_write() has pushed since the last flush.  The main
+ * loop calls this once per pass, so that a burst of small writes goes out
+ * as one SSH packet.
+ */
+void ssh_flush() {
+    int cryptStatus;
+
+    if (ssh_write_pending == Q_FALSE) {
+        return;
+    }
+    ssh_write_pending = Q_FALSE;
+
+    cryptStatus = cryptFlushData(cryptSession);
+    if (cryptStatusError(cryptStatus)) {
+        DLOG(("ERROR cryptFlushData()\n"));
+
+        /*
+         * cryptlib error.  The next read or write will see it too and
+         * report it.
+         */
+        emit_crypto_error(cryptStatus, cryptSession);
+    }
+}
+
+/**
+ * Set the cryptlib buffer size on a new session from the ssh_buffer_size
+ * option.  This has to happen before the session is activated.
+ */
+static void ssh_set_buffer_size() {
+    int cryptStatus;
+    int buffer_size = get_option_int(Q_OPTION_SSH_BUFFER_SIZE);
+
+    if (buffer_size <= 0) {
+        /* Use the cryptlib default */
+        return;
+    }
+    if (buffer_size < 8192) {
+        buffer_size = 8192;
+    }
+    cryptStatus = cryptSetAttribute(cryptSession, CRYPT_ATTRIBUTE_BUFFERSIZE,
+                                    buffer_size);
+    if (cryptStatusError(cryptStatus)) {
+        DLOG(("ERROR cryptSetAttribute(CRYPT_ATTRIBUTE_BUFFERSIZE)\n"));
+        emit_crypto_error(cryptStatus, cryptSession);
+    }
+}
+
 /**
  * Perform SSH protocol negotiation for a new TCP connection.
  *
@@ -4403,6 +4675,8 @@ static int ssh_setup_connection(int fd, const char * host, const char * port) {
         DLOG(("Disabled Nagle's algorithm\n"));
     }
 
+    ssh_set_buffer_size();
+
     /* Pass in the network socket */
     DLOG(("Passing network socket to cryptlib\n"));
     cryptSetAttribute(cryptSession, CRYPT_SESSINFO_NETWORKSOCKET, fd);
@@ -4532,6 +4806,12 @@ crypt_error:
  */
 static void ssh_close() {
     int cryptStatus;
+
+    ssh_flush();
+    ssh_read_buffer_start = 0;
+    ssh_read_buffer_n = 0;
+    maybe_readable = Q_FALSE;
+
     cryptStatus = cryptDestroySession(cryptSession);
     if (cryptStatusError(cryptStatus)) {
         /*
@@ -4583,43 +4863,88 @@ ssize_t ssh_read(const int fd, void * buf, size_t count) {
         return 0;
     }
 
-    /* Read some more bytes from the remote side */
-    cryptStatus = cryptPopData(cryptSession, buf, count, &readBytes);
-    if (cryptStatusError(cryptStatus)) {
-        DLOG(("ERROR cryptPopData()\n"));
-        emit_crypto_error(cryptStatus, cryptSession);
-
-        /* cryptlib error */
-        if ((cryptStatus == CRYPT_ERROR_COMPLETE) ||
-            (cryptStatus == CRYPT_ERROR_READ)
-        ) {
-            DLOG(("EOF EOF EOF\n"));
+    if (ssh_read_buffer_n == 0) {
+        /*
+         * Drain cryptlib into ssh_read_buffer.  Keep popping until it has
+         * nothing more to give or the buffer is full.
+         */
+        ssh_read_buffer_start = 0;
+        for (;;) {
+            cryptStatus = cryptPopData(cryptSession,
+                ssh_read_buffer + ssh_read_buffer_n,
+                sizeof(ssh_read_buffer) - ssh_read_buffer_n, &readBytes);
+            if (cryptStatusError(cryptStatus)) {
+                DLOG(("ERROR cryptPopData()\n"));
+                emit_crypto_error(cryptStatus, cryptSession);
+                if (ssh_read_buffer_n > 0) {
+                    /*
+                     * Return what we have first, the error will come back
+                     * on the next pop.
+                     */
+                    break;
+                }
 
-            /* Remote end has closed connection */
-            if (q_program_state != Q_STATE_HOST) {
-                snprintf((char *) read_buffer, sizeof(read_buffer), "%s",
-                    _("Connection closed.\r\n"));
-                read_buffer_n = strlen((char *) read_buffer);
-            }
-            nvt.is_eof = Q_TRUE;
-            /*
-             * The message will be returned on the next ssh_read().
-             */
-            maybe_readable = Q_TRUE;
+                /* cryptlib error */
+                if ((cryptStatus == CRYPT_ERROR_COMPLETE) ||
+                    (cryptStatus == CRYPT_ERROR_READ)
+                ) {
+                    DLOG(("EOF EOF EOF\n"));
+
+                    /* Remote end has closed connection */
+                    if (q_program_state != Q_STATE_HOST) {
+                        snprintf((char *) read_buffer, sizeof(read_buffer),
+                            "%s", _("Connection closed.\r\n"));
+                        read_buffer_n = strlen((char *) read_buffer);
+                    }
+                    nvt.is_eof = Q_TRUE;
+                    /*
+                     * The message will be returned on the next ssh_read().
+                     */
+                    maybe_readable = Q_TRUE;
 #ifdef Q_PDCURSES_WIN32
-            set_errno(WSAEWOULDBLOCK);
+                    set_errno(WSAEWOULDBLOCK);
 #else
-            set_errno(EAGAIN);
+                    set_errno(EAGAIN);
 #endif
-            return -1;
-        } else {
-            /* This will be an error */
-            emit_crypto_error(cryptStatus, cryptSession);
-            set_errno(EIO);
-            return -1;
+                    return -1;
+                } else {
+                    /* This will be an error */
+                    set_errno(EIO);
+                    return -1;
+                }
+            }
+            if (readBytes == 0) {
+                break;
+            }
+            ssh_read_buffer_n += readBytes;
+            if (ssh_read_buffer_n == sizeof(ssh_read_buffer)) {
+                break;
+            }
         }
     }
 
+    if (ssh_read_buffer_n == 0) {
+        /*
+         * SSH protocol consumed everything.  Anything more will show up on
+         * the socket.
+         */
+        maybe_readable = Q_FALSE;
+#ifdef Q_PDCURSES_WIN32
+        set_errno(WSAEWOULDBLOCK);
+#else
+        set_errno(EAGAIN);
+#endif
+        return -1;
+    }
+
+    readBytes = ssh_read_buffer_n;
+    if (readBytes > count) {
+        readBytes = count;
+    }
+    memcpy(buf, ssh_read_buffer + ssh_read_buffer_start, readBytes);
+    ssh_read_buffer_start += readBytes;
+    ssh_read_buffer_n -= readBytes;
+
     DLOG(("ssh_read() : read %d bytes (count = %d):\n", readBytes, (int)count));
     for (i = 0; i < readBytes; i++) {
         DLOG2((" %02x", (((char *) buf)[i] & 0xFF)));
@@ -4634,23 +4959,14 @@ ssize_t ssh_read(const int fd, void * buf, size_t count) {
     }
     DLOG2(("\n"));
 
-    if (readBytes == 0) {
-        /* SSH protocol consumed everything.  Come back again. */
-        maybe_readable = Q_TRUE;
-#ifdef Q_PDCURSES_WIN32
-        set_errno(WSAEWOULDBLOCK);
-#else
-        set_errno(EAGAIN);
-#endif
-        return -1;
-    }
-
-    if (readBytes == count) {
+    /*
+     * If we stopped because ssh_read_buffer was full, cryptlib may be
+     * holding more even if the socket is quiet.
+     */
+    if ((ssh_read_buffer_n > 0) ||
+        (ssh_read_buffer_start == sizeof(ssh_read_buffer))
+    ) {
         DLOG(("ssh_read() maybe_readable: TRUE\n"));
-        /*
-         * There might still be more data in the envelope, have
-         * process_incoming_data() call us again.
-         */
         maybe_readable = Q_TRUE;
     } else {
         DLOG(("ssh_read() maybe_readable: FALSE\n"));
@@ -4703,16 +5019,15 @@ ssize_t ssh_write(const int fd, void * buf, size_t count) {
         return -1;
     }
 
-    /* Post everything */
-    cryptStatus = cryptFlushData(cryptSession);
-    if (cryptStatusError(cryptStatus)) {
-        DLOG(("ERROR cryptFlushData()\n"));
-
-        /* cryptlib error */
-        emit_crypto_error(cryptStatus, cryptSession);
-        /* This will be an error */
-        set_errno(EIO);
-        return -1;
+    /*
+     * Leave the data in cryptlib's send buffer for ssh_flush(), unless the
+     * buffer is full and we need the room.
+     */
+    if (writtenBytes > 0) {
+        ssh_write_pending = Q_TRUE;
+    }
+    if (writtenBytes < count) {
+        ssh_flush();
     }
 
     if (writtenBytes == 0) {
@@ -4805,7 +5120,7 @@ const char * ssh_server_key_str() {
 void ssh_create_server_key() {
     int cryptStatus;
     CRYPT_CONTEXT privKeyContext;
-    int keyLen = 1024 / 8;
+    int keyLen = get_option_int(Q_OPTION_HOST_SSH_KEY_BITS) / 8;
     CRYPT_KEYSET keySet;
     char * filename;
     char notify_message[DIALOG_MESSAGE_SIZE];
@@ -4819,6 +5134,13 @@ void ssh_create_server_key() {
 
     DLOG(("ssh_create_server_key()\n"));
 
+    if (keyLen < 1024 / 8) {
+        keyLen = 1024 / 8;
+    }
+    if (keyLen > CRYPT_MAX_PKCSIZE) {
+        keyLen = CRYPT_MAX_PKCSIZE;
+    }
+
     /*
      * Show the user a message that we are creating the server key.  Make
      * sure we don't wait on them to press a key, just compute and go.
@@ -4883,6 +5205,7 @@ void ssh_create_server_key() {
         emit_crypto_error(cryptStatus, cryptSession);
         return;
     }
+    cryptDestroyContext(privKeyContext);
 
     DLOG(("create_server_key() FINISHED\n"));
 }
@@ -4987,6 +5310,8 @@ static int ssh_accept(int fd) {
         DLOG(("Disabled Nagle's algorithm\n"));
     }
 
+    ssh_set_buffer_size();
+
     /* Pass in the SSH server private key */
     DLOG(("Loading server key into session...\n"));
     cryptStatus = cryptSetAttribute(cryptSession, CRYPT_SESSINFO_PRIVATEKEY,
@@ -269,15 +269,22 @@ extern ssize_t ssh_write(const int fd, void * buf, size_t count);
 extern void ssh_resize_screen(const int lines, const int columns);
 
 /**
- * Flag to indicate some more data MIGHT be ready to read.  This can happen
- * if the last call to ssh_read() resulted in a length of 0 or EAGAIN.  The
- * socket will not be readable to select(), but another call to ssh_read()
- * could read some data.
+ * Flag to indicate some more data MIGHT be ready to read.  This is true
+ * when ssh_read() has decrypted data buffered, or when cryptlib may still
+ * be holding some.  The socket will not be readable to select(), but
+ * another call to ssh_read() will return data.
  *
  * @return true if there might be data to read from the ssh session
  */
 extern Q_BOOL ssh_maybe_readable();
 
+/**
+ * Send everything ssh_write() has pushed since the last flush.  The main
+ * loop calls this once per pass, so that a burst of small writes goes out
+ * as one SSH packet.
+ */
+extern void ssh_flush();
+
 /**
  * Get the ssh server key fingerprint as a hex-encoded SHA1 hash of the
  * server key, the same as the key fingerprint exposed by most ssh clients.
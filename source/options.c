@@ -51,6 +51,12 @@ struct option_struct {
     char * name;
     char * default_value;
     char * comment;
+
+    /* value parsed as "true" / "false" */
+    Q_BOOL bool_value;
+
+    /* value parsed as an integer */
+    int int_value;
 };
 
 /* The full path to the options file. */
@@ -80,6 +86,12 @@ static struct option_struct options[] = {
 "### The password to require for host mode logins.  Maximum length is 64\n"
 "### bytes."},
 
+        {Q_OPTION_HOST_SSH_KEY_BITS, NULL, "host_ssh_key_bits", "2048", ""
+"### The size in bits of the RSA key created for the host mode SSH server\n"
+"### the first time it is started.  Value is between 1024 and 4096.  An\n"
+"### existing key is not changed; delete ssh_server_key.p15 to make a new\n"
+"### one."},
+
 /* Directories */
 
 #ifdef Q_PDCURSES_WIN32
@@ -284,6 +296,17 @@ static struct option_struct options[] = {
 "### The default capture format.  Value is 'normal', 'raw', 'html', or\n"
 "### 'ask'."},
 
+        {Q_OPTION_CAPTURE_COMPRESS, NULL, "capture_compress", "none", ""
+"### Whether or not to compress the capture file as it is written.  Value\n"
+"### is 'none', 'gzip', or 'zstd'.  The compressor runs as a separate\n"
+"### process and must be on the PATH.  '.gz' or '.zst' is appended to the\n"
+"### capture file name."},
+
+        {Q_OPTION_CAPTURE_ROTATE_SIZE, NULL, "capture_rotate_size", "0", ""
+"### When the capture file reaches this many kilobytes, close it and\n"
+"### continue in a new file with '.1', '.2', etc. appended to the name.\n"
+"### 0 means never rotate."},
+
 /* Screen dump */
 
         {Q_OPTION_SCREEN_DUMP_TYPE, NULL, "screen_dump_type", "normal", ""
@@ -645,6 +668,11 @@ static struct option_struct options[] = {
 "### The location of the SSH known_hosts file.  The $HOME environment\n"
 "### variable will be substituted if specified."},
 
+        {Q_OPTION_SSH_BUFFER_SIZE, NULL, "ssh_buffer_size", "65536", ""
+"### The size in bytes of the buffers cryptlib uses for each SSH\n"
+"### connection.  Larger buffers move more data per packet, which helps\n"
+"### file transfers.  Minimum is 8192; 0 uses the cryptlib default."},
+
 /* Communication protocol: RLOGIN */
 
 #ifdef Q_PDCURSES_WIN32
@@ -733,6 +761,33 @@ static struct option_struct options[] = {
 "linefeed\n"
 "### while sending the file."},
 
+        {Q_OPTION_ASCII_UPLOAD_CHAR_RATE, NULL, "ascii_upload_char_rate",
+         "0", ""
+"### The maximum number of characters per second to send during ASCII\n"
+"### file uploads, for remote systems that cannot keep up.  0 means send\n"
+"### as fast as the connection allows."},
+
+        {Q_OPTION_ASCII_UPLOAD_LINE_DELAY, NULL, "ascii_upload_line_delay",
+         "0", ""
+"### The number of milliseconds to pause after each line during ASCII\n"
+"### file uploads.  0 means do not pause."},
+
+        {Q_OPTION_ASCII_UPLOAD_WAIT_ECHO, NULL, "ascii_upload_wait_for_echo",
+         "false", ""
+"### Whether or not to wait for the remote system to echo each line\n"
+"### before sending the next one during ASCII file uploads.  Value is\n"
+"### 'true' or 'false'.\n"
+"###\n"
+"### A line counts as echoed when a carriage-return or linefeed comes\n"
+"### back.  If nothing comes back within 10 seconds, the upload continues."},
+
+        {Q_OPTION_ASCII_UPLOAD_WAIT_PROMPT, NULL,
+         "ascii_upload_wait_for_prompt", "", ""
+"### Text to wait for from the remote system after each line before\n"
+"### sending the next one during ASCII file uploads, for example a line\n"
+"### editor prompt.  Leave blank to not wait for a prompt.  If the text\n"
+"### does not arrive within 10 seconds, the upload continues."},
+
         {Q_OPTION_ASCII_DOWNLOAD_USE_TRANSLATE_TABLE, NULL,
          "ascii_download_use_xlate_table", "true", ""
 "### Whether or not the ASCII translate table function should be used\n"
@@ -829,8 +884,9 @@ static struct option_struct options[] = {
 "### packets continuously without waiting for ACKs).\n"
 "### Value is 'true' or 'false'.\n"
 "###\n"
-"### 'true' means Kermit will use streaming, resulting in a significant\n"
-"### performance improvement in most cases, especially over TCP links.\n"
+"### 'true' means Kermit will use streaming on network connections,\n"
+"### resulting in a significant performance improvement.  Serial and\n"
+"### modem connections always use sliding windows instead.\n"
 "### 'false' means Kermit will not use streaming."},
 
         {Q_OPTION_KERMIT_UPLOADS_FORCE_BINARY, NULL,
@@ -870,12 +926,71 @@ static struct option_struct options[] = {
 "### Kermit may need to use short packets to get through.\n"
 "### Value is 'true' or 'false'.\n"
 "###\n"
-"### 'true' means Kermit will use long packets, up to 1k.\n"
+"### 'true' means Kermit will use long packets, up to 9k on network\n"
+"### connections and 1k on serial and modem connections.\n"
 "### 'false' means Kermit will use short packets, up to 96 bytes."},
 
     {Q_OPTION_NULL, NULL, NULL, NULL}
 };
 
+/**
+ * The entries of options indexed by Q_OPTION, so that lookups do not need
+ * to scan the table.  Filled in by index_options().
+ */
+static struct option_struct * options_index[Q_OPTION_MAX];
+static Q_BOOL options_indexed = Q_FALSE;
+
+/**
+ * Fill in options_index from the options table.
+ */
+static void index_options() {
+    struct option_struct * current_option;
+
+    memset(options_index, 0, sizeof(options_index));
+    for (current_option = options; current_option->option != Q_OPTION_NULL;
+         current_option++) {
+        assert(current_option->option < Q_OPTION_MAX);
+        options_index[current_option->option] = current_option;
+    }
+    options_indexed = Q_TRUE;
+}
+
+/**
+ * Find the option_struct from the Q_OPTION value.
+ *
+ * @param option the option enum
+ * @return the options struct, or NULL if there is no such option
+ */
+static struct option_struct * find_option(const Q_OPTION option) {
+    if (options_indexed == Q_FALSE) {
+        index_options();
+    }
+    if ((option <= Q_OPTION_NULL) || (option >= Q_OPTION_MAX)) {
+        return NULL;
+    }
+    return options_index[option];
+}
+
+/**
+ * Update the parsed copies of an option's value.  This must be called
+ * whenever option->value changes.
+ *
+ * @param option the option that changed
+ */
+static void parse_option_value(struct option_struct * option) {
+    if (option->value == NULL) {
+        option->bool_value = Q_FALSE;
+        option->int_value = 0;
+        return;
+    }
+    if (strcasecmp(option->value, "true") == 0) {
+        option->bool_value = Q_TRUE;
+    } else {
+        option->bool_value = Q_FALSE;
+    }
+    option->int_value = atoi(option->value);
+}
+
 /**
  * Replace all instances of "pattern" in "original" with "new_string",
  * returning a newly-allocated string.
@@ -1124,16 +1239,41 @@ char * substitute_wcs_half(const char * original, const char * pattern,
  * @return the option value from the config file
  */
 char * get_option(const Q_OPTION option) {
-    struct option_struct * current_option = options;
-    while (current_option->option != Q_OPTION_NULL) {
-        if (current_option->option == option) {
-            return current_option->value;
-        }
-        current_option++;
+    struct option_struct * current_option = find_option(option);
+    if (current_option != NULL) {
+        return current_option->value;
     }
     return "";
 }
 
+/**
+ * Get an option value as a boolean.
+ *
+ * @param option the option
+ * @return true if the option value is "true" (in any case)
+ */
+Q_BOOL get_option_bool(const Q_OPTION option) {
+    struct option_struct * current_option = find_option(option);
+    if (current_option != NULL) {
+        return current_option->bool_value;
+    }
+    return Q_FALSE;
+}
+
+/**
+ * Get an option value as an integer.
+ *
+ * @param option the option
+ * @return the option value as parsed by atoi()
+ */
+int get_option_int(const Q_OPTION option) {
+    struct option_struct * current_option = find_option(option);
+    if (current_option != NULL) {
+        return current_option->int_value;
+    }
+    return 0;
+}
+
 /**
  * Get the long description for an option.  The help system uses this to
  * automatically generate a help screen out of the options descriptions.
@@ -1142,12 +1282,9 @@ char * get_option(const Q_OPTION option) {
  * @return the option description
  */
 const char * get_option_description(const Q_OPTION option) {
-    struct option_struct * current_option = options;
-    while (current_option->option != Q_OPTION_NULL) {
-        if (current_option->option == option) {
-            return current_option->comment;
-        }
-        current_option++;
+    struct option_struct * current_option = find_option(option);
+    if (current_option != NULL) {
+        return current_option->comment;
     }
     return "";
 }
@@ -1160,12 +1297,9 @@ const char * get_option_description(const Q_OPTION option) {
  * @return the option key
  */
 const char * get_option_key(const Q_OPTION option) {
-    struct option_struct * current_option = options;
-    while (current_option->option != Q_OPTION_NULL) {
-        if (current_option->option == option) {
-            return current_option->name;
-        }
-        current_option++;
+    struct option_struct * current_option = find_option(option);
+    if (current_option != NULL) {
+        return current_option->name;
     }
     return "";
 }
@@ -1178,12 +1312,9 @@ const char * get_option_key(const Q_OPTION option) {
  * @return the option default value
  */
 const char * get_option_default(const Q_OPTION option) {
-    struct option_struct * current_option = options;
-    while (current_option->option != Q_OPTION_NULL) {
-        if (current_option->option == option) {
-            return current_option->default_value;
-        }
-        current_option++;
+    struct option_struct * current_option = find_option(option);
+    if (current_option != NULL) {
+        return current_option->default_value;
     }
     return "";
 }
@@ -1330,6 +1461,7 @@ static void set_option(struct option_struct * option, char * value) {
         Xfree(option->value, __FILE__, __LINE__);
     }
     option->value = new_value;
+    parse_option_value(option);
 }
 
 /**
@@ -1396,6 +1528,7 @@ static void check_option(struct option_struct * option) {
     default:
         break;
     }
+    parse_option_value(option);
 }
 
 /**
@@ -1460,14 +1593,23 @@ static void load_options_from_file(const char * filename) {
                      */
                     set_option(current_option,
                                line + strlen(current_option->name));
+                    break;
                 }
             }
-            check_option(current_option);
             current_option++;
         }
     }
 
     fclose(file);
+
+    /*
+     * Now that every line is read, perform the $HOME etc. substitutions
+     * once per option.
+     */
+    for (current_option = options; current_option->option != Q_OPTION_NULL;
+         current_option++) {
+        check_option(current_option);
+    }
 }
 
 /**
@@ -1480,25 +1622,6 @@ char * get_options_filename() {
     return home_directory_options_filename;
 }
 
-/**
- * Find the option_struct from the Q_OPTION value.
- *
- * @param option the option enum
- * @return the options struct
- */
-static struct option_struct * find_option(const Q_OPTION option) {
-    struct option_struct * current_option;
-
-    current_option = options;
-    while (current_option->option != Q_OPTION_NULL) {
-        if (current_option->option == option) {
-            return current_option;
-        }
-        current_option++;
-    }
-    return NULL;
-}
-
 /**
  * Create a directory, using either Windows or POSIX calls.  This will also
  * create any directories that are missing in the middle.
@@ -1684,6 +1807,7 @@ void reset_options() {
         }
         current_option->value =
             Xstrdup(current_option->default_value, __FILE__, __LINE__);
+        parse_option_value(current_option);
 
         /*
          * Translate option help text to local language
@@ -1899,22 +2023,22 @@ no_more_config_files:
      */
     q_status.idle_timeout = 0;
     if (get_option(Q_OPTION_IDLE_TIMEOUT) != NULL) {
-        q_status.idle_timeout = atoi(get_option(Q_OPTION_IDLE_TIMEOUT));
+        q_status.idle_timeout = get_option_int(Q_OPTION_IDLE_TIMEOUT);
     }
 
     q_status.bracketed_paste_mode = Q_FALSE;
-    if (strcasecmp(get_option(Q_OPTION_BRACKETED_PASTE), "true") == 0) {
+    if (get_option_bool(Q_OPTION_BRACKETED_PASTE) == Q_TRUE) {
         q_status.bracketed_paste_mode = Q_TRUE;
     }
 
     q_screensaver_timeout = 0;
     if (get_option(Q_OPTION_SCREENSAVER_TIMEOUT) != NULL) {
-        q_screensaver_timeout = atoi(get_option(Q_OPTION_SCREENSAVER_TIMEOUT));
+        q_screensaver_timeout = get_option_int(Q_OPTION_SCREENSAVER_TIMEOUT);
     }
 
     q_scrollback_max = atoi(get_option_default(Q_OPTION_SCROLLBACK_LINES));
     if (get_option(Q_OPTION_SCROLLBACK_LINES) != NULL) {
-        q_scrollback_max = atoi(get_option(Q_OPTION_SCROLLBACK_LINES));
+        q_scrollback_max = get_option_int(Q_OPTION_SCROLLBACK_LINES);
     }
     if (q_scrollback_max < 0) {
         q_scrollback_max = 0;
@@ -1922,7 +2046,7 @@ no_more_config_files:
 
     q_keepalive_timeout = 0;
     if (get_option(Q_OPTION_KEEPALIVE_TIMEOUT) != NULL) {
-        q_keepalive_timeout = atoi(get_option(Q_OPTION_KEEPALIVE_TIMEOUT));
+        q_keepalive_timeout = get_option_int(Q_OPTION_KEEPALIVE_TIMEOUT);
     }
     if (strlen(get_option(Q_OPTION_KEEPALIVE_BYTES)) > 0) {
         memset(q_keepalive_bytes, 0, sizeof(q_keepalive_bytes));
@@ -2008,11 +2132,11 @@ no_more_config_files:
     q_status.sound = Q_FALSE;
     q_status.beeps = Q_FALSE;
     q_status.ansi_music = Q_FALSE;
-    if (strcasecmp(get_option(Q_OPTION_SOUNDS_ENABLED), "true") == 0) {
+    if (get_option_bool(Q_OPTION_SOUNDS_ENABLED) == Q_TRUE) {
         q_status.sound = Q_TRUE;
         q_status.beeps = Q_TRUE;
 
-        if (strcasecmp(get_option(Q_OPTION_ANSI_MUSIC), "true") == 0) {
+        if (get_option_bool(Q_OPTION_ANSI_MUSIC) == Q_TRUE) {
             q_status.ansi_music = Q_TRUE;
         }
     }
@@ -2022,11 +2146,11 @@ no_more_config_files:
         q_status.zmodem_autostart = Q_FALSE;
     }
     q_status.zmodem_zchallenge = Q_FALSE;
-    if (strcasecmp(get_option(Q_OPTION_ZMODEM_ZCHALLENGE), "true") == 0) {
+    if (get_option_bool(Q_OPTION_ZMODEM_ZCHALLENGE) == Q_TRUE) {
         q_status.zmodem_zchallenge = Q_TRUE;
     }
     q_status.zmodem_escape_ctrl = Q_FALSE;
-    if (strcasecmp(get_option(Q_OPTION_ZMODEM_ESCAPE_CTRL), "true") == 0) {
+    if (get_option_bool(Q_OPTION_ZMODEM_ESCAPE_CTRL) == Q_TRUE) {
         q_status.zmodem_escape_ctrl = Q_TRUE;
     }
 
@@ -2035,7 +2159,7 @@ no_more_config_files:
         q_status.kermit_autostart = Q_FALSE;
     }
     q_status.kermit_robust_filename = Q_FALSE;
-    if (strcasecmp(get_option(Q_OPTION_KERMIT_ROBUST_FILENAME), "true") == 0) {
+    if (get_option_bool(Q_OPTION_KERMIT_ROBUST_FILENAME) == Q_TRUE) {
         q_status.kermit_robust_filename = Q_TRUE;
     }
     q_status.kermit_streaming = Q_TRUE;
@@ -2052,8 +2176,7 @@ no_more_config_files:
         q_status.kermit_uploads_force_binary = Q_FALSE;
     }
     q_status.kermit_downloads_convert_text = Q_FALSE;
-    if (strcasecmp(get_option(Q_OPTION_KERMIT_DOWNLOADS_CONVERT_TEXT), "true")
-        == 0) {
+    if (get_option_bool(Q_OPTION_KERMIT_DOWNLOADS_CONVERT_TEXT) == Q_TRUE) {
         q_status.kermit_downloads_convert_text = Q_TRUE;
     }
     q_status.kermit_resend = Q_TRUE;
@@ -2067,17 +2190,17 @@ no_more_config_files:
     }
 
     q_status.ansi_animate = Q_FALSE;
-    if (strcasecmp(get_option(Q_OPTION_ANSI_ANIMATE), "true") == 0) {
+    if (get_option_bool(Q_OPTION_ANSI_ANIMATE) == Q_TRUE) {
         q_status.ansi_animate = Q_TRUE;
     }
 
     q_status.exit_on_disconnect = Q_FALSE;
-    if (strcasecmp(get_option(Q_OPTION_EXIT_ON_DISCONNECT), "true") == 0) {
+    if (get_option_bool(Q_OPTION_EXIT_ON_DISCONNECT) == Q_TRUE) {
         q_status.exit_on_disconnect = Q_TRUE;
     }
 
     q_status.external_telnet = Q_FALSE;
-    if (strcasecmp(get_option(Q_OPTION_TELNET_EXTERNAL), "true") == 0) {
+    if (get_option_bool(Q_OPTION_TELNET_EXTERNAL) == Q_TRUE) {
         q_status.external_telnet = Q_TRUE;
     }
     q_status.external_rlogin = Q_TRUE;
@@ -2129,12 +2252,12 @@ no_more_config_files:
         q_status.petscii_has_wide_font = Q_FALSE;
     }
     q_status.petscii_use_unicode = Q_FALSE;
-    if (strcasecmp(get_option(Q_OPTION_PETSCII_UNICODE), "true") == 0) {
+    if (get_option_bool(Q_OPTION_PETSCII_UNICODE) == Q_TRUE) {
         q_status.petscii_use_unicode = Q_TRUE;
         q_status.petscii_has_wide_font = Q_FALSE;
     }
     q_status.atascii_has_wide_font = Q_FALSE;
-    if (strcasecmp(get_option(Q_OPTION_ATASCII_WIDE_FONT), "true") == 0) {
+    if (get_option_bool(Q_OPTION_ATASCII_WIDE_FONT) == Q_TRUE) {
         q_status.atascii_has_wide_font = Q_TRUE;
     }
 
@@ -42,6 +42,7 @@ typedef enum Q_OPTIONS {
 
     Q_OPTION_HOST_USERNAME,
     Q_OPTION_HOST_PASSWORD,
+    Q_OPTION_HOST_SSH_KEY_BITS,
     Q_OPTION_WORKING_DIR,
     Q_OPTION_HOST_DIR,
     Q_OPTION_DOWNLOAD_DIR,
@@ -68,6 +69,8 @@ typedef enum Q_OPTIONS {
     Q_OPTION_CAPTURE,
     Q_OPTION_CAPTURE_FILE,
     Q_OPTION_CAPTURE_TYPE,
+    Q_OPTION_CAPTURE_COMPRESS,
+    Q_OPTION_CAPTURE_ROTATE_SIZE,
     Q_OPTION_SCREEN_DUMP_TYPE,
     Q_OPTION_SCROLLBACK_LINES,
     Q_OPTION_SCROLLBACK_SAVE_TYPE,
@@ -103,6 +106,7 @@ typedef enum Q_OPTIONS {
     Q_OPTION_SSH,
     Q_OPTION_SSH_USER,
     Q_OPTION_SSH_KNOWNHOSTS,
+    Q_OPTION_SSH_BUFFER_SIZE,
     Q_OPTION_RLOGIN_EXTERNAL,
     Q_OPTION_RLOGIN,
     Q_OPTION_RLOGIN_USER,
@@ -111,6 +115,10 @@ typedef enum Q_OPTIONS {
     Q_OPTION_ASCII_UPLOAD_USE_TRANSLATE_TABLE,
     Q_OPTION_ASCII_UPLOAD_CR_POLICY,
     Q_OPTION_ASCII_UPLOAD_LF_POLICY,
+    Q_OPTION_ASCII_UPLOAD_CHAR_RATE,
+    Q_OPTION_ASCII_UPLOAD_LINE_DELAY,
+    Q_OPTION_ASCII_UPLOAD_WAIT_ECHO,
+    Q_OPTION_ASCII_UPLOAD_WAIT_PROMPT,
     Q_OPTION_ASCII_DOWNLOAD_USE_TRANSLATE_TABLE,
     Q_OPTION_ASCII_DOWNLOAD_CR_POLICY,
     Q_OPTION_ASCII_DOWNLOAD_LF_POLICY,
@@ -141,6 +149,22 @@ typedef enum Q_OPTIONS {
  */
 extern char * get_option(const Q_OPTION option);
 
+/**
+ * Get an option value as a boolean.
+ *
+ * @param option the option
+ * @return true if the option value is "true" (in any case)
+ */
+extern Q_BOOL get_option_bool(const Q_OPTION option);
+
+/**
+ * Get an option value as an integer.
+ *
+ * @param option the option
+ * @return the option value as parsed by atoi()
+ */
+extern int get_option_int(const Q_OPTION option);
+
 /**
  * Reset options to default state.
  */
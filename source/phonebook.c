@@ -112,6 +112,9 @@ static int phonebook_entry_i = 0;
 /* The currently visible "page" in the phonebook */
 static int phonebook_page = 0;
 
+/* If true, load_phonebook() has been called at least once */
+static Q_BOOL phonebook_loaded = Q_FALSE;
+
 /* Sort field choices */
 typedef enum {
     SORT_METHOD_NAME_ASC,       /* Sort by name ascending */
@@ -867,6 +870,79 @@ static char * toggles_to_string(int toggles) {
     return toggles_string_buffer;
 }
 
+/**
+ * Append a lowercase copy of a string to a search index buffer.
+ *
+ * @param dest the position in the buffer to write to
+ * @param src the string to copy
+ * @return the position just past the copied text
+ */
+static wchar_t * append_lowercase(wchar_t * dest, const wchar_t * src) {
+    for (; *src != 0; src++) {
+        *dest = towlower(*src);
+        dest++;
+    }
+    return dest;
+}
+
+/**
+ * Rebuild the search index of a phonebook entry.  This must be called
+ * whenever the name, address, or notes are changed.
+ *
+ * @param entry the entry to index
+ */
+static void index_phone_entry(struct q_phone_struct * entry) {
+    wchar_t * address = NULL;
+    wchar_t * end;
+    size_t length = 0;
+    int i;
+
+    if (entry->search_text != NULL) {
+        Xfree(entry->search_text, __FILE__, __LINE__);
+        entry->search_text = NULL;
+    }
+
+    /*
+     * Fields are separated by newlines, which a search string can never
+     * contain, so a match cannot straddle two fields.
+     */
+    if (entry->name != NULL) {
+        length += wcslen(entry->name);
+    }
+    length++;
+    if (entry->address != NULL) {
+        address = Xstring_to_wcsdup(entry->address, __FILE__, __LINE__);
+        length += wcslen(address);
+    }
+    length++;
+    if (entry->notes != NULL) {
+        for (i = 0; entry->notes[i] != NULL; i++) {
+            length += wcslen(entry->notes[i]) + 1;
+        }
+    }
+
+    entry->search_text = (wchar_t *) Xmalloc(sizeof(wchar_t) * (length + 1),
+                                             __FILE__, __LINE__);
+    end = entry->search_text;
+    if (entry->name != NULL) {
+        end = append_lowercase(end, entry->name);
+    }
+    *end++ = '\n';
+    if (address != NULL) {
+        end = append_lowercase(end, address);
+        Xfree(address, __FILE__, __LINE__);
+    }
+    *end++ = '\n';
+    entry->search_notes_offset = end - entry->search_text;
+    if (entry->notes != NULL) {
+        for (i = 0; entry->notes[i] != NULL; i++) {
+            end = append_lowercase(end, entry->notes[i]);
+            *end++ = '\n';
+        }
+    }
+    *end = 0;
+}
+
 /**
  * Load the phonebook from file.
  *
@@ -896,6 +972,8 @@ void load_phonebook(const Q_BOOL backup_version) {
 
     DLOG(("load_phonebook()\n"));
 
+    phonebook_loaded = Q_TRUE;
+
     if (backup_version == Q_FALSE) {
         filename = q_phonebook.filename;
     } else {
@@ -934,6 +1012,9 @@ void load_phonebook(const Q_BOOL backup_version) {
             }
             Xfree(old_entry->notes, __FILE__, __LINE__);
         }
+        if (old_entry->search_text != NULL) {
+            Xfree(old_entry->search_text, __FILE__, __LINE__);
+        }
         Xfree(old_entry->script_filename, __FILE__, __LINE__);
         Xfree(old_entry->capture_filename, __FILE__, __LINE__);
         Xfree(old_entry->translate_8bit_filename, __FILE__, __LINE__);
@@ -1428,6 +1509,14 @@ void load_phonebook(const Q_BOOL backup_version) {
         new_entry->keybindings_filename = Xstrdup("", __FILE__, __LINE__);
     }
 
+    /*
+     * Build the search index
+     */
+    for (new_entry = q_phonebook.entries; new_entry != NULL;
+         new_entry = new_entry->next) {
+        index_phone_entry(new_entry);
+    }
+
     q_phonebook.selected_entry = q_phonebook.entries;
     fclose(file);
     phonebook_page = 0;
@@ -1443,6 +1532,17 @@ void load_phonebook(const Q_BOOL backup_version) {
 
 }
 
+/**
+ * Load the phonebook from file if it has not been loaded yet.  Startup only
+ * loads the phonebook when --dial needs it, everything else waits until the
+ * phonebook screen is first shown or something is dialed.
+ */
+void load_phonebook_if_needed() {
+    if (phonebook_loaded == Q_FALSE) {
+        load_phonebook(Q_FALSE);
+    }
+}
+
 /**
  * Save the phonebook to file.
  *
@@ -1461,6 +1561,14 @@ static void save_phonebook(const Q_BOOL backup_version) {
         return;
     }
 
+    if (phonebook_loaded == Q_FALSE) {
+        /*
+         * Never write out a phonebook that was never read in: it would
+         * replace the user's file with an empty one.
+         */
+        return;
+    }
+
     if (backup_version == Q_FALSE) {
         filename = q_phonebook.filename;
     } else {
@@ -1609,6 +1717,7 @@ void create_phonebook() {
     new_entry->username         = Xwcsdup(L"", __FILE__, __LINE__);
     new_entry->password         = Xwcsdup(L"", __FILE__, __LINE__);
     new_entry->notes            = NULL;
+    new_entry->search_text      = NULL;
     new_entry->tagged           = Q_FALSE;
     new_entry->doorway          = Q_DOORWAY_CONFIG;
     new_entry->emulation        = Q_EMUL_XTERM_UTF8;
@@ -1658,6 +1767,7 @@ void create_phonebook() {
     new_entry->username         = Xwcsdup(L"", __FILE__, __LINE__);
     new_entry->password         = Xwcsdup(L"", __FILE__, __LINE__);
     new_entry->notes            = NULL;
+    new_entry->search_text      = NULL;
     new_entry->tagged           = Q_FALSE;
     new_entry->doorway          = Q_DOORWAY_CONFIG;
     new_entry->emulation        = Q_EMUL_ANSI;
@@ -1706,6 +1816,7 @@ void create_phonebook() {
     new_entry->username         = Xwcsdup(L"new", __FILE__, __LINE__);
     new_entry->password         = Xwcsdup(L"", __FILE__, __LINE__);
     new_entry->notes            = NULL;
+    new_entry->search_text      = NULL;
     new_entry->tagged           = Q_FALSE;
     new_entry->doorway          = Q_DOORWAY_CONFIG;
     new_entry->emulation        = Q_EMUL_XTERM_UTF8;
@@ -1755,6 +1866,7 @@ void create_phonebook() {
     new_entry->username         = Xwcsdup(L"", __FILE__, __LINE__);
     new_entry->password         = Xwcsdup(L"", __FILE__, __LINE__);
     new_entry->notes            = NULL;
+    new_entry->search_text      = NULL;
     new_entry->tagged           = Q_FALSE;
     new_entry->doorway          = Q_DOORWAY_CONFIG;
     new_entry->emulation        = Q_EMUL_VT102;
@@ -1803,6 +1915,7 @@ void create_phonebook() {
     new_entry->username         = Xwcsdup(L"", __FILE__, __LINE__);
     new_entry->password         = Xwcsdup(L"", __FILE__, __LINE__);
     new_entry->notes            = NULL;
+    new_entry->search_text      = NULL;
     new_entry->tagged           = Q_FALSE;
     new_entry->doorway          = Q_DOORWAY_CONFIG;
     new_entry->emulation        = Q_EMUL_XTERM_UTF8;
@@ -1852,6 +1965,7 @@ void create_phonebook() {
     new_entry->username         = Xwcsdup(L"bbs", __FILE__, __LINE__);
     new_entry->password         = Xwcsdup(L"bbs", __FILE__, __LINE__);
     new_entry->notes            = NULL;
+    new_entry->search_text      = NULL;
     new_entry->tagged           = Q_FALSE;
     new_entry->doorway          = Q_DOORWAY_CONFIG;
     new_entry->emulation        = Q_EMUL_XTERM_UTF8;
@@ -1900,6 +2014,7 @@ void create_phonebook() {
     new_entry->username         = Xwcsdup(L"", __FILE__, __LINE__);
     new_entry->password         = Xwcsdup(L"", __FILE__, __LINE__);
     new_entry->notes            = NULL;
+    new_entry->search_text      = NULL;
     new_entry->tagged           = Q_FALSE;
     new_entry->doorway          = Q_DOORWAY_CONFIG;
     new_entry->emulation        = Q_EMUL_XTERM_UTF8;
@@ -1949,6 +2064,7 @@ void create_phonebook() {
     new_entry->username         = Xwcsdup(L"", __FILE__, __LINE__);
     new_entry->password         = Xwcsdup(L"", __FILE__, __LINE__);
     new_entry->notes            = NULL;
+    new_entry->search_text      = NULL;
     new_entry->tagged           = Q_FALSE;
     new_entry->doorway          = Q_DOORWAY_CONFIG;
     new_entry->emulation        = Q_EMUL_ANSI;
@@ -1998,6 +2114,7 @@ void create_phonebook() {
     new_entry->username         = Xwcsdup(L"", __FILE__, __LINE__);
     new_entry->password         = Xwcsdup(L"", __FILE__, __LINE__);
     new_entry->notes            = NULL;
+    new_entry->search_text      = NULL;
     new_entry->tagged           = Q_FALSE;
     new_entry->doorway          = Q_DOORWAY_CONFIG;
     new_entry->emulation        = Q_EMUL_ANSI;
@@ -2028,6 +2145,7 @@ void create_phonebook() {
      * Now save it.  Note that we don't care if anyone else might have
      * modified it.
      */
+    phonebook_loaded = Q_TRUE;
     save_phonebook(Q_FALSE);
 }
 
@@ -2176,7 +2294,8 @@ void do_dialer() {
      * Save phonebook - in case someone JUST added an entry and will be
      * dialing.
      */
-    if (phonebook_is_mine(Q_FALSE) == Q_TRUE) {
+    if ((phonebook_loaded == Q_TRUE) &&
+        (phonebook_is_mine(Q_FALSE) == Q_TRUE)) {
         save_phonebook(Q_FALSE);
     }
 
@@ -2250,11 +2369,101 @@ void do_dialer() {
     /*
      * Save phonebook
      */
-    if (phonebook_is_mine(Q_FALSE) == Q_TRUE) {
+    if ((phonebook_loaded == Q_TRUE) &&
+        (phonebook_is_mine(Q_FALSE) == Q_TRUE)) {
         save_phonebook(Q_FALSE);
     }
 }
 
+/**
+ * Compare two phonebook entries for sort_phonebook().
+ *
+ * @param a the first entry
+ * @param b the second entry
+ * @param method one of the available sorting methods
+ * @return less than zero if a sorts before b, greater than zero if a sorts
+ * after b, and zero if they are equivalent
+ */
+static int compare_phone_entries(const struct q_phone_struct * a,
+                                 const struct q_phone_struct * b,
+                                 const SORT_METHOD method) {
+
+    switch (method) {
+    case SORT_METHOD_NAME_ASC:
+        return wcscmp(a->name, b->name);
+    case SORT_METHOD_ADDRESS_ASC:
+        return strcasecmp(a->address, b->address);
+    case SORT_METHOD_TOTAL_CALLS_DESC:
+        if (a->times_on > b->times_on) {
+            return -1;
+        }
+        if (a->times_on < b->times_on) {
+            return 1;
+        }
+        return 0;
+    case SORT_METHOD_METHOD_ASC:
+        return (int) a->method - (int) b->method;
+    case SORT_METHOD_LAST_CALL_DESC:
+        if (a->last_call > b->last_call) {
+            return -1;
+        }
+        if (a->last_call < b->last_call) {
+            return 1;
+        }
+        return 0;
+    case SORT_METHOD_REVERSE:
+    case SORT_METHOD_MAX:
+        break;
+    }
+    return 0;
+}
+
+/**
+ * Merge sort an array of phonebook entry pointers.  The sort is stable, so
+ * entries that compare equal keep their existing relative order.
+ *
+ * @param entries the array to sort
+ * @param scratch scratch space at least as large as entries
+ * @param n the number of entries
+ * @param method one of the available sorting methods
+ */
+static void merge_sort_phone_entries(struct q_phone_struct ** entries,
+                                     struct q_phone_struct ** scratch,
+                                     const int n, const SORT_METHOD method) {
+
+    int half = n / 2;
+    int i, j, k;
+
+    if (n < 2) {
+        return;
+    }
+
+    merge_sort_phone_entries(entries, scratch, half, method);
+    merge_sort_phone_entries(entries + half, scratch, n - half, method);
+
+    /*
+     * Already in order: nothing to merge.
+     */
+    if (compare_phone_entries(entries[half - 1], entries[half], method) <= 0) {
+        return;
+    }
+
+    memcpy(scratch, entries, sizeof(struct q_phone_struct *) * half);
+    i = 0;
+    j = half;
+    k = 0;
+    while ((i < half) && (j < n)) {
+        if (compare_phone_entries(entries[j], scratch[i], method) < 0) {
+            entries[k++] = entries[j++];
+        } else {
+            entries[k++] = scratch[i++];
+        }
+    }
+    while (i < half) {
+        entries[k++] = scratch[i++];
+    }
+}
+
 /**
  * Sort the phonebook.
  *
@@ -2262,128 +2471,60 @@ void do_dialer() {
  */
 static void sort_phonebook(const SORT_METHOD method) {
     /*
-     * This is a hideously inefficient method.  Basically I just keep looping
-     * through the phonebook swapping adjacent entries until the whole thing
-     * is sorted.
+     * Copy the entry pointers into an array, merge sort that, and then
+     * relink the list in the new order.
      */
 
     struct q_phone_struct * current_entry;
-    struct q_phone_struct * swap;
-    struct q_phone_struct * tail;
-    Q_BOOL sorted = Q_FALSE;
+    struct q_phone_struct ** sorted;
+    struct q_phone_struct ** scratch;
+    int count = 0;
+    int i;
 
     if (q_phonebook.entries == NULL) {
         return;
     }
 
+    for (current_entry = q_phonebook.entries; current_entry != NULL;
+         current_entry = current_entry->next) {
+        count++;
+    }
+
+    sorted = (struct q_phone_struct **) Xmalloc(
+        sizeof(struct q_phone_struct *) * count, __FILE__, __LINE__);
+    i = 0;
+    for (current_entry = q_phonebook.entries; current_entry != NULL;
+         current_entry = current_entry->next) {
+        sorted[i] = current_entry;
+        i++;
+    }
+
     if (method == SORT_METHOD_REVERSE) {
         /*
          * Special case: reverse everything
          */
-        for (current_entry = q_phonebook.entries; current_entry != NULL;
-             current_entry = current_entry->prev) {
-            /*
-             * Tail will be the last entry and become the new head
-             */
-            tail = current_entry;
-
-            /*
-             * Switch out prev/next
-             */
-            swap = current_entry->next;
-            current_entry->next = current_entry->prev;
-            current_entry->prev = swap;
+        for (i = 0; i < count / 2; i++) {
+            current_entry = sorted[i];
+            sorted[i] = sorted[count - 1 - i];
+            sorted[count - 1 - i] = current_entry;
         }
-
-        /*
-         * Point back to the top
-         */
-        q_phonebook.entries = tail;
-        q_phonebook.selected_entry = q_phonebook.entries;
-        phonebook_page = 0;
-        phonebook_entry_i = 0;
-        return;
+    } else {
+        scratch = (struct q_phone_struct **) Xmalloc(
+            sizeof(struct q_phone_struct *) * ((count / 2) + 1),
+            __FILE__, __LINE__);
+        merge_sort_phone_entries(sorted, scratch, count, method);
+        Xfree(scratch, __FILE__, __LINE__);
     }
 
-    while (sorted == Q_FALSE) {
-
-        sorted = Q_TRUE;
-
-        for (current_entry = q_phonebook.entries; current_entry->next != NULL;
-             current_entry = current_entry->next) {
-
-            if (method == SORT_METHOD_NAME_ASC) {
-                if (wcscmp(current_entry->name,
-                        current_entry->next->name) <= 0) {
-                    continue;
-                }
-
-            } else if (method == SORT_METHOD_ADDRESS_ASC) {
-                if (strcasecmp(current_entry->address,
-                        current_entry->next->address) <= 0) {
-                    continue;
-                }
-
-            } else if (method == SORT_METHOD_TOTAL_CALLS_DESC) {
-                if (current_entry->times_on >= current_entry->next->times_on) {
-                    continue;
-                }
-
-            } else if (method == SORT_METHOD_METHOD_ASC) {
-                if (current_entry->method <= current_entry->next->method) {
-                    continue;
-                }
-
-            } else if (method == SORT_METHOD_LAST_CALL_DESC) {
-                if (current_entry->last_call >= current_entry->next->last_call) {
-                    continue;
-                }
-
-            }
-
-            /*
-             * Swap current_entry and current_entry->next
-             */
-            if (current_entry == q_phonebook.entries) {
-                /*
-                 * Swapping the head
-                 */
-                q_phonebook.entries = current_entry->next;
-                swap = current_entry->next->next;
-
-                q_phonebook.entries->next = current_entry;
-                q_phonebook.entries->prev = NULL;
-                current_entry->prev = current_entry->next;
-                current_entry->next = swap;
-                if (swap != NULL) {
-                    swap->prev = current_entry;
-                }
-            } else {
-                /*
-                 * Swapping in the middle
-                 */
-                swap = current_entry->next->next;
-
-                current_entry->prev->next = current_entry->next;
-                current_entry->next->prev = current_entry->prev;
-                current_entry->prev = current_entry->next;
-                current_entry->next->next = current_entry;
-                current_entry->next = swap;
-                if (swap != NULL) {
-                    swap->prev = current_entry;
-                }
-            }
-
-            sorted = Q_FALSE;
-
-            /*
-             * Search again from the top
-             */
-            break;
-
-        } /* for (...) */
-
-    } /* while (sorted == Q_FALSE) */
+    /*
+     * Rebuild the list from the array
+     */
+    for (i = 0; i < count; i++) {
+        sorted[i]->prev = (i > 0 ? sorted[i - 1] : NULL);
+        sorted[i]->next = (i < count - 1 ? sorted[i + 1] : NULL);
+    }
+    q_phonebook.entries = sorted[0];
+    Xfree(sorted, __FILE__, __LINE__);
 
     /*
      * Point back to the top
@@ -2394,89 +2535,45 @@ static void sort_phonebook(const SORT_METHOD method) {
 }
 
 /**
- * See if a phonebook entry matches the search string.  Note that the search
- * string is destructively switched to lowercase.
+ * Switch a search string to lowercase in place so that it can be passed to
+ * match_phonebook_entry().
  *
  * @param search_string text to search for
- * @param entry the entry to search in
- * @return true if a match is found
  */
-static Q_BOOL match_phonebook_entry(wchar_t * search_string,
-                                    const struct q_phone_struct * entry) {
-
-    wchar_t * field_string;
-    unsigned int i, j;
-
-    /*
-     * Force the search string to lowercase
-     */
-    for (i = 0; i < wcslen(search_string); i++) {
-        search_string[i] = towlower(search_string[i]);
+static void lowercase_search_string(wchar_t * search_string) {
+    for (; *search_string != 0; search_string++) {
+        *search_string = towlower(*search_string);
     }
+}
 
-    /*
-     * Check name
-     */
-    if (wcslen(entry->name) > 0) {
-        field_string = Xwcsdup(entry->name, __FILE__, __LINE__);
-        for (i = 0; i < wcslen(field_string); i++) {
-            field_string[i] = towlower(field_string[i]);
-        }
-
-        if (wcsstr(field_string, search_string) != NULL) {
-            Xfree(field_string, __FILE__, __LINE__);
-            return Q_TRUE;
-        }
-        Xfree(field_string, __FILE__, __LINE__);
-    }
+/**
+ * See if a phonebook entry matches the search string.
+ *
+ * @param search_string text to search for, already lowercase
+ * @param entry the entry to search in
+ * @return true if a match is found
+ */
+static Q_BOOL match_phonebook_entry(const wchar_t * search_string,
+                                    struct q_phone_struct * entry) {
 
-    /*
-     * Check address
-     */
-    if (strlen(entry->address) > 0) {
-        field_string = Xstring_to_wcsdup(entry->address, __FILE__, __LINE__);
-        for (i = 0; i < wcslen(field_string); i++) {
-            field_string[i] = towlower(field_string[i]);
-        }
+    wchar_t * match;
 
-        if (wcsstr(field_string, search_string) != NULL) {
-            Xfree(field_string, __FILE__, __LINE__);
-            return Q_TRUE;
-        }
-        Xfree(field_string, __FILE__, __LINE__);
+    if (entry->search_text == NULL) {
+        index_phone_entry(entry);
     }
 
-    /*
-     * Last of all, check the notes
-     */
-    if (entry->notes == NULL) {
+    match = wcsstr(entry->search_text, search_string);
+    if (match == NULL) {
         /*
-         * Can't match anymore without notes
+         * Nothing matched
          */
         return Q_FALSE;
     }
 
-    /*
-     * Notes is a list of strings
-     */
-    for (j = 0; entry->notes[j] != NULL; j++) {
-        field_string = Xwcsdup(entry->notes[j], __FILE__, __LINE__);
-        for (i = 0; i < wcslen(field_string); i++) {
-            field_string[i] = towlower(field_string[i]);
-        }
-
-        if (wcsstr(field_string, search_string) != NULL) {
-            Xfree(field_string, __FILE__, __LINE__);
-            found_note_flag = Q_TRUE;
-            return Q_TRUE;
-        }
-        Xfree(field_string, __FILE__, __LINE__);
+    if ((size_t) (match - entry->search_text) >= entry->search_notes_offset) {
+        found_note_flag = Q_TRUE;
     }
-
-    /*
-     * Nothing matched
-     */
-    return Q_FALSE;
+    return Q_TRUE;
 }
 
 /**
@@ -2486,10 +2583,10 @@ static Q_BOOL match_phonebook_entry(wchar_t * search_string,
  */
 static void tag_multiple(const char * tag_string) {
     int i;
+    int token_count;
     int current_entry_i;
     char ** search_tokens;
-    char * search_string;
-    wchar_t * wcs_search_string;
+    wchar_t ** wcs_search_strings;
 
     struct q_phone_struct * current_entry;
     if (q_phonebook.entries == NULL) {
@@ -2497,6 +2594,25 @@ static void tag_multiple(const char * tag_string) {
     }
     search_tokens = tokenize_command(tag_string);
 
+    /*
+     * Convert the text searches once rather than for every entry
+     */
+    token_count = 0;
+    while (search_tokens[token_count] != NULL) {
+        token_count++;
+    }
+    wcs_search_strings = (wchar_t **) Xmalloc(sizeof(wchar_t *) *
+                                              (token_count + 1),
+                                              __FILE__, __LINE__);
+    for (i = 0; i < token_count; i++) {
+        wcs_search_strings[i] = NULL;
+        if (tolower(search_tokens[i][0]) == 't') {
+            wcs_search_strings[i] = Xstring_to_wcsdup(&search_tokens[i][1],
+                                                      __FILE__, __LINE__);
+            lowercase_search_string(wcs_search_strings[i]);
+        }
+    }
+
     current_entry_i = 0;
     for (current_entry = q_phonebook.entries; current_entry != NULL;
          current_entry = current_entry->next) {
@@ -2504,25 +2620,17 @@ static void tag_multiple(const char * tag_string) {
 
         for (i = 0; search_tokens[i] != NULL; i++) {
 
-            if (tolower(search_tokens[i][0]) == 't') {
+            if (wcs_search_strings[i] != NULL) {
 
                 /*
                  * Text search
                  */
-                search_string = &search_tokens[i][1];
-                wcs_search_string =
-                    Xstring_to_wcsdup(search_string, __FILE__, __LINE__);
-
-                if (match_phonebook_entry(wcs_search_string, current_entry) ==
-                    Q_TRUE) {
+                if ((current_entry->tagged == Q_FALSE) &&
+                    (match_phonebook_entry(wcs_search_strings[i],
+                                           current_entry) == Q_TRUE)) {
                     current_entry->tagged = Q_TRUE;
                     q_phonebook.tagged++;
                 }
-                /*
-                 * No leak
-                 */
-                Xfree(wcs_search_string, __FILE__, __LINE__);
-
             }
 
             if (q_isdigit(search_tokens[i][0])) {
@@ -2540,6 +2648,16 @@ static void tag_multiple(const char * tag_string) {
 
     } /* for (...) */
 
+    /*
+     * No leak
+     */
+    for (i = 0; i < token_count; i++) {
+        if (wcs_search_strings[i] != NULL) {
+            Xfree(wcs_search_strings[i], __FILE__, __LINE__);
+        }
+    }
+    Xfree(wcs_search_strings, __FILE__, __LINE__);
+
     /*
      * Free up the array of token pointers
      */
@@ -2647,6 +2765,7 @@ static void edit_attached_note(struct q_phone_struct * entry) {
 
     fclose(file);
     unlink(filename);
+    index_phone_entry(entry);
 }
 
 /**
@@ -2686,6 +2805,9 @@ static void delete_phonebook_entry(struct q_phone_struct * entry) {
         }
         Xfree(entry->notes, __FILE__, __LINE__);
     }
+    if (entry->search_text != NULL) {
+        Xfree(entry->search_text, __FILE__, __LINE__);
+    }
     Xfree(entry->script_filename, __FILE__, __LINE__);
     Xfree(entry->capture_filename, __FILE__, __LINE__);
     Xfree(entry->translate_8bit_filename, __FILE__, __LINE__);
@@ -3365,6 +3487,12 @@ static void cycle_redialer_number() {
      * KEY_ENTER.  Keep these two functions in sync.
      */
 
+    /*
+     * --connect dials before the phonebook is loaded, but the tagged
+     * entries live there.
+     */
+    load_phonebook_if_needed();
+
     entry = q_phonebook.selected_entry;
     if (q_phonebook.tagged == 0) {
         /*
@@ -3409,10 +3537,13 @@ static void cycle_redialer_number() {
  */
 static Q_BOOL kill_redialer_number() {
 
+    load_phonebook_if_needed();
+
     /*
      * Untag it
      */
-    if (q_phonebook.selected_entry->tagged == Q_TRUE) {
+    if ((q_phonebook.selected_entry != NULL) &&
+        (q_phonebook.selected_entry->tagged == Q_TRUE)) {
         q_phonebook.selected_entry->tagged = Q_FALSE;
         q_phonebook.tagged--;
     }
@@ -4086,7 +4217,7 @@ void phonebook_refresh() {
              * Recompute the time remaining
              */
             time(&now);
-            q_dialer_cycle_time = atoi(get_option(Q_OPTION_DIAL_BETWEEN_TIME)) -
+            q_dialer_cycle_time = get_option_int(Q_OPTION_DIAL_BETWEEN_TIME) -
                 (now - q_dialer_cycle_start_time);
 
             if (q_dialer_cycle_time > 0) {
@@ -4099,9 +4230,12 @@ void phonebook_refresh() {
             cycle_redialer_number();
 
             /*
-             * Re-do the dial
+             * Re-do the dial.  With nothing tagged this is the same entry
+             * again, which might not be in the phonebook (--connect).
              */
-            q_current_dial_entry = q_phonebook.selected_entry;
+            if (q_phonebook.tagged > 0) {
+                q_current_dial_entry = q_phonebook.selected_entry;
+            }
             do_dialer();
             return;
 
@@ -4110,7 +4244,7 @@ void phonebook_refresh() {
              * Recompute the time remaining
              */
             time(&now);
-            q_dialer_cycle_time = atoi(get_option(Q_OPTION_DIAL_CONNECT_TIME)) -
+            q_dialer_cycle_time = get_option_int(Q_OPTION_DIAL_CONNECT_TIME) -
                 (now - q_dialer_cycle_start_time);
 
             /*
@@ -6931,6 +7065,7 @@ static void edit_phone_entry_form(struct q_phone_struct * entry) {
                 Xfree(entry->address, __FILE__, __LINE__);
             }
             entry->address = field_get_char_value(fields[1]);
+            index_phone_entry(entry);
 
             if (entry->port != NULL) {
                 Xfree(entry->port, __FILE__, __LINE__);
@@ -7188,6 +7323,7 @@ void phonebook_keyboard_handler(const int keystroke, const int flags) {
         entry->use_default_toggles = Q_TRUE;
         entry->toggles          = 0;
         entry->notes            = NULL;
+        entry->search_text      = NULL;
         entry->last_call        = 0;
         entry->times_on         = 0;
         entry->tagged           = Q_FALSE;
@@ -7286,6 +7422,7 @@ void phonebook_keyboard_handler(const int keystroke, const int flags) {
                 }
                 Xfree(entry->notes, __FILE__, __LINE__);
                 entry->notes = NULL;
+                index_phone_entry(entry);
             }
             break;
         }
@@ -7330,6 +7467,7 @@ void phonebook_keyboard_handler(const int keystroke, const int flags) {
         if (search_string == NULL) {
             break;
         }
+        lowercase_search_string(search_string);
         /*
          * Search for the first matching entry
          */
@@ -7390,6 +7528,7 @@ void phonebook_keyboard_handler(const int keystroke, const int flags) {
             if (search_string == NULL) {
                 break;
             }
+            lowercase_search_string(search_string);
         }
 
         new_phonebook_entry_i = phonebook_entry_i;
@@ -7471,6 +7610,7 @@ void phonebook_keyboard_handler(const int keystroke, const int flags) {
             entry->emulation = Q_EMUL_ANSI;
             entry->codepage = default_codepage(entry->emulation);
             entry->notes = NULL;
+            entry->search_text = NULL;
             entry->script_filename = "";
             entry->capture_filename = "";
             entry->translate_8bit_filename = "";
@@ -7767,6 +7907,7 @@ void phonebook_keyboard_handler(const int keystroke, const int flags) {
                         }
                         Xfree(entry->notes, __FILE__, __LINE__);
                         entry->notes = NULL;
+                        index_phone_entry(entry);
                     }
                 }
 
@@ -8052,7 +8193,7 @@ void dialer_keyboard_handler(const int keystroke, const int flags) {
             q_dial_state = Q_DIAL_MANUAL_CYCLE;
         } else {
             q_dialer_cycle_start_time -=
-                atoi(get_option(Q_OPTION_DIAL_BETWEEN_TIME));;
+                get_option_int(Q_OPTION_DIAL_BETWEEN_TIME);;
         }
         close_dial_entry();
         break;
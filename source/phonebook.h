@@ -97,6 +97,17 @@ struct q_phone_struct {
 
     Q_BOOL quicklearn;
 
+    /**
+     * Lowercase copy of name, address, and notes separated by newlines,
+     * used by Find.  Rebuilt whenever those fields change.
+     */
+    wchar_t * search_text;
+
+    /**
+     * Offset in search_text where the notes begin.
+     */
+    size_t search_notes_offset;
+
     struct q_phone_struct * next;
     struct q_phone_struct * prev;
 };
@@ -160,6 +171,11 @@ extern void phonebook_reset();
  */
 extern void load_phonebook(const Q_BOOL backup_version);
 
+/**
+ * Load the phonebook from file if it has not been loaded yet.
+ */
+extern void load_phonebook_if_needed();
+
 /**
  * Create the initial default phonebook.
  */
@@ -88,6 +88,7 @@
 #include "common.h"
 #include <stdlib.h>
 #include <errno.h>
+#include <fcntl.h>
 #ifndef Q_PDCURSES_WIN32
 #  include <sys/resource.h>
 #  include <sys/wait.h>
@@ -125,7 +126,7 @@ struct q_transfer_stats_struct q_transfer_stats = {
     NULL,
     NULL,
     NULL,
-    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0
 };
 
 /**
@@ -139,6 +140,139 @@ static struct file_info * batch_upload_file_list = NULL;
 /* Current file # for batch upload */
 static int batch_upload_file_list_i;
 
+/* Number of batch upload files to open and read ahead */
+#define UPLOAD_PREFETCH_N 8
+
+/* The batch upload list that upload_prefetch_fd refers to */
+static struct file_info * upload_prefetch_list = NULL;
+
+/* Index in upload_prefetch_list of each prefetched file, or -1 */
+static int upload_prefetch_index[UPLOAD_PREFETCH_N];
+
+/* Open descriptor for each prefetched file */
+static int upload_prefetch_fd[UPLOAD_PREFETCH_N];
+
+/**
+ * Close any files opened ahead by open_upload_file().
+ */
+static void close_upload_prefetch() {
+    int i;
+
+    if (upload_prefetch_list == NULL) {
+        return;
+    }
+    for (i = 0; i < UPLOAD_PREFETCH_N; i++) {
+        if (upload_prefetch_index[i] != -1) {
+            close(upload_prefetch_fd[i]);
+            upload_prefetch_index[i] = -1;
+        }
+    }
+    upload_prefetch_list = NULL;
+}
+
+/**
+ * Open a file in a batch upload list for reading.  This also opens the next
+ * few files in the list and asks the kernel to start reading them into the
+ * page cache, so that the protocol does not wait on the disk between
+ * files.
+ *
+ * @param file_list the batch upload list, terminated by an entry with a
+ * NULL name
+ * @param i the index in file_list of the file to open
+ * @return the opened file, or NULL if it could not be opened
+ */
+FILE * open_upload_file(struct file_info * file_list, const int i) {
+#ifdef Q_PDCURSES_WIN32
+    return fopen(file_list[i].name, "rb");
+#else
+    FILE * file;
+    int fd = -1;
+    int next;
+    int j;
+
+    if (upload_prefetch_list != file_list) {
+        close_upload_prefetch();
+        upload_prefetch_list = file_list;
+        for (j = 0; j < UPLOAD_PREFETCH_N; j++) {
+            upload_prefetch_index[j] = -1;
+        }
+    }
+
+    /*
+     * Use the prefetched descriptor if we have one
+     */
+    for (j = 0; j < UPLOAD_PREFETCH_N; j++) {
+        if (upload_prefetch_index[j] == i) {
+            fd = upload_prefetch_fd[j];
+            upload_prefetch_index[j] = -1;
+        } else if ((upload_prefetch_index[j] != -1) &&
+            (upload_prefetch_index[j] < i)
+        ) {
+            /*
+             * Skipped over
+             */
+            close(upload_prefetch_fd[j]);
+            upload_prefetch_index[j] = -1;
+        }
+    }
+    if (fd == -1) {
+        fd = open(file_list[i].name, O_RDONLY);
+        if (fd == -1) {
+            return NULL;
+        }
+    }
+#ifdef POSIX_FADV_SEQUENTIAL
+    posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+#endif
+    file = fdopen(fd, "rb");
+    if (file == NULL) {
+        close(fd);
+        return NULL;
+    }
+
+    /*
+     * Open the next files and start readahead on them
+     */
+    for (next = i + 1; (next <= i + UPLOAD_PREFETCH_N) &&
+             (file_list[next].name != NULL); next++) {
+
+        for (j = 0; j < UPLOAD_PREFETCH_N; j++) {
+            if (upload_prefetch_index[j] == next) {
+                break;
+            }
+        }
+        if (j < UPLOAD_PREFETCH_N) {
+            /*
+             * Already prefetched
+             */
+            continue;
+        }
+        for (j = 0; j < UPLOAD_PREFETCH_N; j++) {
+            if (upload_prefetch_index[j] == -1) {
+                break;
+            }
+        }
+        if (j == UPLOAD_PREFETCH_N) {
+            break;
+        }
+
+        upload_prefetch_fd[j] = open(file_list[next].name, O_RDONLY);
+        if (upload_prefetch_fd[j] == -1) {
+            /*
+             * Let the protocol report the error when it gets there.
+             */
+            continue;
+        }
+        upload_prefetch_index[j] = next;
+#ifdef POSIX_FADV_WILLNEED
+        posix_fadvise(upload_prefetch_fd[j], 0, 0, POSIX_FADV_WILLNEED);
+#endif
+    }
+
+    return file;
+#endif /* Q_PDCURSES_WIN32 */
+}
+
 /**
  * Save a list of files to the batch upload window data file.  This is used
  * by host mode to perform an upload ("download" to the remote side).
@@ -161,7 +295,10 @@ void set_batch_upload(struct file_info * upload) {
  */
 
 typedef enum {
-    ASCII_XFER_STATE_OK,
+    ASCII_XFER_STATE_OK,                /* Sending or receiving */
+    ASCII_XFER_STATE_WAIT_ECHO,         /* Waiting for the line to echo */
+    ASCII_XFER_STATE_WAIT_PROMPT,       /* Waiting for the prompt */
+    ASCII_XFER_STATE_LINE_DELAY,        /* Pausing after a line */
     ASCII_XFER_STATE_ABORT
 } ASCII_XFER_STATE;
 
@@ -171,6 +308,12 @@ typedef enum {
     ASCII_XFER_CRLF_ADD
 } ASCII_XFER_CRLF_POLICY;
 
+/**
+ * How long to wait for an echo or prompt before sending the next line
+ * anyway, in seconds.
+ */
+#define ASCII_XFER_WAIT_TIMEOUT 10
+
 static ASCII_XFER_STATE ascii_xfer_state;
 static FILE * ascii_xfer_file = NULL;
 static char * ascii_xfer_filename = NULL;
@@ -186,8 +329,90 @@ static ASCII_XFER_CRLF_POLICY ascii_xfer_download_cr_handling =
 static ASCII_XFER_CRLF_POLICY ascii_xfer_download_lf_handling =
     ASCII_XFER_CRLF_NONE;
 
+/*
+ * File data read ahead for an upload, or CRLF-translated data for a
+ * download.  This is reused for the whole transfer.
+ */
+static unsigned char ascii_xfer_buffer[Q_BUFFER_SIZE];
+static unsigned int ascii_xfer_buffer_n = 0;
+static unsigned int ascii_xfer_buffer_i = 0;
+static Q_BOOL ascii_xfer_eof = Q_FALSE;
+
+/* Upload pacing, from the ascii_upload_* options */
+static int ascii_xfer_char_rate = 0;
+static int ascii_xfer_line_delay = 0;
+static Q_BOOL ascii_xfer_line_pacing = Q_FALSE;
+static Q_BOOL ascii_xfer_wait_echo = Q_FALSE;
+static char * ascii_xfer_wait_prompt = NULL;
+static unsigned int ascii_xfer_wait_prompt_i = 0;
+
+/*
+ * For the wait prompt, the longest prefix of the prompt that is also a
+ * suffix of each leading substring.
+ */
+static unsigned int * ascii_xfer_wait_prompt_prefix = NULL;
+
+/* When the current line wait began */
+static struct timeval ascii_xfer_wait_time;
+
+/* Bytes the character rate allows right now, and when it was last topped up */
+static double ascii_xfer_rate_credit;
+static struct timeval ascii_xfer_rate_time;
+
+/**
+ * Get the number of milliseconds between two times.
+ *
+ * @param begin the earlier time
+ * @param end the later time
+ * @return the milliseconds from begin to end
+ */
+static double ascii_transfer_millis(const struct timeval * begin,
+                                    const struct timeval * end) {
+
+    return (double) (end->tv_sec - begin->tv_sec) * 1000.0 +
+        (double) (end->tv_usec - begin->tv_usec) / 1000.0;
+}
+
 /**
- * Perform CRLF handling on an ASCII transfer buffer.
+ * Find the length of the leading run of bytes that CRLF handling will copy
+ * unchanged.
+ *
+ * @param input the bytes to scan
+ * @param input_n the number of bytes in input
+ * @param cr_policy selection for CR (strip, add, or leave as-is)
+ * @param lf_policy selection for LF (strip, add, or leave as-is)
+ * @return the number of bytes before the first CR or LF that needs handling
+ */
+static unsigned int ascii_transfer_crlf_span(const unsigned char * input,
+                                             const unsigned int input_n,
+                                             const ASCII_XFER_CRLF_POLICY
+                                             cr_policy,
+                                             const ASCII_XFER_CRLF_POLICY
+                                             lf_policy) {
+
+    const unsigned char * end;
+    unsigned int i;
+
+    if (cr_policy == ASCII_XFER_CRLF_NONE) {
+        end = memchr(input, C_LF, input_n);
+        return (end == NULL ? input_n : end - input);
+    }
+    if (lf_policy == ASCII_XFER_CRLF_NONE) {
+        end = memchr(input, C_CR, input_n);
+        return (end == NULL ? input_n : end - input);
+    }
+    for (i = 0; i < input_n; i++) {
+        if ((input[i] == C_CR) || (input[i] == C_LF)) {
+            break;
+        }
+    }
+    return i;
+}
+
+/**
+ * Perform CRLF handling on an ASCII transfer buffer.  Runs of bytes that
+ * need no handling are copied with memcpy().  output must have room for
+ * twice input_n bytes.
  *
  * @param input the bytes from the remote side
  * @param input_n the number of bytes in input_n
@@ -205,6 +430,7 @@ static void ascii_transfer_crlf_handling(const unsigned char * input,
                                          lf_policy) {
 
     unsigned int i, j;
+    unsigned int run;
 
     /*
      * Check if we need to do anything
@@ -227,6 +453,18 @@ static void ascii_transfer_crlf_handling(const unsigned char * input,
 
     while (i < input_n) {
 
+        /*
+         * Copy everything up to the next CR or LF in one go
+         */
+        run = ascii_transfer_crlf_span(input + i, input_n - i, cr_policy,
+                                       lf_policy);
+        memcpy(output + j, input + i, run);
+        i += run;
+        j += run;
+        if (i == input_n) {
+            break;
+        }
+
         if (input[i] == C_CR) {
 
             /*
@@ -280,106 +518,341 @@ static void ascii_transfer_crlf_handling(const unsigned char * input,
 }
 
 /**
- * Process raw bytes from the remote side through the transfer protocol.  See
- * also protocol_process_data().
+ * Read more of the upload file into ascii_xfer_buffer, keeping any bytes
+ * not yet sent.
+ *
+ * @return false if the read failed, in which case the transfer has been
+ * aborted
+ */
+static Q_BOOL ascii_transfer_fill_buffer() {
+    char notify_message[DIALOG_MESSAGE_SIZE];
+    size_t rc;
+
+    if (ascii_xfer_eof == Q_TRUE) {
+        return Q_TRUE;
+    }
+
+    if (ascii_xfer_buffer_i > 0) {
+        memmove(ascii_xfer_buffer, ascii_xfer_buffer + ascii_xfer_buffer_i,
+                ascii_xfer_buffer_n - ascii_xfer_buffer_i);
+        ascii_xfer_buffer_n -= ascii_xfer_buffer_i;
+        ascii_xfer_buffer_i = 0;
+    }
+
+    rc = fread(ascii_xfer_buffer + ascii_xfer_buffer_n, 1,
+               sizeof(ascii_xfer_buffer) - ascii_xfer_buffer_n,
+               ascii_xfer_file);
+    ascii_xfer_buffer_n += rc;
+
+    if (ferror(ascii_xfer_file)) {
+        /*
+         * Error
+         */
+        snprintf(notify_message, sizeof(notify_message),
+                 _("Error reading from file \"%s\": %s"),
+                 ascii_xfer_filename, strerror(errno));
+        notify_form(notify_message, 0);
+
+        stop_file_transfer(Q_TRANSFER_STATE_ABORT);
+        ascii_xfer_state = ASCII_XFER_STATE_ABORT;
+        return Q_FALSE;
+    }
+    if (feof(ascii_xfer_file)) {
+        ascii_xfer_eof = Q_TRUE;
+    }
+    return Q_TRUE;
+}
+
+/**
+ * Build the prefix table for ascii_xfer_wait_prompt, so that the prompt
+ * is found even when a partial match overlaps it (e.g. "aab" in "aaab").
+ */
+static void ascii_transfer_build_prompt_prefix() {
+    unsigned int prompt_n = strlen(ascii_xfer_wait_prompt);
+    unsigned int i;
+    unsigned int j;
+
+    ascii_xfer_wait_prompt_prefix =
+        (unsigned int *) Xmalloc(sizeof(unsigned int) * prompt_n, __FILE__,
+                                 __LINE__);
+    ascii_xfer_wait_prompt_prefix[0] = 0;
+    j = 0;
+    for (i = 1; i < prompt_n; i++) {
+        while ((j > 0) &&
+               (ascii_xfer_wait_prompt[i] != ascii_xfer_wait_prompt[j])) {
+            j = ascii_xfer_wait_prompt_prefix[j - 1];
+        }
+        if (ascii_xfer_wait_prompt[i] == ascii_xfer_wait_prompt[j]) {
+            j++;
+        }
+        ascii_xfer_wait_prompt_prefix[i] = j;
+    }
+}
+
+/**
+ * Begin waiting after a line has been sent, according to the pacing
+ * options.
+ *
+ * @param echoed if true, the echo or prompt wait has already been satisfied
+ */
+static void ascii_transfer_wait_line(const Q_BOOL echoed) {
+    if ((echoed == Q_FALSE) && (ascii_xfer_wait_prompt != NULL)) {
+        ascii_xfer_state = ASCII_XFER_STATE_WAIT_PROMPT;
+        ascii_xfer_wait_prompt_i = 0;
+    } else if ((echoed == Q_FALSE) && (ascii_xfer_wait_echo == Q_TRUE)) {
+        ascii_xfer_state = ASCII_XFER_STATE_WAIT_ECHO;
+    } else if (ascii_xfer_line_delay > 0) {
+        ascii_xfer_state = ASCII_XFER_STATE_LINE_DELAY;
+    } else {
+        ascii_xfer_state = ASCII_XFER_STATE_OK;
+    }
+    gettimeofday(&ascii_xfer_wait_time, NULL);
+}
+
+/**
+ * See if the remote side has answered the line just sent.
  *
  * @param input the bytes from the remote side
  * @param input_n the number of bytes in input_n
- * @param remaining the number of un-processed bytes that should be sent
- * through a future invocation of protocol_process_data()
+ */
+static void ascii_transfer_check_wait(const unsigned char * input,
+                                      const unsigned int input_n) {
+
+    struct timeval now;
+    unsigned int i;
+
+    gettimeofday(&now, NULL);
+
+    switch (ascii_xfer_state) {
+
+    case ASCII_XFER_STATE_WAIT_ECHO:
+        /*
+         * The line is echoed once its line terminator comes back.
+         */
+        if ((memchr(input, C_CR, input_n) != NULL) ||
+            (memchr(input, C_LF, input_n) != NULL)) {
+            ascii_transfer_wait_line(Q_TRUE);
+            return;
+        }
+        break;
+
+    case ASCII_XFER_STATE_WAIT_PROMPT:
+        for (i = 0; i < input_n; i++) {
+            while ((ascii_xfer_wait_prompt_i > 0) &&
+                   ((unsigned char) ascii_xfer_wait_prompt[
+                       ascii_xfer_wait_prompt_i] != input[i])) {
+                ascii_xfer_wait_prompt_i =
+                    ascii_xfer_wait_prompt_prefix[ascii_xfer_wait_prompt_i - 1];
+            }
+            if ((unsigned char) ascii_xfer_wait_prompt[
+                    ascii_xfer_wait_prompt_i] == input[i]) {
+                ascii_xfer_wait_prompt_i++;
+            }
+            if (ascii_xfer_wait_prompt[ascii_xfer_wait_prompt_i] == 0) {
+                ascii_transfer_wait_line(Q_TRUE);
+                return;
+            }
+        }
+        break;
+
+    case ASCII_XFER_STATE_LINE_DELAY:
+        if (ascii_transfer_millis(&ascii_xfer_wait_time, &now) >=
+            ascii_xfer_line_delay) {
+            ascii_xfer_state = ASCII_XFER_STATE_OK;
+        }
+        return;
+
+    default:
+        return;
+    }
+
+    /*
+     * Don't hang forever on a host that never answers.
+     */
+    if (ascii_transfer_millis(&ascii_xfer_wait_time, &now) >=
+        ASCII_XFER_WAIT_TIMEOUT * 1000) {
+        ascii_transfer_wait_line(Q_TRUE);
+    }
+}
+
+/**
+ * Send the next run of the upload file: as much as fits in output when
+ * streaming, or through the end of the current line when line pacing is
+ * enabled.
+ *
  * @param output a buffer to contain the bytes to send to the remote side
- * @param output_n the number of bytes that this function wrote to output
+ * @param output_n the number of bytes already in output.  This is updated
+ * with the bytes appended.
  * @param output_max the maximum number of bytes this function may write to
  * output
  */
-static void ascii_transfer(unsigned char * input, const unsigned int input_n,
-                           int * remaining, unsigned char * output,
-                           unsigned int * output_n,
-                           const unsigned int output_max) {
+static void ascii_transfer_send(unsigned char * output,
+                                unsigned int * output_n,
+                                const unsigned int output_max) {
 
-    unsigned char working_buffer[2 * Q_BUFFER_SIZE];
-    unsigned int working_buffer_n;
-    char notify_message[DIALOG_MESSAGE_SIZE];
-    int rc;
+    struct timeval now;
+    unsigned int n;
+    unsigned int limit;
+    unsigned int written;
     unsigned int i;
+    unsigned char * line_end;
+    unsigned char * cr;
 
     /*
-     * Check my input arguments
+     * CRLF handling can double the data, so only use half the free space.
      */
-    assert(input_n >= 0);
-    assert(input != NULL);
-    assert(output != NULL);
-    assert(output_max >= 1);
-
-    if (ascii_xfer_state == ASCII_XFER_STATE_ABORT) {
+    if (output_max - *output_n < Q_BUFFER_SIZE) {
         return;
     }
+    limit = (output_max - *output_n) / 2 - 1;
 
-    /*
-     * Clear working buffer
-     */
-    memset(working_buffer, 0, sizeof(working_buffer));
-    working_buffer_n = 0;
-
-    if (ascii_xfer_sending == Q_TRUE) {
+    if (ascii_xfer_char_rate > 0) {
         /*
-         * If the outgoing transfer buffer is full, abort
+         * Top up the rate credit, but never let it build past a tenth of a
+         * second so that pauses do not turn into bursts.
          */
-        if (output_max - *output_n < Q_BUFFER_SIZE) {
+        gettimeofday(&now, NULL);
+        ascii_xfer_rate_credit += ascii_transfer_millis(&ascii_xfer_rate_time,
+            &now) * ascii_xfer_char_rate / 1000.0;
+        ascii_xfer_rate_time = now;
+        if (ascii_xfer_rate_credit > ascii_xfer_char_rate / 10.0 + 1.0) {
+            ascii_xfer_rate_credit = ascii_xfer_char_rate / 10.0 + 1.0;
+        }
+        if (ascii_xfer_rate_credit < limit) {
+            limit = (unsigned int) ascii_xfer_rate_credit;
+        }
+        if (limit == 0) {
+            return;
+        }
+    }
+
+    if (ascii_xfer_buffer_i == ascii_xfer_buffer_n) {
+        if (ascii_transfer_fill_buffer() == Q_FALSE) {
             return;
         }
+    }
 
+    if (ascii_xfer_buffer_i == ascii_xfer_buffer_n) {
         /*
-         * Send the next few bytes
+         * End of file
          */
-        rc = fread(working_buffer, 1, (output_max / 2) - 1, ascii_xfer_file);
-        working_buffer_n = rc;
+        stop_file_transfer(Q_TRANSFER_STATE_END);
+        time(&q_transfer_stats.end_time);
+        q_screen_dirty = Q_TRUE;
 
         /*
-         * Perform CRLF handling.
+         * Don't do everything again
          */
-        ascii_transfer_crlf_handling(working_buffer, working_buffer_n, output,
-                                     output_n, ascii_xfer_upload_cr_handling,
-                                     ascii_xfer_upload_lf_handling);
+        ascii_xfer_state = ASCII_XFER_STATE_ABORT;
+        return;
+    }
 
-        q_transfer_stats.bytes_transfer += *output_n;
+    n = ascii_xfer_buffer_n - ascii_xfer_buffer_i;
+    if (n > limit) {
+        n = limit;
+    }
+    line_end = NULL;
 
+    if (ascii_xfer_line_pacing == Q_TRUE) {
         /*
-         * Perform translation table processing
+         * Stop at the end of the line.  CRLF is one line end, so make sure
+         * the byte after a CR is in the buffer before deciding.
          */
-        if (ascii_xfer_upload_use_xlate_table == Q_TRUE) {
-            for (i = 0; i < (*output_n); i++) {
-                output[i] = translate_8bit_out(output[i]);
+        line_end = memchr(ascii_xfer_buffer + ascii_xfer_buffer_i, C_LF, n);
+        cr = memchr(ascii_xfer_buffer + ascii_xfer_buffer_i, C_CR,
+                    line_end == NULL ? n :
+                    line_end - (ascii_xfer_buffer + ascii_xfer_buffer_i));
+        if (cr != NULL) {
+            if ((cr + 1 == ascii_xfer_buffer + ascii_xfer_buffer_n) &&
+                (ascii_xfer_eof == Q_FALSE)) {
+                i = cr - ascii_xfer_buffer - ascii_xfer_buffer_i;
+                if (ascii_transfer_fill_buffer() == Q_FALSE) {
+                    return;
+                }
+                cr = ascii_xfer_buffer + ascii_xfer_buffer_i + i;
             }
+            line_end = cr;
+            if ((cr + 1 < ascii_xfer_buffer + ascii_xfer_buffer_n) &&
+                (cr[1] == C_LF)) {
+                line_end = cr + 1;
+            }
+        }
+        if (line_end != NULL) {
+            n = line_end - (ascii_xfer_buffer + ascii_xfer_buffer_i) + 1;
         }
+    }
 
-        if (ferror(ascii_xfer_file)) {
-            /*
-             * Error
-             */
-            char notify_message[DIALOG_MESSAGE_SIZE];
-            snprintf(notify_message, sizeof(notify_message),
-                     _("Error reading from file \"%s\": %s"),
-                     ascii_xfer_filename, strerror(errno));
-            notify_form(notify_message, 0);
+    /*
+     * Perform CRLF handling.
+     */
+    ascii_transfer_crlf_handling(ascii_xfer_buffer + ascii_xfer_buffer_i, n,
+                                 output + *output_n, &written,
+                                 ascii_xfer_upload_cr_handling,
+                                 ascii_xfer_upload_lf_handling);
 
-            stop_file_transfer(Q_TRANSFER_STATE_ABORT);
-            ascii_xfer_state = ASCII_XFER_STATE_ABORT;
-            return;
+    /*
+     * Perform translation table processing
+     */
+    if (ascii_xfer_upload_use_xlate_table == Q_TRUE) {
+        for (i = *output_n; i < *output_n + written; i++) {
+            output[i] = translate_8bit_out(output[i]);
         }
+    }
 
-        if (feof(ascii_xfer_file)) {
-            /*
-             * End of file
-             */
-            stop_file_transfer(Q_TRANSFER_STATE_END);
-            time(&q_transfer_stats.end_time);
-            q_screen_dirty = Q_TRUE;
+    *output_n += written;
+    ascii_xfer_buffer_i += n;
+    q_transfer_stats.bytes_transfer += n;
+    if (ascii_xfer_char_rate > 0) {
+        ascii_xfer_rate_credit -= n;
+    }
 
-            /*
-             * Don't do everything again
-             */
-            ascii_xfer_state = ASCII_XFER_STATE_ABORT;
+    if (line_end != NULL) {
+        ascii_transfer_wait_line(Q_FALSE);
+    }
+}
+
+/**
+ * Process raw bytes from the remote side through the transfer protocol.  See
+ * also protocol_process_data().
+ *
+ * @param input the bytes from the remote side
+ * @param input_n the number of bytes in input_n
+ * @param remaining the number of un-processed bytes that should be sent
+ * through a future invocation of protocol_process_data()
+ * @param output a buffer to contain the bytes to send to the remote side
+ * @param output_n the number of bytes that this function wrote to output
+ * @param output_max the maximum number of bytes this function may write to
+ * output
+ */
+static void ascii_transfer(unsigned char * input, const unsigned int input_n,
+                           int * remaining, unsigned char * output,
+                           unsigned int * output_n,
+                           const unsigned int output_max) {
+
+    char notify_message[DIALOG_MESSAGE_SIZE];
+    unsigned int chunk_n;
+    unsigned int rc;
+    unsigned int i, j;
+
+    /*
+     * Check my input arguments
+     */
+    assert(input_n >= 0);
+    assert(input != NULL);
+    assert(output != NULL);
+    assert(output_max >= 1);
+
+    if (ascii_xfer_state == ASCII_XFER_STATE_ABORT) {
+        return;
+    }
+
+    if (ascii_xfer_sending == Q_TRUE) {
+        /*
+         * Look for the echo or prompt, then send more if allowed.
+         */
+        ascii_transfer_check_wait(input, input_n);
+        if (ascii_xfer_state == ASCII_XFER_STATE_OK) {
+            ascii_transfer_send(output, output_n, output_max);
         }
 
     } else {
@@ -393,36 +866,26 @@ static void ascii_transfer(unsigned char * input, const unsigned int input_n,
             }
         }
 
-        /*
-         * Perform CRLF handling.
-         */
-        ascii_transfer_crlf_handling(input, input_n, working_buffer,
-                                     &working_buffer_n,
-                                     ascii_xfer_download_cr_handling,
-                                     ascii_xfer_download_lf_handling);
-
-        /*
-         * Save the input bytes to file
-         */
-        rc = fwrite(working_buffer, 1, working_buffer_n, ascii_xfer_file);
-        if (ferror(ascii_xfer_file)) {
-            snprintf(notify_message, sizeof(notify_message),
-                     _("Error writing to file \"%s\": %s"), ascii_xfer_filename,
-                     strerror(errno));
-            notify_form(notify_message, 0);
-
-            stop_file_transfer(Q_TRANSFER_STATE_ABORT);
-            ascii_xfer_state = ASCII_XFER_STATE_ABORT;
-            return;
-        } else {
+        for (i = 0; i < input_n; i += chunk_n) {
             /*
-             * Flush it
+             * Perform CRLF handling, half a buffer at a time since it can
+             * double the data.
              */
-            fflush(ascii_xfer_file);
+            chunk_n = input_n - i;
+            if (chunk_n > sizeof(ascii_xfer_buffer) / 2) {
+                chunk_n = sizeof(ascii_xfer_buffer) / 2;
+            }
+            ascii_transfer_crlf_handling(input + i, chunk_n, ascii_xfer_buffer,
+                                         &j, ascii_xfer_download_cr_handling,
+                                         ascii_xfer_download_lf_handling);
 
-            if (rc < working_buffer_n) {
+            /*
+             * Save the input bytes to file
+             */
+            rc = fwrite(ascii_xfer_buffer, 1, j, ascii_xfer_file);
+            if (ferror(ascii_xfer_file) || (rc < j)) {
                 /*
-                 * Short file, filesystem is probably full
+                 * A short write means the filesystem is probably full
                  */
                 snprintf(notify_message, sizeof(notify_message),
                          _("Error writing to file \"%s\": %s"),
@@ -434,6 +897,13 @@ static void ascii_transfer(unsigned char * input, const unsigned int input_n,
                 return;
             }
         }
+
+        /*
+         * Flush it
+         */
+        if (input_n > 0) {
+            fflush(ascii_xfer_file);
+        }
     }
 
     /*
@@ -448,6 +918,24 @@ static void ascii_transfer(unsigned char * input, const unsigned int input_n,
     console_refresh(Q_FALSE);
 }
 
+/**
+ * Convert an ascii_*_cr_policy or ascii_*_lf_policy option value.
+ *
+ * @param option the option to look up
+ * @return the policy
+ */
+static ASCII_XFER_CRLF_POLICY ascii_transfer_crlf_policy(const Q_OPTION
+                                                         option) {
+
+    if (strcasecmp(get_option(option), "strip") == 0) {
+        return ASCII_XFER_CRLF_STRIP;
+    }
+    if (strcasecmp(get_option(option), "add") == 0) {
+        return ASCII_XFER_CRLF_ADD;
+    }
+    return ASCII_XFER_CRLF_NONE;
+}
+
 /**
  * Setup for a new ASCII file transfer.
  *
@@ -468,41 +956,47 @@ static Q_BOOL ascii_transfer_start(const char * in_filename,
     /*
      * Pull the options
      */
-    if (strcasecmp
-        (get_option(Q_OPTION_ASCII_UPLOAD_USE_TRANSLATE_TABLE), "true") == 0) {
-        ascii_xfer_upload_use_xlate_table = Q_TRUE;
-    }
-    if (strcasecmp(get_option(Q_OPTION_ASCII_UPLOAD_CR_POLICY), "strip") == 0) {
-        ascii_xfer_upload_cr_handling = ASCII_XFER_CRLF_STRIP;
-    }
-    if (strcasecmp(get_option(Q_OPTION_ASCII_UPLOAD_CR_POLICY), "add") == 0) {
-        ascii_xfer_upload_cr_handling = ASCII_XFER_CRLF_ADD;
-    }
-    if (strcasecmp(get_option(Q_OPTION_ASCII_UPLOAD_LF_POLICY), "strip") == 0) {
-        ascii_xfer_upload_lf_handling = ASCII_XFER_CRLF_STRIP;
-    }
-    if (strcasecmp(get_option(Q_OPTION_ASCII_UPLOAD_LF_POLICY), "add") == 0) {
-        ascii_xfer_upload_lf_handling = ASCII_XFER_CRLF_ADD;
-    }
-    if (strcasecmp
-        (get_option(Q_OPTION_ASCII_DOWNLOAD_USE_TRANSLATE_TABLE),
-         "true") == 0) {
-        ascii_xfer_download_use_xlate_table = Q_TRUE;
-    }
-    if (strcasecmp
-        (get_option(Q_OPTION_ASCII_DOWNLOAD_CR_POLICY), "strip") == 0) {
-        ascii_xfer_download_cr_handling = ASCII_XFER_CRLF_STRIP;
-    }
-    if (strcasecmp(get_option(Q_OPTION_ASCII_DOWNLOAD_CR_POLICY), "add") == 0) {
-        ascii_xfer_download_cr_handling = ASCII_XFER_CRLF_ADD;
-    }
-    if (strcasecmp
-        (get_option(Q_OPTION_ASCII_DOWNLOAD_LF_POLICY), "strip") == 0) {
-        ascii_xfer_download_lf_handling = ASCII_XFER_CRLF_STRIP;
-    }
-    if (strcasecmp(get_option(Q_OPTION_ASCII_DOWNLOAD_LF_POLICY), "add") == 0) {
-        ascii_xfer_download_lf_handling = ASCII_XFER_CRLF_ADD;
-    }
+    ascii_xfer_upload_use_xlate_table =
+        get_option_bool(Q_OPTION_ASCII_UPLOAD_USE_TRANSLATE_TABLE);
+    ascii_xfer_upload_cr_handling =
+        ascii_transfer_crlf_policy(Q_OPTION_ASCII_UPLOAD_CR_POLICY);
+    ascii_xfer_upload_lf_handling =
+        ascii_transfer_crlf_policy(Q_OPTION_ASCII_UPLOAD_LF_POLICY);
+    ascii_xfer_download_use_xlate_table =
+        get_option_bool(Q_OPTION_ASCII_DOWNLOAD_USE_TRANSLATE_TABLE);
+    ascii_xfer_download_cr_handling =
+        ascii_transfer_crlf_policy(Q_OPTION_ASCII_DOWNLOAD_CR_POLICY);
+    ascii_xfer_download_lf_handling =
+        ascii_transfer_crlf_policy(Q_OPTION_ASCII_DOWNLOAD_LF_POLICY);
+
+    ascii_xfer_char_rate = get_option_int(Q_OPTION_ASCII_UPLOAD_CHAR_RATE);
+    ascii_xfer_line_delay = get_option_int(Q_OPTION_ASCII_UPLOAD_LINE_DELAY);
+    ascii_xfer_wait_echo = get_option_bool(Q_OPTION_ASCII_UPLOAD_WAIT_ECHO);
+    if (ascii_xfer_wait_prompt != NULL) {
+        Xfree(ascii_xfer_wait_prompt, __FILE__, __LINE__);
+        ascii_xfer_wait_prompt = NULL;
+    }
+    if (ascii_xfer_wait_prompt_prefix != NULL) {
+        Xfree(ascii_xfer_wait_prompt_prefix, __FILE__, __LINE__);
+        ascii_xfer_wait_prompt_prefix = NULL;
+    }
+    if (strlen(get_option(Q_OPTION_ASCII_UPLOAD_WAIT_PROMPT)) > 0) {
+        ascii_xfer_wait_prompt =
+            Xstrdup(get_option(Q_OPTION_ASCII_UPLOAD_WAIT_PROMPT), __FILE__,
+                    __LINE__);
+        ascii_transfer_build_prompt_prefix();
+    }
+    ascii_xfer_line_pacing = Q_FALSE;
+    if ((ascii_xfer_line_delay > 0) || (ascii_xfer_wait_echo == Q_TRUE) ||
+        (ascii_xfer_wait_prompt != NULL)) {
+        ascii_xfer_line_pacing = Q_TRUE;
+    }
+    ascii_xfer_rate_credit = 0;
+    gettimeofday(&ascii_xfer_rate_time, NULL);
+
+    ascii_xfer_buffer_n = 0;
+    ascii_xfer_buffer_i = 0;
+    ascii_xfer_eof = Q_FALSE;
 
     if (send == Q_TRUE) {
         /*
@@ -565,6 +1059,14 @@ static void ascii_transfer_stop(const Q_BOOL save_partial) {
         Xfree(ascii_xfer_filename, __FILE__, __LINE__);
     }
     ascii_xfer_filename = NULL;
+    if (ascii_xfer_wait_prompt != NULL) {
+        Xfree(ascii_xfer_wait_prompt, __FILE__, __LINE__);
+    }
+    ascii_xfer_wait_prompt = NULL;
+    if (ascii_xfer_wait_prompt_prefix != NULL) {
+        Xfree(ascii_xfer_wait_prompt_prefix, __FILE__, __LINE__);
+    }
+    ascii_xfer_wait_prompt_prefix = NULL;
 }
 
 /* ------------------------------------------------------------------------
@@ -754,6 +1256,8 @@ static void clear_stats() {
     q_transfer_stats.error_count = 0;
     q_transfer_stats.blocks = 0;
     q_transfer_stats.block_size = 0;
+    q_transfer_stats.window_size = 0;
+    q_transfer_stats.round_trip_ms = 0;
     q_transfer_stats.blocks_transfer = 0;
     q_transfer_stats.batch_bytes_total = 0;
     q_transfer_stats.batch_bytes_transfer = 0;
@@ -1141,6 +1645,7 @@ void stop_file_transfer(const Q_TRANSFER_STATE new_state) {
     /*
      * Free the batch upload list
      */
+    close_upload_prefetch();
     if (batch_upload_file_list != NULL) {
         for (i = 0; batch_upload_file_list[i].name != NULL; i++) {
             Xfree(batch_upload_file_list[i].name, __FILE__, __LINE__);
@@ -2119,8 +2624,14 @@ void protocol_transfer_refresh() {
                             q_transfer_stats.error_count);
     screen_put_color_str_yx(window_top + 8, window_left + 27,
                             _("Block Size   "), Q_COLOR_MENU_TEXT);
-    screen_put_color_printf(Q_COLOR_MENU_COMMAND, "%-lu",
-                            q_transfer_stats.block_size);
+    if (q_transfer_stats.window_size > 0) {
+        screen_put_color_printf(Q_COLOR_MENU_COMMAND, "%lu x %lu",
+                                q_transfer_stats.block_size,
+                                q_transfer_stats.window_size);
+    } else {
+        screen_put_color_printf(Q_COLOR_MENU_COMMAND, "%-lu",
+                                q_transfer_stats.block_size);
+    }
 
     /*
      * CPS
@@ -105,6 +105,17 @@ struct q_transfer_stats_struct {
     unsigned long blocks_transfer;
     unsigned long error_count;
 
+    /**
+     * The number of blocks sent between acknowledgements, for protocols
+     * that stream a window of blocks.  0 if the protocol does not.
+     */
+    unsigned long window_size;
+
+    /**
+     * The measured round-trip time in millis, or 0 if not measured.
+     */
+    unsigned long round_trip_ms;
+
     /**
      * The total bytes to send for a batch.
      */
@@ -222,6 +233,19 @@ extern void start_file_transfer();
  */
 extern void set_batch_upload(struct file_info * upload);
 
+/**
+ * Open a file in a batch upload list for reading.  This also opens the next
+ * few files in the list and asks the kernel to start reading them into the
+ * page cache, so that the protocol does not wait on the disk between
+ * files.
+ *
+ * @param file_list the batch upload list, terminated by an entry with a
+ * NULL name
+ * @param i the index in file_list of the file to open
+ * @return the opened file, or NULL if it could not be opened
+ */
+extern FILE * open_upload_file(struct file_info * file_list, const int i);
+
 /**
  * Keyboard handler for the protocol selection dialog.
  *
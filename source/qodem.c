@@ -33,9 +33,9 @@
 #include <errno.h>
 #include <string.h>
 #include <assert.h>
+#include <sys/time.h>
 
 #ifdef Q_SSH_CRYPTLIB
-#include <sys/time.h>
 
 /*
  * SSH uses cryptlib, it's a very straightforward library.  We need to define
@@ -221,7 +221,7 @@ static int buffered_write_buffer_n = 0;
  * Console (keyboard) output does not use this, that is sent directly to
  * qodem_write().
  */
-static unsigned char q_transfer_buffer_raw[Q_BUFFER_SIZE];
+static unsigned char q_transfer_buffer_raw[Q_TRANSFER_BUFFER_SIZE];
 static unsigned int q_transfer_buffer_raw_n = 0;
 
 /* These are used by the select() call in data_handler() */
@@ -254,6 +254,33 @@ unsigned char q_cols_arg = 80;
 /* The --status-line command line argument */
 static Q_BOOL status_line_disabled = Q_FALSE;
 
+/* The --profile-startup command line argument */
+static Q_BOOL profile_startup_enabled = Q_FALSE;
+
+/**
+ * The most steps --profile-startup will record.
+ */
+#define PROFILE_STARTUP_MAX     32
+
+/**
+ * One timed step of startup, as reported by --profile-startup.
+ */
+struct startup_step {
+    /* The subsystem name */
+    const char * name;
+
+    /* How long the subsystem took to initialize, in milliseconds */
+    double millis;
+};
+
+/* The steps timed so far */
+static struct startup_step startup_steps[PROFILE_STARTUP_MAX];
+static int startup_steps_n = 0;
+
+/* When qodem_main() started, and when the previous step ended */
+static struct timeval startup_begin_time;
+static struct timeval startup_step_time;
+
 /**
  * The --keyfile command line argument.
  */
@@ -333,6 +360,7 @@ static struct option q_getopt_long_options[] = {
     {"emulation",           1,      0,      0},
     {"status-line",         1,      0,      0},
     {"geometry",            1,      0,      0},
+    {"profile-startup",     0,      0,      0},
     {0,                     0,      0,      0}
 };
 
@@ -341,19 +369,6 @@ static struct option q_getopt_long_options[] = {
  * get_workingdir_filename(), and get_scriptdir_filename().
  */
 static char datadir_filename[FILENAME_SIZE];
-#ifdef Q_SSH_CRYPTLIB
-
-/*
- * The SSH socket will always be periodically checked.
- */
-#ifdef Q_PDCURSES_WIN32
-static long ssh_last_time = 1000000;
-#else
-static suseconds_t ssh_last_time = 1000000;
-#endif
-static struct timeval ssh_tv;
-
-#endif /* Q_SSH_CRYPTLIB */
 
 #if defined(Q_PDCURSES) && !defined(Q_PDCURSES_WIN32)
 /*
@@ -467,7 +482,7 @@ int qodem_write(const int fd, const char * data, const int data_n,
      * We were passed a const data so that callers can pass read-only string
      * literals, but might need to change data before it hits the wire.
      */
-    char write_buffer_data[Q_BUFFER_SIZE];
+    char write_buffer_data[Q_TRANSFER_BUFFER_SIZE];
     char * write_buffer = (char *) data;
 
     if (data_n == 0) {
@@ -566,19 +581,19 @@ do_write:
             (q_host_type == Q_HOST_TYPE_TELNETD))
     ) {
         /* Telnet */
-        rc = telnet_write(fd, write_buffer + begin, data_n);
+        rc = telnet_write(fd, write_buffer + begin, n);
     } else if ((q_status.dial_method == Q_DIAL_METHOD_RLOGIN) &&
         (net_is_connected() == Q_TRUE)
     ) {
         /* Rlogin */
-        rc = rlogin_write(fd, write_buffer + begin, data_n);
+        rc = rlogin_write(fd, write_buffer + begin, n);
     } else if (((q_status.dial_method == Q_DIAL_METHOD_SOCKET) &&
             (net_is_connected() == Q_TRUE)) ||
         (((q_program_state == Q_STATE_HOST) || (q_host_active == Q_TRUE)) &&
             (q_host_type == Q_HOST_TYPE_SOCKET))
     ) {
         /* Socket */
-        rc = send(fd, write_buffer + begin, data_n, 0);
+        rc = send(fd, write_buffer + begin, n, 0);
 #ifdef Q_SSH_CRYPTLIB
     } else if (((q_status.dial_method == Q_DIAL_METHOD_SSH) &&
             (net_is_connected() == Q_TRUE)) ||
@@ -586,7 +601,7 @@ do_write:
             (q_host_type == Q_HOST_TYPE_SSHD))
     ) {
         /* SSH */
-        rc = ssh_write(fd, write_buffer + begin, data_n);
+        rc = ssh_write(fd, write_buffer + begin, n);
 #endif
 
     } else {
@@ -601,7 +616,7 @@ do_write:
             (q_status.dial_method == Q_DIAL_METHOD_SHELL)
         ) {
             DWORD bytes_written = 0;
-            if (WriteFile(q_child_stdin, write_buffer + begin, data_n,
+            if (WriteFile(q_child_stdin, write_buffer + begin, n,
                     &bytes_written, NULL) == TRUE) {
 
                 rc = bytes_written;
@@ -630,7 +645,7 @@ do_write:
             assert(q_serial_handle != NULL);
             ZeroMemory(&serial_overlapped, sizeof(serial_overlapped));
             serial_overlapped.hEvent = serial_event;
-            if (WriteFile(q_serial_handle, write_buffer + begin, data_n, NULL,
+            if (WriteFile(q_serial_handle, write_buffer + begin, n, NULL,
                     &serial_overlapped) == TRUE) {
 
                 if (GetOverlappedResult(q_serial_handle, &serial_overlapped,
@@ -682,12 +697,12 @@ do_write:
         } else {
             DLOG(("qodem_write() write() %d bytes to fd %d\n", data_n, fd));
             /* Everyone else */
-            rc = write(fd, write_buffer + begin, data_n);
+            rc = write(fd, write_buffer + begin, n);
         }
 #else
 
         /* Everyone else */
-        rc = write(fd, write_buffer + begin, data_n);
+        rc = write(fd, write_buffer + begin, n);
 
 #endif /* Q_PDCURSES_WIN32 */
 
@@ -712,7 +727,7 @@ do_write:
         int error = get_errno();
         if (rc > 0) {
             n -= rc;
-            begin += n;
+            begin += rc;
             if (n > 0) {
                 /*
                  * The last write was successful, and there are more bytes to
@@ -806,16 +821,36 @@ void qodem_buffered_write(const char * data, const int data_n) {
  * @param fd the socket descriptor
  */
 void qodem_buffered_write_flush(const int fd) {
+    int begin = 0;
+    int n;
+
     DLOG(("qodem_buffered_write_flush()\n"));
 
-    if (buffered_write_buffer_i > 0) {
-        qodem_write(fd, buffered_write_buffer, buffered_write_buffer_i, Q_TRUE);
-    } else {
-        assert(buffered_write_buffer_i == 0);
+    /*
+     * qodem_write() translates synchronous writes through a buffer of
+     * Q_TRANSFER_BUFFER_SIZE, so hand it the data in pieces no larger than
+     * that.
+     */
+    while (begin < buffered_write_buffer_i) {
+        n = buffered_write_buffer_i - begin;
+        if (n > Q_TRANSFER_BUFFER_SIZE) {
+            n = Q_TRANSFER_BUFFER_SIZE;
+        }
+        qodem_write(fd, buffered_write_buffer + begin, n, Q_TRUE);
+        begin += n;
     }
     buffered_write_buffer_i = 0;
 }
 
+/**
+ * Get the number of bytes waiting in the buffer of qodem_buffered_write().
+ *
+ * @return the number of bytes not yet flushed
+ */
+int qodem_buffered_write_pending() {
+    return buffered_write_buffer_i;
+}
+
 /**
  * Read data from remote system to a buffer, dispatching to the
  * appropriate connection-specific read function.
@@ -1053,6 +1088,8 @@ static char * usage_string() {
 "      --play MUSIC                Play MUSIC as ANSI Music\n"
 "      --play-exit                 Immediately exit after playing MUSIC\n"
 "      --geometry COLSxROWS        Request text window size COLS x ROWS\n"
+"      --profile-startup           Report the time each subsystem took to\n"
+"                                  initialize when qodem exits.\n"
 "      --xterm                     Enable X11 terminal mode\n"
 "      --version                   Display program version\n"
 "  -h, --help                      This help screen\n"
@@ -1306,6 +1343,10 @@ static void process_command_line_option(const char * option,
         play_music_exit = Q_TRUE;
     }
 
+    if (strcmp(option, "profile-startup") == 0) {
+        profile_startup_enabled = Q_TRUE;
+    }
+
     if (strcmp(option, "connect") == 0) {
         initial_call.address = (char *)value;
         memset(value_wchar, 0, sizeof(value_wchar));
@@ -1401,7 +1442,7 @@ void qlog(const char * format, ...) {
     va_end(arglist);
 
     fprintf(q_status.logging_file, "%s", outbuf);
-    fflush(q_status.logging_file);
+    logging_written();
 }
 
 /**
@@ -1673,17 +1714,6 @@ static Q_BOOL is_readable(int fd) {
             if (ssh_maybe_readable() == Q_TRUE) {
                 return Q_TRUE;
             }
-            /*
-             * ALWAYS try to read after 0.25 seconds, even if there is
-             * "nothing" on the socket itself.
-             */
-            gettimeofday(&ssh_tv, NULL);
-            if ((ssh_tv.tv_usec < ssh_last_time) ||
-                (ssh_tv.tv_usec - ssh_last_time > 250000)
-            ) {
-                DLOG(("SSH OVERRIDE: check socket anyway\n"));
-                return Q_TRUE;
-            }
         }
     }
 #endif
@@ -1785,10 +1815,6 @@ static void process_incoming_data() {
         (wait_on_script == Q_FALSE)
     ) {
 
-#ifdef Q_SSH_CRYPTLIB
-        ssh_last_time = ssh_tv.tv_usec;
-#endif
-
         /*
          * There is something to read.
          */
@@ -2418,6 +2444,9 @@ static void data_handler() {
     /* Flush curses */
     screen_flush();
 
+    /* Flush capture and session log if necessary */
+    flush_capture_and_log();
+
 #ifdef Q_PDCURSES_WIN32
     /*
      * Win32 doesn't support select() on stdin or on sub-process pipe
@@ -2511,6 +2540,17 @@ static void data_handler() {
      */
     default_timeout = 20000;
 
+#ifdef Q_SSH_CRYPTLIB
+    /*
+     * Send what ssh_write() has batched up, and don't block if ssh_read()
+     * already has data waiting.
+     */
+    ssh_flush();
+    if (ssh_maybe_readable() == Q_TRUE) {
+        default_timeout = 0;
+    }
+#endif
+
     /* Initialize select() structures */
     FD_ZERO(&readfds);
     FD_ZERO(&writefds);
@@ -2820,14 +2860,6 @@ static void data_handler() {
          * during this idle period.
          */
 
-        /* Flush capture file if necessary */
-        if (q_status.capture == Q_TRUE) {
-            if (q_status.capture_flush_time < time(NULL)) {
-                fflush(q_status.capture_file);
-                q_status.capture_flush_time = time(NULL);
-            }
-        }
-
 #ifndef Q_NO_SERIAL
 
         /*
@@ -3348,6 +3380,51 @@ static void reset_global_state() {
     set_status_line(Q_TRUE);
 }
 
+/**
+ * Record the time spent since the previous step for --profile-startup.
+ *
+ * @param name the subsystem that just finished initializing
+ */
+static void profile_startup(const char * name) {
+    struct timeval now;
+
+    if (profile_startup_enabled == Q_FALSE) {
+        return;
+    }
+    if (startup_steps_n == PROFILE_STARTUP_MAX) {
+        return;
+    }
+
+    gettimeofday(&now, NULL);
+    startup_steps[startup_steps_n].name = name;
+    startup_steps[startup_steps_n].millis =
+        (double) (now.tv_sec - startup_step_time.tv_sec) * 1000.0 +
+        (double) (now.tv_usec - startup_step_time.tv_usec) / 1000.0;
+    startup_steps_n++;
+    startup_step_time = now;
+}
+
+/**
+ * Print the --profile-startup report to stderr.  This must be called after
+ * curses has been shut down.
+ */
+static void profile_startup_report() {
+    double total = 0.0;
+    int i;
+
+    if (profile_startup_enabled == Q_FALSE) {
+        return;
+    }
+
+    fprintf(stderr, _("Startup profile (milliseconds):\n"));
+    for (i = 0; i < startup_steps_n; i++) {
+        fprintf(stderr, "    %-24s %10.3f\n", startup_steps[i].name,
+            startup_steps[i].millis);
+        total += startup_steps[i].millis;
+    }
+    fprintf(stderr, "    %-24s %10.3f\n", _("total"), total);
+}
+
 /**
  * Program main entry point.
  *
@@ -3369,6 +3446,10 @@ int qodem_main(int argc, char * const argv[]) {
     char * username;
 #endif
 
+    /* Everything --profile-startup reports is measured from here */
+    gettimeofday(&startup_begin_time, NULL);
+    startup_step_time = startup_begin_time;
+
     /* Internationalization */
     if (setlocale(LC_ALL, "") == NULL) {
         fprintf(stderr, "setlocale returned NULL: %s\n",
@@ -3454,9 +3535,6 @@ int qodem_main(int argc, char * const argv[]) {
      */
     time(&screensaver_time);
 
-    /* Initialize the music "engine" :-) */
-    music_init();
-
     /*
      * Setup an initial call state to support the --connect or --dial command
      * line options.
@@ -3539,8 +3617,11 @@ int qodem_main(int argc, char * const argv[]) {
     fflush(stdout);
 #endif
 
+    profile_startup(_("command line"));
+
     /* Load the options. */
     load_options();
+    profile_startup(_("options"));
 
     /* Initialize curses. */
     screen_setup(q_rows_arg, q_cols_arg);
@@ -3548,6 +3629,7 @@ int qodem_main(int argc, char * const argv[]) {
     /* Now that colors are known, use them. */
     q_setup_colors();
     q_current_color = scrollback_full_attr(Q_COLOR_CONSOLE_TEXT);
+    profile_startup(_("screen"));
 
     /*
      * Modify q_status based on command line options.  Do this AFTER
@@ -3557,6 +3639,7 @@ int qodem_main(int argc, char * const argv[]) {
 
     /* Setup MIXED mode doorway */
     setup_doorway_handling();
+    profile_startup(_("doorway"));
 
     /*
      * Initialize the keyboard here.  It will newterm() each supported
@@ -3566,6 +3649,7 @@ int qodem_main(int argc, char * const argv[]) {
     if (q_keyfile != NULL) {
         switch_current_keyboard(q_keyfile);
     }
+    profile_startup(_("keyboard"));
 
     /*
      * Set the translation tables to do nothing.
@@ -3577,28 +3661,26 @@ int qodem_main(int argc, char * const argv[]) {
     if (q_xlufile != NULL) {
         use_translate_table_unicode(q_xlufile);
     }
+    profile_startup(_("translate tables"));
 
 #ifndef Q_NO_SERIAL
     /*
      * Load the modem configuration
      */
     load_modem_config();
+    profile_startup(_("modem"));
 #endif
 
-    /*
-     * Setup the help system
-     */
-    setup_help();
-
     /*
      * See if the user wants automatic capture/logging enabled.
      */
-    if (strcasecmp(get_option(Q_OPTION_CAPTURE), "true") == 0) {
+    if (get_option_bool(Q_OPTION_CAPTURE) == Q_TRUE) {
         start_capture(get_option(Q_OPTION_CAPTURE_FILE));
     }
-    if (strcasecmp(get_option(Q_OPTION_LOG), "true") == 0) {
+    if (get_option_bool(Q_OPTION_LOG) == Q_TRUE) {
         start_logging(get_option(Q_OPTION_LOG_FILE));
     }
+    profile_startup(_("capture and log"));
 
     /* Default scrolling region needs HEIGHT which is set by curses. */
     q_status.scroll_region_top      = 0;
@@ -3709,6 +3791,7 @@ no_initial_call:
         if (play_music_exit == Q_TRUE) {
             q_program_state = Q_STATE_EXIT;
         }
+        profile_startup(_("music"));
     }
 
     if (q_program_state != Q_STATE_EXIT) {
@@ -3758,8 +3841,14 @@ no_initial_call:
         }
         q_phonebook.filename = substituted_filename;
 
-        /* Now load it */
-        load_phonebook(Q_FALSE);
+        /*
+         * Only --dial needs the phonebook now.  Otherwise it is loaded when
+         * the phonebook screen is first shown.
+         */
+        if (dial_phonebook_entry_n != -1) {
+            load_phonebook(Q_FALSE);
+        }
+        profile_startup(_("phonebook"));
 
         /*
          * Explicitly call console_refresh() so that the scrollback will be
@@ -3769,6 +3858,7 @@ no_initial_call:
 
         /* Reset all emulations */
         reset_emulation();
+        profile_startup(_("console"));
 
         if (dial_phonebook_entry_n != -1) {
             q_current_dial_entry = q_phonebook.entries;
@@ -3787,8 +3877,8 @@ no_initial_call:
             q_keyboard_blocks = Q_TRUE;
             q_current_dial_entry = &initial_call;
             do_dialer();
-        } else if ((strncmp(get_option(Q_OPTION_START_PHONEBOOK),
-                "true", 4) == 0) && (q_status.xterm_mode == Q_FALSE)) {
+        } else if ((get_option_bool(Q_OPTION_START_PHONEBOOK) == Q_TRUE) &&
+            (q_status.xterm_mode == Q_FALSE)) {
             switch_state(Q_STATE_PHONEBOOK);
         } else if (q_status.xterm_mode == Q_TRUE) {
             /*
@@ -3801,8 +3891,7 @@ no_initial_call:
             switch_state(Q_STATE_CONSOLE);
         }
 
-        if ((strncmp(get_option(Q_OPTION_STATUS_LINE_VISIBLE),
-                "true", 4) == 0) &&
+        if ((get_option_bool(Q_OPTION_STATUS_LINE_VISIBLE) == Q_TRUE) &&
             (q_status.xterm_mode == Q_FALSE) &&
             (status_line_disabled == Q_FALSE)
         ) {
@@ -3810,8 +3899,14 @@ no_initial_call:
         } else {
             set_status_line(Q_FALSE);
         }
+        profile_startup(_("first screen"));
 
 #ifdef Q_SSH_CRYPTLIB
+        /*
+         * cryptlib runs the slow poll in the background and only waits on it
+         * when it first needs random data.  The SSH server key is created
+         * when host mode first needs it, not here.
+         */
         if ((cryptStatusError(cryptInit()) != CRYPT_OK) ||
             (cryptStatusError(cryptAddRandom(NULL,
                     CRYPT_RANDOM_SLOWPOLL)) != CRYPT_OK)
@@ -3822,9 +3917,8 @@ no_initial_call:
                 _("Press any key to continue...\n"));
             screen_flush();
             discarding_getch();
-        } else {
-            ssh_create_server_key();
         }
+        profile_startup(_("cryptlib"));
 #endif
 
         /* Enter main loop */
@@ -3863,6 +3957,9 @@ no_initial_call:
     /* Shutdown curses */
     screen_teardown();
 
+    /* Curses is gone, so --profile-startup can write to stderr now */
+    profile_startup_report();
+
     /* Shutdown the music "engine" :-) */
     music_teardown();
 
@@ -37,6 +37,12 @@ extern "C" {
 /* The network buffer size. */
 #define Q_BUFFER_SIZE 4096
 
+/*
+ * The outgoing buffer size for file transfers, dialer, scripts, and host
+ * mode.  It must hold at least one 9024-byte Kermit long packet.
+ */
+#define Q_TRANSFER_BUFFER_SIZE 16384
+
 /**
  * Available capture types.
  */
@@ -777,6 +783,13 @@ extern void qodem_buffered_write(const char * data, const int data_n);
  */
 extern void qodem_buffered_write_flush(const int fd);
 
+/**
+ * Get the number of bytes waiting in the buffer of qodem_buffered_write().
+ *
+ * @return the number of bytes not yet flushed
+ */
+extern int qodem_buffered_write_pending();
+
 /**
  * Spawn a command in an external terminal.  This is used for the mail reader
  * and external file editors.
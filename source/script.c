@@ -23,10 +23,12 @@
 #include <assert.h>
 #include <errno.h>
 #include <fcntl.h>
+#include <sys/time.h>
 
 #ifdef Q_PDCURSES_WIN32
 #  include <windows.h>
 #else
+#  include <regex.h>
 #  include <signal.h>
 #  include <sys/ioctl.h>
 #  include <sys/poll.h>
@@ -69,12 +71,27 @@ static const char * DLOGNAME = NULL;
 Q_SCRIPT q_running_script;
 
 /*
- * Buffer of UTF-8 encoded printable characters to send to the script's
- * stdin.  This is space for at least 128 Unicode code points that could each
- * take up to 4 bytes to encode.
+ * The print buffer starts at PRINT_BUFFER_INITIAL bytes and doubles as
+ * needed up to PRINT_BUFFER_MAX.
  */
-static char print_buffer[128 * 4];
-static int print_buffer_n;
+#define PRINT_BUFFER_INITIAL    4096
+#define PRINT_BUFFER_MAX        65536
+
+/*
+ * Once the print buffer holds PRINT_BUFFER_HIGH_WATER bytes, stop reading
+ * from the remote side until the script drains it to PRINT_BUFFER_LOW_WATER.
+ */
+#define PRINT_BUFFER_HIGH_WATER (PRINT_BUFFER_MAX / 4 * 3)
+#define PRINT_BUFFER_LOW_WATER  (PRINT_BUFFER_MAX / 4)
+
+/*
+ * Ring buffer of UTF-8 encoded printable characters to send to the script's
+ * stdin.  print_buffer_n bytes are waiting, starting at print_buffer_start.
+ */
+static char * print_buffer = NULL;
+static int print_buffer_size = 0;
+static int print_buffer_start = 0;
+static int print_buffer_n = 0;
 
 #ifdef Q_PDCURSES_WIN32
 
@@ -95,6 +112,9 @@ HANDLE q_script_thread = NULL;
  */
 static time_t script_start_time;
 
+/* If true, the running script is a built-in script */
+static Q_BOOL builtin_script = Q_FALSE;
+
 /*
  * Script stdout buffer.
  */
@@ -122,15 +142,14 @@ int script_rc = -1;
 
 /**
  * Figure out the appropriate full and empty print buffer state exposed to
- * the global script status.
+ * the global script status.  Full turns on at the high watermark and stays
+ * on until the buffer drains to the low watermark, so that reads from the
+ * remote side pause and resume in large steps.
  */
 static void update_print_buffer_flags() {
-    if (print_buffer_n >= sizeof(print_buffer) - 4) {
-        /*
-         * No more room for another character, we are full
-         */
+    if (print_buffer_n >= PRINT_BUFFER_HIGH_WATER) {
         q_running_script.print_buffer_full = Q_TRUE;
-    } else {
+    } else if (print_buffer_n <= PRINT_BUFFER_LOW_WATER) {
         q_running_script.print_buffer_full = Q_FALSE;
     }
     if (print_buffer_n == 0) {
@@ -140,6 +159,61 @@ static void update_print_buffer_flags() {
     }
 }
 
+/**
+ * Make room for n more bytes in the print buffer, growing it if needed.
+ *
+ * @param n the number of bytes to add
+ * @return true if there is room
+ */
+static Q_BOOL reserve_print_buffer(const int n) {
+    char * new_buffer;
+    int new_size;
+    int first;
+
+    if (print_buffer_n + n <= print_buffer_size) {
+        return Q_TRUE;
+    }
+    if (print_buffer_size == PRINT_BUFFER_MAX) {
+        return Q_FALSE;
+    }
+
+    if (print_buffer_size == 0) {
+        new_size = PRINT_BUFFER_INITIAL;
+    } else {
+        new_size = print_buffer_size * 2;
+    }
+    new_buffer = (char *) Xmalloc(new_size, __FILE__, __LINE__);
+
+    /*
+     * Unwrap the waiting bytes to the front of the new buffer.
+     */
+    if (print_buffer_n > 0) {
+        first = print_buffer_size - print_buffer_start;
+        if (first > print_buffer_n) {
+            first = print_buffer_n;
+        }
+        memcpy(new_buffer, print_buffer + print_buffer_start, first);
+        memcpy(new_buffer + first, print_buffer, print_buffer_n - first);
+    }
+    if (print_buffer != NULL) {
+        Xfree(print_buffer, __FILE__, __LINE__);
+    }
+    print_buffer = new_buffer;
+    print_buffer_size = new_size;
+    print_buffer_start = 0;
+
+    return (print_buffer_n + n <= print_buffer_size ? Q_TRUE : Q_FALSE);
+}
+
+/**
+ * Throw away everything in the print buffer.
+ */
+static void clear_print_buffer() {
+    print_buffer_start = 0;
+    print_buffer_n = 0;
+    update_print_buffer_flags();
+}
+
 /**
  * Called by print_character() in scrollback.c to pass printable characters
  * to the running script's stdin.
@@ -147,7 +221,10 @@ static void update_print_buffer_flags() {
  * @param ch the character
  */
 void script_print_character(const wchar_t ch) {
+    char utf8_buffer[4];
     int rc;
+    int end;
+    int i;
 
     if (q_running_script.paused == Q_TRUE) {
         /*
@@ -160,14 +237,13 @@ void script_print_character(const wchar_t ch) {
         /*
          * Drop characters when the script is dead.
          */
-        print_buffer_n = 0;
-        update_print_buffer_flags();
+        clear_print_buffer();
         return;
     }
 
-    if (q_running_script.print_buffer_full == Q_TRUE) {
+    if (builtin_script == Q_TRUE) {
         /*
-         * Drop characters when the print buffer is full.
+         * Built-in scripts match on the raw remote data instead.
          */
         return;
     }
@@ -175,7 +251,26 @@ void script_print_character(const wchar_t ch) {
     /*
      * Encode the character to UTF-8.
      */
-    rc = utf8_encode(ch, &print_buffer[print_buffer_n]);
+    rc = utf8_encode(ch, utf8_buffer);
+    if (rc == 0) {
+        return;
+    }
+
+    if (reserve_print_buffer(rc) == Q_FALSE) {
+        /*
+         * Drop characters when the print buffer is full.
+         */
+        return;
+    }
+
+    end = (print_buffer_start + print_buffer_n) % print_buffer_size;
+    for (i = 0; i < rc; i++) {
+        print_buffer[end] = utf8_buffer[i];
+        end++;
+        if (end == print_buffer_size) {
+            end = 0;
+        }
+    }
     print_buffer_n += rc;
 
     /*
@@ -276,63 +371,29 @@ static void print_stderr() {
 }
 
 /**
- * Process raw bytes from the remote side through the script.  See also
- * console_process_incoming_data().
+ * Write as much of the print buffer as the script will take right now.
  *
- * @param input the bytes from the remote side
- * @param input_n the number of bytes in input_n
- * @param remaining the number of un-processed bytes that should be sent
- * through a future invocation of script_process_data()
- * @param output a buffer to contain the bytes to send to the remote side
- * @param output_n the number of bytes that this function wrote to output
- * @param output_max the maximum number of bytes this function may write to
- * output
+ * @return false if the write failed with an error other than EAGAIN
  */
-void script_process_data(unsigned char * input, const unsigned int input_n,
-                         int * remaining, unsigned char * output,
-                         unsigned int * output_n,
-                         const unsigned int output_max) {
-
+static Q_BOOL write_print_buffer() {
     char notify_message[DIALOG_MESSAGE_SIZE];
-    int rc = 0;
+    int rc;
     int n;
-    int i;
-    uint32_t utf8_char;
-    uint32_t last_utf8_state;
-#ifdef Q_PDCURSES_WIN32
-    DWORD actual_bytes = 0;
-    DWORD bytes_read = 0;
-#else
-    struct pollfd pfd;
-#endif
-    Q_BOOL check_stderr = Q_FALSE;
-
-    DLOG(("script.c: buffer_full %s buffer_empty %s running %s paused %s\n",
-         (q_running_script.print_buffer_full == Q_TRUE ? "true" : "false"),
-         (q_running_script.print_buffer_empty == Q_TRUE ? "true" : "false"),
-         (q_running_script.running == Q_TRUE ? "true" : "false"),
-         (q_running_script.paused == Q_TRUE ? "true" : "false")));
-
-    DLOG(("script.c: stdin %s stdout %s buffer_n %d\n",
-         (q_running_script.stdin_writeable == Q_TRUE ? "true" : "false"),
-         (q_running_script.stdout_readable == Q_TRUE ? "true" : "false"),
-         print_buffer_n));
-
-    /*
-     * -----------------------------------------------------------------
-     * Dispatch things in print_buffer to script stdin
-     * -----------------------------------------------------------------
-     */
-    if (q_running_script.stdin_writeable == Q_TRUE) {
 
+    while (print_buffer_n > 0) {
         /*
-         * Write the data to q_running_script.script_tty_fd
+         * Write the contiguous part from print_buffer_start.
          */
+        n = print_buffer_size - print_buffer_start;
+        if (n > print_buffer_n) {
+            n = print_buffer_n;
+        }
+
 #ifdef Q_PDCURSES_WIN32
-        if (print_buffer_n > 0) {
+        {
             DWORD bytes_written = 0;
-            if (WriteFile(q_script_stdin, print_buffer,
-                          print_buffer_n, &bytes_written, NULL) == TRUE) {
+            if (WriteFile(q_script_stdin, print_buffer + print_buffer_start,
+                          n, &bytes_written, NULL) == TRUE) {
                 rc = bytes_written;
 
                 /*
@@ -343,16 +404,10 @@ void script_process_data(unsigned char * input, const unsigned int input_n,
                 errno = GetLastError();
                 rc = -1;
             }
-        } else {
-            /*
-             * NOP, pretend it's EAGAIN
-             */
-            errno = EAGAIN;
-            rc = -1;
         }
 #else
-        rc = write(q_running_script.script_tty_fd, print_buffer,
-                   print_buffer_n);
+        rc = write(q_running_script.script_tty_fd,
+                   print_buffer + print_buffer_start, n);
 #endif
 
         if (rc < 0) {
@@ -379,19 +434,877 @@ void script_process_data(unsigned char * input, const unsigned int input_n,
                          _("Call to write() failed: %d %s"), errno,
                          strerror(errno));
                 notify_form(notify_message, 0);
-                return;
+                return Q_FALSE;
+            }
+            break;
+        }
+
+        /*
+         * Hang onto the difference for the next round.
+         */
+        assert(rc <= n);
+        print_buffer_start += rc;
+        if (print_buffer_start == print_buffer_size) {
+            print_buffer_start = 0;
+        }
+        print_buffer_n -= rc;
+        if (print_buffer_n == 0) {
+            print_buffer_start = 0;
+        }
+        update_print_buffer_flags();
+
+        if (rc < n) {
+            break;
+        }
+    }
+
+    return Q_TRUE;
+}
+
+/**
+ * Encode one character from a script for the remote side, according to the
+ * current emulation.
+ *
+ * @param ch the character
+ * @param output the buffer to write to, with room for at least 4 bytes
+ * @return the number of bytes written to output
+ */
+static int encode_script_char(uint32_t ch, unsigned char * output) {
+
+    switch (q_status.emulation) {
+    case Q_EMUL_TTY:
+    case Q_EMUL_ANSI:
+    case Q_EMUL_AVATAR:
+    case Q_EMUL_PETSCII:
+    case Q_EMUL_ATASCII:
+    case Q_EMUL_DEBUG:
+    case Q_EMUL_VT52:
+    case Q_EMUL_VT100:
+    case Q_EMUL_VT102:
+    case Q_EMUL_VT220:
+    case Q_EMUL_LINUX:
+    case Q_EMUL_XTERM:
+        /*
+         * 8-bit emulations: try to backmap to the codepage, including
+         * allowing Unicode synonyms.
+         */
+        output[0] = translate_unicode_to_8bit((wchar_t) ch, q_status.codepage);
+        /*
+         * 8-bit emulations
+         */
+        output[0] = (unsigned char) (ch & 0xFF);
+        return 1;
+    case Q_EMUL_LINUX_UTF8:
+    case Q_EMUL_XTERM_UTF8:
+        /*
+         * UTF-8 emulations: encode outbound "keystroke", after running it
+         * through the direct Unicode translation map.
+         */
+        ch = translate_unicode_out((wchar_t) ch);
+
+        /*
+         * Now re-encode on the wire.
+         */
+        return utf8_encode((wchar_t) ch, (char *) output);
+    }
+    return 0;
+}
+
+/* ------------------------------------------------------------------------
+ * Built-in scripts -------------------------------------------------------
+ * ------------------------------------------------------------------------
+ *
+ * Scripts ending in BUILTIN_SCRIPT_EXTENSION are interpreted here rather
+ * than run as a separate process.  They are a list of expect-style
+ * commands, one per line:
+ *
+ *     send "text"                      Send text to the remote side
+ *     waitfor "text" [seconds [label]] Wait for text from the remote side
+ *     regex "pattern" [seconds [label]] Wait for a POSIX extended regex
+ *     pause seconds                    Do nothing for a while
+ *     print "text"                     Show text in the script output area
+ *     label name                       Mark a place to goto
+ *     goto name                        Continue at label name
+ *     exit [code]                      Stop with exit code (default 0)
+ *
+ * Strings understand \r, \n, \t, \e, \\, \", and \xHH.  A wait that times
+ * out continues at its label, or stops the script with exit code 1 if it
+ * has none.  Matching runs directly on the bytes from the remote side (after
+ * the 8-bit input translate table), with no pty round trip.  Like expect,
+ * remote data that no wait has consumed yet is kept, so a prompt that
+ * arrives during a send or pause is still seen by the next wait.
+ */
+
+#define BUILTIN_SCRIPT_EXTENSION        ".qsc"
+
+/* The longest line in a built-in script */
+#define BUILTIN_SCRIPT_LINE_SIZE        1024
+
+/* How much unconsumed remote data is kept for the next wait */
+#define BUILTIN_SCRIPT_PENDING_SIZE     4096
+
+/*
+ * The most commands run per call, so that a loop with no wait in it
+ * can't lock up the UI
+ */
+#define BUILTIN_SCRIPT_MAX_STEPS        256
+
+typedef enum {
+    BUILTIN_SEND,
+    BUILTIN_WAITFOR,
+    BUILTIN_REGEX,
+    BUILTIN_PAUSE,
+    BUILTIN_PRINT,
+    BUILTIN_LABEL,
+    BUILTIN_GOTO,
+    BUILTIN_EXIT
+} BUILTIN_OP;
+
+/**
+ * One command of a built-in script.
+ */
+struct builtin_command {
+    /* What to do */
+    BUILTIN_OP op;
+
+    /* The waitfor/regex/label bytes, NUL-terminated */
+    unsigned char * text;
+    int text_n;
+
+    /* The send/print characters */
+    wchar_t * chars;
+    int chars_n;
+
+    /* For waitfor, the longest prefix of text that is also a suffix of
+     * text[0..i], used to match across reads without backing up */
+    int * prefix;
+
+    /* Wait or pause time in milliseconds (0 = forever), or the exit code */
+    int value;
+
+    /* Where goto or a timed out wait goes, or -1 */
+    int target;
+
+    /* The label name for target, until it is resolved */
+    char * target_label;
+
+#ifndef Q_PDCURSES_WIN32
+    /* The compiled regex */
+    regex_t regex;
+#endif
+};
+
+/* The loaded script */
+static struct builtin_command * builtin_commands = NULL;
+static int builtin_commands_n = 0;
+
+/* The command being executed */
+static int builtin_pc;
+
+/* If true, the command at builtin_pc has begun */
+static Q_BOOL builtin_armed;
+
+/* When the command at builtin_pc began */
+static struct timeval builtin_command_time;
+
+/* How much of a waitfor text has matched, or how much of a send is out */
+static int builtin_progress;
+
+/* Remote data received since the last match, NUL-terminated */
+static char builtin_pending[BUILTIN_SCRIPT_PENDING_SIZE + 1];
+static int builtin_pending_n;
+
+/* How much of builtin_pending the current wait has already looked at */
+static int builtin_scanned;
+
+/**
+ * See if a script filename names a built-in script.
+ *
+ * @param filename the script filename, possibly followed by arguments
+ * @return true if the first word ends in BUILTIN_SCRIPT_EXTENSION
+ */
+static Q_BOOL is_builtin_script(const char * filename) {
+    const char * end;
+    int n;
+
+    end = strchr(filename, ' ');
+    if (end == NULL) {
+        end = filename + strlen(filename);
+    }
+    n = strlen(BUILTIN_SCRIPT_EXTENSION);
+    if ((end - filename > n) &&
+        (strncasecmp(end - n, BUILTIN_SCRIPT_EXTENSION, n) == 0)) {
+        return Q_TRUE;
+    }
+    return Q_FALSE;
+}
+
+/**
+ * Free the loaded built-in script.
+ */
+static void builtin_script_free() {
+    int i;
+
+    for (i = 0; i < builtin_commands_n; i++) {
+        if (builtin_commands[i].text != NULL) {
+            Xfree(builtin_commands[i].text, __FILE__, __LINE__);
+        }
+        if (builtin_commands[i].chars != NULL) {
+            Xfree(builtin_commands[i].chars, __FILE__, __LINE__);
+        }
+        if (builtin_commands[i].prefix != NULL) {
+            Xfree(builtin_commands[i].prefix, __FILE__, __LINE__);
+        }
+        if (builtin_commands[i].target_label != NULL) {
+            Xfree(builtin_commands[i].target_label, __FILE__, __LINE__);
+        }
+#ifndef Q_PDCURSES_WIN32
+        if (builtin_commands[i].op == BUILTIN_REGEX) {
+            regfree(&builtin_commands[i].regex);
+        }
+#endif
+    }
+    if (builtin_commands != NULL) {
+        Xfree(builtin_commands, __FILE__, __LINE__);
+    }
+    builtin_commands = NULL;
+    builtin_commands_n = 0;
+}
+
+/**
+ * Parse one argument from a built-in script line: either a quoted string
+ * with escapes or a bare word.
+ *
+ * @param line the current position in the line.  This is advanced past the
+ * argument.
+ * @param text the buffer to write the argument to, at least
+ * BUILTIN_SCRIPT_LINE_SIZE bytes.  It is NUL-terminated.
+ * @param text_n the number of bytes written to text
+ * @return false if there is no argument or the quotes are unbalanced
+ */
+static Q_BOOL builtin_script_argument(char ** line, unsigned char * text,
+                                      int * text_n) {
+    char * p = *line;
+    char hex[3];
+    int n = 0;
+
+    while ((*p == ' ') || (*p == '\t')) {
+        p++;
+    }
+    if ((*p == 0) || (*p == '\r') || (*p == '\n') || (*p == '#')) {
+        return Q_FALSE;
+    }
+
+    if (*p != '"') {
+        while ((*p != 0) && (*p != ' ') && (*p != '\t') && (*p != '\r') &&
+               (*p != '\n')) {
+            text[n] = *p;
+            n++;
+            p++;
+        }
+    } else {
+        for (p++; *p != '"'; p++) {
+            if ((*p == 0) || (*p == '\r') || (*p == '\n')) {
+                return Q_FALSE;
+            }
+            if (*p != '\\') {
+                text[n] = *p;
+                n++;
+                continue;
+            }
+            p++;
+            switch (*p) {
+            case 'r':
+                text[n] = C_CR;
+                break;
+            case 'n':
+                text[n] = C_LF;
+                break;
+            case 't':
+                text[n] = C_TAB;
+                break;
+            case 'e':
+                text[n] = C_ESC;
+                break;
+            case 'x':
+                if ((isxdigit(p[1]) == 0) || (isxdigit(p[2]) == 0)) {
+                    return Q_FALSE;
+                }
+                hex[0] = p[1];
+                hex[1] = p[2];
+                hex[2] = 0;
+                text[n] = (unsigned char) strtol(hex, NULL, 16);
+                p += 2;
+                break;
+            case 0:
+                return Q_FALSE;
+            default:
+                text[n] = *p;
+                break;
+            }
+            n++;
+        }
+        p++;
+    }
+
+    text[n] = 0;
+    *text_n = n;
+    *line = p;
+    return Q_TRUE;
+}
+
+/**
+ * Decode UTF-8 script text into characters.
+ *
+ * @param text the UTF-8 bytes
+ * @param text_n the number of bytes in text
+ * @param chars_n the number of characters decoded
+ * @return a newly-allocated array of characters
+ */
+static wchar_t * builtin_script_chars(const unsigned char * text,
+                                      const int text_n, int * chars_n) {
+    wchar_t * chars;
+    uint32_t state = 0;
+    uint32_t ch;
+    int i;
+
+    chars = (wchar_t *) Xmalloc(sizeof(wchar_t) * (text_n + 1), __FILE__,
+                                __LINE__);
+    *chars_n = 0;
+    for (i = 0; i < text_n; i++) {
+        if (utf8_decode(&state, &ch, text[i]) == UTF8_ACCEPT) {
+            chars[*chars_n] = (wchar_t) ch;
+            (*chars_n)++;
+        } else if (state == UTF8_REJECT) {
+            /*
+             * Not UTF-8, take the byte as-is
+             */
+            state = 0;
+            chars[*chars_n] = text[i];
+            (*chars_n)++;
+        }
+    }
+    return chars;
+}
+
+/**
+ * Load a built-in script.  Errors are reported with notify_form().
+ *
+ * @param script_filename the script filename, possibly followed by
+ * arguments which are ignored
+ * @return true if the script loaded
+ */
+static Q_BOOL builtin_script_load(const char * script_filename) {
+    char notify_message[DIALOG_MESSAGE_SIZE];
+    char line[BUILTIN_SCRIPT_LINE_SIZE];
+    unsigned char keyword[BUILTIN_SCRIPT_LINE_SIZE];
+    unsigned char text[BUILTIN_SCRIPT_LINE_SIZE];
+    unsigned char word[BUILTIN_SCRIPT_LINE_SIZE];
+    struct builtin_command * command;
+    char * filename;
+    char * error = NULL;
+    char * p;
+    FILE * file;
+    int line_number = 0;
+    int keyword_n;
+    int text_n;
+    int word_n;
+    int i, j;
+
+    /*
+     * Drop any arguments, and look in the scripts directory unless a path
+     * was given.
+     */
+    filename = Xstrdup(script_filename, __FILE__, __LINE__);
+    p = strchr(filename, ' ');
+    if (p != NULL) {
+        *p = 0;
+    }
+    if ((strchr(filename, '/') == NULL) && (strchr(filename, '\\') == NULL)) {
+        file = fopen(get_scriptdir_filename(filename), "r");
+    } else {
+        file = fopen(filename, "r");
+    }
+    if (file == NULL) {
+        snprintf(notify_message, sizeof(notify_message),
+                 _("Error opening file \"%s\" for reading: %s"), filename,
+                 strerror(errno));
+        notify_form(notify_message, 0);
+        Xfree(filename, __FILE__, __LINE__);
+        return Q_FALSE;
+    }
+
+    builtin_script_free();
+
+    while ((error == NULL) &&
+           (fgets(line, sizeof(line), file) != NULL)) {
+        line_number++;
+        p = line;
+        if (builtin_script_argument(&p, keyword, &keyword_n) == Q_FALSE) {
+            /*
+             * Blank line or comment
+             */
+            continue;
+        }
+
+        builtin_commands = (struct builtin_command *)
+            Xrealloc(builtin_commands, sizeof(struct builtin_command) *
+                     (builtin_commands_n + 1), __FILE__, __LINE__);
+        command = &builtin_commands[builtin_commands_n];
+        memset(command, 0, sizeof(struct builtin_command));
+        command->target = -1;
+
+        if (strcasecmp((char *) keyword, "send") == 0) {
+            command->op = BUILTIN_SEND;
+        } else if (strcasecmp((char *) keyword, "print") == 0) {
+            command->op = BUILTIN_PRINT;
+        } else if (strcasecmp((char *) keyword, "waitfor") == 0) {
+            command->op = BUILTIN_WAITFOR;
+        } else if (strcasecmp((char *) keyword, "regex") == 0) {
+            command->op = BUILTIN_REGEX;
+        } else if (strcasecmp((char *) keyword, "pause") == 0) {
+            command->op = BUILTIN_PAUSE;
+        } else if (strcasecmp((char *) keyword, "label") == 0) {
+            command->op = BUILTIN_LABEL;
+        } else if (strcasecmp((char *) keyword, "goto") == 0) {
+            command->op = BUILTIN_GOTO;
+        } else if (strcasecmp((char *) keyword, "exit") == 0) {
+            command->op = BUILTIN_EXIT;
+        } else {
+            error = _("unknown command");
+            break;
+        }
+        builtin_commands_n++;
+
+        if (builtin_script_argument(&p, text, &text_n) == Q_FALSE) {
+            if (command->op != BUILTIN_EXIT) {
+                error = _("missing or unterminated argument");
             }
+            continue;
+        }
+
+        switch (command->op) {
+        case BUILTIN_SEND:
+        case BUILTIN_PRINT:
+            command->chars = builtin_script_chars(text, text_n,
+                                                  &command->chars_n);
+            break;
+
+        case BUILTIN_WAITFOR:
+        case BUILTIN_REGEX:
+            if (text_n == 0) {
+                error = _("empty match text");
+                break;
+            }
+            command->text = (unsigned char *) Xstrdup((char *) text, __FILE__,
+                                                      __LINE__);
+            command->text_n = text_n;
+            if (builtin_script_argument(&p, word, &word_n) == Q_TRUE) {
+                command->value = (int) (atof((char *) word) * 1000);
+                if (builtin_script_argument(&p, word, &word_n) == Q_TRUE) {
+                    command->target_label = Xstrdup((char *) word, __FILE__,
+                                                    __LINE__);
+                }
+            }
+            if (command->op == BUILTIN_WAITFOR) {
+                /*
+                 * Build the prefix table once so that matching never has to
+                 * look back at earlier input.
+                 */
+                command->prefix = (int *) Xmalloc(sizeof(int) * text_n,
+                                                  __FILE__, __LINE__);
+                command->prefix[0] = 0;
+                j = 0;
+                for (i = 1; i < text_n; i++) {
+                    while ((j > 0) && (text[i] != text[j])) {
+                        j = command->prefix[j - 1];
+                    }
+                    if (text[i] == text[j]) {
+                        j++;
+                    }
+                    command->prefix[i] = j;
+                }
+            } else {
+#ifdef Q_PDCURSES_WIN32
+                error = _("regex is not supported on this system");
+#else
+                if (regcomp(&command->regex, (char *) text,
+                            REG_EXTENDED) != 0) {
+                    /*
+                     * Don't regfree() what was never compiled
+                     */
+                    command->op = BUILTIN_WAITFOR;
+                    error = _("invalid regular expression");
+                }
+#endif
+            }
+            break;
+
+        case BUILTIN_PAUSE:
+            command->value = (int) (atof((char *) text) * 1000);
+            break;
+
+        case BUILTIN_LABEL:
+            command->text = (unsigned char *) Xstrdup((char *) text, __FILE__,
+                                                      __LINE__);
+            command->text_n = text_n;
+            break;
+
+        case BUILTIN_GOTO:
+            command->target_label = Xstrdup((char *) text, __FILE__,
+                                            __LINE__);
+            break;
+
+        case BUILTIN_EXIT:
+            command->value = atoi((char *) text);
+            break;
+        }
+    }
+    fclose(file);
+
+    /*
+     * Resolve labels
+     */
+    for (i = 0; (error == NULL) && (i < builtin_commands_n); i++) {
+        command = &builtin_commands[i];
+        if (command->target_label == NULL) {
+            continue;
+        }
+        for (j = 0; j < builtin_commands_n; j++) {
+            if ((builtin_commands[j].op == BUILTIN_LABEL) &&
+                (strcmp((char *) builtin_commands[j].text,
+                        command->target_label) == 0)) {
+                command->target = j;
+                break;
+            }
+        }
+        if (command->target == -1) {
+            error = _("unknown label");
+            line_number = 0;
+        }
+    }
+
+    if (error != NULL) {
+        if (line_number > 0) {
+            snprintf(notify_message, sizeof(notify_message),
+                     _("Error in script \"%s\" line %d: %s"), filename,
+                     line_number, error);
         } else {
+            snprintf(notify_message, sizeof(notify_message),
+                     _("Error in script \"%s\": %s \"%s\""), filename, error,
+                     command->target_label);
+        }
+        notify_form(notify_message, 0);
+        builtin_script_free();
+        Xfree(filename, __FILE__, __LINE__);
+        return Q_FALSE;
+    }
+
+    Xfree(filename, __FILE__, __LINE__);
+    builtin_pc = 0;
+    builtin_armed = Q_FALSE;
+    builtin_pending_n = 0;
+    builtin_pending[0] = 0;
+    return Q_TRUE;
+}
+
+/**
+ * Stop the built-in script.
+ *
+ * @param rc the script exit code
+ */
+static void builtin_script_exit(const int rc) {
+    qlog(_("Script exited with RC=%u\n"), rc);
+    script_rc = rc;
+    script_stop();
+}
+
+/**
+ * Save bytes from the remote side for the waits to match against.
+ *
+ * @param input the bytes from the remote side
+ * @param input_n the number of bytes in input
+ */
+static void builtin_script_receive(const unsigned char * input,
+                                   const unsigned int input_n) {
+    unsigned char ch;
+    unsigned int i;
+
+    for (i = 0; i < input_n; i++) {
+        if (builtin_pending_n == BUILTIN_SCRIPT_PENDING_SIZE) {
             /*
-             * Hang onto the difference for the next round.
+             * Nothing has matched for a long while, drop the older half.
              */
-            assert(rc <= print_buffer_n);
+            memmove(builtin_pending,
+                    builtin_pending + BUILTIN_SCRIPT_PENDING_SIZE / 2,
+                    BUILTIN_SCRIPT_PENDING_SIZE / 2);
+            builtin_pending_n = BUILTIN_SCRIPT_PENDING_SIZE / 2;
+            builtin_scanned -= BUILTIN_SCRIPT_PENDING_SIZE / 2;
+            if (builtin_scanned < 0) {
+                builtin_scanned = 0;
+            }
+        }
+        ch = translate_8bit_in(input[i]);
+        if (ch != 0) {
+            builtin_pending[builtin_pending_n] = ch;
+            builtin_pending_n++;
+        }
+    }
+    builtin_pending[builtin_pending_n] = 0;
+}
 
-            if (rc < print_buffer_n) {
-                memmove(print_buffer, print_buffer + rc, print_buffer_n - rc);
+/**
+ * Discard the start of builtin_pending up to the end of a match.
+ *
+ * @param n the number of bytes to discard
+ */
+static void builtin_script_consume(const int n) {
+    memmove(builtin_pending, builtin_pending + n, builtin_pending_n - n + 1);
+    builtin_pending_n -= n;
+    builtin_scanned = 0;
+}
+
+/**
+ * Match the waitfor or regex command at builtin_pc against the pending
+ * remote data.  On a match, the data up to the end of the match is
+ * consumed and the rest is left for the following commands.
+ *
+ * @return true if the command matched
+ */
+static Q_BOOL builtin_script_match() {
+    struct builtin_command * command = &builtin_commands[builtin_pc];
+    unsigned char ch;
+    int i;
+#ifndef Q_PDCURSES_WIN32
+    regmatch_t match;
+#endif
+
+    if (builtin_scanned == builtin_pending_n) {
+        /*
+         * Nothing new
+         */
+        return Q_FALSE;
+    }
+
+    if (command->op == BUILTIN_WAITFOR) {
+        for (i = builtin_scanned; i < builtin_pending_n; i++) {
+            ch = builtin_pending[i];
+            while ((builtin_progress > 0) &&
+                   (command->text[builtin_progress] != ch)) {
+                builtin_progress = command->prefix[builtin_progress - 1];
+            }
+            if (command->text[builtin_progress] == ch) {
+                builtin_progress++;
+            }
+            if (builtin_progress == command->text_n) {
+                builtin_script_consume(i + 1);
+                return Q_TRUE;
             }
-            print_buffer_n -= rc;
-            update_print_buffer_flags();
+        }
+        builtin_scanned = builtin_pending_n;
+        return Q_FALSE;
+    }
+
+#ifndef Q_PDCURSES_WIN32
+    if (regexec(&command->regex, builtin_pending, 1, &match, 0) == 0) {
+        builtin_script_consume(match.rm_eo);
+        return Q_TRUE;
+    }
+#endif
+    builtin_scanned = builtin_pending_n;
+    return Q_FALSE;
+}
+
+/**
+ * Run the built-in script until it has to wait.
+ *
+ * @param input the bytes from the remote side
+ * @param input_n the number of bytes in input
+ * @param output a buffer to contain the bytes to send to the remote side
+ * @param output_n the number of bytes that this function wrote to output
+ * @param output_max the maximum number of bytes this function may write to
+ * output
+ */
+static void builtin_script_process(const unsigned char * input,
+                                   const unsigned int input_n,
+                                   unsigned char * output,
+                                   unsigned int * output_n,
+                                   const unsigned int output_max) {
+
+    struct builtin_command * command;
+    struct timeval now;
+    int elapsed;
+    int steps = 0;
+    int i;
+
+    builtin_script_receive(input, input_n);
+
+    while ((q_running_script.running == Q_TRUE) &&
+           (q_running_script.paused == Q_FALSE)) {
+
+        if (steps == BUILTIN_SCRIPT_MAX_STEPS) {
+            /*
+             * Let the main loop run, pick up here on the next round
+             */
+            return;
+        }
+        steps++;
+
+        if (builtin_pc == builtin_commands_n) {
+            builtin_script_exit(0);
+            return;
+        }
+        command = &builtin_commands[builtin_pc];
+
+        gettimeofday(&now, NULL);
+        if (builtin_armed == Q_FALSE) {
+            builtin_armed = Q_TRUE;
+            builtin_command_time = now;
+            builtin_progress = 0;
+            builtin_scanned = 0;
+        }
+        elapsed = (now.tv_sec - builtin_command_time.tv_sec) * 1000 +
+            (now.tv_usec - builtin_command_time.tv_usec) / 1000;
+
+        switch (command->op) {
+
+        case BUILTIN_SEND:
+            while (builtin_progress < command->chars_n) {
+                if (output_max - *output_n < 4) {
+                    /*
+                     * No room, finish on the next round
+                     */
+                    return;
+                }
+                *output_n += encode_script_char(
+                    command->chars[builtin_progress], output + *output_n);
+                builtin_progress++;
+            }
+            break;
+
+        case BUILTIN_PRINT:
+            for (i = 0; (i < command->chars_n) &&
+                 (stderr_utf8_buffer_n < Q_BUFFER_SIZE - 1); i++) {
+                stderr_utf8_buffer[stderr_utf8_buffer_n] = command->chars[i];
+                stderr_utf8_buffer_n++;
+            }
+            stderr_utf8_buffer[stderr_utf8_buffer_n] = '\n';
+            stderr_utf8_buffer_n++;
+            print_stderr();
+            break;
+
+        case BUILTIN_WAITFOR:
+        case BUILTIN_REGEX:
+            if (builtin_script_match() == Q_TRUE) {
+                break;
+            }
+            if ((command->value > 0) && (elapsed >= command->value)) {
+                if (command->target != -1) {
+                    builtin_pc = command->target;
+                    builtin_armed = Q_FALSE;
+                    continue;
+                }
+                qlog(_("Script timed out waiting for \"%s\"\n"),
+                     command->text);
+                builtin_script_exit(1);
+                return;
+            }
+            return;
+
+        case BUILTIN_PAUSE:
+            if (elapsed < command->value) {
+                return;
+            }
+            break;
+
+        case BUILTIN_LABEL:
+            break;
+
+        case BUILTIN_GOTO:
+            builtin_pc = command->target;
+            builtin_armed = Q_FALSE;
+            continue;
+
+        case BUILTIN_EXIT:
+            builtin_script_exit(command->value);
+            return;
+        }
+
+        /*
+         * On to the next command
+         */
+        builtin_pc++;
+        builtin_armed = Q_FALSE;
+    }
+}
+
+/**
+ * Process raw bytes from the remote side through the script.  See also
+ * console_process_incoming_data().
+ *
+ * @param input the bytes from the remote side
+ * @param input_n the number of bytes in input_n
+ * @param remaining the number of un-processed bytes that should be sent
+ * through a future invocation of script_process_data()
+ * @param output a buffer to contain the bytes to send to the remote side
+ * @param output_n the number of bytes that this function wrote to output
+ * @param output_max the maximum number of bytes this function may write to
+ * output
+ */
+void script_process_data(unsigned char * input, const unsigned int input_n,
+                         int * remaining, unsigned char * output,
+                         unsigned int * output_n,
+                         const unsigned int output_max) {
+
+    int rc = 0;
+    int n;
+    int i;
+    uint32_t utf8_char;
+    uint32_t last_utf8_state;
+#ifdef Q_PDCURSES_WIN32
+    DWORD actual_bytes = 0;
+    DWORD bytes_read = 0;
+#else
+    struct pollfd pfd;
+#endif
+    Q_BOOL check_stderr = Q_FALSE;
+
+    if (builtin_script == Q_TRUE) {
+        /*
+         * Built-in scripts see the remote data directly, and the console
+         * still gets all of it.  Bytes the console leaves in remaining come
+         * back on the next call, so the script only sees them then.
+         */
+        if (input_n > 0) {
+            console_process_incoming_data(input, input_n, remaining);
+        }
+        if ((q_running_script.running == Q_TRUE) &&
+            (q_running_script.paused == Q_FALSE)) {
+            builtin_script_process(input, input_n - *remaining, output,
+                                   output_n, output_max);
+        }
+        return;
+    }
+
+    DLOG(("script.c: buffer_full %s buffer_empty %s running %s paused %s\n",
+         (q_running_script.print_buffer_full == Q_TRUE ? "true" : "false"),
+         (q_running_script.print_buffer_empty == Q_TRUE ? "true" : "false"),
+         (q_running_script.running == Q_TRUE ? "true" : "false"),
+         (q_running_script.paused == Q_TRUE ? "true" : "false")));
+
+    DLOG(("script.c: stdin %s stdout %s buffer_n %d\n",
+         (q_running_script.stdin_writeable == Q_TRUE ? "true" : "false"),
+         (q_running_script.stdout_readable == Q_TRUE ? "true" : "false"),
+         print_buffer_n));
+
+    /*
+     * -----------------------------------------------------------------
+     * Dispatch things in print_buffer to script stdin
+     * -----------------------------------------------------------------
+     */
+    if (q_running_script.stdin_writeable == Q_TRUE) {
+        if (write_print_buffer() == Q_FALSE) {
+            return;
         }
     }
 
@@ -411,6 +1324,18 @@ void script_process_data(unsigned char * input, const unsigned int input_n,
         console_process_incoming_data(input, input_n, remaining);
     }
 
+    /*
+     * The pty was writeable this round, so hand the script what the remote
+     * side just printed rather than waiting for the next select().
+     */
+    if ((q_running_script.stdin_writeable == Q_TRUE) &&
+        (print_buffer_n > 0)
+    ) {
+        if (write_print_buffer() == Q_FALSE) {
+            return;
+        }
+    }
+
     /*
      * -----------------------------------------------------------------
      * Read bytes from script stderr, decode from UTF-8, and display on
@@ -701,46 +1626,7 @@ void script_process_data(unsigned char * input, const unsigned int input_n,
                 continue;
             }
 
-            switch (q_status.emulation) {
-            case Q_EMUL_TTY:
-            case Q_EMUL_ANSI:
-            case Q_EMUL_AVATAR:
-            case Q_EMUL_PETSCII:
-            case Q_EMUL_ATASCII:
-            case Q_EMUL_DEBUG:
-            case Q_EMUL_VT52:
-            case Q_EMUL_VT100:
-            case Q_EMUL_VT102:
-            case Q_EMUL_VT220:
-            case Q_EMUL_LINUX:
-            case Q_EMUL_XTERM:
-                /*
-                 * 8-bit emulations: try to backmap to the codepage,
-                 * including allowing Unicode synonyms.
-                 */
-                output[*output_n] = translate_unicode_to_8bit(
-                                        (wchar_t) utf8_char, q_status.codepage);
-                /*
-                 * 8-bit emulations
-                 */
-                output[*output_n] = (unsigned char) (utf8_char & 0xFF);
-                rc = 1;
-                break;
-            case Q_EMUL_LINUX_UTF8:
-            case Q_EMUL_XTERM_UTF8:
-                /*
-                 * UTF-8 emulations: encode outbound "keystroke", after
-                 * running it through the direct Unicode translation map.
-                 */
-                utf8_char = translate_unicode_out((wchar_t) utf8_char);
-
-                /*
-                 * Now re-encode on the wire.
-                 */
-                rc = utf8_encode((wchar_t) utf8_char,
-                                 (char *) &output[*output_n]);
-                break;
-            }
+            rc = encode_script_char(utf8_char, &output[*output_n]);
             *output_n += rc;
 
             if (output_max - *output_n < 4) {
@@ -825,9 +1711,7 @@ void script_start(const char * script_filename) {
     q_running_script.stdin_writeable = Q_FALSE;
     q_running_script.stdout_readable = Q_FALSE;
 
-    memset(print_buffer, 0, sizeof(print_buffer));
-    print_buffer_n = 0;
-    update_print_buffer_flags();
+    clear_print_buffer();
 
 #ifndef Q_PDCURSES_WIN32
 
@@ -856,6 +1740,22 @@ void script_start(const char * script_filename) {
     stderr_lines = line;
     stderr_last = stderr_lines;
 
+    builtin_script = is_builtin_script(script_filename);
+    if (builtin_script == Q_TRUE) {
+#ifndef Q_PDCURSES_WIN32
+        Xfree(stderr_filename, __FILE__, __LINE__);
+#endif
+        if (builtin_script_load(script_filename) == Q_FALSE) {
+            builtin_script = Q_FALSE;
+            return;
+        }
+        q_running_script.running = Q_TRUE;
+        q_running_script.paused = Q_FALSE;
+        time(&script_start_time);
+        switch_state(Q_STATE_SCRIPT_EXECUTE);
+        return;
+    }
+
 #ifdef Q_PDCURSES_WIN32
     /*
      * Modeled after example on MSDN:
@@ -1401,48 +2301,55 @@ void script_stop() {
     /*
      * Throw away the remaining print buffer
      */
-    print_buffer_n = 0;
-    update_print_buffer_flags();
+    clear_print_buffer();
+
+    if (builtin_script == Q_TRUE) {
+        builtin_script_free();
+    }
 
 #ifdef Q_PDCURSES_WIN32
 
-    if (GetExitCodeProcess(q_script_process, &status) == TRUE) {
-        /*
-         * Got return code
-         */
-        if (status == STILL_ACTIVE) {
+    if (builtin_script == Q_FALSE) {
+        if (GetExitCodeProcess(q_script_process, &status) == TRUE) {
             /*
-             * Process thinks it's still running, DIE!
+             * Got return code
              */
-            TerminateProcess(q_script_process, -1);
-            status = -1;
-            qlog(_("Script forcibly terminated: still thinks it is alive.\n"));
+            if (status == STILL_ACTIVE) {
+                /*
+                 * Process thinks it's still running, DIE!
+                 */
+                TerminateProcess(q_script_process, -1);
+                status = -1;
+                qlog(_("Script forcibly terminated: still thinks it is "
+                       "alive.\n"));
+            } else {
+                qlog(_("Script exited with RC=%u\n"), status);
+            }
         } else {
-            qlog(_("Script exited with RC=%u\n"), status);
+            /*
+             * Can't get process exit code
+             */
+            TerminateProcess(q_script_process, -1);
+            qlog(_("Script forcibly terminated: unable to get exit "
+                   "code.\n"));
         }
-    } else {
+
         /*
-         * Can't get process exit code
+         * Close pipes
          */
-        TerminateProcess(q_script_process, -1);
-        qlog(_("Script forcibly terminated: unable to get exit code.\n"));
-    }
-
-    /*
-     * Close pipes
-     */
-    CloseHandle(q_script_stdin);
-    q_script_stdin = NULL;
-    CloseHandle(q_script_stdout);
-    q_script_stdout = NULL;
-    if (q_script_stderr != NULL) {
-        CloseHandle(q_script_stderr);
-        q_script_stderr = NULL;
+        CloseHandle(q_script_stdin);
+        q_script_stdin = NULL;
+        CloseHandle(q_script_stdout);
+        q_script_stdout = NULL;
+        if (q_script_stderr != NULL) {
+            CloseHandle(q_script_stderr);
+            q_script_stderr = NULL;
+        }
+        CloseHandle(q_script_process);
+        q_script_process = NULL;
+        CloseHandle(q_script_thread);
+        q_script_thread = NULL;
     }
-    CloseHandle(q_script_process);
-    q_script_process = NULL;
-    CloseHandle(q_script_thread);
-    q_script_thread = NULL;
 
 #else
 
@@ -83,7 +83,9 @@ typedef struct {
     Q_BOOL stdout_readable;
 
     /**
-     * If true, the print buffer is full.
+     * If true, the print buffer has reached its high watermark and no more
+     * remote data should be processed until the script drains it to the low
+     * watermark.
      */
     Q_BOOL print_buffer_full;
 
@@ -76,6 +76,7 @@
 #include <ctype.h>
 #ifndef Q_PDCURSES_WIN32
 #include <wctype.h>
+#include <regex.h>
 #endif
 #include <stdlib.h>
 #include <string.h>
@@ -409,15 +410,13 @@ static void wrap_current_line() {
             /*
              * HTML
              */
-            fprintf(q_status.capture_file, "\n");
+            capture_printf("\n");
         } else if (q_status.capture_type == Q_CAPTURE_TYPE_NORMAL) {
             /*
              * Normal
              */
-            fprintf(q_status.capture_file, "\n");
+            capture_printf("\n");
         }
-        fflush(q_status.capture_file);
-        q_status.capture_flush_time = time(NULL);
         q_status.capture_x = 0;
     }
 }
@@ -706,15 +705,15 @@ void print_character(const wchar_t character) {
         if (q_status.cursor_x > q_status.capture_x) {
             for (i = 0; i < q_status.cursor_x - q_status.capture_x; i++) {
                 if (q_status.capture_type == Q_CAPTURE_TYPE_HTML) {
-                    fprintf(q_status.capture_file, "&nbsp;");
+                    capture_printf("&nbsp;");
                 } else {
-                    fprintf(q_status.capture_file, " ");
+                    capture_printf(" ");
                 }
                 if ((q_scrollback_current->double_width == Q_TRUE) &&
                     (q_status.emulation != Q_EMUL_PETSCII) &&
                     (q_status.emulation != Q_EMUL_ATASCII)
                 ) {
-                    fprintf(q_status.capture_file, " ");
+                    capture_printf(" ");
                 }
             }
             q_status.capture_x = q_status.cursor_x;
@@ -725,25 +724,25 @@ void print_character(const wchar_t character) {
              * HTML
              */
             if (color_changed == Q_TRUE) {
-                fprintf(q_status.capture_file, "</font><font %s>",
+                capture_printf("</font><font %s>",
                         color_to_html(q_current_color));
             }
             if (character2 == ' ') {
-                fprintf(q_status.capture_file, "&nbsp;");
+                capture_printf("&nbsp;");
             } else if (character2 == '<') {
-                fprintf(q_status.capture_file, "&lt;");
+                capture_printf("&lt;");
             } else if (character2 == '>') {
-                fprintf(q_status.capture_file, "&gt;");
+                capture_printf("&gt;");
             } else if (character2 < 0x7F) {
-                fprintf(q_status.capture_file, "%c", (int) character2);
+                capture_printf("%c", (int) character2);
             } else {
-                fprintf(q_status.capture_file, "&#%d;", (int) character2);
+                capture_printf("&#%d;", (int) character2);
             }
         } else if (q_status.capture_type == Q_CAPTURE_TYPE_NORMAL) {
             /*
              * Normal
              */
-            fprintf(q_status.capture_file, "%lc", (wint_t) character2);
+            capture_printf("%lc", (wint_t) character2);
         }
         q_status.capture_x++;
 
@@ -754,18 +753,10 @@ void print_character(const wchar_t character) {
             (q_status.emulation != Q_EMUL_PETSCII) &&
             (q_status.emulation != Q_EMUL_ATASCII)
         ) {
-            fprintf(q_status.capture_file, " ");
+            capture_printf(" ");
             q_status.capture_x++;
         }
 
-        /*
-         * Flush if we haven't in a while
-         */
-        if (q_status.capture_flush_time < time(NULL)) {
-            fflush(q_status.capture_file);
-            q_status.capture_flush_time = time(NULL);
-        }
-
     }
 
     /*
@@ -819,9 +810,97 @@ static void clear_scrollback() {
 
 }
 
+/* Size of the output buffer used by save_scrollback() and screen_dump() */
+#define SAVE_BUFFER_SIZE        65536
+
+/* Number of entries in the HTML color string cache */
+#define HTML_COLOR_CACHE_N      64
+
+/**
+ * Output buffer for save_scrollback() and screen_dump().  Whole lines are
+ * built here and written out with one fwrite() per SAVE_BUFFER_SIZE bytes.
+ */
+static char save_buffer[SAVE_BUFFER_SIZE];
+
+/**
+ * Number of bytes in save_buffer.
+ */
+static size_t save_buffer_n = 0;
+
+/**
+ * A cached color_to_html() result.
+ */
+struct html_color_cache_entry {
+    attr_t attr;
+    Q_BOOL valid;
+    size_t length;
+    char html[256];
+};
+
+/**
+ * Direct-mapped cache of "</font><font ...>" strings, indexed by attr.
+ */
+static struct html_color_cache_entry html_color_cache[HTML_COLOR_CACHE_N];
+
+/**
+ * Write everything in save_buffer to file.
+ *
+ * @param file the file to save to
+ */
+static void save_buffer_flush(FILE * file) {
+    if (save_buffer_n > 0) {
+        fwrite(save_buffer, 1, save_buffer_n, file);
+        save_buffer_n = 0;
+    }
+}
+
+/**
+ * Append bytes to save_buffer, flushing it to file first if they would
+ * not fit.
+ *
+ * @param file the file to save to
+ * @param data the bytes to append
+ * @param length the number of bytes in data
+ */
+static void save_buffer_append(FILE * file, const char * data,
+                               const size_t length) {
+
+    if (save_buffer_n + length > sizeof(save_buffer)) {
+        save_buffer_flush(file);
+    }
+    if (length > sizeof(save_buffer)) {
+        fwrite(data, 1, length, file);
+        return;
+    }
+    memcpy(save_buffer + save_buffer_n, data, length);
+    save_buffer_n += length;
+}
+
+/**
+ * Get the "</font><font ...>" string for a color, computing it with
+ * color_to_html() only the first time that color is seen.
+ *
+ * @param attr the curses attribute
+ * @return the cache entry for attr
+ */
+static struct html_color_cache_entry * html_color_lookup(const attr_t attr) {
+    struct html_color_cache_entry * entry;
+
+    entry = &html_color_cache[((attr >> 8) ^ attr) % HTML_COLOR_CACHE_N];
+    if ((entry->valid == Q_FALSE) || (entry->attr != attr)) {
+        snprintf(entry->html, sizeof(entry->html), "</font><font %s>",
+                 color_to_html(attr));
+        entry->length = strlen(entry->html);
+        entry->attr = attr;
+        entry->valid = Q_TRUE;
+    }
+    return entry;
+}
+
 /**
  * Save one line of the visible scrollback to file, including HTML or NORMAL
- * mode.
+ * mode.  Output goes to save_buffer; the caller must call
+ * save_buffer_flush() when done.
  *
  * @param file the file to save to
  * @param line the line to save
@@ -831,12 +910,32 @@ static void clear_scrollback() {
 static void save_scrollback_line(FILE * file, struct q_scrolline_struct * line,
                                  Q_CAPTURE_TYPE save_type,
                                  attr_t * last_color) {
+    /*
+     * Worst case per cell is a font change, an "&#NNNNNNN;" entity, and a
+     * "&nbsp;" for double-width.
+     */
+    char line_buffer[Q_MAX_LINE_LENGTH * 16 + 16];
+    struct html_color_cache_entry * color_entry;
+    mbstate_t state;
+    size_t n = 0;
+    size_t rc;
     int i;
     wchar_t ch;
     Q_BOOL color_changed = Q_FALSE;
+    Q_BOOL pad_double_width = Q_FALSE;
+    attr_t blank_color;
 
     assert(q_status.read_only == Q_FALSE);
 
+    blank_color = Q_A_NORMAL | scrollback_full_attr(Q_COLOR_CONSOLE_TEXT);
+    if ((line->double_width == Q_TRUE) &&
+        (q_status.emulation != Q_EMUL_PETSCII) &&
+        (q_status.emulation != Q_EMUL_ATASCII)
+    ) {
+        pad_double_width = Q_TRUE;
+    }
+    memset(&state, 0, sizeof(state));
+
     for (i = 0; i < WIDTH; i++) {
         /*
          * Break out at the end of the screen
@@ -845,17 +944,21 @@ static void save_scrollback_line(FILE * file, struct q_scrolline_struct * line,
             if ((2 * i) >= WIDTH) {
                 break;
             }
-        } else {
-            if (i >= WIDTH) {
-                break;
-            }
         }
+
+        /*
+         * Make room for the next cell and a font change, flushing whole
+         * lines-so-far to save_buffer as needed.
+         */
+        if (n + 512 > sizeof(line_buffer)) {
+            save_buffer_append(file, line_buffer, n);
+            n = 0;
+        }
+
         if (i >= line->length) {
             ch = ' ';
-            if (*last_color !=
-                (Q_A_NORMAL | scrollback_full_attr(Q_COLOR_CONSOLE_TEXT))) {
-                *last_color =
-                    Q_A_NORMAL | scrollback_full_attr(Q_COLOR_CONSOLE_TEXT);
+            if (*last_color != blank_color) {
+                *last_color = blank_color;
                 color_changed = Q_TRUE;
             }
         } else {
@@ -871,39 +974,48 @@ static void save_scrollback_line(FILE * file, struct q_scrolline_struct * line,
              * HTML
              */
             if (color_changed == Q_TRUE) {
-                fprintf(file, "</font><font %s>", color_to_html(*last_color));
+                color_entry = html_color_lookup(*last_color);
+                memcpy(line_buffer + n, color_entry->html,
+                       color_entry->length);
+                n += color_entry->length;
                 color_changed = Q_FALSE;
             }
             if (ch == ' ') {
-                fprintf(file, "&nbsp;");
+                memcpy(line_buffer + n, "&nbsp;", 6);
+                n += 6;
             } else if (ch == '<') {
-                fprintf(file, "&lt;");
+                memcpy(line_buffer + n, "&lt;", 4);
+                n += 4;
             } else if (ch == '>') {
-                fprintf(file, "&gt;");
+                memcpy(line_buffer + n, "&gt;", 4);
+                n += 4;
             } else if (ch < 0x7F) {
-                fprintf(file, "%c", (int) ch);
+                line_buffer[n++] = (char) ch;
             } else {
-                fprintf(file, "&#%d;", (int) ch);
+                n += sprintf(line_buffer + n, "&#%d;", (int) ch);
+            }
+            if (pad_double_width == Q_TRUE) {
+                memcpy(line_buffer + n, "&nbsp;", 6);
+                n += 6;
             }
         } else if (save_type == Q_CAPTURE_TYPE_NORMAL) {
             /*
              * Normal
              */
-            fprintf(file, "%lc", (wint_t) ch);
-        }
-        if ((line->double_width == Q_TRUE) &&
-            (q_status.emulation != Q_EMUL_PETSCII) &&
-            (q_status.emulation != Q_EMUL_ATASCII)
-        ) {
-            if (save_type == Q_CAPTURE_TYPE_HTML) {
-                fprintf(file, "&nbsp;");
+            rc = wcrtomb(line_buffer + n, ch, &state);
+            if (rc != (size_t) -1) {
+                n += rc;
             } else {
-                fprintf(file, " ");
+                memset(&state, 0, sizeof(state));
+            }
+            if (pad_double_width == Q_TRUE) {
+                line_buffer[n++] = ' ';
             }
         }
 
     }                           /* for (i = 0; i < WIDTH; i++) */
-    fprintf(file, "\n");
+    line_buffer[n++] = '\n';
+    save_buffer_append(file, line_buffer, n);
 }
 
 /**
@@ -985,6 +1097,7 @@ static Q_BOOL save_scrollback(const char * filename,
                                  &color);
         }
     }
+    save_buffer_flush(file);
 
     if (q_status.scrollback_save_type == Q_CAPTURE_TYPE_HTML) {
         /*
@@ -1069,6 +1182,7 @@ Q_BOOL screen_dump(const char * filename) {
         save_scrollback_line(file, line, q_status.screen_dump_type, &color);
         line = line->next;
     }
+    save_buffer_flush(file);
 
     if (q_status.screen_dump_type == Q_CAPTURE_TYPE_HTML) {
         /*
@@ -1096,6 +1210,191 @@ Q_BOOL screen_dump(const char * filename) {
     return Q_TRUE;
 }
 
+/**
+ * Highlight count characters of a matching line starting at start.
+ *
+ * @param line the line
+ * @param start the first character to highlight
+ * @param count the number of characters to highlight
+ */
+static void highlight_search_match(struct q_scrolline_struct * line,
+                                   const int start, const int count) {
+    int i;
+
+    if (line->search_match == Q_FALSE) {
+        line->search_match = Q_TRUE;
+        memcpy(line->search_colors, line->colors, sizeof(line->colors));
+    }
+    for (i = start; (i < start + count) && (i < Q_MAX_LINE_LENGTH); i++) {
+        line->search_colors[i] |= Q_A_BLINK | Q_A_REVERSE;
+    }
+}
+
+/**
+ * Mark every line in the scrollback buffer that matches a Find string, and
+ * highlight the matches.  Plain strings are matched case-insensitively.  On
+ * POSIX systems a string written as /pattern/ is a case-insensitive POSIX
+ * extended regular expression instead.
+ *
+ * @param search the string the user entered.  Plain strings are lowercased
+ * in place.
+ * @return true if any line matched.  Otherwise the user has already been
+ * told why.
+ */
+static Q_BOOL find_scrollback_matches(wchar_t * search) {
+    struct q_scrolline_struct * line;
+    wchar_t lower_line[Q_MAX_LINE_LENGTH];
+    wchar_t * begin;
+    Q_BOOL find_found = Q_FALSE;
+    Q_BOOL use_regex = Q_FALSE;
+    int search_n;
+    int line_n;
+    int i;
+#ifndef Q_PDCURSES_WIN32
+    /*
+     * Each character is at most 4 bytes of UTF-8
+     */
+    char utf8_line[Q_MAX_LINE_LENGTH * 4 + 1];
+    short utf8_index[Q_MAX_LINE_LENGTH * 4 + 1];
+    char * pattern;
+    regex_t regex;
+    regmatch_t match;
+    char error_message[DIALOG_MESSAGE_SIZE / 2];
+    char notify_message[DIALOG_MESSAGE_SIZE];
+    int utf8_n;
+    int offset;
+    int rc;
+    int j;
+#endif
+
+    search_n = wcslen(search);
+
+#ifndef Q_PDCURSES_WIN32
+    if ((search_n > 2) && (search[0] == '/') && (search[search_n - 1] == '/')) {
+        /*
+         * Regular expression
+         */
+        pattern = (char *) Xmalloc(search_n * 4 + 1, __FILE__, __LINE__);
+        utf8_n = 0;
+        for (i = 1; i < search_n - 1; i++) {
+            utf8_n += utf8_encode(search[i], pattern + utf8_n);
+        }
+        pattern[utf8_n] = 0;
+        rc = regcomp(&regex, pattern, REG_EXTENDED | REG_ICASE);
+        Xfree(pattern, __FILE__, __LINE__);
+        if (rc != 0) {
+            /*
+             * Don't leave the last search highlighted, and don't let a
+             * typo look like no match.
+             */
+            for (line = q_scrollback_buffer; line != NULL; line = line->next) {
+                line->search_match = Q_FALSE;
+            }
+            regerror(rc, &regex, error_message, sizeof(error_message));
+            snprintf(notify_message, sizeof(notify_message),
+                     _("Invalid regular expression: %s"), error_message);
+            notify_form(notify_message, 0);
+            return Q_FALSE;
+        }
+        use_regex = Q_TRUE;
+    }
+#endif
+
+    /*
+     * Force lowercase.  Regular expressions are left as typed, REG_ICASE
+     * already ignores case and lowercasing would change escapes like \S.
+     */
+    if (use_regex == Q_FALSE) {
+        for (i = 0; i < search_n; i++) {
+            search[i] = towlower(search[i]);
+        }
+    }
+
+    for (line = q_scrollback_buffer; line != NULL; line = line->next) {
+        line->search_match = Q_FALSE;
+        if (line->chars[Q_MAX_LINE_LENGTH - 1] != 0) {
+            line->chars[Q_MAX_LINE_LENGTH - 1] = 0;
+        }
+
+#ifndef Q_PDCURSES_WIN32
+        if (use_regex == Q_TRUE) {
+            /*
+             * Encode to UTF-8, remembering which character each byte
+             * belongs to.
+             */
+            utf8_n = 0;
+            for (i = 0; line->chars[i] != 0; i++) {
+                rc = utf8_encode(line->chars[i], utf8_line + utf8_n);
+                for (j = 0; j < rc; j++) {
+                    utf8_index[utf8_n + j] = i;
+                }
+                utf8_n += rc;
+            }
+            utf8_line[utf8_n] = 0;
+            utf8_index[utf8_n] = i;
+
+            offset = 0;
+            while ((offset <= utf8_n) &&
+                   (regexec(&regex, utf8_line + offset, 1, &match,
+                            (offset > 0 ? REG_NOTBOL : 0)) == 0)) {
+                if (match.rm_eo > match.rm_so) {
+                    highlight_search_match(line,
+                        utf8_index[offset + match.rm_so],
+                        utf8_index[offset + match.rm_eo] -
+                        utf8_index[offset + match.rm_so]);
+                    offset += match.rm_eo;
+                } else {
+                    /*
+                     * Empty match: the line matches, but there is nothing
+                     * to highlight here.
+                     */
+                    if (line->search_match == Q_FALSE) {
+                        highlight_search_match(line, 0, 0);
+                    }
+                    offset += match.rm_so + 1;
+                }
+            }
+            if (line->search_match == Q_TRUE) {
+                find_found = Q_TRUE;
+            }
+            continue;
+        }
+#endif
+
+        /*
+         * Lowercase into a local buffer rather than allocating a copy of
+         * every line.
+         */
+        for (line_n = 0; line->chars[line_n] != 0; line_n++) {
+            lower_line[line_n] = towlower(line->chars[line_n]);
+        }
+        lower_line[line_n] = 0;
+        if (line_n < search_n) {
+            continue;
+        }
+
+        for (begin = wcsstr(lower_line, search); begin != NULL;
+             begin = wcsstr(begin + 1, search)) {
+            /*
+             * Found, highlight it
+             */
+            highlight_search_match(line, begin - lower_line, search_n);
+            find_found = Q_TRUE;
+        }
+    }
+
+#ifndef Q_PDCURSES_WIN32
+    if (use_regex == Q_TRUE) {
+        regfree(&regex);
+    }
+#endif
+
+    if (find_found == Q_FALSE) {
+        notify_form(_("Text not found"), 1.5);
+    }
+    return find_found;
+}
+
 /**
  * Keyboard handler for the Alt-/ view scrollback state.
  *
@@ -1111,8 +1410,6 @@ void scrollback_keyboard_handler(const int keystroke, const int flags) {
     unsigned int local_height;
     char * filename;
     char notify_message[DIALOG_MESSAGE_SIZE];
-    wchar_t * lower_line = NULL;
-    wchar_t * begin;
     Q_BOOL find_found = Q_FALSE;
 
     local_height = HEIGHT - STATUS_HEIGHT - 2;
@@ -1135,59 +1432,12 @@ void scrollback_keyboard_handler(const int keystroke, const int flags) {
         if (q_scrollback_search_string == NULL) {
             break;
         }
-        /*
-         * Force lowercase
-         */
-        for (i = 0; i < wcslen(q_scrollback_search_string); i++) {
-            q_scrollback_search_string[i] =
-                towlower(q_scrollback_search_string[i]);
-        }
-        /*
-         * Search for the first matching line
-         */
-        line = q_scrollback_buffer;
-        while (line != NULL) {
-            if (line->chars[Q_MAX_LINE_LENGTH - 1] != 0) {
-                line->chars[Q_MAX_LINE_LENGTH - 1] = 0;
-            }
-            lower_line = Xwcsdup(line->chars, __FILE__, __LINE__);
-            /*
-             * Force lowercase
-             */
-            for (i = 0; i < wcslen(lower_line); i++) {
-                lower_line[i] = towlower(lower_line[i]);
-            }
-            if (wcsstr(lower_line, q_scrollback_search_string) != NULL) {
-                /*
-                 * Found, highlight it
-                 */
-                line->search_match = Q_TRUE;
-                memcpy(line->search_colors, line->colors, sizeof(line->colors));
-                begin = wcsstr(lower_line, q_scrollback_search_string);
-                while (begin != NULL) {
-                    for (i = 0; i < wcslen(q_scrollback_search_string); i++) {
-                        line->search_colors[i + (begin - lower_line)] |=
-                            Q_A_BLINK | Q_A_REVERSE;
-                    }
-                    begin = wcsstr(begin + 1, q_scrollback_search_string);
-                }
-                find_found = Q_TRUE;
-            } else {
-                /*
-                 * Not found
-                 */
-                line->search_match = Q_FALSE;
-            }
-
-            Xfree(lower_line, __FILE__, __LINE__);
-            line = line->next;
-        }
+        find_found = find_scrollback_matches(q_scrollback_search_string);
 
         /*
          * Text not found
          */
         if (find_found == Q_FALSE) {
-            notify_form(_("Text not found"), 1.5);
             break;
         } else {
             /*
@@ -1247,62 +1497,13 @@ void scrollback_keyboard_handler(const int keystroke, const int flags) {
                 break;
             }
 
-            /*
-             * Force lowercase
-             */
-            for (i = 0; i < wcslen(q_scrollback_search_string); i++) {
-                q_scrollback_search_string[i] =
-                    towlower(q_scrollback_search_string[i]);
-            }
-            /*
-             * Search for the first matching line
-             */
-            line = q_scrollback_buffer;
-            while (line != NULL) {
-                if (line->chars[Q_MAX_LINE_LENGTH - 1] != 0) {
-                    line->chars[Q_MAX_LINE_LENGTH - 1] = 0;
-                }
-                lower_line = Xwcsdup(line->chars, __FILE__, __LINE__);
-                /*
-                 * Force lowercase
-                 */
-                for (i = 0; i < wcslen(lower_line); i++) {
-                    lower_line[i] = towlower(lower_line[i]);
-                }
-                if (wcsstr(lower_line, q_scrollback_search_string) != NULL) {
-                    /*
-                     * Found, highlight it
-                     */
-                    line->search_match = Q_TRUE;
-                    memcpy(line->search_colors, line->colors,
-                           sizeof(line->colors));
-                    begin = wcsstr(lower_line, q_scrollback_search_string);
-                    while (begin != NULL) {
-                        for (i = 0; i < wcslen(q_scrollback_search_string);
-                             i++) {
-
-                            line->search_colors[i + (begin - lower_line)] |=
-                                Q_A_BLINK | Q_A_REVERSE;
-                        }
-                        begin = wcsstr(begin + 1, q_scrollback_search_string);
-                    }
-                    find_found = Q_TRUE;
-                } else {
-                    /*
-                     * Not found
-                     */
-                    line->search_match = Q_FALSE;
-                }
-
-                Xfree(lower_line, __FILE__, __LINE__);
-                line = line->next;
-            }
+            find_found = find_scrollback_matches(
+                q_scrollback_search_string);
 
             /*
              * Text not found
              */
             if (find_found == Q_FALSE) {
-                notify_form(_("Text not found"), 1.5);
                 Xfree(q_scrollback_search_string, __FILE__, __LINE__);
                 q_scrollback_search_string = NULL;
                 break;
@@ -2280,15 +2481,13 @@ void cursor_down(const int count, const Q_BOOL honor_scroll_region) {
                 /*
                  * HTML
                  */
-                fprintf(q_status.capture_file, "\n");
+                capture_printf("\n");
             } else if (q_status.capture_type == Q_CAPTURE_TYPE_NORMAL) {
                 /*
                  * Normal
                  */
-                fprintf(q_status.capture_file, "\n");
+                capture_printf("\n");
             }
-            fflush(q_status.capture_file);
-            q_status.capture_flush_time = time(NULL);
             q_status.capture_x = 0;
         }
 
@@ -2711,16 +2910,12 @@ void cursor_linefeed(const Q_BOOL new_line_mode) {
             /*
              * HTML
              */
-            fprintf(q_status.capture_file, "\n");
+            capture_printf("\n");
         } else if (q_status.capture_type == Q_CAPTURE_TYPE_NORMAL) {
             /*
              * Normal
              */
-            fprintf(q_status.capture_file, "\n");
-        }
-        if (q_status.capture_flush_time != time(NULL)) {
-            fflush(q_status.capture_file);
-            q_status.capture_flush_time = time(NULL);
+            capture_printf("\n");
         }
     }
 
@@ -370,6 +370,8 @@ void switch_state(const Q_PROGRAM_STATE new_state) {
     case Q_STATE_MODEM_CONFIG:
 #endif
     case Q_STATE_PHONEBOOK:
+        load_phonebook_if_needed();
+        /* Fall through... */
     case Q_STATE_TRANSLATE_EDITOR_8BIT:
     case Q_STATE_TRANSLATE_EDITOR_UNICODE:
         set_blocking_input(Q_TRUE);
@@ -134,6 +134,28 @@ static unsigned char current_block[XMODEM_MAX_BLOCK_SIZE];
 /* Size of current_block */
 static unsigned int current_block_n = 0;
 
+/*
+ * Size of the file read-ahead and write-behind buffers.  The sender reads
+ * the file in chunks this big and slices blocks out of them; the -G receivers
+ * collect this many bytes of verified blocks before writing them.
+ */
+#define XMODEM_FILE_BUFFER_SIZE (64 * 1024)
+
+/* File data read from disk but not yet put into a block */
+static unsigned char read_buffer[XMODEM_FILE_BUFFER_SIZE];
+
+/* Number of bytes in read_buffer */
+static unsigned int read_buffer_n = 0;
+
+/* Next byte in read_buffer to put into a block */
+static unsigned int read_buffer_i = 0;
+
+/* Verified block data not yet written to disk (X_1K_G and Y_G only) */
+static unsigned char write_buffer[XMODEM_FILE_BUFFER_SIZE];
+
+/* Number of bytes in write_buffer */
+static unsigned int write_buffer_n = 0;
+
 /* Sequence # of current_block.  Start with 1. */
 static unsigned char current_block_sequence_i = 1;
 
@@ -248,6 +270,99 @@ static void clear_block() {
     current_block_n = 0;
 }
 
+/**
+ * Read file data for the next block to send out of read_buffer, refilling it
+ * from disk as needed.  On a read error ferror(file) is set.
+ *
+ * @param buffer the buffer to copy the file data to
+ * @param n the number of bytes wanted
+ * @param eof set to true if the file ended before n bytes could be read
+ * @return the number of bytes copied to buffer
+ */
+static int read_file_data(unsigned char * buffer, const unsigned int n,
+                          Q_BOOL * eof) {
+    unsigned int rc = 0;
+    unsigned int count;
+
+    *eof = Q_FALSE;
+    while (rc < n) {
+        if (read_buffer_i == read_buffer_n) {
+            read_buffer_n = fread(read_buffer, 1, sizeof(read_buffer), file);
+            read_buffer_i = 0;
+            if (read_buffer_n == 0) {
+                *eof = Q_TRUE;
+                break;
+            }
+        }
+        count = read_buffer_n - read_buffer_i;
+        if (count > n - rc) {
+            count = n - rc;
+        }
+        memcpy(buffer + rc, read_buffer + read_buffer_i, count);
+        read_buffer_i += count;
+        rc += count;
+    }
+    return rc;
+}
+
+/**
+ * Write everything in write_buffer to disk.
+ *
+ * @return true if all of it was written
+ */
+static Q_BOOL flush_write_buffer() {
+    unsigned int rc;
+
+    if (write_buffer_n == 0) {
+        return Q_TRUE;
+    }
+    rc = fwrite(write_buffer, 1, write_buffer_n, file);
+    if (rc != write_buffer_n) {
+        DLOG(("flush_write_buffer() only wrote %d instead of %d\n", rc,
+                write_buffer_n));
+        DLOG(("flush_write_buffer() ferror: %d\n", ferror(file)));
+        write_buffer_n = 0;
+        return Q_FALSE;
+    }
+    write_buffer_n = 0;
+    fflush(file);
+    return Q_TRUE;
+}
+
+/**
+ * Append verified block data to the file.  The -G flavors never wait for an
+ * ACK, so their data goes through write_buffer and reaches the disk in large
+ * chunks; the other flavors write and flush every block.
+ *
+ * @param buffer the block data
+ * @param n the number of bytes in buffer
+ * @return true if the data was written (or buffered) OK
+ */
+static Q_BOOL write_file_data(const unsigned char * buffer,
+                              const unsigned int n) {
+    unsigned int rc;
+
+    if ((flavor == X_1K_G) || (flavor == Y_G)) {
+        if (write_buffer_n + n > sizeof(write_buffer)) {
+            if (flush_write_buffer() == Q_FALSE) {
+                return Q_FALSE;
+            }
+        }
+        memcpy(write_buffer + write_buffer_n, buffer, n);
+        write_buffer_n += n;
+        return Q_TRUE;
+    }
+
+    rc = fwrite(buffer, 1, n, file);
+    if (rc != n) {
+        DLOG(("write_file_data() only wrote %d instead of %d\n", rc, n));
+        DLOG(("write_file_data() ferror: %d\n", ferror(file)));
+        return Q_FALSE;
+    }
+    fflush(file);
+    return Q_TRUE;
+}
+
 /**
  * Reset the timeout timer.
  */
@@ -567,6 +682,8 @@ static Q_BOOL setup_for_next_file() {
         fclose(file);
     }
     file = NULL;
+    read_buffer_n = 0;
+    read_buffer_i = 0;
     if (filename != NULL) {
         Xfree(filename, __FILE__, __LINE__);
     }
@@ -592,8 +709,8 @@ static Q_BOOL setup_for_next_file() {
     /*
      * Open the file
      */
-    if ((file = fopen(upload_file_list[upload_file_list_i].name,
-                "rb")) == NULL) {
+    if ((file = open_upload_file(upload_file_list,
+                upload_file_list_i)) == NULL) {
 
         DLOG(("Unable to open file %s, returning false\n",
                 upload_file_list[upload_file_list_i].name));
@@ -942,6 +1059,7 @@ static Q_BOOL ymodem_decode_block_0() {
         stats_increment_errors(_("FILE OPEN ERROR"));
         return Q_FALSE;
     }
+    write_buffer_n = 0;
 
     /*
      * Length
@@ -1016,6 +1134,7 @@ static Q_BOOL construct_block() {
     unsigned char checksum;
     int crc;
     int rc;
+    Q_BOOL eof;
     char notify_message[DIALOG_MESSAGE_SIZE];
 
     /*
@@ -1033,7 +1152,7 @@ static Q_BOOL construct_block() {
          */
         DLOG2(("128\n"));
 
-        rc = fread(current_block + 3, 1, 128, file);
+        rc = read_file_data(current_block + 3, 128, &eof);
         if (ferror(file)) {
             snprintf(notify_message, sizeof(notify_message),
                      _("Error reading from file \"%s\": %s"), filename,
@@ -1042,7 +1161,7 @@ static Q_BOOL construct_block() {
             stats_file_cancelled(_("DISK READ ERROR"));
             return Q_FALSE;
         }
-        if (feof(file)) {
+        if (eof == Q_TRUE) {
             DLOG(("LAST BLOCK\n"));
             state = LAST_BLOCK;
         }
@@ -1078,7 +1197,7 @@ static Q_BOOL construct_block() {
          */
         DLOG2(("1024\n"));
 
-        rc = fread(current_block + 3, 1, 1024, file);
+        rc = read_file_data(current_block + 3, 1024, &eof);
         if (ferror(file)) {
             snprintf(notify_message, sizeof(notify_message),
                      _("Error reading from file \"%s\": %s"), filename,
@@ -1087,7 +1206,7 @@ static Q_BOOL construct_block() {
             stats_file_cancelled(_("DISK READ ERROR"));
             return Q_FALSE;
         }
-        if (feof(file)) {
+        if (eof == Q_TRUE) {
             DLOG(("LAST BLOCK\n"));
             state = LAST_BLOCK;
         }
@@ -1140,7 +1259,6 @@ static Q_BOOL verify_block() {
     unsigned int i;
     unsigned char checksum;
     int crc;
-    int rc;
     unsigned char ch;
     unsigned char ch2;
 
@@ -1324,26 +1442,19 @@ static Q_BOOL verify_block() {
         /*
          * 128 byte block
          */
-        rc = fwrite(current_block + 3, 1, 128, file);
-        if (rc != 128) {
+        if (write_file_data(current_block + 3, 128) == Q_FALSE) {
             stats_increment_errors(_("FILE WRITE ERROR, IS DISK FULL?"));
-            DLOG(("verify_block() only wrote %d instead of 128\n", rc));
-            DLOG(("verify_block() ferror: %d\n", ferror(file)));
             return Q_FALSE;
         }
     } else {
         /*
          * 1024 byte block
          */
-        rc = fwrite(current_block + 3, 1, 1024, file);
-        if (rc != 1024) {
+        if (write_file_data(current_block + 3, 1024) == Q_FALSE) {
             stats_increment_errors(_("FILE WRITE ERROR, IS DISK FULL?"));
-            DLOG(("verify_block() only wrote %d instead of 1024\n", rc));
-            DLOG(("verify_block() ferror: %d\n", ferror(file)));
             return Q_FALSE;
         }
     }
-    fflush(file);
 
     /*
      * Increment sequence #
@@ -1560,7 +1671,15 @@ static void xmodem_receive(unsigned char * input, unsigned int * input_n,
              * block, process it, and come back for more.
              */
             unsigned int n = 1024 + 5;
-            if (current_block[0] == C_SOH) {
+            if ((current_block_n == 0) && (*input_n > 0) &&
+                (input[0] == C_SOH)
+            ) {
+                /*
+                 * A short block starts at the front of input.
+                 */
+                n = 128 + 5;
+            } else if ((current_block_n > 0) &&
+                       (current_block[0] == C_SOH)) {
                 /*
                  * We need a short block, not a long one.
                  */
@@ -1661,6 +1780,13 @@ eot:
              */
             clear_block();
 
+            /*
+             * Get everything onto the disk before trimming it.
+             */
+            if (flush_write_buffer() == Q_FALSE) {
+                stats_increment_errors(_("FILE WRITE ERROR, IS DISK FULL?"));
+            }
+
             /*
              * Xmodem pads the file with SUBs.  We generally don't want these
              * SUBs to be in the final file image, as that leads to a corrupt
@@ -2880,6 +3006,9 @@ Q_BOOL xmodem_start(const char * in_filename, const Q_BOOL send,
     filename = Xstrdup(in_filename, __FILE__, __LINE__);
     sending = send;
     flavor = in_flavor;
+    read_buffer_n = 0;
+    read_buffer_i = 0;
+    write_buffer_n = 0;
     state = INIT;
     current_block_sequence_i = 1;
     current_block_number = 1;
@@ -2985,10 +3114,14 @@ void xmodem_stop(const Q_BOOL save_partial) {
 
     if ((save_partial == Q_TRUE) || (sending == Q_TRUE)) {
         if (file != NULL) {
+            if (sending == Q_FALSE) {
+                flush_write_buffer();
+            }
             fflush(file);
             fclose(file);
         }
     } else {
+        write_buffer_n = 0;
         if (file != NULL) {
             fclose(file);
             if (unlink(filename) < 0) {
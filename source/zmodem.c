@@ -51,6 +51,7 @@
 #  include <unistd.h>
 #endif
 #include <libgen.h>
+#include <sys/time.h>
 #include <errno.h>
 #include <string.h>
 #include <stdlib.h>
@@ -88,6 +89,33 @@ static const char * DLOGNAME = NULL;
  */
 #define WINDOW_SIZE_UNRELIABLE 4
 
+/*
+ * Bounds for block_size_adjust().  Block and window sizes are powers of two.
+ */
+#define ZMODEM_MIN_BLOCK_SIZE   32
+#define WINDOW_SIZE_MIN         2
+#define WINDOW_SIZE_MAX         64
+
+/*
+ * Framing bytes on each data subpacket: ZDLE, frame end, CRC-32, and a few
+ * escapes.
+ */
+#define ZMODEM_SUBPACKET_OVERHEAD 8
+
+/*
+ * Give up after this many retransmit requests in a row at
+ * ZMODEM_MIN_BLOCK_SIZE with no clean window between them.
+ */
+#define ZMODEM_NOISE_RETRANSMITS 10
+
+/*
+ * The error rate starts at half an error over 64k, so that a short clean
+ * history doesn't look perfect.  This prior decays with the rest of the
+ * history.
+ */
+#define ZMODEM_PRIOR_BYTES      65536.0
+#define ZMODEM_PRIOR_ERRORS     0.5
+
 /* Data types ----------------------------------------------- */
 
 /* Used to note the start of a packet */
@@ -300,18 +328,12 @@ struct ZMODEM_STATUS {
     /* Number of bytes confirmed from the receiver */
     int confirmed_bytes;
 
-    /*
-     * Number of bytes confirmed from the receiver when we dropped the block
-     * size.
-     */
-    int last_confirmed_bytes;
+    /* Number of blocks between ZACK requests */
+    unsigned window_size;
 
     /* True means TCP/IP or error-correcting modem */
     Q_BOOL reliable_link;
 
-    /* File position when the block size was last reduced */
-    off_t file_position_downgrade;
-
     /* When 0, require a ZACK, controls window size */
     unsigned blocks_ack_count;
 
@@ -349,10 +371,54 @@ static struct ZMODEM_STATUS status = {
     0,
     Q_TRUE,
     0,
-    0,
     0
 };
 
+/**
+ * The sender's measurements of the link, used by block_size_adjust().
+ */
+struct ZMODEM_LINK_STATS {
+    /* Time the first block of the current window went out, in millis */
+    uint64_t window_begin;
+
+    /* Time the current window asked for a ZACK, in millis */
+    uint64_t ack_request;
+
+    /* Wire bytes sent in the current window */
+    unsigned long window_bytes;
+
+    /*
+     * Smoothed round-trip time in millis from a ZACK request to its ZACK,
+     * including the time to drain whatever was queued ahead of it.  0 until
+     * measured.
+     */
+    unsigned long round_trip_ms;
+
+    /*
+     * Smallest round-trip time seen, in millis: the stall the link actually
+     * idles for at the end of each window.
+     */
+    unsigned long min_round_trip_ms;
+
+    /* Smoothed link rate, 0 until measured */
+    double bytes_per_second;
+
+    /* Decaying count of wire bytes sent */
+    double bytes;
+
+    /* Decaying count of retransmit requests */
+    double errors;
+
+    /*
+     * Retransmit requests in a row at ZMODEM_MIN_BLOCK_SIZE, reset by a
+     * clean window
+     */
+    int min_block_retransmits;
+};
+
+/* Link measurements for the current transfer */
+static struct ZMODEM_LINK_STATS link_stats;
+
 /* The list of files to upload */
 static struct file_info * upload_file_list;
 
@@ -544,57 +610,299 @@ static uint32_t compute_crc32(const uint32_t old_crc, const unsigned char * buf,
 /* ------------------------------------------------------------------------ */
 
 /**
- * Move up to a larger block size if things are going better.
+ * Get the current time in millis.
+ *
+ * @return the time in millis since the epoch
  */
-static void block_size_up() {
-    DLOG(("block_size_up(): block_size = %d\n", status.block_size));
+static uint64_t now_millis() {
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    return ((uint64_t) tv.tv_sec * 1000) + (tv.tv_usec / 1000);
+}
+
+/**
+ * Estimate the goodput of sending windows of window_size blocks of
+ * block_size bytes each.  Every window ends with a stall waiting for the
+ * ZACK.  Every damaged block costs itself, everything sent after it before
+ * the ZRPOS comes back (at most the rest of the window), and a stall.
+ *
+ * @param block_size the number of file bytes per data subpacket
+ * @param window_size the number of subpackets between ZACK requests
+ * @param error_rate the probability that any one byte is damaged
+ * @return the expected file bytes per second
+ */
+static double window_goodput(const int block_size, const int window_size,
+                             const double error_rate) {
+
+    double rate = link_stats.bytes_per_second;
+    double stall = link_stats.min_round_trip_ms / 1000.0;
+    double window_bytes;
+    double in_flight;
+    double errors;
+    double seconds;
+
+    window_bytes = window_size * (block_size + ZMODEM_SUBPACKET_OVERHEAD);
+    in_flight = rate * link_stats.round_trip_ms / 1000.0;
+    if (in_flight > window_bytes) {
+        in_flight = window_bytes;
+    }
+    errors = window_bytes * error_rate;
+    seconds = (window_bytes / rate) + stall +
+        (errors * ((((block_size + ZMODEM_SUBPACKET_OVERHEAD) + in_flight) /
+                    rate) + stall));
+    return (window_size * block_size) / seconds;
+}
+
+/**
+ * Get the largest window size worth considering with a block size.  The
+ * rate and round trip are only measured on windows that come back clean,
+ * so keep them short enough that most of them do.
+ *
+ * @param block_size the number of file bytes per data subpacket
+ * @param error_rate the per-byte error rate
+ * @return the number of subpackets between ZACK requests
+ */
+static int window_size_max(const int block_size, const double error_rate) {
+    int window_size;
+
+    for (window_size = WINDOW_SIZE_MIN; window_size < WINDOW_SIZE_MAX;
+         window_size *= 2) {
+
+        if (window_size * 2 * (block_size + ZMODEM_SUBPACKET_OVERHEAD) *
+            error_rate > 0.5) {
+            break;
+        }
+    }
+    return window_size;
+}
+
+/**
+ * Get the current estimate of the per-byte error rate.
+ *
+ * @return the probability that any one byte is damaged
+ */
+static double link_error_rate() {
+    if (link_stats.bytes < 1.0) {
+        return 1.0;
+    }
+    if (link_stats.errors >= link_stats.bytes) {
+        return 1.0;
+    }
+    return link_stats.errors / link_stats.bytes;
+}
+
+/**
+ * Pick the block size and window size with the best expected goodput for
+ * the measured link rate, round-trip time, and error rate.
+ */
+static void block_size_adjust() {
+    int block_size;
+    int window_size;
+    int best_block_size;
+    int best_window_size;
+    double goodput;
+    double best_goodput;
+    double error_rate = link_error_rate();
+
+    if (link_stats.bytes_per_second <= 0.0) {
+        /*
+         * Nothing measured yet: keep the fixed window size, and pick the
+         * block size on wire efficiency alone.
+         */
+        if (status.reliable_link == Q_TRUE) {
+            status.window_size = WINDOW_SIZE_RELIABLE;
+        } else {
+            status.window_size = WINDOW_SIZE_UNRELIABLE;
+        }
+        best_goodput = 0.0;
+        for (block_size = ZMODEM_MIN_BLOCK_SIZE;
+             block_size <= ZMODEM_BLOCK_SIZE; block_size *= 2) {
+
+            goodput = (double) block_size /
+                ((block_size + ZMODEM_SUBPACKET_OVERHEAD) *
+                    (1.0 + ((block_size + ZMODEM_SUBPACKET_OVERHEAD) *
+                            error_rate)));
+            if (goodput > best_goodput) {
+                best_goodput = goodput;
+                status.block_size = block_size;
+            }
+        }
+    } else {
+        /*
+         * Only move off the current sizes for a clear win, otherwise the
+         * noise in the estimates flips them back and forth.
+         */
+        best_block_size = status.block_size;
+        best_window_size = status.window_size;
+        if (best_window_size > window_size_max(best_block_size, error_rate)) {
+            best_window_size = window_size_max(best_block_size, error_rate);
+        }
+        best_goodput = 1.05 * window_goodput(best_block_size,
+                                             best_window_size, error_rate);
+
+        for (block_size = ZMODEM_MIN_BLOCK_SIZE;
+             block_size <= ZMODEM_BLOCK_SIZE; block_size *= 2) {
+
+            for (window_size = WINDOW_SIZE_MIN;
+                 window_size <= window_size_max(block_size, error_rate);
+                 window_size *= 2) {
+
+                goodput = window_goodput(block_size, window_size,
+                                         error_rate);
+                if (goodput > best_goodput) {
+                    best_goodput = goodput;
+                    best_block_size = block_size;
+                    best_window_size = window_size;
+                }
+            }
+        }
+        status.block_size = best_block_size;
+        status.window_size = best_window_size;
+    }
 
+    q_transfer_stats.block_size = status.block_size;
+    q_transfer_stats.window_size = status.window_size;
+    q_transfer_stats.round_trip_ms = link_stats.round_trip_ms;
+
+    DLOG(("block_size_adjust(): rate %f bytes/sec rtt %lu ms (min %lu) error rate %f --> block_size %d window_size %u\n",
+            link_stats.bytes_per_second, link_stats.round_trip_ms,
+            link_stats.min_round_trip_ms, error_rate,
+            status.block_size, status.window_size));
+}
+
+/**
+ * Start a new window of measurements.
+ */
+static void block_size_new_window() {
     /*
-     * After getting a clean bill of health for 8k, move block size up
+     * Older history counts for less each window.
      */
-    if ((status.confirmed_bytes - status.file_position_downgrade) > 8196) {
-        status.block_size *= 2;
-        if (status.block_size > ZMODEM_BLOCK_SIZE) {
-            status.block_size = ZMODEM_BLOCK_SIZE;
-        }
+    link_stats.bytes = (link_stats.bytes * 7 / 8) + link_stats.window_bytes;
+    link_stats.errors = link_stats.errors * 7 / 8;
+
+    link_stats.window_begin = 0;
+    link_stats.window_bytes = 0;
+    link_stats.ack_request = 0;
+}
+
+/**
+ * Record a data subpacket going out.
+ *
+ * @param n the number of file bytes in the subpacket
+ */
+static void block_size_sent(const int n) {
+    if (link_stats.window_begin == 0) {
+        link_stats.window_begin = now_millis();
     }
-    status.last_confirmed_bytes = status.confirmed_bytes;
+    link_stats.window_bytes += n + ZMODEM_SUBPACKET_OVERHEAD;
+}
 
-    DLOG(("block_size_up(): NEW block size = %d\n", status.block_size));
+/**
+ * Record a subpacket going out that asks for a ZACK (ZCRCQ or ZCRCW).
+ */
+static void block_size_ack_requested() {
+    link_stats.ack_request = now_millis();
 }
 
 /**
- * Move down to a smaller block size if things are going badly.
+ * Take a round-trip time sample if a ZACK was requested.
+ *
+ * @param now the current time in millis
  */
-static void block_size_down() {
-    int outstanding_packets =
-        (status.confirmed_bytes - status.last_confirmed_bytes) /
-            status.block_size;
+static void block_size_rtt_sample(const uint64_t now) {
+    unsigned long sample;
+
+    if ((link_stats.ack_request == 0) || (now < link_stats.ack_request)) {
+        return;
+    }
+    sample = now - link_stats.ack_request;
+    if (sample == 0) {
+        /*
+         * Fast links round trip inside the clock resolution.
+         */
+        sample = 1;
+    }
+    if ((link_stats.min_round_trip_ms == 0) ||
+        (sample < link_stats.min_round_trip_ms)) {
+        link_stats.min_round_trip_ms = sample;
+    }
+    if (link_stats.round_trip_ms == 0) {
+        link_stats.round_trip_ms = sample;
+    } else {
+        link_stats.round_trip_ms = ((link_stats.round_trip_ms * 7) +
+            sample) / 8;
+    }
+    link_stats.ack_request = 0;
+}
+
+/**
+ * The receiver acknowledged a window: take the round trip and throughput
+ * samples and pick the next block size and window size.
+ */
+static void block_size_up() {
+    uint64_t now = now_millis();
+    unsigned long elapsed;
+    double rate;
 
-    DLOG(("block_size_down(): block_size = %d outstanding_packets = %d\n",
-            status.block_size, outstanding_packets));
+    block_size_rtt_sample(now);
 
-    if (outstanding_packets >= 3) {
-        if (status.block_size > 32) {
-            status.block_size /= 2;
-            status.file_position_downgrade = status.confirmed_bytes;
+    if ((link_stats.window_begin > 0) && (link_stats.window_bytes > 0) &&
+        (now >= link_stats.window_begin)
+    ) {
+        /*
+         * The link idles for the base round trip at the end of the window,
+         * the rest of the time it was sending.
+         */
+        elapsed = now - link_stats.window_begin;
+        if (elapsed > link_stats.min_round_trip_ms) {
+            elapsed -= link_stats.min_round_trip_ms;
         }
-    }
-    if (outstanding_packets >= 10) {
-        if (status.block_size == 32) {
-            /*
-             * Too much line noise, give up
-             */
-            status.state = ABORT;
-            stop_file_transfer(Q_TRANSFER_STATE_ABORT);
-            set_transfer_stats_last_message(_("LINE NOISE, !@#&*%U"));
+        if (elapsed == 0) {
+            elapsed = 1;
+        }
+        rate = link_stats.window_bytes * 1000.0 / elapsed;
+        if (link_stats.bytes_per_second <= 0.0) {
+            link_stats.bytes_per_second = rate;
+        } else {
+            link_stats.bytes_per_second =
+                ((link_stats.bytes_per_second * 7) + rate) / 8;
         }
     }
-    status.blocks_ack_count = WINDOW_SIZE_UNRELIABLE;
-    status.last_confirmed_bytes = status.confirmed_bytes;
 
-    DLOG(("block_size_down(): NEW block size = %d\n", status.block_size));
+    link_stats.min_block_retransmits = 0;
+    block_size_new_window();
+    block_size_adjust();
+    status.blocks_ack_count = status.window_size;
+}
 
+/**
+ * The receiver asked for a retransmit: count the error and pick the next
+ * block size and window size.
+ */
+static void block_size_down() {
+    if (status.block_size == ZMODEM_MIN_BLOCK_SIZE) {
+        link_stats.min_block_retransmits++;
+    } else {
+        link_stats.min_block_retransmits = 0;
+    }
+
+    /*
+     * Decay first so that one error per window reads as one error per
+     * window's worth of bytes.
+     */
+    block_size_new_window();
+    link_stats.errors += 1.0;
+    block_size_adjust();
+    status.blocks_ack_count = status.window_size;
+
+    if (link_stats.min_block_retransmits >= ZMODEM_NOISE_RETRANSMITS) {
+        /*
+         * Too much line noise, give up
+         */
+        status.state = ABORT;
+        stop_file_transfer(Q_TRANSFER_STATE_ABORT);
+        set_transfer_stats_last_message(_("LINE NOISE, !@#&*%U"));
+    }
 }
 
 /* ------------------------------------------------------------------------ */
@@ -619,7 +927,6 @@ static void stats_new_file(const char * filename, const int filesize) {
     q_transfer_stats.bytes_transfer = 0;
     q_transfer_stats.error_count = 0;
     status.confirmed_bytes = 0;
-    status.last_confirmed_bytes = 0;
     set_transfer_stats_last_message("");
     q_transfer_stats.bytes_total = filesize;
     q_transfer_stats.blocks = filesize / ZMODEM_BLOCK_SIZE;
@@ -667,11 +974,11 @@ static void stats_increment_blocks() {
 
     status.consecutive_errors = 0;
 
-    DLOG(("stats_increment_blocks(): waiting_for_ack = %s ack_required = %s reliable_link = %s confirmed_bytes = %u last_confirmed_bytes = %u block_size = %d blocks_ack_count = %d\n",
+    DLOG(("stats_increment_blocks(): waiting_for_ack = %s ack_required = %s reliable_link = %s confirmed_bytes = %u window_size = %u block_size = %d blocks_ack_count = %d\n",
             (status.waiting_for_ack == Q_TRUE ? "true" : "false"),
             (status.ack_required == Q_TRUE ? "true" : "false"),
             (status.reliable_link == Q_TRUE ? "true" : "false"),
-            status.confirmed_bytes, status.last_confirmed_bytes,
+            status.confirmed_bytes, status.window_size,
             status.block_size, status.blocks_ack_count));
 
 }
@@ -701,11 +1008,11 @@ static void stats_increment_errors(const char * format, ...) {
      */
     status.reliable_link = Q_FALSE;
 
-    DLOG(("stats_increment_errors(): waiting_for_ack = %s ack_required = %s reliable_link = %s confirmed_bytes = %u last_confirmed_bytes = %u block_size = %d blocks_ack_count = %d\n",
+    DLOG(("stats_increment_errors(): waiting_for_ack = %s ack_required = %s reliable_link = %s confirmed_bytes = %u window_size = %u block_size = %d blocks_ack_count = %d\n",
             (status.waiting_for_ack == Q_TRUE ? "true" : "false"),
             (status.ack_required == Q_TRUE ? "true" : "false"),
             (status.reliable_link == Q_TRUE ? "true" : "false"),
-            status.confirmed_bytes, status.last_confirmed_bytes,
+            status.confirmed_bytes, status.window_size,
             status.block_size, status.blocks_ack_count));
 
     /*
@@ -772,7 +1079,7 @@ static Q_BOOL setup_for_next_file() {
      * Open the file
      */
     if ((status.file_stream =
-         fopen(upload_file_list[upload_file_list_i].name, "rb")) == NULL) {
+         open_upload_file(upload_file_list, upload_file_list_i)) == NULL) {
         DLOG(("ERROR: Unable to open file %s: %s (%d)\n",
                 upload_file_list[upload_file_list_i].name, strerror(errno),
                 errno));
@@ -987,6 +1294,7 @@ static Q_BOOL decode_zdata_bytes(unsigned char * input,
 
     int i;                      /* input iterator */
     int j;                      /* for doing_crc case */
+    int can_count;              /* consecutive CANs after a ZDLE */
     Q_BOOL doing_crc = Q_FALSE;
     Q_BOOL done = Q_FALSE;
     unsigned char crc_type = 0;
@@ -1062,9 +1370,13 @@ decode_zdata_bytes_big_loop:
             if (input[i] == ZCRCE) {
                 if (doing_crc == Q_TRUE) {
                     /*
-                     * WOAH! CRC escape within a CRC escape
+                     * WOAH! CRC escape within a CRC escape.  Line noise hit
+                     * the CRC: end the subpacket at the CAN so that the CRC
+                     * check fails.
                      */
-                    return Q_FALSE;
+                    i--;
+                    done = Q_TRUE;
+                    break;
                 }
 
                 /*
@@ -1077,9 +1389,13 @@ decode_zdata_bytes_big_loop:
             } else if (input[i] == ZCRCG) {
                 if (doing_crc == Q_TRUE) {
                     /*
-                     * WOAH! CRC escape within a CRC escape
+                     * WOAH! CRC escape within a CRC escape.  Line noise hit
+                     * the CRC: end the subpacket at the CAN so that the CRC
+                     * check fails.
                      */
-                    return Q_FALSE;
+                    i--;
+                    done = Q_TRUE;
+                    break;
                 }
 
                 /*
@@ -1092,9 +1408,13 @@ decode_zdata_bytes_big_loop:
             } else if (input[i] == ZCRCQ) {
                 if (doing_crc == Q_TRUE) {
                     /*
-                     * WOAH! CRC escape within a CRC escape
+                     * WOAH! CRC escape within a CRC escape.  Line noise hit
+                     * the CRC: end the subpacket at the CAN so that the CRC
+                     * check fails.
                      */
-                    return Q_FALSE;
+                    i--;
+                    done = Q_TRUE;
+                    break;
                 }
 
                 /*
@@ -1107,9 +1427,13 @@ decode_zdata_bytes_big_loop:
             } else if (input[i] == ZCRCW) {
                 if (doing_crc == Q_TRUE) {
                     /*
-                     * WOAH! CRC escape within a CRC escape
+                     * WOAH! CRC escape within a CRC escape.  Line noise hit
+                     * the CRC: end the subpacket at the CAN so that the CRC
+                     * check fails.
                      */
-                    return Q_FALSE;
+                    i--;
+                    done = Q_TRUE;
+                    break;
                 }
 
                 /*
@@ -1154,6 +1478,24 @@ decode_zdata_bytes_big_loop:
                     *output_n = *output_n + 1;
                 }
             } else if (input[i] == C_CAN) {
+                /*
+                 * A real cancel is five CANs in a row.  Anything shorter is
+                 * line noise hitting a ZDLE: end the subpacket here so that
+                 * the CRC check fails.
+                 */
+                for (can_count = 1; (i + can_count < *input_n) &&
+                         (input[i + can_count] == C_CAN); can_count++) {
+                }
+                if ((can_count < 4) && (i + can_count == *input_n)) {
+                    DLOG(("decode_zdata_bytes: incomplete (C_CAN)\n"));
+                    return Q_FALSE;
+                }
+                if (can_count < 4) {
+                    i--;
+                    done = Q_TRUE;
+                    break;
+                }
+
                 /*
                  * Real CAN, cancel the transfer
                  */
@@ -3353,6 +3695,24 @@ static Q_BOOL receive_zdata(unsigned char * output,
         if (packet_buffer_n > 0) {
             packet.data_n = 0;
         }
+
+        if ((packet_buffer_n == sizeof(packet_buffer)) &&
+            (status.prior_state == ZRPOS_WAIT)
+        ) {
+            /*
+             * The buffer is full and there is still no CRC escape: line
+             * noise ate the end of the subpacket.  Nothing more can fit, so
+             * ask for it again.
+             */
+            stats_increment_errors(_("CRC ERROR"));
+            packet_buffer_n = 0;
+            options = status.file_position;
+            build_packet(P_ZRPOS, options, output, output_n, output_max);
+            status.state = ZRPOS_WAIT;
+
+            DLOG(("receive_zdata(): no CRC escape, send ZRPOS file_position = %ld\n",
+                    status.file_position));
+        }
         return Q_TRUE;
     }
 
@@ -4420,11 +4780,11 @@ static Q_BOOL send_zdata(unsigned char * output,
 
     DLOG(("send_zdata(): DATA state=%d prior_state=%d packet.data_n=%d\n",
             status.state, status.prior_state, packet.data_n));
-    DLOG(("send_zdata(): waiting_for_ack = %s ack_required = %s reliable_link = %s confirmed_bytes = %u last_confirmed_bytes = %u block_size = %d blocks_ack_count = %d\n",
+    DLOG(("send_zdata(): waiting_for_ack = %s ack_required = %s reliable_link = %s confirmed_bytes = %u window_size = %u block_size = %d blocks_ack_count = %d\n",
             (status.waiting_for_ack == Q_TRUE ? "true" : "false"),
             (status.ack_required == Q_TRUE ? "true" : "false"),
             (status.reliable_link == Q_TRUE ? "true" : "false"),
-            status.confirmed_bytes, status.last_confirmed_bytes,
+            status.confirmed_bytes, status.window_size,
             status.block_size, status.blocks_ack_count));
 
     /*
@@ -4530,6 +4890,7 @@ static Q_BOOL send_zdata(unsigned char * output,
                      */
                     status.ack_required = Q_FALSE;
                     status.waiting_for_ack = Q_FALSE;
+                    block_size_rtt_sample(now_millis());
 
                     DLOG(("send_zdata(): 2nd ZRPOS in reponse to ZCRCW\n"));
                 }
@@ -4752,6 +5113,7 @@ static Q_BOOL send_zdata(unsigned char * output,
                 q_transfer_stats.bytes_transfer += status.block_size;
             }
             packet.data_n = rc;
+            block_size_sent(rc);
 
             /*
              * Increment count
@@ -4775,6 +5137,7 @@ static Q_BOOL send_zdata(unsigned char * output,
                         sizeof(outbound_packet), ZCRCW);
 
                     status.waiting_for_ack = Q_TRUE;
+                    block_size_ack_requested();
                 } else {
                     /*
                      * Check window size
@@ -4786,11 +5149,7 @@ static Q_BOOL send_zdata(unsigned char * output,
                         /*
                          * Require a ZACK via ZCRCQ
                          */
-                        if (status.reliable_link == Q_TRUE) {
-                            status.blocks_ack_count = WINDOW_SIZE_RELIABLE;
-                        } else {
-                            status.blocks_ack_count = WINDOW_SIZE_UNRELIABLE;
-                        }
+                        status.blocks_ack_count = status.window_size;
                         status.waiting_for_ack = Q_TRUE;
                         status.streaming_zdata = Q_TRUE;
 
@@ -4800,6 +5159,7 @@ static Q_BOOL send_zdata(unsigned char * output,
                         packet.use_crc32 = status.use_crc32;
                         encode_zdata_bytes(outbound_packet, &outbound_packet_n,
                             sizeof(outbound_packet), ZCRCQ);
+                        block_size_ack_requested();
                     } else {
 
                         DLOG(("send_zdata(): Keep streaming with ZCRCG \n"));
@@ -4833,6 +5193,7 @@ static Q_BOOL send_zdata(unsigned char * output,
                     encode_zdata_bytes(output, output_n, output_max, ZCRCW);
 
                     status.waiting_for_ack = Q_TRUE;
+                    block_size_ack_requested();
                 } else {
                     /*
                      * Check window size
@@ -4844,11 +5205,7 @@ static Q_BOOL send_zdata(unsigned char * output,
                         /*
                          * Require a ZACK via ZCRCQ
                          */
-                        if (status.reliable_link == Q_TRUE) {
-                            status.blocks_ack_count = WINDOW_SIZE_RELIABLE;
-                        } else {
-                            status.blocks_ack_count = WINDOW_SIZE_UNRELIABLE;
-                        }
+                        status.blocks_ack_count = status.window_size;
                         status.waiting_for_ack = Q_TRUE;
                         status.streaming_zdata = Q_TRUE;
 
@@ -4858,6 +5215,7 @@ static Q_BOOL send_zdata(unsigned char * output,
                         packet.use_crc32 = status.use_crc32;
 
                         encode_zdata_bytes(output, output_n, output_max, ZCRCQ);
+                        block_size_ack_requested();
 
                     } else {
                         DLOG(("send_zdata(): Keep streaming with ZCRCG \n"));
@@ -4903,6 +5261,7 @@ static Q_BOOL send_zdata(unsigned char * output,
                 sizeof(outbound_packet), ZCRCW);
 
             status.waiting_for_ack = Q_TRUE;
+            block_size_ack_requested();
 
         } else if (output_max - *output_n > 32) {
 
@@ -4918,6 +5277,7 @@ static Q_BOOL send_zdata(unsigned char * output,
             encode_zdata_bytes(output, output_n, output_max, ZCRCW);
 
             status.waiting_for_ack = Q_TRUE;
+            block_size_ack_requested();
         }
     }
 
@@ -5555,17 +5915,21 @@ Q_BOOL zmodem_start(struct file_info * file_list, const char * pathname,
     /*
      * Set block size
      */
+    status.block_size = ZMODEM_BLOCK_SIZE;
     q_transfer_stats.block_size = ZMODEM_BLOCK_SIZE;
     status.confirmed_bytes = 0;
-    status.last_confirmed_bytes = 0;
     status.consecutive_errors = 0;
 
     /*
      * Set the window size
      */
     status.reliable_link = Q_TRUE;
+    status.window_size = WINDOW_SIZE_RELIABLE;
     status.blocks_ack_count = WINDOW_SIZE_RELIABLE;
     status.streaming_zdata = Q_FALSE;
+    memset(&link_stats, 0, sizeof(link_stats));
+    link_stats.bytes = ZMODEM_PRIOR_BYTES;
+    link_stats.errors = ZMODEM_PRIOR_ERRORS;
 
     /*
      * Clear the last message